@@ -0,0 +1 @@
+cmd_nautilus.bin := ld -z max-page-size=0x1000 -melf_x86_64 -dp  -o nautilus.bin -T link/nautilus.ld  src/built-in.o --start-group  lib/built-in.o `locate libstdc++.a | head -1` --end-group
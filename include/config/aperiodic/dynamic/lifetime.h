@@ -0,0 +1 @@
+#undef NAUT_CONFIG_APERIODIC_DYNAMIC_LIFETIME
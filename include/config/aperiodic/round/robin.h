@@ -0,0 +1 @@
+#define NAUT_CONFIG_APERIODIC_ROUND_ROBIN 1
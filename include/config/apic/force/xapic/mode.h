@@ -0,0 +1 @@
+#undef NAUT_CONFIG_APIC_FORCE_XAPIC_MODE
@@ -0,0 +1 @@
+#undef NAUT_CONFIG_APIC_TIMER_CALIBRATE_INDEPENDENTLY
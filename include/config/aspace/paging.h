@@ -0,0 +1 @@
+#define NAUT_CONFIG_ASPACE_PAGING 1
@@ -0,0 +1 @@
+#define NAUT_CONFIG_CXX_SUPPORT 1
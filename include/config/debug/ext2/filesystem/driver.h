@@ -0,0 +1 @@
+#define NAUT_CONFIG_DEBUG_EXT2_FILESYSTEM_DRIVER 1
@@ -0,0 +1 @@
+#define NAUT_CONFIG_DEBUG_FAT32_FILESYSTEM_DRIVER 1
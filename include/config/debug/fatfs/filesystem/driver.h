@@ -0,0 +1 @@
+#undef NAUT_CONFIG_DEBUG_FATFS_FILESYSTEM_DRIVER
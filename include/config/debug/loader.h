@@ -0,0 +1 @@
+#undef NAUT_CONFIG_DEBUG_LOADER
@@ -0,0 +1 @@
+#undef NAUT_CONFIG_DEBUG_NET_ETHERNET_AGENT
@@ -0,0 +1 @@
+#define NAUT_CONFIG_DEBUG_RAMDISK 1
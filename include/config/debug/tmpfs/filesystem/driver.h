@@ -0,0 +1 @@
+#undef NAUT_CONFIG_DEBUG_TMPFS_FILESYSTEM_DRIVER
@@ -0,0 +1 @@
+#undef NAUT_CONFIG_DISABLE_PS2_MOUSE
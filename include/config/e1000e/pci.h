@@ -0,0 +1 @@
+#undef NAUT_CONFIG_E1000E_PCI
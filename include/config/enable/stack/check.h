@@ -0,0 +1 @@
+#undef NAUT_CONFIG_ENABLE_STACK_CHECK
@@ -0,0 +1 @@
+#define NAUT_CONFIG_EXT2_FILESYSTEM_DRIVER 1
@@ -0,0 +1 @@
+#define NAUT_CONFIG_FATFS_FILESYSTEM_DRIVER 1
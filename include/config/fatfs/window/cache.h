@@ -0,0 +1 @@
+#define NAUT_CONFIG_FATFS_WINDOW_CACHE 32
@@ -0,0 +1 @@
+#define NAUT_CONFIG_FPU_SAVE 1
@@ -0,0 +1 @@
+#define NAUT_CONFIG_HALT_WHILE_IDLE 1
@@ -0,0 +1 @@
+#define NAUT_CONFIG_HZ 10
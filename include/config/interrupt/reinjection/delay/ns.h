@@ -0,0 +1 @@
+#define NAUT_CONFIG_INTERRUPT_REINJECTION_DELAY_NS 10000
@@ -0,0 +1 @@
+#define NAUT_CONFIG_KICK_SCHEDULE 1
@@ -0,0 +1 @@
+#define NAUT_CONFIG_MAX_THREADS 1024
@@ -0,0 +1 @@
+#undef NAUT_CONFIG_MLX3_PCI
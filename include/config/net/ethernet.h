@@ -0,0 +1 @@
+#define NAUT_CONFIG_NET_ETHERNET 1
@@ -0,0 +1 @@
+#define NAUT_CONFIG_OVERLAY_FILESYSTEM_DRIVER 1
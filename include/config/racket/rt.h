@@ -0,0 +1 @@
+#define NAUT_CONFIG_RACKET_RT 1
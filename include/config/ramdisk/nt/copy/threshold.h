@@ -0,0 +1 @@
+#define NAUT_CONFIG_RAMDISK_NT_COPY_THRESHOLD 262144
@@ -0,0 +1 @@
+#define NAUT_CONFIG_RAMDISK_PARALLEL_COPY_THRESHOLD 8388608
@@ -0,0 +1 @@
+#undef NAUT_CONFIG_RAMDISK_RANGE_LOCKS
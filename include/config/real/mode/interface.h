@@ -0,0 +1 @@
+#undef NAUT_CONFIG_REAL_MODE_INTERFACE
@@ -0,0 +1 @@
+#define NAUT_CONFIG_RUN_TESTS_AT_BOOT 1
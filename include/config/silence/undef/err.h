@@ -0,0 +1 @@
+#undef NAUT_CONFIG_SILENCE_UNDEF_ERR
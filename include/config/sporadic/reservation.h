@@ -0,0 +1 @@
+#define NAUT_CONFIG_SPORADIC_RESERVATION 10
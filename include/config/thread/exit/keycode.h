@@ -0,0 +1 @@
+#define NAUT_CONFIG_THREAD_EXIT_KEYCODE 196
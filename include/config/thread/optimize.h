@@ -0,0 +1 @@
+#undef NAUT_CONFIG_THREAD_OPTIMIZE
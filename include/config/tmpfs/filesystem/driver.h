@@ -0,0 +1 @@
+#define NAUT_CONFIG_TMPFS_FILESYSTEM_DRIVER 1
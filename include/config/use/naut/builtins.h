@@ -0,0 +1 @@
+#define NAUT_CONFIG_USE_NAUT_BUILTINS 1
@@ -0,0 +1 @@
+#define NAUT_CONFIG_UTILIZATION_LIMIT 99
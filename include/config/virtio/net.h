@@ -0,0 +1 @@
+#undef NAUT_CONFIG_VIRTIO_NET
@@ -0,0 +1 @@
+#undef NAUT_CONFIG_VIRTUAL_CONSOLE_CHARDEV_CONSOLE
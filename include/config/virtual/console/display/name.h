@@ -0,0 +1 @@
+#define NAUT_CONFIG_VIRTUAL_CONSOLE_DISPLAY_NAME 1
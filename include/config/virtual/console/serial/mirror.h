@@ -0,0 +1 @@
+#undef NAUT_CONFIG_VIRTUAL_CONSOLE_SERIAL_MIRROR
@@ -28,6 +28,30 @@
 int nk_ramdisk_init(struct naut_info *naut);
 int nk_ramdisk_deinit();
 
+struct nk_block_dev;
+
+// flags for runtime-created ramdisks
+#define NK_RAMDISK_ZERO  1  // zero the contents
+#define NK_RAMDISK_HUGE  2  // back with whole, aligned large pages
+
+// create a ramdisk of at least size bytes whose memory comes from
+// the given numa domain (-1 => the caller's domain)
+struct nk_block_dev *nk_ramdisk_create(char *name, uint64_t size, int numa_node, uint64_t flags);
+// same, but the size, geometry, and contents are copied from src_name
+struct nk_block_dev *nk_ramdisk_create_copy(char *name, char *src_name, int numa_node, uint64_t flags);
+// fails while a filesystem is attached to the ramdisk
+int                  nk_ramdisk_destroy(char *name);
+
+// Copy-on-write snapshots.  After a snapshot, writes go to private
+// copies of the affected 4 KB chunks, and a rollback discards them
+// in time proportional to the number of chunks modified.  Snapshotting
+// again folds the modifications into the snapshot.  Clones start
+// from the snapshot of base_name and share its unmodified chunks.
+// None of these may race with I/O to the ramdisks involved.
+int                  nk_ramdisk_snapshot(char *name);
+int                  nk_ramdisk_rollback(char *name);
+struct nk_block_dev *nk_ramdisk_clone(char *name, char *base_name);
+
 
 
 #endif
@@ -24,7 +24,48 @@
 #ifndef __FS_FATFS_H__
 #define __FS_FATFS_H__
 
+// attach with the native FAT32 engine
 int nk_fs_fatfs_attach(char *devname, char *fsname, int readonly);
+
+// choose the engine serving the mount
+#define NK_FS_FATFS_NATIVE   0x0   // the FAT32 code in fatfs.c
+#define NK_FS_FATFS_CHAN     0x1   // ChaN's FatFs (ff.c)
+// with NK_FS_FATFS_CHAN, keep a cluster link map per open file so
+// seeking does not walk the FAT
+#define NK_FS_FATFS_FASTSEEK 0x2
+// with NK_FS_FATFS_CHAN, cache n FAT and directory sectors instead of
+// NAUT_CONFIG_FATFS_WINDOW_CACHE; 0 leaves just the one sector window
+#define NK_FS_FATFS_CACHE(n) ((((n)+1)&0xffffff)<<8)
+int nk_fs_fatfs_attach_engine(char *devname, char *fsname, int readonly, int flags);
+
+// either engine
 int nk_fs_fatfs_detach(char *fsname);
 
+// create path on fsname, an NK_FS_FATFS_CHAN mount, as size bytes in a
+// single run of clusters - on exFAT, with no FAT chain at all.  Reads
+// and writes within that size go straight to the device
+int nk_fs_fatfs_create_contig(char *fsname, char *path, uint64_t size);
+
+// print how fragmented the files and free space of fsname, a native
+// engine mount, are; verbose 1 also lists fragmented files, 2 all files
+int nk_fs_fatfs_frag_report(char *fsname, int verbose);
+
+struct nk_fs_fatfs_defrag_stats {
+    int      running;
+    uint64_t passes;          // over the whole tree
+    uint64_t files_moved;
+    uint64_t clusters_moved;
+    uint64_t files_skipped;   // no free run was long enough
+    uint64_t retries;         // the volume changed under a move
+};
+
+// move fragmented files of fsname, a native engine mount, into single
+// runs of free clusters while it stays in use, copying no more than
+// rate bytes/s (0 for no limit).  With background, a thread does this
+// until nothing is left to move or it is stopped; otherwise it is one
+// pass over the tree
+int nk_fs_fatfs_defrag(char *fsname, uint64_t rate, int background);
+int nk_fs_fatfs_defrag_stop(char *fsname);
+int nk_fs_fatfs_defrag_stats(char *fsname, struct nk_fs_fatfs_defrag_stats *stats);
+
 #endif
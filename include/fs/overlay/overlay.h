@@ -0,0 +1,31 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2017, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+
+#ifndef __FS_OVERLAY_H__
+#define __FS_OVERLAY_H__
+
+// register fsname as the union of two registered filesystems.  Nothing
+// is ever written to lower.  upper must be writeable and should start
+// out empty - a tmpfs, typically
+int nk_fs_overlay_attach(char *fsname, char *lower, char *upper);
+// fails if files are still open
+int nk_fs_overlay_detach(char *fsname);
+
+#endif
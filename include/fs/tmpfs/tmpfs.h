@@ -0,0 +1,30 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2017, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+
+#ifndef __FS_TMPFS_H__
+#define __FS_TMPFS_H__
+
+// create an empty memory-only filesystem named fsname
+// max_bytes limits the file data it can hold, 0 meaning no limit
+int nk_fs_tmpfs_attach(char *fsname, uint64_t max_bytes);
+// fails if files are still open; everything in it is discarded
+int nk_fs_tmpfs_detach(char *fsname);
+
+#endif
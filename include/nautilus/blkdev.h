@@ -48,6 +48,14 @@ struct nk_block_dev_int {
     int (*get_characteristics)(void *state, struct nk_block_dev_characteristics *c);
     int (*read_blocks)(void *state, uint64_t blocknum, uint64_t count, uint8_t *dest, void (*callback)(nk_block_dev_status_t status, void *context), void *context);
     int (*write_blocks)(void *state, uint64_t blocknum, uint64_t count, uint8_t *src, void (*callback)(nk_block_dev_status_t status, void *context), void *context);
+    // memory-backed devices only - points *ptr at the device's own storage
+    // for blocks [blocknum, blocknum+count), which is contiguous.  The
+    // memory is read-only to the caller and valid until the next write
+    // to those blocks.
+    int (*direct_access)(void *state, uint64_t blocknum, uint64_t count, void **ptr);
+    // devices with a volatile write cache - callback fires once every
+    // previously completed write is on stable storage
+    int (*flush)(void *state, void (*callback)(nk_block_dev_status_t status, void *context), void *context);
 };
 
 
@@ -64,6 +72,12 @@ int                   nk_block_dev_unregister(struct nk_block_dev *);
 
 struct nk_block_dev * nk_block_dev_find(char *name);
 
+// a filesystem is attached to its device from its attach to its detach;
+// drivers that can remove a device at runtime refuse while it is
+void nk_block_dev_attach(struct nk_block_dev *dev);
+void nk_block_dev_detach(struct nk_block_dev *dev);
+int  nk_block_dev_attached(struct nk_block_dev *dev);   // how many are
+
 
 int nk_block_dev_get_characteristics(struct nk_block_dev *d, struct nk_block_dev_characteristics *c);
 
@@ -83,7 +97,23 @@ int nk_block_dev_write(struct nk_block_dev *dev,
 		       void (*callback)(nk_block_dev_status_t status, void *state), 
 		       void *state);
 
-
+// zero => *ptr is the device's read-only copy of the blocks
+// -1   => device is not memory-backed or the range is invalid;
+//         use nk_block_dev_read() instead
+int nk_block_dev_direct_access(struct nk_block_dev *dev,
+			       uint64_t blocknum,
+			       uint64_t count,
+			       void **ptr);
+
+// durability barrier: all writes completed before the call are on
+// stable storage when the flush completes.  Devices without a write
+// cache (no flush op) succeed immediately.  A filesystem's sync is
+// its own write-back followed by this call - a completed write alone
+// may still sit in the device's cache.
+int nk_block_dev_flush(struct nk_block_dev *dev,
+		       nk_dev_request_type_t type,
+		       void (*callback)(nk_block_dev_status_t status, void *state),
+		       void *state);
 
 #endif
 
@@ -63,6 +63,8 @@ struct nk_dev {
     struct nk_dev_int *interface;
     
     nk_wait_queue_t *waiting_threads;
+
+    int attached; // consumers, such as filesystems on a block device
 };
 
 // Not all request types apply to all device types
@@ -43,6 +43,24 @@ struct nk_fs_stat {
     uint64_t st_size;
 };
 
+// one directory entry, as returned by nk_fs_readdir_batch
+#define NK_FS_DIRENT_NAME_LEN 256
+struct nk_fs_dirent {
+    char     name[NK_FS_DIRENT_NAME_LEN];  // UTF-8, truncated if need be
+    uint64_t size;
+    uint32_t attr;
+#define NK_FS_ATTR_DIR      1
+#define NK_FS_ATTR_READONLY 2
+#define NK_FS_ATTR_HIDDEN   4
+#define NK_FS_ATTR_SYSTEM   8
+};
+
+// one segment of a vectored read or write
+struct nk_fs_iovec {
+    void   *base;
+    size_t  len;
+};
+
 // Abstract base class for a filesystem interface
 struct nk_fs_int {
     int   (*stat_path)(void *state, char *path, struct nk_fs_stat *st);
@@ -56,17 +74,55 @@ struct nk_fs_int {
     ssize_t  (*read_file)(void *state, void *file, void *dest, off_t offset, size_t n);
     ssize_t  (*write_file)(void *state, void *file, void *src, off_t offset, size_t n);
     void  (*close_file)(void *state, void *file);
+    int   (*rename)(void *state, char *old_path, char *new_path, int isdir);
+    // optional - for filesystems on memory-backed devices, point *ptr at
+    // the device's copy of the file data at offset and return how many
+    // bytes (at most n) are contiguous there, 0 at end of file, -1 if
+    // the data cannot be accessed in place
+    ssize_t  (*read_direct)(void *state, void *file, off_t offset, size_t n, void **ptr);
+    // optional - transfer the segments in order starting at offset, as one
+    // operation; without these, read_file/write_file are used per segment
+    ssize_t  (*readv_file)(void *state, void *file, const struct nk_fs_iovec *iov, int iovcnt, off_t offset);
+    ssize_t  (*writev_file)(void *state, void *file, const struct nk_fs_iovec *iov, int iovcnt, off_t offset);
+    // optional - directory iteration, skipping "." and "..".  opendir
+    // returns a cursor, or 0 on failure.  readdir_batch fills in up to n
+    // entries and returns how many, 0 at the end, or -1 on error
+    void    *(*opendir)(void *state, char *path);
+    ssize_t  (*readdir_batch)(void *state, void *dir, struct nk_fs_dirent *ents, size_t n);
+    void     (*closedir)(void *state, void *dir);
+    // optional - stat n entries of directory dir in one pass over it
+    // rc[i] is 0 if st[i] was filled in, -1 if names[i] was not found
+    // returns the number found
+    int      (*stat_many)(void *state, char *dir, char **names, int n, struct nk_fs_stat *st, int *rc);
+    // optional - copy between two files of this filesystem at the device
+    // level; returns bytes copied (possibly fewer than n), 0 at the end
+    // of file_in, or -1 if the caller should copy through memory instead
+    ssize_t  (*copy_range)(void *state, void *file_in, off_t off_in, void *file_out, off_t off_out, size_t n);
+    // optional - durability barriers.  sync_file returns once the file's
+    // data, and its metadata unless data_only, is on stable storage;
+    // sync_fs does the same for everything written to the filesystem.
+    // a filesystem that writes through synchronously to a device without
+    // a write cache can leave these out
+    int      (*sync_file)(void *state, void *file, int data_only);
+    int      (*sync_fs)(void *state);
+    // optional - O_DIRECT transfers straight between buf and the device,
+    // bypassing any caching.  The filesystem checks that buf, offset and
+    // n are aligned to what it can transfer whole, failing with -1 if not.
+    // A read may return less than n at end of file
+    ssize_t  (*read_uncached)(void *state, void *file, void *buf, off_t offset, size_t n);
+    ssize_t  (*write_uncached)(void *state, void *file, void *buf, off_t offset, size_t n);
 };
 
 // This is the class for a filesystem.  It should be the first
 // member of any specific type of filesystem
 struct nk_fs {
     char              name[FS_NAME_LEN];           // colon-terminated name
-    char              mount_path[MOUNT_PATH_LEN];  // for future mount point model, maybe... 
+    char              mount_path[MOUNT_PATH_LEN];  // empty if not mounted
     struct list_head  fs_list_node;
 
     uint64_t          flags;
 #define NK_FS_READONLY   1
+#define NK_FS_MOVES_DATA 2   // an open file's data can be relocated (defragmented)
 
     void             *state;  // internal FS state
     struct nk_fs_int *interface;
@@ -81,19 +137,24 @@ int           nk_fs_unregister(struct nk_fs *fs);
 
 struct nk_fs *nk_fs_find(char *name);
 
+// make a registered filesystem visible at an absolute path
+int nk_fs_mount(char *fsname, char *path);
+int nk_fs_umount(char *path);
+
 void nk_fs_dump_filesystems();
 void nk_fs_dump_files();
 
 //
 // The interface emulates the Unix interface as closely as possible
 // 
-// Currently, a path here includes the fs name:
+// A path either names the fs explicitly, DOS style, or is resolved
+// through the mount points:
 //
 // C:/foo/bar/baz => fs named "C", path on fs is /foo/bar/baz
-// /foo/bar/haz => fs named "rootfs", path on fs is /foo/bar/baz
-//
-// Yes, this is DOS style...
-// Support for mount points does not exist yet
+// /foo/bar/baz => fs mounted at the deepest of /foo/bar/baz, /foo/bar,
+//                 /foo, and /, with the rest of the path being the path
+//                 on that fs.  If none is mounted, fs named "rootfs",
+//                 path on fs is /foo/bar/baz
 //
 
 typedef struct nk_fs_open_file_state *nk_fs_fd_t;
@@ -101,13 +162,20 @@ typedef struct nk_fs_open_file_state *nk_fs_fd_t;
 #define FS_FD_ERR(fd) ((fd)==FS_BAD_FD)
 
 int        nk_fs_stat(char *path, struct nk_fs_stat *st);
+// stat n paths, with rc[i] zero if st[i] is valid; returns the number
+// found.  Consecutive paths in the same directory are done in one pass
+int        nk_fs_stat_many(char **paths, int n, struct nk_fs_stat *st, int *rc);
 int        nk_fs_truncate(char *path, off_t len);
+int        nk_fs_unlink(char *path);
+// files only; both paths must be on the same filesystem
+int        nk_fs_rename(char *old_path, char *new_path);
 #define O_RDONLY 1
 #define O_WRONLY 2
 #define O_RDWR   3 // OR of RD and WR ONLY
 #define O_APPEND 4
 #define O_CREAT  8
 #define O_TRUNC  16 // guess
+#define O_DIRECT 32 // no caching; buffer, offset and length must be aligned
 nk_fs_fd_t nk_fs_creat(char *path, int mode);
 nk_fs_fd_t nk_fs_open(char *path, int flags, int mode);
 int        nk_fs_fstat(nk_fs_fd_t fd, struct nk_fs_stat *st);
@@ -116,7 +184,50 @@ off_t      nk_fs_seek(nk_fs_fd_t fd, off_t position, int whence);
 ssize_t    nk_fs_tell(nk_fs_fd_t fd);
 ssize_t    nk_fs_read(nk_fs_fd_t fd, void *buf, size_t len);
 ssize_t    nk_fs_write(nk_fs_fd_t fd, void *buf, size_t len);
+// positional variants neither use nor update the position, and do not
+// serialize against other users of the fd
+ssize_t    nk_fs_pread(nk_fs_fd_t fd, void *buf, size_t len, off_t offset);
+ssize_t    nk_fs_pwrite(nk_fs_fd_t fd, void *buf, size_t len, off_t offset);
+ssize_t    nk_fs_readv(nk_fs_fd_t fd, const struct nk_fs_iovec *iov, int iovcnt);
+ssize_t    nk_fs_writev(nk_fs_fd_t fd, const struct nk_fs_iovec *iov, int iovcnt);
+ssize_t    nk_fs_preadv(nk_fs_fd_t fd, const struct nk_fs_iovec *iov, int iovcnt, off_t offset);
+ssize_t    nk_fs_pwritev(nk_fs_fd_t fd, const struct nk_fs_iovec *iov, int iovcnt, off_t offset);
+// zero-copy read of up to len bytes at offset, without moving the position
+// *buf is read-only and valid until the next write to that part of the file;
+// on a filesystem with NK_FS_MOVES_DATA, use it at once, as the file may move
+// returns bytes available at *buf, 0 at end of file, -1 if not possible
+ssize_t    nk_fs_read_direct(nk_fs_fd_t fd, off_t offset, size_t len, const void **buf);
 int        nk_fs_close(nk_fs_fd_t fd);
+// once these return zero, prior writes through fd (fsync, fdatasync) or
+// to fd's whole filesystem (syncfs) survive a crash.  fdatasync may skip
+// metadata that is not needed to read the data back, such as times
+int        nk_fs_fsync(nk_fs_fd_t fd);
+int        nk_fs_fdatasync(nk_fs_fd_t fd);
+int        nk_fs_syncfs(nk_fs_fd_t fd);
+
+// copy len bytes without a round trip through the caller's memory, in
+// place on the device if both files are on the same filesystem and it
+// supports it; the ranges must not overlap.  returns bytes copied
+ssize_t    nk_fs_copy_range(nk_fs_fd_t fd_in, off_t off_in, nk_fs_fd_t fd_out, off_t off_out, size_t len);
+// send len bytes of the file as the payloads of consecutive ethernet
+// packets of the given type to dest_mac; returns bytes sent
+struct nk_net_dev;
+ssize_t    nk_fs_sendfile(nk_fs_fd_t fd, off_t offset, size_t len, struct nk_net_dev *dev, uint8_t *dest_mac, uint16_t ethertype);
+
+// map len bytes of the file starting at offset, which must be page
+// aligned.  prot is NK_ASPACE_READ, optionally with NK_ASPACE_WRITE.  The
+// fd must stay open until the mapping is unmapped.  Returns the address,
+// or 0 on failure.  Bytes past the end of the file read as zero and are
+// not written back.  Changes reach the file only on msync or munmap
+void      *nk_fs_mmap(nk_fs_fd_t fd, off_t offset, size_t len, int prot);
+int        nk_fs_msync(void *addr, size_t len);
+int        nk_fs_munmap(void *addr, size_t len);
+
+typedef struct nk_fs_dir_state *nk_fs_dir_t;
+nk_fs_dir_t nk_fs_opendir(char *path);   // 0 on failure
+// fill up to n entries; returns how many, 0 at the end, -1 on error
+ssize_t     nk_fs_readdir_batch(nk_fs_dir_t dir, struct nk_fs_dirent *ents, size_t n);
+int         nk_fs_closedir(nk_fs_dir_t dir);
 
 
 void test_fs(void);
@@ -0,0 +1 @@
+cmd_src/aspace/built-in.o :=  ld -z max-page-size=0x1000 -melf_x86_64 -dp  -r -o src/aspace/built-in.o src/aspace/base/built-in.o src/aspace/paging/built-in.o src/aspace/carat/built-in.o
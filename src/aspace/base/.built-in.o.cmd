@@ -0,0 +1 @@
+cmd_src/aspace/base/built-in.o :=  ld -z max-page-size=0x1000 -melf_x86_64 -dp  -r -o src/aspace/base/built-in.o src/aspace/base/base.o
@@ -22,6 +22,10 @@
 
 #include <nautilus/nautilus.h>
 #include <nautilus/blkdev.h>
+#include <nautilus/paging.h>
+#include <nautilus/task.h>
+#include <nautilus/numa.h>
+#include <nautilus/shell.h>
 #include <dev/ramdisk.h>
 
 #ifndef NAUT_CONFIG_DEBUG_RAMDISK
@@ -39,6 +43,60 @@
 #define STATE_LOCK(state) _state_lock_flags = spin_lock_irq_save(&state->lock)
 #define STATE_UNLOCK(state) spin_unlock_irq_restore(&(state->lock), _state_lock_flags)
 
+// The data path does not use the device lock.  Reads and writes
+// to disjoint blocks proceed concurrently, and overlapping accesses
+// race exactly as they would on a real disk.  If range locks are
+// configured, writers additionally serialize per RAMDISK_RANGE_LOCK_SIZE
+// chunk of the disk so that overlapping writes are not interleaved.
+#define RAMDISK_RANGE_LOCK_SHIFT 20
+#define RAMDISK_RANGE_LOCK_SIZE  (1ULL<<RAMDISK_RANGE_LOCK_SHIFT)
+
+// copies split across cpus are never cut into pieces smaller than this
+#define RAMDISK_MIN_PARALLEL_PIECE (1ULL<<20)
+#define RAMDISK_MAX_PARALLEL_PIECES 16
+
+#define MIN(x,y) ((x)<(y) ? (x) : (y))
+#define MAX(x,y) ((x)>(y) ? (x) : (y))
+
+// amount of a source device copied per request when cloning it
+#define RAMDISK_CLONE_CHUNK (1ULL<<20)
+
+static spinlock_t       ramdisk_list_lock;
+static struct list_head ramdisk_list;
+
+#define LIST_LOCK_CONF uint8_t _list_lock_flags
+#define LIST_LOCK() _list_lock_flags = spin_lock_irq_save(&ramdisk_list_lock)
+#define LIST_UNLOCK() spin_unlock_irq_restore(&ramdisk_list_lock, _list_lock_flags)
+
+// Copy-on-write snapshots.  A snapshot freezes the current contents of
+// a ramdisk as a base image.  Later writes go to private copies of the
+// affected RAMDISK_COW_CHUNK-sized pieces, which are recorded in a
+// per-chunk overlay map, and rolling back just discards those copies.
+// Clones share the base image of a snapshot and have their own overlays.
+#define RAMDISK_COW_SHIFT 12
+#define RAMDISK_COW_CHUNK (1ULL<<RAMDISK_COW_SHIFT)
+
+struct ramdisk_image {
+    void     *data;
+    uint64_t len;
+    int      owns_data;
+    int      refcount;    // ramdisks using this image
+};
+
+struct ramdisk_cow {
+    struct ramdisk_image *image;
+    spinlock_t lock;       // serializes installation of overlay chunks
+    int        cpu;        // overlay chunks are allocated near this cpu
+    uint64_t   num_chunks;
+    void * volatile *overlay; // private copy of each chunk, 0 => use the image
+    uint64_t   num_dirty;
+    uint64_t   *dirty;     // chunks that have an overlay, in no order
+};
+
+#define COW_LOCK_CONF uint8_t _cow_lock_flags
+#define COW_LOCK(cow) _cow_lock_flags = spin_lock_irq_save(&(cow)->lock)
+#define COW_UNLOCK(cow) spin_unlock_irq_restore(&(cow)->lock, _cow_lock_flags)
+
 struct ramdisk_state {
     struct nk_block_dev *blkdev;
     spinlock_t lock;
@@ -46,8 +104,293 @@ struct ramdisk_state {
     uint64_t block_size;
     uint64_t num_blocks;
     void     *data;
+    uint64_t flags;       // NK_RAMDISK_* plus the internal ones below
+#define RAMDISK_OWNS_DATA  (1ULL<<63)  // data was allocated by us, not embedded
+    int      numa_node;   // domain the data lives in, -1 if unknown
+    struct ramdisk_cow *cow; // non-null once snapshotted or cloned
+    struct list_head ramdisk_list_node;
+#ifdef NAUT_CONFIG_RAMDISK_RANGE_LOCKS
+    uint64_t    num_range_locks;
+    spinlock_t *range_locks;
+#endif
+};
+
+
+#ifdef NAUT_CONFIG_RAMDISK_RANGE_LOCKS
+static int range_locks_init(struct ramdisk_state *s)
+{
+    uint64_t i;
+
+    s->num_range_locks = (s->len + RAMDISK_RANGE_LOCK_SIZE - 1) >> RAMDISK_RANGE_LOCK_SHIFT;
+    s->range_locks = malloc(sizeof(spinlock_t)*s->num_range_locks);
+
+    if (!s->range_locks) {
+	ERROR("Cannot allocate %lu range locks\n",s->num_range_locks);
+	return -1;
+    }
+
+    for (i=0;i<s->num_range_locks;i++) {
+	spinlock_init(&s->range_locks[i]);
+    }
+
+    return 0;
+}
+
+// locks are always acquired in ascending order, so overlapping
+// writers cannot deadlock.  Interrupts are left on during the copy.
+static void range_lock(struct ramdisk_state *s, uint64_t offset, uint64_t len)
+{
+    uint64_t i;
+    for (i=offset>>RAMDISK_RANGE_LOCK_SHIFT; i<=(offset+len-1)>>RAMDISK_RANGE_LOCK_SHIFT; i++) {
+	spin_lock(&s->range_locks[i]);
+    }
+}
+
+static void range_unlock(struct ramdisk_state *s, uint64_t offset, uint64_t len)
+{
+    uint64_t i;
+    for (i=offset>>RAMDISK_RANGE_LOCK_SHIFT; i<=(offset+len-1)>>RAMDISK_RANGE_LOCK_SHIFT; i++) {
+	spin_unlock(&s->range_locks[i]);
+    }
+}
+#else
+#define range_locks_init(s) 0
+#define range_lock(s,offset,len)
+#define range_unlock(s,offset,len)
+#endif
+
+
+// ordinary copy - the kernel memcpy is a byte loop, so use string ops
+static void copy_temporal(uint8_t *dest, uint8_t *src, uint64_t len)
+{
+    uint64_t words = len >> 3;
+    uint64_t bytes = len & 0x7;
+
+    __asm__ __volatile__ ("rep movsq"
+			  : "+D"(dest), "+S"(src), "+c"(words)
+			  :
+			  : "memory");
+    __asm__ __volatile__ ("rep movsb"
+			  : "+D"(dest), "+S"(src), "+c"(bytes)
+			  :
+			  : "memory");
+}
+
+// streaming copy for large writes - the destination will not be
+// touched again soon, so avoid dragging it through the cache
+// only integer registers are used, so no FPU state is involved
+static void copy_nontemporal(uint8_t *dest, uint8_t *src, uint64_t len)
+{
+    uint64_t head = (-(uint64_t)dest) & 0x7;
+    uint64_t i, n;
+    uint64_t *d, *s;
+
+    if (head > len) {
+	head = len;
+    }
+
+    copy_temporal(dest,src,head);
+    dest += head; src += head; len -= head;
+
+    d = (uint64_t *)dest;
+    s = (uint64_t *)src;
+    n = len >> 3;
+
+    for (i=0; i+4<=n; i+=4) {
+	__asm__ __volatile__ ("movnti %4, %0\n"
+			      "movnti %5, %1\n"
+			      "movnti %6, %2\n"
+			      "movnti %7, %3\n"
+			      : "=m"(d[i]), "=m"(d[i+1]), "=m"(d[i+2]), "=m"(d[i+3])
+			      : "r"(s[i]), "r"(s[i+1]), "r"(s[i+2]), "r"(s[i+3]));
+    }
+    for (; i<n; i++) {
+	__asm__ __volatile__ ("movnti %1, %0" : "=m"(d[i]) : "r"(s[i]));
+    }
+
+    // make the streaming stores globally visible before we report completion
+    __asm__ __volatile__ ("sfence" : : : "memory");
+
+    copy_temporal(dest+(n<<3),src+(n<<3),len&0x7);
+}
+
+static void copy_serial(uint8_t *dest, uint8_t *src, uint64_t len, int write)
+{
+    if (write && len >= NAUT_CONFIG_RAMDISK_NT_COPY_THRESHOLD) {
+	copy_nontemporal(dest,src,len);
+    } else {
+	copy_temporal(dest,src,len);
+    }
+}
+
+#if NAUT_CONFIG_RAMDISK_PARALLEL_COPY_THRESHOLD > 0
+struct copy_piece {
+    uint8_t  *dest;
+    uint8_t  *src;
+    uint64_t  len;
+    int       write;
 };
 
+static void *copy_piece_task(void *in)
+{
+    struct copy_piece *p = (struct copy_piece *)in;
+    copy_serial(p->dest,p->src,p->len,p->write);
+    return 0;
+}
+
+// split a large copy into pieces, hand all but the first to other cpus
+// as tasks, and do the first ourselves.  A piece whose task cannot be
+// created is copied inline.  nk_task_wait() pumps the task queues, so
+// this makes progress even when no cpu is dedicated to running tasks.
+static void copy_parallel(uint8_t *dest, uint8_t *src, uint64_t len, int write)
+{
+    struct copy_piece pieces[RAMDISK_MAX_PARALLEL_PIECES];
+    struct nk_task   *tasks[RAMDISK_MAX_PARALLEL_PIECES];
+    uint64_t num_cpus = nk_get_nautilus_info()->sys.num_cpus;
+    uint64_t num_pieces, piece_len, off, i;
+    int cpu = my_cpu_id();
+
+    num_pieces = MIN(num_cpus, RAMDISK_MAX_PARALLEL_PIECES);
+    num_pieces = MIN(num_pieces, len / RAMDISK_MIN_PARALLEL_PIECE);
+
+    if (num_pieces < 2) {
+	copy_serial(dest,src,len,write);
+	return;
+    }
+
+    // page-align the pieces so that no two cpus write the same line
+    piece_len = ((len / num_pieces) + PAGE_SIZE_4KB - 1) & ~(PAGE_SIZE_4KB - 1);
+
+    for (i=0, off=0; i<num_pieces && off<len; i++, off+=piece_len) {
+	pieces[i].dest = dest + off;
+	pieces[i].src = src + off;
+	pieces[i].len = MIN(piece_len, len - off);
+	pieces[i].write = write;
+    }
+    num_pieces = i;
+
+    for (i=1;i<num_pieces;i++) {
+	tasks[i] = nk_task_produce((cpu+i)%num_cpus, 0, copy_piece_task, &pieces[i], 0);
+	if (!tasks[i]) {
+	    DEBUG("Cannot produce copy task, copying piece %lu inline\n",i);
+	    copy_piece_task(&pieces[i]);
+	}
+    }
+
+    copy_piece_task(&pieces[0]);
+
+    for (i=1;i<num_pieces;i++) {
+	if (tasks[i]) {
+	    nk_task_wait(tasks[i],0,0);
+	}
+    }
+}
+#endif
+
+static void copy_data(uint8_t *dest, uint8_t *src, uint64_t len, int write)
+{
+#if NAUT_CONFIG_RAMDISK_PARALLEL_COPY_THRESHOLD > 0
+    if (len >= NAUT_CONFIG_RAMDISK_PARALLEL_COPY_THRESHOLD && !in_interrupt_context()) {
+	copy_parallel(dest,src,len,write);
+	return;
+    }
+#endif
+    copy_serial(dest,src,len,write);
+}
+
+
+static uint64_t cow_chunk_len(struct ramdisk_state *s, uint64_t chunk)
+{
+    return MIN(RAMDISK_COW_CHUNK, s->len - (chunk<<RAMDISK_COW_SHIFT));
+}
+
+static void cow_read(struct ramdisk_state *s, uint8_t *dest, uint64_t offset, uint64_t len)
+{
+    struct ramdisk_cow *cow = s->cow;
+    uint64_t chunk, n;
+    uint8_t *src;
+
+    while (len) {
+	chunk = offset >> RAMDISK_COW_SHIFT;
+	n = MIN(len, RAMDISK_COW_CHUNK - (offset & (RAMDISK_COW_CHUNK-1)));
+	src = cow->overlay[chunk];
+	if (src) {
+	    src += offset & (RAMDISK_COW_CHUNK-1);
+	} else {
+	    // unmodified chunks are contiguous in the image, so
+	    // copy a whole run of them at once
+	    src = cow->image->data + offset;
+	    while (n < len && !cow->overlay[++chunk]) {
+		n += MIN(len-n, RAMDISK_COW_CHUNK);
+	    }
+	}
+	copy_data(dest,src,n,0);
+	dest += n;
+	offset += n;
+	len -= n;
+    }
+}
+
+// make a private copy of a chunk that includes the new data
+static int cow_copy_up(struct ramdisk_state *s, uint64_t chunk, uint64_t off, uint8_t *src, uint64_t n)
+{
+    COW_LOCK_CONF;
+    struct ramdisk_cow *cow = s->cow;
+    uint64_t clen = cow_chunk_len(s,chunk);
+    uint8_t *base = cow->image->data + (chunk<<RAMDISK_COW_SHIFT);
+    uint8_t *new = malloc_specific(RAMDISK_COW_CHUNK,cow->cpu);
+    uint8_t *cur;
+
+    if (!new) {
+	ERROR("Cannot allocate copy of chunk %lu of %s\n",chunk,s->blkdev->dev.name);
+	return -1;
+    }
+
+    // the chunk is filled in before it is visible to readers
+    memcpy(new,base,off);
+    memcpy(new+off,src,n);
+    memcpy(new+off+n,base+off+n,clen-off-n);
+
+    COW_LOCK(cow);
+    cur = cow->overlay[chunk];
+    if (!cur) {
+	cow->overlay[chunk] = new;
+	cow->dirty[cow->num_dirty++] = chunk;
+    }
+    COW_UNLOCK(cow);
+
+    if (cur) {
+	// lost a race with another writer of this chunk
+	free(new);
+	memcpy(cur+off,src,n);
+    }
+
+    return 0;
+}
+
+static int cow_write(struct ramdisk_state *s, uint8_t *src, uint64_t offset, uint64_t len)
+{
+    struct ramdisk_cow *cow = s->cow;
+    uint64_t chunk, off, n;
+    uint8_t *dest;
+
+    while (len) {
+	chunk = offset >> RAMDISK_COW_SHIFT;
+	off = offset & (RAMDISK_COW_CHUNK-1);
+	n = MIN(len, RAMDISK_COW_CHUNK - off);
+	dest = cow->overlay[chunk];
+	if (dest) {
+	    copy_data(dest+off,src,n,1);
+	} else if (cow_copy_up(s,chunk,off,src,n)) {
+	    return -1;
+	}
+	src += n;
+	offset += n;
+	len -= n;
+    }
+
+    return 0;
+}
 
 static int get_characteristics(void *state, struct nk_block_dev_characteristics *c)
 {
@@ -63,20 +406,21 @@ static int get_characteristics(void *state, struct nk_block_dev_characteristics
 
 static int read_blocks(void *state, uint64_t blocknum, uint64_t count, uint8_t *dest,void (*callback)(nk_block_dev_status_t, void *), void *context)
 {
-    STATE_LOCK_CONF;
     struct ramdisk_state *s = (struct ramdisk_state *)state;
 
     DEBUG("read_blocks on device %s starting at %lu for %lu blocks\n",
 	  s->blkdev->dev.name, blocknum, count);
 
-    STATE_LOCK(s);
-    if (blocknum+count >= s->num_blocks) { 
-	STATE_UNLOCK(s);
+    // geometry is fixed at creation, so no lock is needed to check it
+    if (blocknum+count > s->num_blocks) { 
 	ERROR("Illegal access past end of disk\n");
 	return -1;
     } else {
-	memcpy(dest,s->data+blocknum*s->block_size,s->block_size*count);
-	STATE_UNLOCK(s);
+	if (s->cow) {
+	    cow_read(s,dest,blocknum*s->block_size,s->block_size*count);
+	} else {
+	    copy_data(dest,s->data+blocknum*s->block_size,s->block_size*count,0);
+	}
 	//nk_dump_mem(dest,s->block_size*count);
 	if (callback) {
 	    callback(NK_BLOCK_DEV_STATUS_SUCCESS,context);
@@ -87,20 +431,30 @@ static int read_blocks(void *state, uint64_t blocknum, uint64_t count, uint8_t *
 
 static int write_blocks(void *state, uint64_t blocknum, uint64_t count, uint8_t *src,void (*callback)(nk_block_dev_status_t, void *), void *context)
 {
-    STATE_LOCK_CONF;
     struct ramdisk_state *s = (struct ramdisk_state *)state;
+    uint64_t offset = blocknum*s->block_size;
+    uint64_t len = count*s->block_size;
+    int rc = 0;
 
     DEBUG("write_blocks on device %s starting at %lu for %lu blocks\n",
 	  s->blkdev->dev.name, blocknum, count);
 
-    STATE_LOCK(s);
-    if (blocknum+count >= s->num_blocks) { 
-	STATE_UNLOCK(s);
+    if (blocknum+count > s->num_blocks) { 
 	ERROR("Illegal access past end of disk\n");
 	return -1;
     } else {
-	memcpy(s->data+blocknum*s->block_size,src,s->block_size*count);
-	STATE_UNLOCK(s);
+	if (len) {
+	    range_lock(s,offset,len);
+	    if (s->cow) {
+		rc = cow_write(s,src,offset,len);
+	    } else {
+		copy_data(s->data+offset,src,len,1);
+	    }
+	    range_unlock(s,offset,len);
+	    if (rc) {
+		return -1;
+	    }
+	}
 	if (callback) { 
 	    callback(NK_BLOCK_DEV_STATUS_SUCCESS,context);
 	}
@@ -108,6 +462,45 @@ static int write_blocks(void *state, uint64_t blocknum, uint64_t count, uint8_t
     }
 }
 
+static int direct_access(void *state, uint64_t blocknum, uint64_t count, void **ptr)
+{
+    struct ramdisk_state *s = (struct ramdisk_state *)state;
+
+    if (blocknum+count > s->num_blocks) { 
+	ERROR("Illegal direct access past end of disk\n");
+	return -1;
+    }
+
+    if (s->cow && count) {
+	// only ranges that resolve to one contiguous piece of memory
+	// can be handed out: either all of it still in the image, or
+	// all of it within a single private chunk
+	struct ramdisk_cow *cow = s->cow;
+	uint64_t offset = blocknum*s->block_size;
+	uint64_t first = offset >> RAMDISK_COW_SHIFT;
+	uint64_t last = (offset + count*s->block_size - 1) >> RAMDISK_COW_SHIFT;
+	uint64_t i;
+	uint8_t *chunk = cow->overlay[first];
+
+	if (chunk) {
+	    if (first != last) {
+		return -1;
+	    }
+	    *ptr = chunk + (offset & (RAMDISK_COW_CHUNK-1));
+	    return 0;
+	}
+
+	for (i=first+1;i<=last;i++) {
+	    if (cow->overlay[i]) {
+		return -1;
+	    }
+	}
+    }
+
+    *ptr = s->data+blocknum*s->block_size;
+
+    return 0;
+}
 
 
 static struct nk_block_dev_int inter = 
@@ -115,38 +508,501 @@ static struct nk_block_dev_int inter =
     .get_characteristics = get_characteristics,
     .read_blocks = read_blocks,
     .write_blocks = write_blocks,
+    .direct_access = direct_access,
 };
 
-static int discover_ramdisks()
+static int numa_node_of(void *addr)
 {
-    int i=0;
-    
-    // this should do real discovery, but currently the only way to
-    // include a ramdisk is with the embedded image
-#if NAUT_CONFIG_RAMDISK_EMBED
-    extern int __RAMDISK_START, __RAMDISK_END;
+    struct mem_region *r = kmem_get_region_by_addr((ulong_t)addr);
+    return r ? (int)r->domain_id : -1;
+}
+
+// find a cpu whose allocations will come from the given domain
+static int numa_node_to_cpu(int numa_node)
+{
+    struct sys_info *sys = &nk_get_nautilus_info()->sys;
+    uint32_t i;
+
+    if (numa_node < 0) {
+	return my_cpu_id();
+    }
+
+    for (i=0;i<sys->num_cpus;i++) {
+	if (sys->cpus[i] && sys->cpus[i]->domain && sys->cpus[i]->domain->id == numa_node) {
+	    return i;
+	}
+    }
+
+    return -1;
+}
+
+static void image_put(struct ramdisk_image *image)
+{
+    if (__sync_sub_and_fetch(&image->refcount,1)==0) {
+	if (image->owns_data) {
+	    free(image->data);
+	}
+	free(image);
+    }
+}
+
+static struct ramdisk_cow *cow_create(struct ramdisk_image *image, int numa_node)
+{
+    struct ramdisk_cow *cow = malloc(sizeof(*cow));
+
+    if (!cow) {
+	ERROR("Cannot allocate copy-on-write state\n");
+	return 0;
+    }
+
+    memset(cow,0,sizeof(*cow));
+    spinlock_init(&cow->lock);
+
+    cow->image = image;
+    cow->cpu = numa_node_to_cpu(numa_node);
+    if (cow->cpu < 0) {
+	cow->cpu = my_cpu_id();
+    }
+    cow->num_chunks = (image->len + RAMDISK_COW_CHUNK - 1) >> RAMDISK_COW_SHIFT;
+    cow->overlay = malloc(sizeof(void*)*cow->num_chunks);
+    cow->dirty = malloc(sizeof(uint64_t)*cow->num_chunks);
+
+    if (!cow->overlay || !cow->dirty) {
+	ERROR("Cannot allocate overlay map for %lu chunks\n",cow->num_chunks);
+	if (cow->overlay) {
+	    free((void*)cow->overlay);
+	}
+	if (cow->dirty) {
+	    free(cow->dirty);
+	}
+	free(cow);
+	return 0;
+    }
+
+    memset((void*)cow->overlay,0,sizeof(void*)*cow->num_chunks);
+
+    return cow;
+}
+
+// drop all private chunks, returning to the image
+static uint64_t cow_discard(struct ramdisk_cow *cow)
+{
+    COW_LOCK_CONF;
+    uint64_t i, n;
+
+    COW_LOCK(cow);
+    n = cow->num_dirty;
+    for (i=0;i<n;i++) {
+	free(cow->overlay[cow->dirty[i]]);
+	cow->overlay[cow->dirty[i]] = 0;
+    }
+    cow->num_dirty = 0;
+    COW_UNLOCK(cow);
+
+    return n;
+}
+
+static void cow_free(struct ramdisk_cow *cow)
+{
+    cow_discard(cow);
+    image_put(cow->image);
+    free((void*)cow->overlay);
+    free(cow->dirty);
+    free(cow);
+}
+
+static void ramdisk_free_state(struct ramdisk_state *s)
+{
+    if (s->cow) {
+	cow_free(s->cow);
+    }
+#ifdef NAUT_CONFIG_RAMDISK_RANGE_LOCKS
+    if (s->range_locks) {
+	free(s->range_locks);
+    }
+#endif
+    if ((s->flags & RAMDISK_OWNS_DATA) && s->data) {
+	free(s->data);
+    }
+    free(s);
+}
 
+// wrap data as a ramdisk and register it as a block device
+// on failure, the data is freed if we own it, as is the cow state if any
+static struct ramdisk_state *ramdisk_register(char *name, void *data, uint64_t len, uint64_t block_size, int numa_node, uint64_t flags, struct ramdisk_cow *cow)
+{
+    LIST_LOCK_CONF;
     struct ramdisk_state *s = malloc(sizeof(*s));
     
     if (!s) { 
 	ERROR("Cannot allocate data structure for ramdisk\n");
-	return -1;
+	if (flags & RAMDISK_OWNS_DATA) {
+	    free(data);
+	}
+	if (cow) {
+	    cow_free(cow);
+	}
+	return 0;
     }
 
     memset(s,0,sizeof(*s));
     
     spinlock_init(&s->lock);
     
-    s->block_size=RAMDISK_DEFAULT_BLOCK_SIZE;
-    s->len = (((uint64_t)(&__RAMDISK_END)) - ((uint64_t)(&__RAMDISK_START)));
+    s->block_size = block_size;
+    s->len = len;
     s->num_blocks = s->len / s->block_size;
-    s->data = &__RAMDISK_START;
+    s->data = data;
+    s->flags = flags;
+    s->numa_node = numa_node;
+    s->cow = cow;
+
+    if (range_locks_init(s)) {
+	ERROR("Failed to set up range locks for ramdisk\n");
+	ramdisk_free_state(s);
+	return 0;
+    }
 
-    s->blkdev = nk_block_dev_register("ramdisk0", 0, &inter, s);
+    s->blkdev = nk_block_dev_register(name, 0, &inter, s);
 
     if (!s->blkdev) {
 	ERROR("Failed to register ramdisk\n");
-	free(s);
+	ramdisk_free_state(s);
+	return 0;
+    } 
+
+    LIST_LOCK();
+    list_add_tail(&s->ramdisk_list_node,&ramdisk_list);
+    LIST_UNLOCK();
+
+    return s;
+}
+
+static struct ramdisk_state *ramdisk_alloc(char *name, uint64_t size, uint64_t block_size, int numa_node, uint64_t flags)
+{
+    uint64_t len;
+    void *data;
+    int cpu;
+
+    if (flags & NK_RAMDISK_HUGE) {
+	// kmem blocks are naturally aligned to their power-of-two size,
+	// so anything this big lands entirely within large identity-mapped
+	// pages
+	len = (size + PAGE_SIZE_2MB - 1) & ~(PAGE_SIZE_2MB - 1);
+    } else {
+	len = (size + block_size - 1) & ~(block_size - 1);
+    }
+
+    if (!len) {
+	ERROR("Cannot create empty ramdisk %s\n",name);
+	return 0;
+    }
+
+    cpu = numa_node_to_cpu(numa_node);
+
+    if (cpu < 0) {
+	ERROR("No cpu in numa domain %d, cannot place ramdisk %s\n",numa_node,name);
+	return 0;
+    }
+
+    data = malloc_specific(len,cpu);
+
+    if (!data) {
+	ERROR("Cannot allocate %lu bytes for ramdisk %s\n",len,name);
+	return 0;
+    }
+
+    if ((flags & NK_RAMDISK_HUGE) && ((uint64_t)data & (PAGE_SIZE_2MB-1))) {
+	ERROR("Allocation for ramdisk %s is not large page aligned\n",name);
+	free(data);
+	return 0;
+    }
+
+    if (numa_node >= 0 && numa_node_of(data) != numa_node) {
+	INFO("Domain %d is full, ramdisk %s placed in domain %d instead\n",
+	     numa_node, name, numa_node_of(data));
+    }
+
+    if (flags & NK_RAMDISK_ZERO) {
+	memset(data,0,len);
+    }
+
+    return ramdisk_register(name, data, len, block_size, numa_node_of(data),
+			    flags | RAMDISK_OWNS_DATA, 0);
+}
+
+struct nk_block_dev *nk_ramdisk_create(char *name, uint64_t size, int numa_node, uint64_t flags)
+{
+    struct ramdisk_state *s;
+
+    s = ramdisk_alloc(name, size, RAMDISK_DEFAULT_BLOCK_SIZE, numa_node, flags);
+
+    if (!s) {
+	return 0;
+    }
+
+    INFO("Created %s in domain %d, blocksize=%lu, numblocks=%lu, len=%lu\n",
+	 name, s->numa_node, s->block_size, s->num_blocks, s->len);
+
+    return s->blkdev;
+}
+
+struct nk_block_dev *nk_ramdisk_create_copy(char *name, char *src_name, int numa_node, uint64_t flags)
+{
+    struct nk_block_dev *src = nk_block_dev_find(src_name);
+    struct nk_block_dev_characteristics c;
+    struct ramdisk_state *s;
+    uint64_t blocks_per_chunk, cur, count;
+
+    if (!src) {
+	ERROR("Cannot find source device %s\n",src_name);
+	return 0;
+    }
+
+    if (nk_block_dev_get_characteristics(src,&c)) {
+	ERROR("Cannot get characteristics of source device %s\n",src_name);
+	return 0;
+    }
+
+    // the copy keeps the block geometry of its source
+    s = ramdisk_alloc(name, c.block_size*c.num_blocks, c.block_size, numa_node, flags & ~NK_RAMDISK_ZERO);
+
+    if (!s) {
+	return 0;
+    }
+
+    blocks_per_chunk = MAX(RAMDISK_CLONE_CHUNK / c.block_size, 1);
+
+    // read straight into the backing memory - no bounce buffer
+    for (cur=0;cur<c.num_blocks;cur+=count) {
+	count = MIN(blocks_per_chunk, c.num_blocks-cur);
+	if (nk_block_dev_read(src, cur, count, s->data + cur*c.block_size, NK_DEV_REQ_BLOCKING, 0, 0)) {
+	    ERROR("Failed to read blocks %lu-%lu of %s\n", cur, cur+count-1, src_name);
+	    nk_ramdisk_destroy(name);
+	    return 0;
+	}
+    }
+
+    INFO("Created %s as a copy of %s in domain %d, blocksize=%lu, numblocks=%lu, len=%lu\n",
+	 name, src_name, s->numa_node, s->block_size, s->num_blocks, s->len);
+
+    return s->blkdev;
+}
+
+int nk_ramdisk_destroy(char *name)
+{
+    LIST_LOCK_CONF;
+    struct ramdisk_state *s, *target = 0;
+    int attached = 0;
+
+    LIST_LOCK();
+    list_for_each_entry(s, &ramdisk_list, ramdisk_list_node) {
+	if (!strncasecmp(s->blkdev->dev.name,name,DEV_NAME_LEN)) {
+	    target = s;
+	    // a filesystem still attached would go on using the freed memory
+	    if (!(attached = nk_block_dev_attached(s->blkdev))) {
+		list_del(&s->ramdisk_list_node);
+	    }
+	    break;
+	}
+    }
+    LIST_UNLOCK();
+
+    if (!target) {
+	ERROR("Cannot find ramdisk %s\n",name);
+	return -1;
+    }
+
+    if (attached) {
+	ERROR("Cannot destroy %s while a filesystem is attached to it - detach it first\n",name);
+	return -1;
+    }
+
+    nk_block_dev_unregister(target->blkdev);
+    ramdisk_free_state(target);
+
+    INFO("Destroyed %s\n",name);
+
+    return 0;
+}
+
+static struct ramdisk_state *ramdisk_find(char *name)
+{
+    LIST_LOCK_CONF;
+    struct ramdisk_state *s, *target = 0;
+
+    LIST_LOCK();
+    list_for_each_entry(s, &ramdisk_list, ramdisk_list_node) {
+	if (!strncasecmp(s->blkdev->dev.name,name,DEV_NAME_LEN)) {
+	    target = s;
+	    break;
+	}
+    }
+    LIST_UNLOCK();
+
+    if (!target) {
+	ERROR("Cannot find ramdisk %s\n",name);
+    }
+
+    return target;
+}
+
+int nk_ramdisk_snapshot(char *name)
+{
+    COW_LOCK_CONF;
+    struct ramdisk_state *s = ramdisk_find(name);
+    struct ramdisk_image *image;
+    struct ramdisk_cow *cow;
+    uint64_t i, chunk;
+
+    if (!s) {
+	return -1;
+    }
+
+    if (s->cow) {
+	// fold the modifications into the image, which is only
+	// possible if no clone is looking at it
+	cow = s->cow;
+	if (cow->image->refcount > 1) {
+	    ERROR("Cannot resnapshot %s while it has clones\n",name);
+	    return -1;
+	}
+	COW_LOCK(cow);
+	for (i=0;i<cow->num_dirty;i++) {
+	    chunk = cow->dirty[i];
+	    memcpy(cow->image->data + (chunk<<RAMDISK_COW_SHIFT), cow->overlay[chunk], cow_chunk_len(s,chunk));
+	    free(cow->overlay[chunk]);
+	    cow->overlay[chunk] = 0;
+	}
+	INFO("Folded %lu modified chunks into snapshot of %s\n",cow->num_dirty,name);
+	cow->num_dirty = 0;
+	COW_UNLOCK(cow);
+	return 0;
+    }
+
+    image = malloc(sizeof(*image));
+
+    if (!image) {
+	ERROR("Cannot allocate image for snapshot of %s\n",name);
+	return -1;
+    }
+
+    image->data = s->data;
+    image->len = s->len;
+    image->owns_data = !!(s->flags & RAMDISK_OWNS_DATA);
+    image->refcount = 1;
+
+    cow = cow_create(image, s->numa_node);
+
+    if (!cow) {
+	free(image);
+	return -1;
+    }
+
+    // the image now owns the memory
+    s->flags &= ~RAMDISK_OWNS_DATA;
+    s->cow = cow;
+
+    INFO("Snapshotted %s (%lu chunks of %lu bytes)\n",name,cow->num_chunks,RAMDISK_COW_CHUNK);
+
+    return 0;
+}
+
+int nk_ramdisk_rollback(char *name)
+{
+    struct ramdisk_state *s = ramdisk_find(name);
+    uint64_t n;
+
+    if (!s) {
+	return -1;
+    }
+
+    if (!s->cow) {
+	ERROR("Ramdisk %s has no snapshot to roll back to\n",name);
+	return -1;
+    }
+
+    n = cow_discard(s->cow);
+
+    INFO("Rolled back %s, discarding %lu modified chunks\n",name,n);
+
+    return 0;
+}
+
+struct nk_block_dev *nk_ramdisk_clone(char *name, char *base_name)
+{
+    struct ramdisk_state *base = ramdisk_find(base_name);
+    struct ramdisk_state *s;
+    struct ramdisk_image *image;
+    struct ramdisk_cow *cow;
+
+    if (!base) {
+	return 0;
+    }
+
+    if (!base->cow) {
+	ERROR("Ramdisk %s must be snapshotted before it can be cloned\n",base_name);
+	return 0;
+    }
+
+    image = base->cow->image;
+    __sync_fetch_and_add(&image->refcount,1);
+
+    cow = cow_create(image, base->numa_node);
+
+    if (!cow) {
+	image_put(image);
+	return 0;
+    }
+
+    s = ramdisk_register(name, image->data, image->len, base->block_size, base->numa_node,
+			 base->flags & NK_RAMDISK_HUGE, cow);
+
+    if (!s) {
+	return 0;
+    }
+
+    INFO("Created %s as a clone of %s, blocksize=%lu, numblocks=%lu, len=%lu\n",
+	 name, base_name, s->block_size, s->num_blocks, s->len);
+
+    return s->blkdev;
+}
+
+static void ramdisk_dump(void)
+{
+    LIST_LOCK_CONF;
+    struct ramdisk_state *s;
+
+    LIST_LOCK();
+    list_for_each_entry(s, &ramdisk_list, ramdisk_list_node) {
+	nk_vc_printf("%s: %lu bytes at %p, domain %d, blocksize=%lu, numblocks=%lu%s%s\n",
+		     s->blkdev->dev.name, s->len, s->data, s->numa_node,
+		     s->block_size, s->num_blocks,
+		     (s->flags & NK_RAMDISK_HUGE) ? ", huge" : "",
+		     s->cow ? ", copy-on-write" : 
+		     (s->flags & RAMDISK_OWNS_DATA) ? "" : ", embedded");
+	if (s->cow) {
+	    nk_vc_printf("  %lu of %lu chunks modified, image shared by %d\n",
+			 s->cow->num_dirty, s->cow->num_chunks, s->cow->image->refcount);
+	}
+    }
+    LIST_UNLOCK();
+}
+
+static int discover_ramdisks()
+{
+    // this should do real discovery, but currently the only way to
+    // include a ramdisk at boot is with the embedded image
+#if NAUT_CONFIG_RAMDISK_EMBED
+    extern int __RAMDISK_START, __RAMDISK_END;
+
+    struct ramdisk_state *s;
+    uint64_t len = (((uint64_t)(&__RAMDISK_END)) - ((uint64_t)(&__RAMDISK_START)));
+
+    s = ramdisk_register("ramdisk0", &__RAMDISK_START, len, RAMDISK_DEFAULT_BLOCK_SIZE,
+			 numa_node_of(&__RAMDISK_START), 0, 0);
+
+    if (!s) {
 	return -1;
     } 
 
@@ -160,6 +1016,8 @@ static int discover_ramdisks()
 int nk_ramdisk_init(struct naut_info *naut)
 {
     INFO("init\n");
+    INIT_LIST_HEAD(&ramdisk_list);
+    spinlock_init(&ramdisk_list_lock);
     return discover_ramdisks();
 }
 
@@ -170,5 +1028,78 @@ int nk_ramdisk_deinit()
 }
 
 
+static uint64_t parse_size(char *str)
+{
+    char *end;
+    uint64_t size = strtol(str,&end,0);
+
+    switch (*end) {
+    case 'g': case 'G': size <<= 10; // fall through
+    case 'm': case 'M': size <<= 10; // fall through
+    case 'k': case 'K': size <<= 10;
+    default: break;
+    }
+
+    return size;
+}
+
+static int
+handle_ramdisk (char * buf, void * priv)
+{
+    char name[DEV_NAME_LEN], src[DEV_NAME_LEN], size[32], huge[8];
+    int node = -1;
+
+    huge[0] = 0;
+
+    if (sscanf(buf,"ramdisk create %31s %31s %d %7s",name,size,&node,huge)>=2) {
+	if (!nk_ramdisk_create(name, parse_size(size), node,
+			       NK_RAMDISK_ZERO | (huge[0]=='h' ? NK_RAMDISK_HUGE : 0))) {
+	    nk_vc_printf("Failed to create ramdisk %s\n",name);
+	    return -1;
+	}
+	return 0;
+    }
+
+    if (sscanf(buf,"ramdisk copy %31s %31s %d %7s",name,src,&node,huge)>=2) {
+	if (!nk_ramdisk_create_copy(name, src, node, huge[0]=='h' ? NK_RAMDISK_HUGE : 0)) {
+	    nk_vc_printf("Failed to create ramdisk %s from %s\n",name,src);
+	    return -1;
+	}
+	return 0;
+    }
+
+    if (sscanf(buf,"ramdisk snapshot %31s",name)==1) {
+	return nk_ramdisk_snapshot(name);
+    }
+
+    if (sscanf(buf,"ramdisk rollback %31s",name)==1) {
+	return nk_ramdisk_rollback(name);
+    }
+
+    if (sscanf(buf,"ramdisk clone %31s %31s",name,src)==2) {
+	if (!nk_ramdisk_clone(name, src)) {
+	    nk_vc_printf("Failed to clone %s as %s\n",src,name);
+	    return -1;
+	}
+	return 0;
+    }
+
+    if (sscanf(buf,"ramdisk destroy %31s",name)==1) {
+	return nk_ramdisk_destroy(name);
+    }
+
+    if (!strncmp(buf,"ramdisk list",12)) {
+	ramdisk_dump();
+	return 0;
+    }
 
+    nk_vc_printf("Don't understand %s\n",buf);
+    return -1;
+}
 
+static struct shell_cmd_impl ramdisk_impl = {
+    .cmd      = "ramdisk",
+    .help_str = "ramdisk create name size[k|m|g] [numa_node] [huge] | copy name srcdev [numa_node] [huge] | snapshot name | rollback name | clone name base | destroy name | list",
+    .handler  = handle_ramdisk,
+};
+nk_register_shell_cmd(ramdisk_impl);
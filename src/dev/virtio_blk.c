@@ -275,10 +275,69 @@ static int write_blocks(void *state, uint64_t blocknum, uint64_t count, uint8_t
     return read_write_blocks(dev, blocknum, count, src, callback, context, 1);
 }
 
+// a flush carries no data, so the chain is just header and status
+static int flush(void *state, void (*callback)(nk_block_dev_status_t, void *), void *context)
+{
+    struct virtio_blk_dev *dev = (struct virtio_blk_dev *) state;
+
+    DEBUG("flush callback = %p context = %p\n", callback, context);
+
+    if (!FBIT_ISSET(dev->virtio_dev->feat_accepted,VIRTIO_BLK_F_FLUSH)) {
+	// no write cache was negotiated, so writes are already durable
+	DEBUG("device has no flush support, treating as write-through\n");
+	if (callback) {
+	    callback(NK_BLOCK_DEV_STATUS_SUCCESS,context);
+	}
+	return 0;
+    }
+
+    struct virtio_blk_req *hdr = malloc(sizeof(struct virtio_blk_req));
+
+    if (!hdr) {
+	ERROR("Failed to allocate request header\n");
+	return -1;
+    }
+
+    memset(hdr, 0, sizeof(struct virtio_blk_req));
+
+    hdr->type = VIRTIO_BLK_T_FLUSH;
+
+    uint16_t desc[2];
+
+    if (virtio_pci_desc_chain_alloc(dev->virtio_dev,VIRTIO_BLK_REQUEST_QUEUE,desc,2)) {
+	ERROR("Failed to allocate descriptor chain\n");
+	free(hdr);
+	return -1;
+    }
+
+    uint16_t hdr_index = desc[0];
+    uint16_t stat_index = desc[1];
+
+    struct virtq *vq = &dev->virtio_dev->virtq[VIRTIO_BLK_REQUEST_QUEUE].vq;
+
+    fill_hdr_desc(vq, hdr, hdr_index, stat_index);
+    fill_stat_desc(vq, &hdr->status, stat_index);
+
+    dev->blk_callb[hdr_index].callback = callback;
+    dev->blk_callb[hdr_index].context = context;
+
+    DEBUG("flush in indexes: header = %d, status = %d\n", hdr_index, stat_index);
+
+    vq->avail->ring[vq->avail->idx % vq->qsz] = hdr_index;
+    mbarrier();
+    vq->avail->idx++;
+    mbarrier();
+
+    virtio_pci_write_regw(dev->virtio_dev, QUEUE_NOTIFY, VIRTIO_BLK_REQUEST_QUEUE);
+
+    return 0;
+}
+
 static struct nk_block_dev_int ops = {
     .get_characteristics = get_characteristics,
     .read_blocks = read_blocks,
     .write_blocks = write_blocks,
+    .flush = flush,
 };
 
 /************************************************************
@@ -499,6 +558,7 @@ uint64_t select_features(uint64_t features)
     FBIT_SETIF(accepted,features,VIRTIO_BLK_F_GEOMETRY);
     FBIT_SETIF(accepted,features,VIRTIO_BLK_F_RO);
     FBIT_SETIF(accepted,features,VIRTIO_BLK_F_BLK_SIZE);
+    FBIT_SETIF(accepted,features,VIRTIO_BLK_F_FLUSH);
     
     DEBUG("features accepted: 0x%0lx\n", accepted);
     return accepted;
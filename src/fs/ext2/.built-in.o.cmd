@@ -0,0 +1 @@
+cmd_src/fs/ext2/built-in.o :=  ld -z max-page-size=0x1000 -melf_x86_64 -dp  -r -o src/fs/ext2/built-in.o src/fs/ext2/ext2.o
@@ -33,10 +33,13 @@
 
 #define EXT2_S_IFREG 0x8000
 #define EXT2_S_IFDIR 0x4000
+#define EXT2_S_IFMT  0xF000
 #define BLOCK_SIZE 1024
 #define DENTRY_ALIGN 4
 #define NUM_DIRECT_DATA_BLOCKS 12
 #define ENDFILE 0xa0
+// largest single device request issued for a file transfer
+#define RUN_MAX_BYTES (4UL<<20)
 
 #define INFO(fmt, args...)  INFO_PRINT("ext2: " fmt, ##args)
 #define DEBUG(fmt, args...) DEBUG_PRINT("ext2: " fmt, ##args)
@@ -48,11 +51,28 @@
 #endif
 
 
+#define EXT2_ICACHE_BUCKETS 64
+#define EXT2_ICACHE_MAX     256
+
+struct ext2_icache_ent;
+struct ext2_group;
+
 struct ext2_state {
     struct nk_block_dev_characteristics chars; 
     struct nk_block_dev *dev;
     struct nk_fs        *fs;
     struct ext2_super_block super;
+
+    spinlock_t              icache_lock;
+    struct ext2_icache_ent *icache[EXT2_ICACHE_BUCKETS];
+    struct list_head        icache_lru;
+    uint32_t                icache_count;
+
+    spinlock_t              alloc_lock;
+    struct ext2_group      *groups;
+    uint32_t                num_groups;
+    uint32_t                alloc_rotor;    // where the last allocation ended
+    int                     super_dirty;    // free counts changed
 };
 
 #include "ext2_access.c"
@@ -67,7 +87,6 @@ static size_t get_file_size(struct ext2_state *fs, struct ext2_inode *inode)
 
 static void set_file_size(struct ext2_state *fs, struct ext2_inode *inode, size_t size) 
 {
-    size_t temp = inode->i_size_high;
     inode->i_size_high = size>>32;
     inode->i_size = size & 0xffffffff;
 }
@@ -81,8 +100,11 @@ static void * ext2_open(void *state, char *path)
 
     DEBUG("open of %s returned inode number %u\n",path,inode_num);
 
-    // ideally FS would track this here so that we can handle multiple
-    // opens, locking, etc correctly, but that's outside of scope for now
+    // the inode stays cached while the file is open
+    if (inode_num && icache_pin(fs,inode_num)) {
+	ERROR("Cannot cache inode %u\n",inode_num);
+	return 0;
+    }
 
     return (void*)(uint64_t)inode_num;
 }
@@ -94,9 +116,9 @@ static void ext2_close(void *state, void *file)
 
     DEBUG("closing inode %u\n",(uint32_t)(uint64_t)file);
 
-    // ideally FS would track this here so that we can handle multiple
-    // opens, locking, etc correctly, but that's outside of scope for now
-
+    if (icache_unpin(fs,(uint32_t)(uint64_t)file)) {
+	ERROR("Failed to write back inode %u on close\n",(uint32_t)(uint64_t)file);
+    }
 }
 
 static int ext2_exists(void *state, char *path) 
@@ -135,6 +157,11 @@ static int map_logical_to_physical_get_put(struct ext2_state *fs, uint32_t inode
 	inode = their_inode;
     }
 
+    if (put) {
+	// the remembered runs may be about to change
+	bmap_forget(fs,inode_num);
+    }
+
     if (left < num_direct) { 
 	//DEBUG("Direct map (%lu)\n", logical_block);
 	if (put) {
@@ -165,6 +192,7 @@ static int map_logical_to_physical_get_put(struct ext2_state *fs, uint32_t inode
 			ERROR("Failed to write new indirect block\n");
 			return -1;
 		    }
+		    bmap_update(fs,inode_num,next,temp);
 		    inode->i_block[num_direct] = next;
 		    if (write_inode(fs,inode_num,inode)) { 
 			ERROR("Failed to write inode with new indirect block\n");
@@ -185,6 +213,7 @@ static int map_logical_to_physical_get_put(struct ext2_state *fs, uint32_t inode
 		    ERROR("Failed to write indirect block\n");
 		    return -1;
 		}
+		bmap_update(fs,inode_num,next,buf);
 		return 0;
 	    } else {
 		*physical_block = ptrs[left%num_single];
@@ -209,6 +238,7 @@ static int map_logical_to_physical_get_put(struct ext2_state *fs, uint32_t inode
 			    ERROR("Failed to write new 2-indirect block (1st)\n");
 			    return -1;
 			}
+			bmap_update(fs,inode_num,next,temp);
 			inode->i_block[num_direct+1] = next;
 			if (write_inode(fs,inode_num,inode)) { 
 			    ERROR("Failed to write inode with new 2-indirect block (1st)\n");
@@ -236,11 +266,13 @@ static int map_logical_to_physical_get_put(struct ext2_state *fs, uint32_t inode
 			    ERROR("Failed to write new 2-indirect block (2nd)\n");
 			    return -1;
 			}
+			bmap_update(fs,inode_num,next,temp);
 			ptrs[left/num_single] = next;
 			if (write_block(fs,cur,buf)) { 
 			    ERROR("Failed to update for new 2-indirect block (2nd)\n");
 			    return -1;
 			}
+			bmap_update(fs,inode_num,cur,buf);
 		    } else {
 			ERROR("required 2-indirect block (2nd step) does not exist\n");
 			return -1;
@@ -256,6 +288,7 @@ static int map_logical_to_physical_get_put(struct ext2_state *fs, uint32_t inode
 			ERROR("Failed to write 2-indirect mapping\n");
 			return -1;
 		    }
+		    bmap_update(fs,inode_num,next,buf);
 		    return 0;
 		} else {
 		    *physical_block = ptrs[left%num_single];
@@ -279,6 +312,7 @@ static int map_logical_to_physical_get_put(struct ext2_state *fs, uint32_t inode
 				ERROR("Failed to write new 3-indirect block (1st)\n");
 				return -1;
 			    }
+			    bmap_update(fs,inode_num,next,temp);
 			    inode->i_block[num_direct+2] = next;
 			    if (write_inode(fs,inode_num,inode)) { 
 				ERROR("Failed to write inode with new 3-indirect block (1st)\n");
@@ -306,11 +340,13 @@ static int map_logical_to_physical_get_put(struct ext2_state *fs, uint32_t inode
 				ERROR("Failed to write new 3-indirect block (2nd)\n");
 				return -1;
 			    }
+			    bmap_update(fs,inode_num,next,temp);
 			    ptrs[left/num_double] = next;
 			    if (write_block(fs,cur,buf)) { 
 				ERROR("Failed to update for new 3-indirect block (2nd)\n");
 				return -1;
 			    }
+			    bmap_update(fs,inode_num,cur,buf);
 			} else {
 			    ERROR("required 3-indirect block (2nd step) does not exist\n");
 			    return -1;
@@ -333,11 +369,13 @@ static int map_logical_to_physical_get_put(struct ext2_state *fs, uint32_t inode
 				ERROR("Failed to write new 3-indirect block (3rd)\n");
 				return -1;
 			    }
+			    bmap_update(fs,inode_num,next,temp);
 			    ptrs[(left%num_double)/num_single] = next;
 			    if (write_block(fs,cur,buf)) { 
 				ERROR("Failed to update for new 3-indirect block (3rd)\n");
 				return -1;
 			    }
+			    bmap_update(fs,inode_num,cur,buf);
 			} else {
 			    ERROR("required 3-indirect block (3rd step) does not exist\n");
 			    return -1;
@@ -353,6 +391,7 @@ static int map_logical_to_physical_get_put(struct ext2_state *fs, uint32_t inode
 			    ERROR("Failed to write 3-indirect mapping\n");
 			    return -1;
 			}
+			bmap_update(fs,inode_num,next,buf);
 			return 0;
 		    } else {
 			*physical_block = ptrs[left%num_single];
@@ -369,12 +408,151 @@ static int map_logical_to_physical_get_put(struct ext2_state *fs, uint32_t inode
 }
 
 
+// maps logical_block within the direct blocks or the one leaf indirect
+// block that holds it, and up to max-1 blocks after it while they
+// follow it on disk, returning their number or -1 on error
+static sint64_t map_leaf(struct ext2_state *fs, uint32_t inode_num, struct ext2_inode *inode, uint32_t logical_block, uint32_t *physical_block, uint32_t max)
+{
+    uint64_t ptrs_per_block = get_block_size(fs)/4;
+    uint64_t num_direct = NUM_DIRECT_DATA_BLOCKS;
+    uint64_t num_single = ptrs_per_block;
+    uint64_t num_double = ptrs_per_block*ptrs_per_block;
+    uint64_t num_triple = ptrs_per_block*ptrs_per_block*ptrs_per_block;
+    uint64_t left = logical_block;
+    uint32_t next;
+
+    if (left < num_direct) {
+	max = MIN(max,num_direct-left);
+	return ptr_run(inode->i_block,left,max,physical_block);
+    }
+
+    left -= num_direct;
+    max = MIN(max,num_single-left%num_single);
+
+    if (left < num_single) {
+	next = inode->i_block[num_direct];
+    } else if ((left -= num_single) < num_double) {
+	next = inode->i_block[num_direct+1];
+	if (next && bmap_ptrs(fs,inode_num,next,left/num_single,1,&next)<0) {
+	    return -1;
+	}
+    } else if ((left -= num_double) < num_triple) {
+	next = inode->i_block[num_direct+2];
+	if (next && bmap_ptrs(fs,inode_num,next,left/num_double,1,&next)<0) {
+	    return -1;
+	}
+	if (next && bmap_ptrs(fs,inode_num,next,(left%num_double)/num_single,1,&next)<0) {
+	    return -1;
+	}
+    } else {
+	ERROR("Logical block %u is beyond 3-indirect\n",logical_block);
+	return -1;
+    }
+
+    if (!next) {
+	// a hole - no indirect block
+	*physical_block = 0;
+	return 1;
+    }
+
+    return bmap_ptrs(fs,inode_num,next,left%num_single,max,physical_block);
+}
+
+/*
+ * maps logical_block, and up to max-1 blocks after it for as long as
+ * they follow it on disk.  Returns the length of the run, with
+ * *physical_block 0 for a hole, or -1 on error
+ */
+static sint64_t map_run(struct ext2_state *fs, uint32_t inode_num, struct ext2_inode *inode, uint32_t logical_block, uint32_t *physical_block, uint32_t max)
+{
+    uint64_t ptrs_per_block = get_block_size(fs)/4;
+    uint32_t len, phys, logical;
+    sint64_t n;
+
+    if ((len = bmap_run_find(fs,inode_num,logical_block,physical_block))) {
+	return MIN(len,max);
+    }
+
+    if ((n = map_leaf(fs,inode_num,inode,logical_block,physical_block,max)) < 0) {
+	return -1;
+    }
+
+    len = n;
+
+    // a run that reaches the end of its leaf may carry on in the next one
+    while (*physical_block && len < max) {
+	logical = logical_block + len;
+	if (logical < NUM_DIRECT_DATA_BLOCKS || (logical-NUM_DIRECT_DATA_BLOCKS) % ptrs_per_block) {
+	    break;
+	}
+	if ((n = map_leaf(fs,inode_num,inode,logical,&phys,max-len)) < 0 || phys != *physical_block+len) {
+	    break;
+	}
+	len += n;
+    }
+
+    if (*physical_block) {
+	bmap_run_add(fs,inode_num,logical_block,*physical_block,len);
+    }
+
+    return len;
+}
+
 #define map_logical_to_physical_get(fs,inode_num,inode,logical_block,physical_block) \
-    map_logical_to_physical_get_put(fs,inode_num,inode,logical_block,physical_block,0)
+    (map_run(fs,inode_num,inode,logical_block,physical_block,1)<0 ? -1 : 0)
 #define map_logical_to_physical_put(fs,inode_num,inode,logical_block,physical_block) \
     map_logical_to_physical_get_put(fs,inode_num,inode,logical_block,&physical_block,1)
 
 
+// indirect blocks that map a file of n blocks with no holes
+static uint64_t indirect_blocks(struct ext2_state *fs, uint64_t n)
+{
+    uint64_t p = get_block_size(fs)/4;
+    uint64_t count = 0, m;
+
+    if (n <= NUM_DIRECT_DATA_BLOCKS) {
+	return 0;
+    }
+    n -= NUM_DIRECT_DATA_BLOCKS;
+
+    m = MIN(n,p);
+    count += 1;
+    n -= m;
+
+    if (n) {
+	m = MIN(n,p*p);
+	count += 1 + CEIL_DIV(m,p);
+	n -= m;
+    }
+
+    if (n) {
+	count += 1 + CEIL_DIV(n,p*p) + CEIL_DIV(n,p);
+    }
+
+    return count;
+}
+
+// frees an indirect block and, for depth>1, the indirect blocks below it
+static int free_indirect(struct ext2_state *fs, uint32_t block, int depth)
+{
+    uint64_t ptrs_per_block = get_block_size(fs)/4;
+    uint32_t ptrs[ptrs_per_block];
+    uint64_t i;
+
+    if (depth > 1) {
+	if (read_block(fs,block,ptrs)) {
+	    return -1;
+	}
+	for (i=0;i<ptrs_per_block;i++) {
+	    if (ptrs[i] && free_indirect(fs,ptrs[i],depth-1)) {
+		return -1;
+	    }
+	}
+    }
+
+    return free_block(fs,block);
+}
+
 static int ext2_truncate(void *state, void *file, off_t len)
 { 
     struct ext2_state *fs = (struct ext2_state *)state;
@@ -402,29 +580,49 @@ static int ext2_truncate(void *state, void *file, off_t len)
     if (new_file_size_blocks < file_size_blocks) { 
 	// shrink
 	uint64_t block;
-	for (block=new_file_size_blocks;block<file_size_blocks;block++) { 
-	    if (map_logical_to_physical_get(fs,inode_num,&inode,block,&phys)) { 
-		ERROR("Unable to map logical block %lu to physical block in truncation\n");
+	sint64_t run;
+	for (block=new_file_size_blocks;block<file_size_blocks;block+=run) { 
+	    if ((run = map_run(fs,inode_num,&inode,block,&phys,file_size_blocks-block)) < 0) { 
+		ERROR("Unable to map logical block %lu to physical block in truncation\n", block);
 		return -1;
 	    } 
-	    if (free_block(fs,phys)) { 
+	    if (phys && free_blocks(fs,phys,run)) { 
 		ERROR("Unable to free block in truncation\n");
 		return -1;
 	    }
 	}
+	if (!new_file_size_blocks) {
+	    // indirect blocks are only given back when the file is emptied
+	    for (block=0;block<3;block++) {
+		if (inode.i_block[NUM_DIRECT_DATA_BLOCKS+block] &&
+		    free_indirect(fs,inode.i_block[NUM_DIRECT_DATA_BLOCKS+block],block+1)) {
+		    ERROR("Unable to free indirect block in truncation\n");
+		    return -1;
+		}
+	    }
+	    memset(inode.i_block,0,sizeof(inode.i_block));
+	}
+	bmap_forget(fs,inode_num);
+	prealloc_release(fs,inode_num);
     } else if (new_file_size_blocks > file_size_blocks) {
 	// grow
 	uint64_t block;
 	uint8_t buf[block_size];
 	memset(buf,0,sizeof(buf));
+	// new blocks go right after the file's last one if they can
+	phys = 0;
+	if (file_size_blocks && map_logical_to_physical_get(fs,inode_num,&inode,file_size_blocks-1,&phys)) {
+	    phys = 0;
+	}
 	for (block=file_size_blocks;block<new_file_size_blocks;block++) { 
-	    if (alloc_block(fs,&phys)) { 
+	    phys = phys ? phys+1 : 0;
+	    if (alloc_data_block(fs,inode_num,&phys)) { 
 		ERROR("Unable to allocate block in truncation\n");
 		// should unwind previous allocations here...
 		return -1;
 	    }
 	    if (map_logical_to_physical_put(fs,inode_num,&inode,block,phys)) { 
-		ERROR("Unable to create mapping of logical block %lu to physical block %lu in truncation\n", block, phys);
+		ERROR("Unable to create mapping of logical block %lu to physical block %u in truncation\n", block, phys);
 		// should unwind here
 		return -1;
 	    } 
@@ -439,7 +637,7 @@ static int ext2_truncate(void *state, void *file, off_t len)
     }
 
     set_file_size(fs, &inode, new_file_size_bytes);
-    inode.i_blocks = new_file_size_blocks;
+    inode.i_blocks = (new_file_size_blocks + indirect_blocks(fs,new_file_size_blocks)) * (block_size/512);
 
     if (write_inode(fs,inode_num,&inode)) { 
 	ERROR("Failed to update inode with new sizes\n");
@@ -456,7 +654,7 @@ static ssize_t ext2_read_write(void *state, void *file, void *srcdest, off_t off
     uint64_t block_size = get_block_size(fs);
     uint32_t inode_num = (uint32_t)(uint64_t)file;
     struct ext2_inode inode;   
-    size_t file_size_bytes, file_size_blocks;
+    size_t file_size_bytes;
 
     DEBUG("%sing inode %u %lu bytes at offset %lu\n",rw[write], inode_num, num_bytes, offset);
   
@@ -466,7 +664,6 @@ static ssize_t ext2_read_write(void *state, void *file, void *srcdest, off_t off
     }
 
     file_size_bytes = get_file_size(fs,&inode);
-    file_size_blocks = CEIL_DIV(file_size_bytes,block_size);
 
     //num_bytes = MIN(block_size*NUM_DATA_BLOCKS)-offset, num_bytes);
 
@@ -478,7 +675,7 @@ static ssize_t ext2_read_write(void *state, void *file, void *srcdest, off_t off
 	} else {
 	    // expand and zero fill if needed
 	    DEBUG("Writing starts past end of file - expanding and retrying\n");
-	    if (ext2_truncate(fs,file,offset+num_bytes-1)) { 
+	    if (ext2_truncate(fs,file,offset+num_bytes)) { 
 		ERROR("file expansion failed\n");
 		return -1;
 	    } else {
@@ -490,7 +687,7 @@ static ssize_t ext2_read_write(void *state, void *file, void *srcdest, off_t off
     if (write) { 
 	if (offset+num_bytes > file_size_bytes) { 
 	    DEBUG("Writing continues past end of file - expanding and retrying\n");
-	    if (ext2_truncate(fs,file,offset+num_bytes-1)) { 
+	    if (ext2_truncate(fs,file,offset+num_bytes)) { 
 		ERROR("file expansion failed\n");
 		return -1;
 	    } else {
@@ -517,28 +714,66 @@ static ssize_t ext2_read_write(void *state, void *file, void *srcdest, off_t off
     uint8_t buf[block_size];
     uint32_t cur_logical_block;
     uint32_t cur_physical_block;
+    uint64_t middle_end = logical_block_start + num_blocks - have_last_block;
+    uint64_t dev_per_block = FLOOR_DIV(block_size,fs->chars.block_size);
+    uint64_t want;
+    sint64_t run;
+    int rc;
 
-    DEBUG("logical blocks [%lu,%lu), first_offset=%lu first=%lu middle=%lu, last=%lu\n",
+    DEBUG("logical blocks [%lu,%lu), first_offset=%lu first=%lu middle=%lu last=%lu\n",
 	  logical_block_start, logical_block_start+num_blocks,
-	  offset_into_first_block, bytes_from_last_block);
+	  offset_into_first_block, bytes_from_first_block, bytes_from_middle_blocks, bytes_from_last_block);
 
     uint64_t bytes=0;
 
     for (cur_logical_block = logical_block_start;
 	 cur_logical_block < logical_block_start + num_blocks;
-	 cur_logical_block++) {
-	
-	if (map_logical_to_physical_get(fs,inode_num,&inode,cur_logical_block,&cur_physical_block)) { 
-	    ERROR("Unable to map logical block %lu\n", cur_logical_block);
+	 cur_logical_block += run) {
+
+	// whole blocks are mapped a contiguous run at a time
+	want = 1;
+	if (cur_logical_block > logical_block_start && cur_logical_block < middle_end) {
+	    want = MIN(middle_end - cur_logical_block, RUN_MAX_BYTES/block_size);
+	}
+
+	if ((run = map_run(fs,inode_num,&inode,cur_logical_block,&cur_physical_block,want)) < 0) { 
+	    ERROR("Unable to map logical block %u\n", cur_logical_block);
 	    return -1;
 	}
 	
-	DEBUG("mapped logical block %lu to physical block %lu\n", cur_logical_block, cur_physical_block);
+	DEBUG("mapped logical blocks [%u,%lu) to physical block %u\n", cur_logical_block, cur_logical_block+run, cur_physical_block);
+
+	if (!cur_physical_block) {
+	    if (write) {
+		ERROR("Logical block %u has no backing block\n", cur_logical_block);
+		return -1;
+	    }
+	    // a hole reads as zeros
+	    run = 1;
+	    if (have_first_block && cur_logical_block==logical_block_start) {
+		memset(srcdest+bytes,0,bytes_from_first_block);
+		bytes += bytes_from_first_block;
+	    } else if (have_last_block && cur_logical_block==(logical_block_start+num_blocks-1)) {
+		memset(srcdest+bytes,0,bytes_from_last_block);
+		bytes += bytes_from_last_block;
+	    } else {
+		memset(srcdest+bytes,0,block_size);
+		bytes += block_size;
+	    }
+	    continue;
+	}
 	
 	if (have_first_block && cur_logical_block==logical_block_start) {
 	    // first block (partial)
+	    uint8_t *direct;
+	    if (!write && (direct = direct_block(fs,cur_physical_block))) {
+		// copy straight out of device memory
+		memcpy(srcdest+bytes,direct+offset_into_first_block,bytes_from_first_block);
+		bytes += bytes_from_first_block;
+		continue;
+	    }
 	    if (read_block(fs,cur_physical_block,buf)) {
-		ERROR("Failed to read first partial physical block %lu\n",cur_physical_block);
+		ERROR("Failed to read first partial physical block %u\n",cur_physical_block);
 		return -1;
 	    } 
 	    if (!write) { 
@@ -548,7 +783,7 @@ static ssize_t ext2_read_write(void *state, void *file, void *srcdest, off_t off
 		// write - copy-in and flush
 		memcpy(buf+offset_into_first_block,srcdest+bytes,bytes_from_first_block);
 		if (write_block(fs,cur_physical_block,buf)) { 
-		    ERROR("Failed to write first partial physical block %lu\n",cur_physical_block);
+		    ERROR("Failed to write first partial physical block %u\n",cur_physical_block);
 		    return -1;
 		}
 	    }
@@ -558,8 +793,14 @@ static ssize_t ext2_read_write(void *state, void *file, void *srcdest, off_t off
 
 	if (have_last_block && cur_logical_block==(logical_block_start+num_blocks-1)) {
 	    // last block (partial)
+	    uint8_t *direct;
+	    if (!write && (direct = direct_block(fs,cur_physical_block))) {
+		memcpy(srcdest+bytes,direct,bytes_from_last_block);
+		bytes += bytes_from_last_block;
+		continue;
+	    }
 	    if (read_block(fs,cur_physical_block,buf)) {
-		ERROR("Failed to read last partial physical block %lu\n",cur_physical_block);
+		ERROR("Failed to read last partial physical block %u\n",cur_physical_block);
 		return -1;
 	    } 
 	    if (!write) { 
@@ -569,7 +810,7 @@ static ssize_t ext2_read_write(void *state, void *file, void *srcdest, off_t off
 		// write - copy-in and flush
 		memcpy(buf,srcdest+bytes,bytes_from_last_block);
 		if (write_block(fs,cur_physical_block,buf)) { 
-		    ERROR("Failed to write first partial physical block %lu\n",cur_physical_block);
+		    ERROR("Failed to write first partial physical block %u\n",cur_physical_block);
 		    return -1;
 		}
 	    }
@@ -577,24 +818,21 @@ static ssize_t ext2_read_write(void *state, void *file, void *srcdest, off_t off
 	    continue;
 	}
 	
-	// common case - r/w complete blocks
+	// common case - r/w complete blocks, one device request per run
 	if (!write) {
-	    if (read_block(fs,cur_physical_block,srcdest+bytes)) { 
-		ERROR("Failed to read middle block %lu\n",cur_physical_block);
-		return -1;
-	    } else {
-		bytes += block_size;
-		continue;
-	    }
+	    rc = nk_block_dev_read(fs->dev,(uint64_t)cur_physical_block*dev_per_block,run*dev_per_block,
+				   srcdest+bytes,NK_DEV_REQ_BLOCKING,0,0);
 	} else {
-	    if (write_block(fs,cur_physical_block,srcdest+bytes)) { 
-		ERROR("Failed to write middle block %lu\n",cur_physical_block);
-		return -1;
-	    } else {
-		bytes += block_size;
-		continue;
-	    }
+	    rc = nk_block_dev_write(fs->dev,(uint64_t)cur_physical_block*dev_per_block,run*dev_per_block,
+				    srcdest+bytes,NK_DEV_REQ_BLOCKING,0,0);
+	}
+
+	if (rc) { 
+	    ERROR("Failed to %s middle blocks %u-%lu\n",rw[write],cur_physical_block,cur_physical_block+run-1);
+	    return -1;
 	}
+
+	bytes += run*block_size;
     }
 
     if (bytes != num_bytes) { 
@@ -618,6 +856,311 @@ static ssize_t ext2_write(void *state, void *file, void *srcdest, off_t offset,
     return ext2_read_write(state,file,srcdest,offset,num_bytes,1);
 }
 
+// moves n bytes between buf and the segments at *seg/*seg_off, advancing them
+static void iov_copy(const struct nk_fs_iovec *iov, int *seg, size_t *seg_off, uint8_t *buf, size_t n, int to_iov)
+{
+    size_t m;
+
+    while (n) {
+	m = MIN(n, iov[*seg].len - *seg_off);
+	if (to_iov) {
+	    memcpy(iov[*seg].base + *seg_off, buf, m);
+	} else {
+	    memcpy(buf, iov[*seg].base + *seg_off, m);
+	}
+	buf += m;
+	n -= m;
+	*seg_off += m;
+	if (*seg_off == iov[*seg].len) {
+	    (*seg)++;
+	    *seg_off = 0;
+	}
+    }
+}
+
+/*
+ * readv/writev - the inode is read, and the file grown, once for the
+ * whole vector, and each block is mapped once however many segments
+ * it spans.  Runs of whole blocks that fall in one segment go straight
+ * between it and the device; the rest go through a block buffer.
+ */
+static ssize_t ext2_rw_iov(void *state, void *file, const struct nk_fs_iovec *iov, int iovcnt, off_t offset, int write)
+{
+    struct ext2_state *fs = (struct ext2_state *)state;
+    uint64_t block_size = get_block_size(fs);
+    uint64_t dev_per_block = FLOOR_DIV(block_size,fs->chars.block_size);
+    uint32_t inode_num = (uint32_t)(uint64_t)file;
+    struct ext2_inode inode;
+    uint32_t logical, physical;
+    size_t total = 0, done = 0, seg_off = 0, n, boff, left;
+    uint8_t buf[block_size];
+    sint64_t run;
+    int seg = 0, i, rc;
+
+    for (i=0;i<iovcnt;i++) {
+	total += iov[i].len;
+    }
+
+    DEBUG("%sing inode %u %lu bytes in %d segments at offset %lu\n",rw[write], inode_num, total, iovcnt, offset);
+
+    if (read_inode(fs,inode_num,&inode)) {
+	ERROR("Failed to read inode %u\n",inode_num);
+	return -1;
+    }
+
+    if (write) {
+	if (offset+total > get_file_size(fs,&inode)) {
+	    if (ext2_truncate(fs,file,offset+total) || read_inode(fs,inode_num,&inode)) {
+		ERROR("file expansion failed\n");
+		return -1;
+	    }
+	}
+    } else {
+	if (offset >= get_file_size(fs,&inode)) {
+	    return 0;
+	}
+	total = MIN(total, get_file_size(fs,&inode)-offset);
+    }
+
+    while (done < total) {
+	while (iov[seg].len == seg_off) {
+	    seg++;
+	    seg_off = 0;
+	}
+
+	logical = (offset+done)/block_size;
+	boff = (offset+done)%block_size;
+	left = MIN(iov[seg].len - seg_off, total - done);
+
+	if (!boff && left >= block_size) {
+	    // whole blocks within this segment
+	    if ((run = map_run(fs,inode_num,&inode,logical,&physical,
+			       MIN(left/block_size, RUN_MAX_BYTES/block_size))) < 0) {
+		ERROR("Unable to map logical block %u\n", logical);
+		return done ? done : -1;
+	    }
+	    n = run*block_size;
+	    if (!physical) {
+		if (write) {
+		    ERROR("Logical block %u has no backing block\n", logical);
+		    return done ? done : -1;
+		}
+		// a hole reads as zeros
+		n = block_size;
+		memset(iov[seg].base + seg_off, 0, n);
+	    } else {
+		if (write) {
+		    rc = nk_block_dev_write(fs->dev,(uint64_t)physical*dev_per_block,run*dev_per_block,
+					    iov[seg].base + seg_off,NK_DEV_REQ_BLOCKING,0,0);
+		} else {
+		    rc = nk_block_dev_read(fs->dev,(uint64_t)physical*dev_per_block,run*dev_per_block,
+					   iov[seg].base + seg_off,NK_DEV_REQ_BLOCKING,0,0);
+		}
+		if (rc) {
+		    ERROR("Failed to %s blocks %u-%lu\n",rw[write],physical,physical+run-1);
+		    return done ? done : -1;
+		}
+	    }
+	    seg_off += n;
+	    done += n;
+	    continue;
+	}
+
+	// a partial block, or one split across segments
+	n = MIN(block_size - boff, total - done);
+
+	if (map_run(fs,inode_num,&inode,logical,&physical,1) < 0) {
+	    ERROR("Unable to map logical block %u\n", logical);
+	    return done ? done : -1;
+	}
+
+	if (!physical) {
+	    if (write) {
+		ERROR("Logical block %u has no backing block\n", logical);
+		return done ? done : -1;
+	    }
+	    memset(buf,0,block_size);
+	} else if ((!write || n < block_size) && read_block(fs,physical,buf)) {
+	    ERROR("Failed to read physical block %u\n",physical);
+	    return done ? done : -1;
+	}
+
+	iov_copy(iov,&seg,&seg_off,buf+boff,n,!write);
+
+	if (write && write_block(fs,physical,buf)) {
+	    ERROR("Failed to write physical block %u\n",physical);
+	    return done ? done : -1;
+	}
+
+	done += n;
+    }
+
+    DEBUG("%s request done\n", rw[write]);
+
+    return done;
+}
+
+static ssize_t ext2_readv(void *state, void *file, const struct nk_fs_iovec *iov, int iovcnt, off_t offset)
+{
+    return ext2_rw_iov(state,file,iov,iovcnt,offset,0);
+}
+
+static ssize_t ext2_writev(void *state, void *file, const struct nk_fs_iovec *iov, int iovcnt, off_t offset)
+{
+    return ext2_rw_iov(state,file,iov,iovcnt,offset,1);
+}
+
+/*
+ * O_DIRECT - whole filesystem blocks move straight between the caller's
+ * buffer and the device, one request per run of logical blocks that is
+ * also contiguous on disk.  Holes read back as zeros.
+ */
+static ssize_t ext2_rw_uncached(void *state, void *file, void *buf, off_t offset, size_t num_bytes, int write)
+{
+    struct ext2_state *fs = (struct ext2_state *)state;
+    uint64_t block_size = get_block_size(fs);
+    uint64_t dev_per_block = FLOOR_DIV(block_size,fs->chars.block_size);
+    uint64_t max_run = RUN_MAX_BYTES/block_size;
+    uint32_t inode_num = (uint32_t)(uint64_t)file;
+    struct ext2_inode inode;
+    size_t file_size_bytes, result;
+    uint64_t logical, num_blocks, i;
+    sint64_t run;
+    uint32_t phys;
+    int rc;
+
+    DEBUG("uncached %s of inode %u %lu bytes at offset %lu\n", rw[write], inode_num, num_bytes, offset);
+
+    if (offset % block_size || num_bytes % block_size || (uint64_t)buf % fs->chars.block_size) {
+	ERROR("O_DIRECT %s is not block aligned (buf=%p offset=%lu len=%lu block=%lu)\n",
+	      rw[write], buf, offset, num_bytes, block_size);
+	return -1;
+    }
+
+    if (read_inode(fs,inode_num,&inode)) {
+	ERROR("Failed to read inode %u\n",inode_num);
+	return -1;
+    }
+
+    file_size_bytes = get_file_size(fs,&inode);
+
+    if (write) {
+	if (offset+num_bytes > file_size_bytes) {
+	    if (ext2_truncate(fs,file,offset+num_bytes) || read_inode(fs,inode_num,&inode)) {
+		ERROR("file expansion failed\n");
+		return -1;
+	    }
+	}
+	result = num_bytes;
+    } else {
+	if (offset >= file_size_bytes) {
+	    return 0;
+	}
+	result = MIN(num_bytes,file_size_bytes-offset);
+	// the tail of the last block lands in the caller's buffer too
+	num_bytes = CEIL_DIV(result,block_size)*block_size;
+    }
+
+    logical = offset/block_size;
+    num_blocks = num_bytes/block_size;
+
+    for (i=0;i<num_blocks;i+=run) {
+	if ((run = map_run(fs,inode_num,&inode,logical+i,&phys,MIN(num_blocks-i,max_run))) < 0) {
+	    ERROR("Unable to map logical block %lu\n", logical+i);
+	    return -1;
+	}
+
+	if (!phys) {
+	    if (write) {
+		ERROR("Logical block %lu has no backing block\n", logical+i);
+		return -1;
+	    }
+	    memset(buf+i*block_size,0,block_size);
+	    run = 1;
+	    continue;
+	}
+
+	DEBUG("blocks [%lu,%lu) at physical %u\n", logical+i, logical+i+run, phys);
+
+	if (write) {
+	    rc = nk_block_dev_write(fs->dev, (uint64_t)phys*dev_per_block, run*dev_per_block,
+				    buf+i*block_size, NK_DEV_REQ_BLOCKING, 0, 0);
+	} else {
+	    rc = nk_block_dev_read(fs->dev, (uint64_t)phys*dev_per_block, run*dev_per_block,
+				   buf+i*block_size, NK_DEV_REQ_BLOCKING, 0, 0);
+	}
+
+	if (rc) {
+	    ERROR("Failed to %s physical blocks %u-%lu\n", rw[write], phys, phys+run-1);
+	    return i ? MIN(i*block_size,result) : -1;
+	}
+    }
+
+    return result;
+}
+
+static ssize_t ext2_read_uncached(void *state, void *file, void *buf, off_t offset, size_t num_bytes)
+{
+    return ext2_rw_uncached(state,file,buf,offset,num_bytes,0);
+}
+
+static ssize_t ext2_write_uncached(void *state, void *file, void *buf, off_t offset, size_t num_bytes)
+{
+    return ext2_rw_uncached(state,file,buf,offset,num_bytes,1);
+}
+
+static ssize_t ext2_read_direct(void *state, void *file, off_t offset, size_t num_bytes, void **ptr)
+{
+    struct ext2_state *fs = (struct ext2_state *)state;
+    uint64_t block_size = get_block_size(fs);
+    uint32_t inode_num = (uint32_t)(uint64_t)file;
+    struct ext2_inode inode;
+    size_t file_size_bytes;
+    uint32_t logical_block, physical_block;
+    uint8_t *base;
+    size_t avail;
+    sint64_t run;
+
+    DEBUG("direct read of inode %u %lu bytes at offset %lu\n", inode_num, num_bytes, offset);
+
+    if (read_inode(fs,inode_num,&inode)) { 
+	ERROR("Failed to read inode %u\n",inode_num);
+	return -1;
+    }
+
+    file_size_bytes = get_file_size(fs,&inode);
+
+    if (offset>=file_size_bytes) {
+	return 0;
+    }
+
+    num_bytes = MIN(file_size_bytes-offset,num_bytes);
+    logical_block = FLOOR_DIV(offset,block_size);
+
+    run = map_run(fs,inode_num,&inode,logical_block,&physical_block,
+		  CEIL_DIV(offset%block_size+num_bytes,block_size));
+
+    if (run < 0) { 
+	ERROR("Unable to map logical block %u\n", logical_block);
+	return -1;
+    }
+
+    if (!physical_block || !(base = direct_block(fs,physical_block))) {
+	return -1;
+    }
+
+    // extend across blocks that are adjacent both on disk and in memory
+    avail = block_size - offset%block_size;
+    while (--run > 0 && direct_block(fs,physical_block+1) == base + avail + offset%block_size) {
+	physical_block++;
+	avail += block_size;
+    }
+
+    *ptr = base + offset%block_size;
+
+    return MIN(avail,num_bytes);
+}
+
 
 /*
 static uint16_t dentry_find_len(struct ext2_dir_entry_2 *dentry) 
@@ -628,6 +1171,8 @@ static uint16_t dentry_find_len(struct ext2_dir_entry_2 *dentry)
 */
 
 
+#include "ext2_htree.c"
+
 static int dentry_get_put_del(struct ext2_state      *fs,
 			      uint32_t                inode_num,
 			      struct ext2_inode       *their_inode,
@@ -637,13 +1182,12 @@ static int dentry_get_put_del(struct ext2_state      *fs,
     struct ext2_inode our_inode;
     struct ext2_inode *inode;
     uint64_t block_size = get_block_size(fs);
-    uint32_t num_sects;
     uint32_t num_blocks;
     uint32_t logical_block;
     uint32_t physical_block;
     uint8_t buf[block_size];
     struct ext2_dir_entry_2 *de, *pde;
-    uint32_t dl;
+    int rc;
 
     DEBUG("dentry_get_put_del(%s, fs=%s, inode=%u, name=%s)\n",
 	  op==GET ? "GET" : op==PUT ? "PUT" : "DEL",
@@ -658,88 +1202,97 @@ static int dentry_get_put_del(struct ext2_state      *fs,
     } else {
 	inode = their_inode;
     }
+
+    // indexed directories go through the index when possible
+    if (dx_indexed(inode)) {
+	if (op==GET || op==DEL_BY_NAME) {
+	    if ((rc = dx_find(fs,inode_num,inode,dentry,op==DEL_BY_NAME)) != -2) {
+		return rc;
+	    }
+	    // otherwise a linear scan still works
+	} else if (op==PUT) {
+	    if (dx_enabled(fs) && (rc = dx_insert(fs,inode_num,inode,dentry,DX_TRIES)) != -2) {
+		return rc;
+	    }
+	    // a linear insert would not respect the index
+	    if (dx_drop(fs,inode_num,inode)) {
+		return -1;
+	    }
+	}
+    }
     
-    // i_blocks counts in sectors, not fs blocks....
-    num_sects = inode->i_blocks;
-    num_blocks = CEIL_DIV(num_sects,block_size);
+    // the size, not i_blocks, says how many blocks the directory has
+    num_blocks = get_file_size(fs,inode)/block_size;
 
-    DEBUG("Directory has %u sectors / %u blocks\n",num_sects, num_blocks);
+    DEBUG("Directory has %u blocks\n", num_blocks);
 
     for (logical_block=0;logical_block<num_blocks;logical_block++) {
-	DEBUG("Scanning directory logical block %lu\n",logical_block);
+	DEBUG("Scanning directory logical block %u\n",logical_block);
 	if (map_logical_to_physical_get(fs,inode_num,inode,logical_block,&physical_block)) { 
 	    ERROR("Unable to map directory block %u\n",logical_block);
 	    return -1;
 	}
-	DEBUG("Scanning directory physical block %lu\n",physical_block);
+	DEBUG("Scanning directory physical block %u\n",physical_block);
 	if (read_block(fs,physical_block,buf)) {
 	    ERROR("Unable to read directory block %u (%u)\n",logical_block,physical_block);
 	    return -1;
 	}
-	// now scan block for name or for space
-	uint32_t left=block_size;
+
+	if (op==PUT) {
+	    // a blank entry or the slack after a live one
+	    if (!dirent_insert(buf,block_size,dentry)) {
+		if (write_block(fs,physical_block,buf)) {
+		    ERROR("Cannot write updated directory block\n");
+		    return -1;
+		} else {
+		    return 0;
+		}
+	    }
+	    continue;
+	}
+
+	// now scan block for name
 	uint32_t offset;
 
 	for (offset=0, pde=0; offset<block_size; offset+=de->rec_len, pde=de) { 
 	    de = (struct ext2_dir_entry_2 *)&buf[offset];
-	    if (!de->inode) { 
-		//blank entry - perhaps its big enough for us
-		if (op==PUT) { 
-		    if (dentry->rec_len<=de->rec_len) {
-			uint16_t old_rec_len = de->rec_len;
-			// will fit here
-			*de = *dentry;
-			if ((old_rec_len - de->rec_len) >= 12) {
-			    // split
+	    if (!dirent_ok(de,offset,block_size)) {
+		ERROR("Corrupt entry in directory block %u\n",logical_block);
+		return -1;
+	    }
+	    if (de->inode) { 
+		if (((op==GET || op==DEL_BY_NAME) 
+		     && de->name_len==dentry->name_len && !strncmp(de->name,dentry->name,de->name_len))
+		    || ((op==DEL_BY_INODE) && de->inode==dentry->inode)) {
+
+		    // found it
+		    if (op==GET) { 
+			memcpy(dentry,de,8+de->name_len);
+			return 0;
+		    } else {
+			// DEL by either
+			de->inode=0;
+			if ((offset+de->rec_len)<block_size) { 
+			    // possible to merge with next
 			    struct ext2_dir_entry_2 *nde = (struct ext2_dir_entry_2 *)&buf[offset+de->rec_len];
-			    nde->inode = 0;
-			    nde->rec_len = old_rec_len - de->rec_len;
-			} else {
-			    de->rec_len = old_rec_len;
+			    if (!nde->inode) { 
+				// merge next
+				de->rec_len+=nde->rec_len;
+			    }
 			}
-			if (write_block(fs,physical_block,buf)) {
-			    ERROR("Cannot write updated directory block\n");
+			if (pde) { 
+			    // merge prev, its slack absorbs us
+			    pde->rec_len+=de->rec_len;
+			}
+			if (write_block(fs,physical_block,buf)) { 
+			    ERROR("Cannot write updated directory block after del\n");
 			    return -1;
 			} else {
+			    // we should free the block here and update the inode 
+			    // if there are now no non-empty entries on it.
 			    return 0;
 			}
 		    }
-		} 
-	    } else {
-		if (op==GET || op==DEL_BY_NAME || op==DEL_BY_INODE) { 
-		    if (((op==GET || op==DEL_BY_NAME) 
-			 && de->name_len==dentry->name_len && !strncmp(de->name,dentry->name,de->name_len))
-			|| ((op==DEL_BY_INODE) && de->inode==dentry->inode)) {
-
-			// found it
-			if (op==GET) { 
-			    *dentry = *de;
-			    return 0;
-			} else {
-			    // DEL by either
-			    de->inode=0;
-			    if ((offset+de->rec_len)<block_size) { 
-				// possible to merge with next
-				struct ext2_dir_entry_2 *nde = (struct ext2_dir_entry_2 *)&buf[offset+de->rec_len];
-				if (!nde->inode) { 
-				    // merge next
-				    de->rec_len+=nde->rec_len;
-				}
-			    }
-			    if (pde && !pde->inode) { 
-				// merge prev
-				pde->rec_len+=de->rec_len;
-			    }
-			    if (write_block(fs,physical_block,buf)) { 
-				ERROR("Cannot write updated directory block after del\n");
-				return -1;
-			    } else {
-				// we should free the block here and update the inode 
-				// if there are now no non-empty entries on it.
-				return 0;
-			    }
-			}
-		    }
 		}
 	    }
 	}
@@ -749,28 +1302,27 @@ static int dentry_get_put_del(struct ext2_state      *fs,
     if (op!=PUT) { 
 	return -1;
     }
+
+    // a directory about to outgrow DX_MIN_BLOCKS gets an index instead
+    if (dx_enabled(fs) && num_blocks >= DX_MIN_BLOCKS && !dx_build(fs,inode_num,inode)) {
+	if ((rc = dx_insert(fs,inode_num,inode,dentry,DX_TRIES)) != -2) {
+	    return rc;
+	}
+	if (dx_drop(fs,inode_num,inode)) {
+	    return -1;
+	}
+    }
     
     // We are now in an add, so we need allocate new block and put
     // the record into it, followed by an empty record
     //
-    if (alloc_block(fs,&physical_block)) { 
-	ERROR("Unable to allocate block in put\n");
-	return -1;
-    }
-    
     memset(buf,0,sizeof(buf));
     de = (struct ext2_dir_entry_2 *)&buf[0];
-    *de = *dentry;
-    de = (struct ext2_dir_entry_2 *)&buf[dentry->rec_len];
-    de->rec_len = block_size-dentry->rec_len;
-    
-    if (write_block(fs,physical_block,buf)) { 
-	ERROR("Unable to write new block in put\n");
-	return -1;
-    }
-    
-    if (map_logical_to_physical_put(fs,inode_num,inode,logical_block,physical_block)) { 
-	ERROR("Unable to map new directory block %u\n",logical_block);
+    de->rec_len = block_size;
+    dirent_insert(buf,block_size,dentry);
+
+    if (dir_append_block(fs,inode_num,inode,buf,&logical_block)) {
+	ERROR("Unable to add block to directory\n");
 	return -1;
     }
     
@@ -867,17 +1419,18 @@ static int dentry_add(struct ext2_state *fs,
     */
 }
 
-static int dentry_remove(struct ext2_state *fs, int dir_inum, int target_inum) 
+static int dentry_remove(struct ext2_state *fs, int dir_inum, int target_inum, char *name) 
 {
     struct ext2_dir_entry_2 de;
 
+    // by name, which an indexed directory can find quickly
     de.inode = target_inum;
-    strcpy(de.name,"");
-    de.name_len=strlen("");
+    strcpy(de.name,name);
+    de.name_len=strlen(name);
     de.file_type = 0;
     de.rec_len = EXT2_DIR_REC_LEN(de.name_len);
     
-    return dentry_del_by_inode(fs,dir_inum,0,&de);
+    return dentry_del_by_name(fs,dir_inum,0,&de);
 
     /*
     ssize_t blocksize = get_block_size(fs);
@@ -1056,14 +1609,12 @@ static int dentry_get_put(struct ext2_state *fs, int dir_inum, int target_inum)
 // return new inode number; 0 if failed
 static void *ext2_create(void *state, char *path, int dir)
 {
-    char *fd[2] = {"file","dir"};
     struct ext2_state *fs = (struct ext2_state *) state;
     uint32_t inode_num;
-    struct ext2_inode inode;
 
     dir &= 0x1;
 
-    DEBUG("create %s %s on fs %s\n", fd[dir], path,fs->fs->name);
+    DEBUG("create %s %s on fs %s\n", dir ? "dir" : "file", path,fs->fs->name);
 
     // HERE HERE
 
@@ -1084,9 +1635,11 @@ static void *ext2_create(void *state, char *path, int dir)
 
     strcpy(dirname, path);
 
+    // cut at the last '/', leaving "" for an entry in the root
     for (int i=strlen(dirname); i>=0; i--) {
 	if (dirname[i]=='/') {
 	    dirname[i] = 0;
+	    break;
 	}
     }
 
@@ -1122,7 +1675,8 @@ static void *ext2_create(void *state, char *path, int dir)
     }
 
     //fill in inode with stuff
-    newinode.i_mode = dir ? EXT2_S_IFDIR : EXT2_S_IFREG;
+    newinode.i_mode = dir ? EXT2_S_IFDIR | 0755 : EXT2_S_IFREG | 0644;
+    newinode.i_links_count = dir ? 2 : 1;
     newinode.i_size = 0;
     //set bitmap to taken  // of what?
 
@@ -1134,13 +1688,43 @@ static void *ext2_create(void *state, char *path, int dir)
     
     free_split_path(parts,num_parts);
 
+    if (dir) {
+	struct ext2_inode parent;
+
+	// a directory starts with "." and "..", and the ".." is a
+	// link to the parent
+	if (dentry_add(fs, inode_num, inode_num, ".", EXT2_FT_DIR) ||
+	    dentry_add(fs, inode_num, dir_num, "..", EXT2_FT_DIR)) {
+	    ERROR("Cannot add . and .. to new directory\n");
+	    return 0;
+	}
+	if (read_inode(fs, dir_num, &parent)) {
+	    ERROR("Cannot read parent directory inode\n");
+	    return 0;
+	}
+	parent.i_links_count++;
+	if (write_inode(fs, dir_num, &parent)) {
+	    ERROR("Cannot write parent directory inode\n");
+	    return 0;
+	}
+	count_dir(fs, inode_num);
+    }
+
     return (void*)(uint64_t)inode_num;
 
 }
 
 static void *ext2_create_file(void *state, char *path)
 {
-    return ext2_create(state,path,0);
+    void *f = ext2_create(state,path,0);
+
+    // the new file is also open
+    if (f && icache_pin((struct ext2_state *)state,(uint32_t)(uint64_t)f)) {
+	ERROR("Cannot cache new inode\n");
+	return 0;
+    }
+
+    return f;
 }
 
 static int ext2_create_dir(void *state, char *path)
@@ -1201,9 +1785,11 @@ int ext2_remove(void *state, char *path)
 
     strcpy(dirname, path);
 
+    // cut at the last '/', leaving "" for an entry in the root
     for (int i=strlen(dirname); i>=0; i--) {
 	if (dirname[i]=='/') {
 	    dirname[i] = 0;
+	    break;
 	}
     }
 
@@ -1222,17 +1808,27 @@ int ext2_remove(void *state, char *path)
     }
 
     // remove dentry 
-    if (dentry_remove(fs, dir_num, inum)) { 
+    if (dentry_remove(fs, dir_num, inum, name)) { 
 	ERROR("Failed to remove directory entry\n");
+	free_split_path(parts,num_parts);
 	return -1;
     }
 
+    free_split_path(parts,num_parts);
+
     // truncate file
     if (ext2_truncate(fs, (void*)(uint64_t)inum, 0)) {
 	ERROR("Failed to truncate file during removal\n");
 	return -1;
     }
 
+    // there is no clock for i_dtime, so the inode is cleared instead
+    memset(&inode,0,sizeof(inode));
+    if (write_inode(fs,inum,&inode)) {
+	ERROR("Failed to clear inode during removal\n");
+	return -1;
+    }
+
     if (free_inode(fs, inum)) { 
 	ERROR("Failed to free inode during removal\n");
 	return -1;
@@ -1270,6 +1866,218 @@ static int ext2_stat_path(void *state, char *path, struct nk_fs_stat *st)
     return ext2_stat(state,(void*)(uint64_t)inum,st);
 }
 
+// Directory cursors walk the directory's blocks once, in logical order,
+// reading each block (or using it in place on a memory-backed device)
+// and stepping through its entries by rec_len.
+struct ext2_dir {
+    uint32_t          inode_num;
+    struct ext2_inode inode;
+    uint32_t          num_blocks;
+    uint32_t          logical_block;
+    uint32_t          offset;       // of the next entry in the current block
+    uint8_t          *data;         // current block, 0 if not loaded
+    uint8_t           buf[0];       // block_size bytes, if needed
+};
+
+static void *ext2_opendir(void *state, char *path)
+{
+    struct ext2_state *fs = (struct ext2_state *)state;
+    uint32_t block_size = get_block_size(fs);
+    uint32_t inum = get_inode_num_by_path(fs,path);
+    struct ext2_dir *d;
+
+    if (!inum) {
+	DEBUG("Nonexistent path %s during opendir\n",path);
+	return 0;
+    }
+
+    d = malloc(sizeof(*d)+block_size);
+
+    if (!d) {
+	ERROR("Cannot allocate directory cursor\n");
+	return 0;
+    }
+
+    memset(d,0,sizeof(*d));
+
+    if (read_inode(fs,inum,&d->inode)) {
+	ERROR("Failed to read inode during opendir\n");
+	free(d);
+	return 0;
+    }
+
+    if ((d->inode.i_mode & EXT2_S_IFMT)!=EXT2_S_IFDIR) {
+	DEBUG("%s is not a directory\n",path);
+	free(d);
+	return 0;
+    }
+
+    d->inode_num = inum;
+    d->num_blocks = CEIL_DIV(get_file_size(fs,&d->inode),block_size);
+
+    return d;
+}
+
+// returns the next live entry other than "." and "..", 0 at the end,
+// or (void*)-1 on error.  The entry is valid until the next call
+static struct ext2_dir_entry_2 *ext2_dir_next(struct ext2_state *fs, struct ext2_dir *d)
+{
+    uint32_t block_size = get_block_size(fs);
+    uint32_t physical_block;
+    struct ext2_dir_entry_2 *de;
+
+    while (d->logical_block < d->num_blocks) {
+	if (!d->data) {
+	    if (map_logical_to_physical_get(fs,d->inode_num,&d->inode,d->logical_block,&physical_block)) {
+		ERROR("Unable to map directory block %u\n",d->logical_block);
+		return (void*)-1;
+	    }
+	    if (!(d->data = direct_block(fs,physical_block))) {
+		if (read_block(fs,physical_block,d->buf)) {
+		    ERROR("Unable to read directory block %u (%u)\n",d->logical_block,physical_block);
+		    return (void*)-1;
+		}
+		d->data = d->buf;
+	    }
+	    d->offset = 0;
+	}
+
+	de = (struct ext2_dir_entry_2 *)(d->data + d->offset);
+
+	if (de->rec_len < 8 || d->offset + de->rec_len > block_size) {
+	    ERROR("Corrupt directory entry in block %u\n",d->logical_block);
+	    return (void*)-1;
+	}
+
+	d->offset += de->rec_len;
+	if (d->offset >= block_size) {
+	    d->logical_block++;
+	    d->data = 0;
+	}
+
+	if (de->inode &&
+	    !(de->name_len==1 && de->name[0]=='.') &&
+	    !(de->name_len==2 && de->name[0]=='.' && de->name[1]=='.')) {
+	    return de;
+	}
+    }
+
+    return 0;
+}
+
+static ssize_t ext2_readdir_batch(void *state, void *dir, struct nk_fs_dirent *ents, size_t n)
+{
+    struct ext2_state *fs = (struct ext2_state *)state;
+    struct ext2_dir_entry_2 *de;
+    struct ext2_inode inode;
+    size_t i, len;
+
+    for (i=0;i<n;i++) {
+	de = ext2_dir_next(fs,(struct ext2_dir *)dir);
+	if (!de) {
+	    break;
+	}
+	if (de==(void*)-1 || read_inode(fs,de->inode,&inode)) {
+	    return i ? i : -1;
+	}
+	len = MIN(de->name_len,NK_FS_DIRENT_NAME_LEN-1);
+	memcpy(ents[i].name,de->name,len);
+	ents[i].name[len] = 0;
+	ents[i].size = get_file_size(fs,&inode);
+	ents[i].attr = ((inode.i_mode & EXT2_S_IFMT)==EXT2_S_IFDIR ? NK_FS_ATTR_DIR : 0) |
+	    ((inode.i_mode & 0222) ? 0 : NK_FS_ATTR_READONLY) |
+	    (de->name[0]=='.' ? NK_FS_ATTR_HIDDEN : 0);
+    }
+
+    return i;
+}
+
+static void ext2_closedir(void *state, void *dir)
+{
+    free(dir);
+}
+
+// inodes are only read for the entries asked for
+static int ext2_stat_many(void *state, char *dir, char **names, int n, struct nk_fs_stat *st, int *rc)
+{
+    struct ext2_state *fs = (struct ext2_state *)state;
+    struct ext2_dir_entry_2 *de;
+    struct ext2_inode inode;
+    struct ext2_dir *d;
+    int i, found = 0, err = 0;
+
+    for (i=0;i<n;i++) {
+	rc[i] = -1;
+    }
+
+    if (!(d = ext2_opendir(state,dir))) {
+	return 0;
+    }
+
+    while (found<n && (de = ext2_dir_next(fs,d))) {
+	if (de==(void*)-1) {
+	    err = 1;
+	    break;
+	}
+	for (i=0;i<n;i++) {
+	    if (rc[i] && strlen(names[i])==de->name_len && !strncmp(names[i],de->name,de->name_len)) {
+		if (read_inode(fs,de->inode,&inode)) {
+		    ERROR("Failed to read inode during stat\n");
+		    continue;
+		}
+		st[i].st_size = get_file_size(fs,&inode);
+		rc[i] = 0;
+		found++;
+	    }
+	}
+    }
+
+    free(d);
+
+    return err && !found ? -1 : found;
+}
+
+
+// file data and directory blocks go to the device as they change; what
+// ext2 holds back is the inodes of open files in the inode cache, and
+// bitmaps, group descriptors and the superblock's free counts in fs->groups
+static int ext2_sync_file(void *state, void *file, int data_only)
+{
+    struct ext2_state *fs = (struct ext2_state *)state;
+
+    DEBUG("sync of inode %u on %s\n", (uint32_t)(uint64_t)file, fs->fs->name);
+
+    // the size is in the inode, so it is written back either way,
+    // along with the bitmaps the file's new blocks are recorded in
+    if (icache_sync(fs, (uint32_t)(uint64_t)file) || groups_sync(fs)) {
+        return -1;
+    }
+
+    if (nk_block_dev_flush(fs->dev, NK_DEV_REQ_BLOCKING, 0, 0)) {
+        ERROR("Failed to flush device\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+static int ext2_sync_fs(void *state)
+{
+    struct ext2_state *fs = (struct ext2_state *)state;
+
+    DEBUG("sync of %s\n", fs->fs->name);
+
+    if (icache_sync(fs, 0) || groups_sync(fs)) {
+        return -1;
+    }
+
+    if (nk_block_dev_flush(fs->dev, NK_DEV_REQ_BLOCKING, 0, 0)) {
+        ERROR("Failed to flush device\n");
+        return -1;
+    }
+
+    return 0;
+}
 
 static struct nk_fs_int ext2_inter = {
     .stat_path = ext2_stat_path,
@@ -1283,6 +2091,17 @@ static struct nk_fs_int ext2_inter = {
     .close_file = ext2_close,
     .read_file = ext2_read,
     .write_file = ext2_write,
+    .readv_file = ext2_readv,
+    .writev_file = ext2_writev,
+    .read_direct = ext2_read_direct,
+    .opendir = ext2_opendir,
+    .readdir_batch = ext2_readdir_batch,
+    .closedir = ext2_closedir,
+    .stat_many = ext2_stat_many,
+    .sync_file = ext2_sync_file,
+    .sync_fs = ext2_sync_fs,
+    .read_uncached = ext2_read_uncached,
+    .write_uncached = ext2_write_uncached,
 };
 
 
@@ -1305,6 +2124,7 @@ int nk_fs_ext2_attach(char *devname, char *fsname, int readonly)
     memset(s,0,sizeof(*s));
 
     s->dev = dev;
+    icache_init(s);
     
     if (nk_block_dev_get_characteristics(dev,&s->chars)) { 
 	ERROR("Cannot get characteristics of device %s\n", devname);
@@ -1321,15 +2141,24 @@ int nk_fs_ext2_attach(char *devname, char *fsname, int readonly)
 	free(s);
 	return -1;
     }
+
+    if (groups_load(s)) {
+	ERROR("Cannot read block groups for fs %s on device %s\n", fsname, devname);
+	free(s);
+	return -1;
+    }
     
     s->fs = nk_fs_register(fsname, flags, &ext2_inter, s);
 
     if (!s->fs) { 
 	ERROR("Unable to register filesystem %s\n", fsname);
+	groups_deinit(s);
 	free(s);
 	return -1;
     }
 
+    nk_block_dev_attach(s->dev);
+
     INFO("filesystem %s on device %s is attached (%s)\n", fsname, devname, readonly ?  "readonly" : "read/write");
     
     return 0;
@@ -1338,11 +2167,26 @@ int nk_fs_ext2_attach(char *devname, char *fsname, int readonly)
 int nk_fs_ext2_detach(char *fsname)
 {
     struct nk_fs *fs = nk_fs_find(fsname);
+    struct ext2_state *s;
+
     if (!fs) { 
 	return -1;
-    } else {
-	return nk_fs_unregister(fs);
     }
+
+    s = (struct ext2_state *)fs->state;
+
+    if (nk_fs_unregister(fs)) {
+	return -1;
+    }
+
+    nk_block_dev_detach(s->dev);
+
+    if (icache_deinit(s)) {
+	groups_deinit(s);
+	return -1;
+    }
+
+    return groups_deinit(s);
 }
 
 /*
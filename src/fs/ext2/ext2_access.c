@@ -71,7 +71,7 @@ static int read_write_superblock(struct ext2_state *fs, int write)
     uint64_t dev_num    = FLOOR_DIV(SUPERBLOCK_SIZE,fs->chars.block_size);
     int rc;
 
-    DEBUG("%sing superblock (offset=%u, size=%u) on fs %s, bs=%u, dev_off=%lu, dev_num=%lu\n",
+    DEBUG("%sing superblock (offset=%u, size=%u) on fs %s, bs=%lu, dev_off=%lu, dev_num=%lu\n",
 	  rw[write], SUPERBLOCK_OFFSET, SUPERBLOCK_SIZE, fs->fs->name, fs->chars.block_size, dev_offset, dev_num);
 
     if (write) { 
@@ -122,7 +122,7 @@ static int read_write_block(struct ext2_state * fs, uint32_t block_num, void *sr
     }
     
     if (rc) { 
-	ERROR("Failed to %s block %lu due to device error\n",rw[write],block_num);
+	ERROR("Failed to %s block %u due to device error\n",rw[write],block_num);
 	return -1;
     }
 
@@ -133,87 +133,464 @@ static int read_write_block(struct ext2_state * fs, uint32_t block_num, void *sr
 #define read_block(fs,block_num,dest)  read_write_block(fs,block_num,dest,0)
 #define write_block(fs,block_num,src)  read_write_block(fs,block_num,src,1)
 
+/*
+ * returns a pointer to the device's own copy of the block if the
+ * device is memory-backed, which lets a reader copy out just the bytes it
+ * needs instead of staging the whole block.  The memory is read-only.
+ * returns 0 if the caller must use read_block instead
+ */
+static void *direct_block(struct ext2_state *fs, uint32_t block_num)
+{
+    uint32_t block_size = get_block_size(fs);
+    uint64_t dev_offset = FLOOR_DIV((uint64_t)block_num*block_size,fs->chars.block_size);
+    uint64_t dev_num    = FLOOR_DIV(block_size,fs->chars.block_size);
+    void *ptr;
+
+    if (nk_block_dev_direct_access(fs->dev,dev_offset,dev_num,&ptr)) {
+	return 0;
+    }
+
+    return ptr;
+}
+
 
 #define blocks_per_group(sb) ((sb)->s_blocks_per_group)
 #define inodes_per_group(sb) ((sb)->s_inodes_per_group)
-#define num_block_groups(sb) ((sb)->s_blocks_count/(sb)->s_blocks_per_group)
+#define num_block_groups(sb) CEIL_DIV((sb)->s_blocks_count-(sb)->s_first_data_block,(sb)->s_blocks_per_group)
+
 /*
- * reads/writes the requested block_group descriptor
- * only the first block group descriptor table is read/written
+ * Block groups
+ *
+ * The group descriptors are read once at attach and kept in
+ * fs->groups, along with each group's block and inode bitmaps once they
+ * are first needed.  Allocation and freeing work on these copies and
+ * keep the free counts in the descriptors and superblock up to date;
+ * groups_sync writes back whatever has changed, and whatever it fails
+ * to write stays dirty for the next sync.  Only the primary
+ * superblock and descriptor table are written.
  */
-static int read_write_block_group(struct ext2_state* fs, uint32_t block_group_num, struct ext2_group_desc *srcdest, int write) 
+struct ext2_group {
+    struct ext2_group_desc desc;
+    uint8_t               *bitmap[2];     // blocks, inodes; 0 until used
+    uint8_t                bitmap_dirty[2];
+    uint8_t                desc_dirty;
+};
+
+#define BLOCK_BITMAP 0
+#define INODE_BITMAP 1
+
+#define ALLOC_LOCK_CONF uint8_t _alloc_lock_flags
+#define ALLOC_LOCK(fs) _alloc_lock_flags = spin_lock_irq_save(&(fs)->alloc_lock)
+#define ALLOC_UNLOCK(fs) spin_unlock_irq_restore(&(fs)->alloc_lock, _alloc_lock_flags);
+
+// the descriptor table starts in the block after the superblock
+static uint32_t group_desc_block(struct ext2_state *fs)
 {
-    uint64_t block_num;
-    uint64_t offset;
-    uint32_t block_size;
-    uint64_t desc_per_block;
+    return fs->super.s_first_data_block + 1;
+}
 
-    write &= 0x1;
+static int groups_load(struct ext2_state *fs)
+{
+    uint32_t block_size = get_block_size(fs);
+    uint32_t desc_per_block = block_size/sizeof(struct ext2_group_desc);
+    uint8_t buf[block_size];
+    struct ext2_group_desc *d = (struct ext2_group_desc *)buf;
+    uint32_t i;
 
-    DEBUG("%s block group fs %s bgn=%u\n", rw[write], fs->fs->name, block_group_num);
+    spinlock_init(&fs->alloc_lock);
 
-    block_size = get_block_size(fs);
-    block_num = FLOOR_DIV(SUPERBLOCK_OFFSET+SUPERBLOCK_SIZE,block_size);
-    desc_per_block = block_size/sizeof(struct ext2_group_desc);
-    block_num += block_group_num/desc_per_block;
-    offset = block_group_num%desc_per_block;
+    fs->num_groups = num_block_groups(&fs->super);
+    fs->groups = malloc(fs->num_groups*sizeof(struct ext2_group));
 
-    DEBUG("%sing block group descriptor %u (block_num=%u) on fs %s\n",
-	  rw[write], block_group_num, block_num, fs->fs->name);
-    
+    if (!fs->groups) {
+	ERROR("Cannot allocate %u block groups\n", fs->num_groups);
+	return -1;
+    }
+
+    memset(fs->groups, 0, fs->num_groups*sizeof(struct ext2_group));
+
+    for (i=0;i<fs->num_groups;i++) {
+	if (!(i % desc_per_block) && read_block(fs, group_desc_block(fs) + i/desc_per_block, buf)) {
+	    ERROR("Cannot read block group descriptors\n");
+	    free(fs->groups);
+	    fs->groups = 0;
+	    return -1;
+	}
+	fs->groups[i].desc = d[i % desc_per_block];
+    }
+
+    DEBUG("%u block groups, %u free blocks, %u free inodes\n",
+	  fs->num_groups, fs->super.s_free_blocks_count, fs->super.s_free_inodes_count);
+
+    return 0;
+}
+
+// returns group g's bitmap, reading it in if need be
+static uint8_t *group_bitmap(struct ext2_state *fs, uint32_t g, int which)
+{
+    uint32_t block_size = get_block_size(fs);
+    struct ext2_group *grp = &fs->groups[g];
+    uint8_t *bitmap;
+    ALLOC_LOCK_CONF;
+
+    if ((bitmap = grp->bitmap[which])) {
+	return bitmap;
+    }
+
+    if (!(bitmap = malloc(block_size))) {
+	ERROR("Cannot allocate bitmap of block group %u\n", g);
+	return 0;
+    }
+
+    if (read_block(fs, which==BLOCK_BITMAP ? grp->desc.bg_block_bitmap : grp->desc.bg_inode_bitmap, bitmap)) {
+	ERROR("Cannot read bitmap of block group %u\n", g);
+	free(bitmap);
+	return 0;
+    }
+
+    ALLOC_LOCK(fs);
+    if (!grp->bitmap[which]) {
+	grp->bitmap[which] = bitmap;
+	bitmap = 0;
+    }
+    ALLOC_UNLOCK(fs);
+
+    free(bitmap);
+
+    return grp->bitmap[which];
+}
+
+static int groups_sync(struct ext2_state *fs)
+{
+    uint32_t block_size = get_block_size(fs);
+    uint32_t desc_per_block = block_size/sizeof(struct ext2_group_desc);
     uint8_t buf[block_size];
     struct ext2_group_desc *d = (struct ext2_group_desc *)buf;
+    uint32_t i, j, first;
+    int which, dirty, super_dirty;
+    ALLOC_LOCK_CONF;
+
+    for (i=0;i<fs->num_groups;i++) {
+	for (which=BLOCK_BITMAP;which<=INODE_BITMAP;which++) {
+	    ALLOC_LOCK(fs);
+	    if ((dirty = fs->groups[i].bitmap_dirty[which])) {
+		memcpy(buf, fs->groups[i].bitmap[which], block_size);
+		fs->groups[i].bitmap_dirty[which] = 0;
+	    }
+	    ALLOC_UNLOCK(fs);
+	    if (dirty && write_block(fs, which==BLOCK_BITMAP ? fs->groups[i].desc.bg_block_bitmap :
+				     fs->groups[i].desc.bg_inode_bitmap, buf)) {
+		ERROR("Cannot write bitmap of block group %u\n", i);
+		ALLOC_LOCK(fs);
+		fs->groups[i].bitmap_dirty[which] = 1;
+		ALLOC_UNLOCK(fs);
+		return -1;
+	    }
+	}
+    }
+
+    // descriptors go back a table block at a time
+    for (first=0;first<fs->num_groups;first+=desc_per_block) {
+	memset(buf, 0, block_size);
+	dirty = 0;
+	ALLOC_LOCK(fs);
+	for (j=0;j<desc_per_block && first+j<fs->num_groups;j++) {
+	    d[j] = fs->groups[first+j].desc;
+	    dirty |= fs->groups[first+j].desc_dirty;
+	    fs->groups[first+j].desc_dirty = 0;
+	}
+	ALLOC_UNLOCK(fs);
+	if (dirty && write_block(fs, group_desc_block(fs) + first/desc_per_block, buf)) {
+	    ERROR("Cannot write block group descriptors\n");
+	    // the whole table block is written again next time
+	    ALLOC_LOCK(fs);
+	    fs->groups[first].desc_dirty = 1;
+	    ALLOC_UNLOCK(fs);
+	    return -1;
+	}
+    }
+
+    ALLOC_LOCK(fs);
+    super_dirty = fs->super_dirty;
+    fs->super_dirty = 0;
+    ALLOC_UNLOCK(fs);
 
-    if (read_block(fs,block_num,buf)) { 
-	ERROR("Cannot read block group\n");
+    if (super_dirty && write_superblock(fs)) {
+	ALLOC_LOCK(fs);
+	fs->super_dirty = 1;
+	ALLOC_UNLOCK(fs);
 	return -1;
-    } 
+    }
 
-    if (write) { 
-	d[offset] = *srcdest;
-	if (write_block(fs,block_num,buf)) { 
-	    ERROR("Cannot write block group\n");
+    return 0;
+}
+
+static int groups_deinit(struct ext2_state *fs)
+{
+    int rc = groups_sync(fs);
+    uint32_t i;
+
+    for (i=0;i<fs->num_groups;i++) {
+	free(fs->groups[i].bitmap[BLOCK_BITMAP]);
+	free(fs->groups[i].bitmap[INODE_BITMAP]);
+    }
+
+    free(fs->groups);
+    fs->groups = 0;
+
+    return rc;
+}
+
+#define test_bit(bitmap,i)  ((bitmap)[(i)/8] & (1<<((i)%8)))
+#define set_bit(bitmap,i)   ((bitmap)[(i)/8] |= (1<<((i)%8)))
+#define clear_bit(bitmap,i) ((bitmap)[(i)/8] &= ~(1<<((i)%8)))
+
+// the first clear bit in [start,end), or end if there is none
+// whole 64 bit words are checked at a time
+static uint32_t find_clear_bit(uint8_t *bitmap, uint32_t start, uint32_t end)
+{
+    uint64_t *w = (uint64_t *)bitmap;
+    uint64_t word;
+    uint32_t i = start;
+
+    while (i < end) {
+	word = ~w[i/64] & (~0ULL << (i%64));
+	if (word) {
+	    i = (i & ~63) + __builtin_ctzll(word);
+	    return MIN(i, end);
+	}
+	i = (i & ~63) + 64;
+    }
+
+    return end;
+}
+
+static uint32_t group_num_blocks(struct ext2_state *fs, uint32_t g)
+{
+    uint64_t first = fs->super.s_first_data_block + (uint64_t)g*blocks_per_group(&fs->super);
+
+    return MIN(blocks_per_group(&fs->super), fs->super.s_blocks_count - first);
+}
+
+/*
+ * allocates a run of up to max free blocks, starting as close after
+ * goal as possible (0 meaning anywhere).  Groups with nothing free are
+ * skipped by their free counts.  Returns the length of the run, with
+ * the first block in *start, or -1 if the filesystem is full
+ */
+static sint64_t alloc_blocks(struct ext2_state *fs, uint32_t goal, uint32_t max, uint32_t *start)
+{
+    uint32_t bpg = blocks_per_group(&fs->super);
+    uint32_t g0, bit0, g, bit, limit, n, k;
+    uint8_t *bitmap;
+    ALLOC_LOCK_CONF;
+
+    if (goal < fs->super.s_first_data_block || goal >= fs->super.s_blocks_count) {
+	goal = fs->alloc_rotor;
+    }
+    if (goal < fs->super.s_first_data_block || goal >= fs->super.s_blocks_count) {
+	goal = fs->super.s_first_data_block;
+    }
+
+    g0 = (goal - fs->super.s_first_data_block)/bpg;
+    bit0 = (goal - fs->super.s_first_data_block)%bpg;
+
+    // the goal group from the goal on, then the others, then the
+    // beginning of the goal group
+    for (k=0;k<=fs->num_groups;k++) {
+	g = (g0+k) % fs->num_groups;
+
+	if (!fs->groups[g].desc.bg_free_blocks_count) {
+	    continue;
+	}
+
+	if (!(bitmap = group_bitmap(fs, g, BLOCK_BITMAP))) {
 	    return -1;
-	} else {
-	    return 0;
 	}
-	// TODO: update shadow copies
-    } else {
-	*srcdest = d[offset];
+
+	limit = group_num_blocks(fs, g);
+
+	ALLOC_LOCK(fs);
+	bit = find_clear_bit(bitmap, k ? 0 : bit0, k==fs->num_groups ? bit0 : limit);
+	if (bit < (k==fs->num_groups ? bit0 : limit)) {
+	    for (n=0; n<max && bit+n<limit && !test_bit(bitmap,bit+n); n++) {
+		set_bit(bitmap,bit+n);
+	    }
+	    fs->groups[g].desc.bg_free_blocks_count -= MIN(n, fs->groups[g].desc.bg_free_blocks_count);
+	    fs->groups[g].desc_dirty = 1;
+	    fs->groups[g].bitmap_dirty[BLOCK_BITMAP] = 1;
+	    fs->super.s_free_blocks_count -= MIN(n, fs->super.s_free_blocks_count);
+	    fs->super_dirty = 1;
+	    *start = fs->super.s_first_data_block + g*bpg + bit;
+	    fs->alloc_rotor = *start + n;
+	    ALLOC_UNLOCK(fs);
+	    DEBUG("allocated blocks %u-%u (goal %u)\n", *start, *start+n-1, goal);
+	    return n;
+	}
+	ALLOC_UNLOCK(fs);
+    }
+
+    ERROR("No free blocks\n");
+
+    return -1;
+}
+
+static int free_blocks(struct ext2_state *fs, uint32_t start, uint32_t n)
+{
+    uint32_t bpg = blocks_per_group(&fs->super);
+    uint32_t g, bit, i;
+    uint8_t *bitmap;
+    ALLOC_LOCK_CONF;
+
+    for (i=0;i<n;i++) {
+	if (start+i < fs->super.s_first_data_block || start+i >= fs->super.s_blocks_count) {
+	    ERROR("Cannot free block %u outside the filesystem\n", start+i);
+	    return -1;
+	}
+
+	g = (start + i - fs->super.s_first_data_block)/bpg;
+	bit = (start + i - fs->super.s_first_data_block)%bpg;
+
+	if (!(bitmap = group_bitmap(fs, g, BLOCK_BITMAP))) {
+	    return -1;
+	}
+
+	ALLOC_LOCK(fs);
+	if (test_bit(bitmap,bit)) {
+	    clear_bit(bitmap,bit);
+	    fs->groups[g].desc.bg_free_blocks_count++;
+	    fs->groups[g].desc_dirty = 1;
+	    fs->groups[g].bitmap_dirty[BLOCK_BITMAP] = 1;
+	    fs->super.s_free_blocks_count++;
+	    fs->super_dirty = 1;
+	}
+	ALLOC_UNLOCK(fs);
+    }
+
+    return 0;
+}
+
+// *num is the goal on the way in
+static int alloc_block(struct ext2_state *fs, uint32_t *num)
+{
+    return alloc_blocks(fs, *num, 1, num) < 0 ? -1 : 0;
+}
+
+#define free_block(fs,num) free_blocks(fs,num,1)
+
+static int alloc_free_inode(struct ext2_state *fs, uint32_t *num, int free)
+{
+    uint32_t ipg = inodes_per_group(&fs->super);
+    uint32_t first = EXT2_FIRST_INO(&fs->super) - 1;
+    uint32_t g, bit;
+    uint8_t *bitmap;
+    ALLOC_LOCK_CONF;
+
+    if (free) {
+	if (*num < 1 || *num > fs->super.s_inodes_count) {
+	    ERROR("Cannot free nonexistent inode %u\n", *num);
+	    return -1;
+	}
+	g = (*num-1)/ipg;
+	bit = (*num-1)%ipg;
+	if (!(bitmap = group_bitmap(fs, g, INODE_BITMAP))) {
+	    return -1;
+	}
+	ALLOC_LOCK(fs);
+	if (test_bit(bitmap,bit)) {
+	    clear_bit(bitmap,bit);
+	    fs->groups[g].desc.bg_free_inodes_count++;
+	    fs->groups[g].desc_dirty = 1;
+	    fs->groups[g].bitmap_dirty[INODE_BITMAP] = 1;
+	    fs->super.s_free_inodes_count++;
+	    fs->super_dirty = 1;
+	}
+	ALLOC_UNLOCK(fs);
 	return 0;
     }
+
+    for (g=0;g<fs->num_groups;g++) {
+	if (!fs->groups[g].desc.bg_free_inodes_count) {
+	    continue;
+	}
+	if (!(bitmap = group_bitmap(fs, g, INODE_BITMAP))) {
+	    return -1;
+	}
+	ALLOC_LOCK(fs);
+	// the reserved inodes at the start of group 0 are never handed out
+	bit = find_clear_bit(bitmap, g ? 0 : MIN(first, ipg), ipg);
+	if (bit < ipg) {
+	    set_bit(bitmap,bit);
+	    fs->groups[g].desc.bg_free_inodes_count--;
+	    fs->groups[g].desc_dirty = 1;
+	    fs->groups[g].bitmap_dirty[INODE_BITMAP] = 1;
+	    fs->super.s_free_inodes_count -= MIN(1, fs->super.s_free_inodes_count);
+	    fs->super_dirty = 1;
+	    *num = g*ipg + bit + 1;
+	    ALLOC_UNLOCK(fs);
+	    return 0;
+	}
+	ALLOC_UNLOCK(fs);
+    }
+
+    ERROR("No free inodes\n");
+    *num = 0;
+
+    return -1;
 }
 
-#define read_block_group(fs,block_group_num,dest)  read_write_block_group(fs,block_group_num,dest,0)
-#define write_block_group(fs,block_group_num,src)  read_write_block_group(fs,block_group_num,src,1)
+#define alloc_inode(fs,num) alloc_free_inode(fs,num,0)
+
+// count a new directory in its group's descriptor
+static void count_dir(struct ext2_state *fs, uint32_t inode_num)
+{
+    uint32_t g = (inode_num-1)/inodes_per_group(&fs->super);
+    ALLOC_LOCK_CONF;
+
+    ALLOC_LOCK(fs);
+    fs->groups[g].desc.bg_used_dirs_count++;
+    fs->groups[g].desc_dirty = 1;
+    ALLOC_UNLOCK(fs);
+}
+#define free_inode(fs,num) alloc_free_inode(fs,&(num),1)
 
-static int read_write_inode(struct ext2_state *fs, uint32_t inode_num, struct ext2_inode *srcdest, int write) 
+static int read_write_inode_disk(struct ext2_state *fs, uint32_t inode_num, struct ext2_inode *srcdest, int write) 
 {
-    struct ext2_group_desc bg;
+    struct ext2_group_desc *bg;
     uint32_t inode_block;
     uint64_t inode_offset;
     uint32_t block_size = get_block_size(fs);
     uint64_t inodes_per_block = FLOOR_DIV(block_size,sizeof(struct ext2_inode));
+    uint32_t index = (inode_num - 1) % inodes_per_group(&fs->super);
     uint8_t buf[block_size];
     struct ext2_inode* inode_table = (struct ext2_inode *)buf;
 
     write &= 0x1;
 
-    if (read_block_group(fs,inode_num/inodes_per_group(&fs->super),&bg)) { 
-	ERROR("Cannot read block group\n");
+    if (!inode_num || (inode_num - 1)/inodes_per_group(&fs->super) >= fs->num_groups) { 
+	ERROR("Inode %u does not exist\n", inode_num);
 	return -1;
     }
 
+    bg = &fs->groups[(inode_num - 1)/inodes_per_group(&fs->super)].desc;
+
     DEBUG("block group:  bbitmap=%u ibitmap=%u, itable=%u\n", 
-	  bg.bg_block_bitmap, bg.bg_inode_bitmap, bg.bg_inode_table);
+	  bg->bg_block_bitmap, bg->bg_inode_bitmap, bg->bg_inode_table);
 
-    //get index into inode table
-    inode_block  = bg.bg_inode_table + FLOOR_DIV(inode_num - 1, inodes_per_block);
-    inode_offset = (inode_num - 1) % inodes_per_block;
+    //get index into the group's inode table
+    inode_block  = bg->bg_inode_table + FLOOR_DIV(index, inodes_per_block);
+    inode_offset = index % inodes_per_block;
 
-    DEBUG("%sing inode %u (block %u, offset %u) inode_size=%u  on fs %s\n", 
+    DEBUG("%sing inode %u (block %u, offset %lu) inode_size=%lu  on fs %s\n", 
 	  rw[write], inode_num, inode_block, inode_offset, sizeof(struct ext2_inode), fs->fs->name);
 
+    if (!write && (inode_table = direct_block(fs,inode_block))) {
+	*srcdest = inode_table[inode_offset];
+	return 0;
+    }
+
+    inode_table = (struct ext2_inode *)buf;
+
     //gets pointer to block where inodes are located 
     if (read_block(fs,inode_block,buf)) { 
 	ERROR("Cannot read inode block\n");
@@ -234,8 +611,578 @@ static int read_write_inode(struct ext2_state *fs, uint32_t inode_num, struct ex
     }
 }
 
-#define read_inode(fs,inode_num,dest)  read_write_inode(fs,inode_num,dest,0)
-#define write_inode(fs,inode_num,src)  read_write_inode(fs,inode_num,src,1)
+#define read_inode_disk(fs,inode_num,dest)  read_write_inode_disk(fs,inode_num,dest,0)
+#define write_inode_disk(fs,inode_num,src)  read_write_inode_disk(fs,inode_num,src,1)
+
+/*
+ * Inode cache
+ *
+ * Inodes are read and written through a hashed cache, most recently
+ * used first on the LRU list.  An open file pins its inode.  Updates to
+ * a pinned inode stay in the cache until the last open of it is closed
+ * or the filesystem is synced; updates to any other inode are written
+ * through.  Only clean, unpinned entries are dropped, so an inode whose
+ * write-back failed stays in the cache until a later sync succeeds.
+ */
+struct ext2_bmap;
+
+struct ext2_icache_ent {
+    struct ext2_icache_ent *next;     // hash chain
+    struct list_head        lru;
+    uint32_t                inode_num;
+    uint32_t                pins;
+    int                     dirty;
+    struct ext2_bmap       *bmap;     // only while pinned
+    uint32_t                pa_start; // preallocation window, only while pinned
+    uint32_t                pa_len;
+    struct ext2_inode       inode;
+};
+
+/*
+ * Block maps
+ *
+ * The cache entry of an open file also keeps the indirect blocks last
+ * used to map it, and the runs of logical blocks last found to be
+ * contiguous on disk.  Whoever writes one of the file's indirect blocks
+ * or changes its direct blocks calls bmap_update or bmap_forget so
+ * these stay current.
+ */
+#define BMAP_IND_SLOTS 4
+#define BMAP_RUNS      8
+
+struct ext2_bmap {
+    uint64_t   clock;
+    struct {
+	uint32_t  block;       // 0 if unused
+	uint64_t  used;
+	uint32_t *ptrs;
+    } ind[BMAP_IND_SLOTS];
+    struct {
+	uint32_t  logical;
+	uint32_t  physical;
+	uint32_t  len;         // 0 if unused
+    } runs[BMAP_RUNS];
+    uint32_t   next_run;
+};
+
+static void bmap_free(struct ext2_bmap *b)
+{
+    int i;
+
+    if (!b) {
+	return;
+    }
+
+    for (i=0;i<BMAP_IND_SLOTS;i++) {
+	free(b->ind[i].ptrs);
+    }
+
+    free(b);
+}
+
+#define ICACHE_LOCK_CONF uint8_t _icache_lock_flags
+#define ICACHE_LOCK(fs) _icache_lock_flags = spin_lock_irq_save(&(fs)->icache_lock)
+#define ICACHE_UNLOCK(fs) spin_unlock_irq_restore(&(fs)->icache_lock, _icache_lock_flags);
+
+static void icache_init(struct ext2_state *fs)
+{
+    spinlock_init(&fs->icache_lock);
+    INIT_LIST_HEAD(&fs->icache_lru);
+}
+
+// caller holds the cache lock
+static struct ext2_icache_ent *icache_find(struct ext2_state *fs, uint32_t inode_num)
+{
+    struct ext2_icache_ent *e;
+
+    for (e = fs->icache[inode_num % EXT2_ICACHE_BUCKETS]; e; e = e->next) {
+	if (e->inode_num == inode_num) {
+	    return e;
+	}
+    }
+
+    return 0;
+}
+
+// caller holds the cache lock
+static void icache_unhash(struct ext2_state *fs, struct ext2_icache_ent *e)
+{
+    struct ext2_icache_ent **p;
+
+    for (p = &fs->icache[e->inode_num % EXT2_ICACHE_BUCKETS]; *p != e; p = &(*p)->next) {
+    }
+
+    *p = e->next;
+    list_del(&e->lru);
+    fs->icache_count--;
+}
+
+// adds an entry for an inode just read from or written to disk
+// unless one appeared in the meantime; returns the entry
+// caller holds the cache lock and passes in a fresh entry, which
+// is consumed or freed
+static struct ext2_icache_ent *icache_insert(struct ext2_state *fs, struct ext2_icache_ent *n)
+{
+    struct ext2_icache_ent *e;
+
+    if ((e = icache_find(fs, n->inode_num))) {
+	free(n);
+	return e;
+    }
+
+    // the least recently used clean, unpinned entry makes room
+    if (fs->icache_count >= EXT2_ICACHE_MAX) {
+	list_for_each_entry_reverse(e, &fs->icache_lru, lru) {
+	    if (!e->pins && !e->dirty) {
+		icache_unhash(fs, e);
+		bmap_free(e->bmap);
+		free(e);
+		break;
+	    }
+	}
+    }
+
+    n->next = fs->icache[n->inode_num % EXT2_ICACHE_BUCKETS];
+    fs->icache[n->inode_num % EXT2_ICACHE_BUCKETS] = n;
+    list_add(&n->lru, &fs->icache_lru);
+    fs->icache_count++;
+
+    return n;
+}
+
+static int icache_read(struct ext2_state *fs, uint32_t inode_num, struct ext2_inode *dest, int pin)
+{
+    struct ext2_icache_ent *e, *n;
+    ICACHE_LOCK_CONF;
+
+    ICACHE_LOCK(fs);
+    if ((e = icache_find(fs, inode_num))) {
+	list_move(&e->lru, &fs->icache_lru);
+	*dest = e->inode;
+	e->pins += pin;
+	ICACHE_UNLOCK(fs);
+	return 0;
+    }
+    ICACHE_UNLOCK(fs);
+
+    if (read_inode_disk(fs, inode_num, dest)) {
+	return -1;
+    }
+
+    if (!(n = malloc(sizeof(*n)))) {
+	// the cache is an optimization, but pins must be tracked
+	return pin ? -1 : 0;
+    }
+
+    memset(n, 0, sizeof(*n));
+    n->inode_num = inode_num;
+    n->inode = *dest;
+
+    ICACHE_LOCK(fs);
+    e = icache_insert(fs, n);
+    *dest = e->inode;
+    e->pins += pin;
+    ICACHE_UNLOCK(fs);
+
+    return 0;
+}
+
+static int icache_write(struct ext2_state *fs, uint32_t inode_num, struct ext2_inode *src)
+{
+    struct ext2_icache_ent *e, *n;
+    ICACHE_LOCK_CONF;
+
+    ICACHE_LOCK(fs);
+    if ((e = icache_find(fs, inode_num))) {
+	list_move(&e->lru, &fs->icache_lru);
+	e->inode = *src;
+	if (e->pins) {
+	    e->dirty = 1;
+	    ICACHE_UNLOCK(fs);
+	    return 0;
+	}
+	ICACHE_UNLOCK(fs);
+	return write_inode_disk(fs, inode_num, src);
+    }
+    ICACHE_UNLOCK(fs);
+
+    if (write_inode_disk(fs, inode_num, src)) {
+	return -1;
+    }
+
+    if ((n = malloc(sizeof(*n)))) {
+	memset(n, 0, sizeof(*n));
+	n->inode_num = inode_num;
+	n->inode = *src;
+	ICACHE_LOCK(fs);
+	e = icache_insert(fs, n);
+	e->inode = *src;
+	ICACHE_UNLOCK(fs);
+    }
+
+    return 0;
+}
+
+#define read_inode(fs,inode_num,dest)  icache_read(fs,inode_num,dest,0)
+#define write_inode(fs,inode_num,src)  icache_write(fs,inode_num,src)
+
+static int icache_pin(struct ext2_state *fs, uint32_t inode_num)
+{
+    struct ext2_icache_ent *e;
+    struct ext2_inode inode;
+    struct ext2_bmap *b;
+    ICACHE_LOCK_CONF;
+
+    if (icache_read(fs, inode_num, &inode, 1)) {
+	return -1;
+    }
+
+    // open files also get a block map, if there is memory for one
+    if ((b = malloc(sizeof(*b)))) {
+	memset(b, 0, sizeof(*b));
+	ICACHE_LOCK(fs);
+	if ((e = icache_find(fs, inode_num)) && !e->bmap) {
+	    e->bmap = b;
+	    b = 0;
+	}
+	ICACHE_UNLOCK(fs);
+	free(b);
+    }
+
+    return 0;
+}
+
+// writes back dirty inodes - just inode_num's, or all of them if 0
+static int icache_sync(struct ext2_state *fs, uint32_t inode_num)
+{
+    struct ext2_icache_ent *e;
+    struct ext2_inode inode;
+    uint32_t num;
+    int rc;
+    ICACHE_LOCK_CONF;
+
+    while (1) {
+	num = 0;
+	ICACHE_LOCK(fs);
+	list_for_each_entry(e, &fs->icache_lru, lru) {
+	    if (e->dirty == 1 && (!inode_num || e->inode_num == inode_num)) {
+		num = e->inode_num;
+		inode = e->inode;
+		e->dirty = 2;  // being written; still not evictable
+		break;
+	    }
+	}
+	ICACHE_UNLOCK(fs);
+
+	if (!num) {
+	    return 0;
+	}
+
+	rc = write_inode_disk(fs, num, &inode);
+
+	// the entry is clean only if it was not updated during the write
+	ICACHE_LOCK(fs);
+	if ((e = icache_find(fs, num))) {
+	    e->dirty = rc || memcmp(&e->inode, &inode, sizeof(inode)) ? 1 : 0;
+	}
+	ICACHE_UNLOCK(fs);
+
+	if (rc) {
+	    ERROR("Failed to write back inode %u\n", num);
+	    return -1;
+	}
+    }
+}
+
+// the last unpin of a dirty inode writes it back
+static int icache_unpin(struct ext2_state *fs, uint32_t inode_num)
+{
+    struct ext2_icache_ent *e;
+    struct ext2_bmap *b = 0;
+    uint32_t pa_start = 0, pa_len = 0;
+    int writeback = 0;
+    ICACHE_LOCK_CONF;
+
+    ICACHE_LOCK(fs);
+    e = icache_find(fs, inode_num);
+    if (e && e->pins && !--e->pins) {
+	writeback = e->dirty;
+	b = e->bmap;
+	e->bmap = 0;
+	pa_start = e->pa_start;
+	pa_len = e->pa_len;
+	e->pa_len = 0;
+    }
+    ICACHE_UNLOCK(fs);
+
+    bmap_free(b);
+
+    // the unused part of the preallocation window goes back
+    if (pa_len) {
+	free_blocks(fs, pa_start, pa_len);
+    }
+
+    return writeback ? icache_sync(fs, inode_num) : 0;
+}
+
+static int icache_deinit(struct ext2_state *fs)
+{
+    struct ext2_icache_ent *e;
+    int rc = icache_sync(fs, 0);
+
+    while (!list_empty(&fs->icache_lru)) {
+	e = list_first_entry(&fs->icache_lru, struct ext2_icache_ent, lru);
+	icache_unhash(fs, e);
+	bmap_free(e->bmap);
+	free(e);
+    }
+
+    return rc;
+}
+
+// the length of the run of pointers starting at ptrs[index] that
+// point to consecutive blocks, at most max
+static uint32_t ptr_run(uint32_t *ptrs, uint32_t index, uint32_t max, uint32_t *first)
+{
+    uint32_t n = 1;
+
+    *first = ptrs[index];
+
+    if (*first) {
+	while (n < max && ptrs[index+n] == *first+n) {
+	    n++;
+	}
+    }
+
+    return n;
+}
+
+/*
+ * looks up ptrs[index] in indirect block "block" of the inode, returning
+ * it in *first along with how many of the (at most max) pointers from
+ * there on continue it, or -1 on error.  Blocks of a memory-backed
+ * device are used in place rather than cached
+ */
+static sint64_t bmap_ptrs(struct ext2_state *fs, uint32_t inode_num, uint32_t block, uint32_t index, uint32_t max, uint32_t *first)
+{
+    uint32_t block_size = get_block_size(fs);
+    uint8_t buf[block_size];
+    struct ext2_icache_ent *e;
+    struct ext2_bmap *b;
+    uint32_t *ptrs, *keep, n = 0;
+    int i, slot, mapped = 0;
+    ICACHE_LOCK_CONF;
+
+    ICACHE_LOCK(fs);
+    if ((e = icache_find(fs, inode_num)) && (b = e->bmap)) {
+	mapped = 1;
+	for (i=0;i<BMAP_IND_SLOTS;i++) {
+	    if (b->ind[i].block == block) {
+		b->ind[i].used = ++b->clock;
+		n = ptr_run(b->ind[i].ptrs, index, max, first);
+		break;
+	    }
+	}
+    }
+    ICACHE_UNLOCK(fs);
+
+    if (n) {
+	return n;
+    }
+
+    if ((ptrs = direct_block(fs, block))) {
+	return ptr_run(ptrs, index, max, first);
+    }
+
+    if (read_block(fs, block, buf)) {
+	ERROR("Cannot read indirect block %u\n", block);
+	return -1;
+    }
+
+    n = ptr_run((uint32_t *)buf, index, max, first);
+
+    if (!mapped || !(keep = malloc(block_size))) {
+	return n;
+    }
+
+    memcpy(keep, buf, block_size);
+
+    // it replaces the least recently used block, if the inode has a map
+    ICACHE_LOCK(fs);
+    if ((e = icache_find(fs, inode_num)) && (b = e->bmap)) {
+	for (i=slot=0;i<BMAP_IND_SLOTS;i++) {
+	    if (b->ind[i].block == block) {
+		slot = -1;
+		break;
+	    }
+	    if (b->ind[i].used < b->ind[slot].used) {
+		slot = i;
+	    }
+	}
+	if (slot >= 0) {
+	    ptrs = b->ind[slot].ptrs;
+	    b->ind[slot].ptrs = keep;
+	    b->ind[slot].block = block;
+	    b->ind[slot].used = ++b->clock;
+	    keep = ptrs;
+	}
+    }
+    ICACHE_UNLOCK(fs);
+
+    free(keep);
+
+    return n;
+}
+
+// the run memo forgets everything about the inode's layout
+static void bmap_forget(struct ext2_state *fs, uint32_t inode_num)
+{
+    struct ext2_icache_ent *e;
+    ICACHE_LOCK_CONF;
+
+    ICACHE_LOCK(fs);
+    if ((e = icache_find(fs, inode_num)) && e->bmap) {
+	memset(e->bmap->runs, 0, sizeof(e->bmap->runs));
+    }
+    ICACHE_UNLOCK(fs);
+}
+
+// block, one of the inode's indirect blocks, was just written from buf
+static void bmap_update(struct ext2_state *fs, uint32_t inode_num, uint32_t block, void *buf)
+{
+    struct ext2_icache_ent *e;
+    struct ext2_bmap *b;
+    int i;
+    ICACHE_LOCK_CONF;
+
+    ICACHE_LOCK(fs);
+    if ((e = icache_find(fs, inode_num)) && (b = e->bmap)) {
+	for (i=0;i<BMAP_IND_SLOTS;i++) {
+	    if (b->ind[i].block == block) {
+		memcpy(b->ind[i].ptrs, buf, get_block_size(fs));
+	    }
+	}
+	memset(b->runs, 0, sizeof(b->runs));
+    }
+    ICACHE_UNLOCK(fs);
+}
+
+// returns the length of the remembered run from logical on, 0 if none
+static uint32_t bmap_run_find(struct ext2_state *fs, uint32_t inode_num, uint32_t logical, uint32_t *physical)
+{
+    struct ext2_icache_ent *e;
+    struct ext2_bmap *b;
+    uint32_t len = 0;
+    int i;
+    ICACHE_LOCK_CONF;
+
+    ICACHE_LOCK(fs);
+    if ((e = icache_find(fs, inode_num)) && (b = e->bmap)) {
+	for (i=0;i<BMAP_RUNS;i++) {
+	    if (logical >= b->runs[i].logical && logical - b->runs[i].logical < b->runs[i].len) {
+		*physical = b->runs[i].physical + (logical - b->runs[i].logical);
+		len = b->runs[i].len - (logical - b->runs[i].logical);
+		break;
+	    }
+	}
+    }
+    ICACHE_UNLOCK(fs);
+
+    return len;
+}
+
+static void bmap_run_add(struct ext2_state *fs, uint32_t inode_num, uint32_t logical, uint32_t physical, uint32_t len)
+{
+    struct ext2_icache_ent *e;
+    struct ext2_bmap *b;
+    ICACHE_LOCK_CONF;
+
+    ICACHE_LOCK(fs);
+    if ((e = icache_find(fs, inode_num)) && (b = e->bmap)) {
+	b->runs[b->next_run].logical = logical;
+	b->runs[b->next_run].physical = physical;
+	b->runs[b->next_run].len = len;
+	b->next_run = (b->next_run + 1) % BMAP_RUNS;
+    }
+    ICACHE_UNLOCK(fs);
+}
+
+/*
+ * Preallocation
+ *
+ * An open file that needs a data block near goal gets a run of up to
+ * PREALLOC_BLOCKS free blocks.  It uses the first, and the rest stay
+ * reserved for it as long as its appends continue right after them.
+ * The window is given back when the file moves elsewhere, shrinks, or
+ * is closed.
+ */
+#define PREALLOC_BLOCKS 8
+
+static void prealloc_release(struct ext2_state *fs, uint32_t inode_num)
+{
+    struct ext2_icache_ent *e;
+    uint32_t start = 0, len = 0;
+    ICACHE_LOCK_CONF;
+
+    ICACHE_LOCK(fs);
+    if ((e = icache_find(fs, inode_num))) {
+	start = e->pa_start;
+	len = e->pa_len;
+	e->pa_len = 0;
+    }
+    ICACHE_UNLOCK(fs);
+
+    if (len) {
+	free_blocks(fs, start, len);
+    }
+}
+
+// *num is the goal on the way in
+static int alloc_data_block(struct ext2_state *fs, uint32_t inode_num, uint32_t *num)
+{
+    struct ext2_icache_ent *e;
+    uint32_t goal = *num, start;
+    sint64_t n;
+    int pinned = 0;
+    ICACHE_LOCK_CONF;
+
+    ICACHE_LOCK(fs);
+    if ((e = icache_find(fs, inode_num)) && e->pins) {
+	pinned = 1;
+	if (e->pa_len && e->pa_start == goal) {
+	    *num = e->pa_start++;
+	    e->pa_len--;
+	    ICACHE_UNLOCK(fs);
+	    return 0;
+	}
+    }
+    ICACHE_UNLOCK(fs);
+
+    if (pinned) {
+	prealloc_release(fs, inode_num);
+    }
+
+    if ((n = alloc_blocks(fs, goal, pinned ? PREALLOC_BLOCKS : 1, &start)) < 0) {
+	return -1;
+    }
+
+    *num = start;
+
+    if (n > 1) {
+	ICACHE_LOCK(fs);
+	if ((e = icache_find(fs, inode_num)) && e->pins && !e->pa_len) {
+	    e->pa_start = start + 1;
+	    e->pa_len = n - 1;
+	    n = 1;
+	}
+	ICACHE_UNLOCK(fs);
+	if (n > 1) {
+	    free_blocks(fs, start + 1, n - 1);
+	}
+    }
+
+    return 0;
+}
 
 /* split_path
  *
@@ -259,6 +1206,7 @@ static char** split_path(char *path, int *num_parts)
 	int part_len = slash - piece_start;
 	parts[i] = (char *) malloc((part_len + 1)*sizeof(char));
 	strncpy(parts[i], piece_start, part_len);
+	parts[i][part_len] = 0;
 	piece_start = slash + 1;
 	i++;
     }
@@ -308,7 +1256,6 @@ static uint32_t get_inode_num_from_dir(struct ext2_state *fs,
 				       char *name) 
 {
     struct ext2_dir_entry_2 dentry;
-    uint32_t inum;
 
     DEBUG("get_inode_num_from_dir on %s, inode_num=%u, dir=%p, search=%s\n",
 	  fs->fs->name,inode_num,dir,name);
@@ -429,7 +1376,9 @@ static uint32_t get_inode_num_by_path(struct ext2_state *fs, char *path)
 	    return 0;
 	}
 	cur_inode_num = new_inode_num;
-	cur_part = *(parts+i);
+	if (i < num_parts) {
+	    cur_part = parts[i];
+	}
     }
 
     //final inode is the requested file. return its number
@@ -438,148 +1387,3 @@ static uint32_t get_inode_num_by_path(struct ext2_state *fs, char *path)
 
     return new_inode_num;
 }
-
-static int alloc_free_inode(struct ext2_state *fs, uint32_t *num, int free)
-{
-    char *af[2] = { "alloc", "free" };
-
-    uint32_t bg_start, bg_end, bgi;
-    uint32_t block_size=get_block_size(fs);
-    uint8_t buf[block_size];
-    struct ext2_group_desc bg;
-    
-    free &= 0x1;
-
-    if (free) { 
-	bg_start = bg_end = (*num-1)/inodes_per_group(&fs->super);
-    } else {
-	bg_start = 0;
-	bg_end = num_block_groups(&fs->super);
-    }
-
-    for (bgi=bg_start;bgi<bg_end;bgi++) {
-	//get block group descriptor
-	if (read_block_group(fs, bgi, &bg)) { 
-	    ERROR("Failed to read block group %u in inode %s\n", bgi, af[free]);
-	    return -1;
-	}
-	
-	if (read_block(fs,bg.bg_inode_bitmap,buf)) { 
-	    ERROR("Failed to read inode bitmap in inode %s\n", af[free]);
-	    return -1;
-	}
-	
-	int byte;
-	int bit;
-	uint8_t cur_byte;
-    
-	if (free) { 
-	    uint32_t actual;
-	    actual = *num-1;  // inode numbers start with 1.... 
-	    actual %= inodes_per_group(&fs->super); // we want index in this group
-	    byte = actual/8;
-	    bit = actual%8;
-	    buf[byte] &= ~(0x1<<bit);
-	} else {
-	    for (byte=0; byte<block_size; byte++) {
-		cur_byte = buf[byte];
-		for (bit=0; bit < 8; bit++, cur_byte>>=1) {
-		    if (!(cur_byte & 0x01)) {
-			buf[byte] |= (0x1 << bit);
-			*num = byte*8 + bit + 1; //first inode number is 1, not 0
-			*num += bgi*inodes_per_group(&fs->super); // we want inode index on whole volume
-			goto out_good;
-		    }
-		}
-	    }
-	    // if we got here, we could not find anything...
-	    *num=0;
-	    return -1;
-	}
-    }
-    
- out_good:
-
-    if (write_block(fs,bg.bg_inode_bitmap,buf)) { 
-	ERROR("Failed to write inode bitmap in inode %s\n", af[free]);
-	return -1;
-    }
-    
-    return 0;
-}
-
-#define alloc_inode(fs,num) alloc_free_inode(fs,num,0)
-#define free_inode(fs,num) alloc_free_inode(fs,&(num),1)
-
-
-static int alloc_free_block(struct ext2_state *fs, uint32_t *num, int free)
-{
-    char *af[2] = { "alloc", "free" };
-
-    uint32_t bg_start, bg_end, bgi;
-    uint32_t block_size=get_block_size(fs);
-    uint8_t buf[block_size];
-    struct ext2_group_desc bg;
-    
-    free &= 0x1;
-
-    if (free) { 
-	bg_start = bg_end = *num/blocks_per_group(&fs->super);
-    } else {
-	bg_start = 0;
-	bg_end = num_block_groups(&fs->super);
-    }
-
-    for (bgi=bg_start;bgi<bg_end;bgi++) {
-	//get block group descriptor
-	if (read_block_group(fs, bgi, &bg)) { 
-	    ERROR("Failed to read block group %u in block %s\n", bgi, af[free]);
-	    return -1;
-	}
-	
-	if (read_block(fs,bg.bg_block_bitmap,buf)) { 
-	    ERROR("Failed to read block bitmap in block %s\n", af[free]);
-	    return -1;
-	}
-	
-	int byte;
-	int bit;
-	uint8_t cur_byte;
-    
-	if (free) { 
-	    uint32_t actual;
-	    actual = *num;  // inode numbers start with 0 
-	    actual %= blocks_per_group(&fs->super); // we want index in this group
-	    byte = actual/8;
-	    bit = actual%8;
-	    buf[byte] &= ~(0x1<<bit);
-	} else {
-	    for (byte=0; byte<block_size; byte++) {
-		cur_byte = buf[byte];
-		for (bit=0; bit < 8; bit++, cur_byte>>=1) {
-		    if (!(cur_byte & 0x01)) {
-			buf[byte] |= (0x1 << bit);
-			*num = byte*8 + bit ; //first block number is 0
-			*num += bgi*blocks_per_group(&fs->super); // we want block index on whole volume
-			goto out_good;
-		    }
-		}
-	    }
-	    // if we got here, we could not find anything...
-	    *num=0;
-	    return -1;
-	}
-    }
-    
- out_good:
-
-    if (write_block(fs,bg.bg_block_bitmap,buf)) { 
-	ERROR("Failed to write block bitmap in block %s\n", af[free]);
-	return -1;
-    }
-    
-    return 0;
-}
-
-#define alloc_block(fs,num) alloc_free_block(fs,num,0)
-#define free_block(fs,num) alloc_free_block(fs,&(num),1)
@@ -0,0 +1,998 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xtack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2016, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+
+/* ext2_htree.c
+ *
+ * Hash tree directory indexes, compatible with the dir_index feature
+ * of Linux ext2/3/4 (see the layout notes in ext2fs.h).
+ *
+ * Lookups, inserts and deletes in an indexed directory read the root,
+ * at most one more index block, and then the one leaf block the name
+ * hashes to.  A full leaf is split in two by hash.  When an index
+ * block fills up, or a linear directory needs more than DX_MIN_BLOCKS
+ * blocks on a filesystem with dir_index, the whole index is rebuilt
+ * with room to spare.
+ *
+ * An index is only ever an accelerator: every block still parses as
+ * ordinary directory entries, so linear scans remain correct.  Any
+ * trouble with an index therefore falls back to treating the directory
+ * as linear, dropping the index flag if the directory is changed.
+ *
+ * Included by ext2.c.
+ */
+
+// linear directories with this many blocks get an index when they grow;
+// a scan of fewer is about as cheap as walking an index
+#define DX_MIN_BLOCKS 8
+// how full a rebuild leaves leaves and index blocks, in quarters
+#define DX_FILL 3
+// splits and rebuilds one insert may do before giving up on the index
+#define DX_TRIES 3
+#define DX_MAX_LEVELS 1
+
+#define DX_ROOT_ENTRIES 32    // offset of the entries in the root block
+#define DX_NODE_ENTRIES 8     // offset of the entries in other index blocks
+#define DX_HASH_EOF     0x7fffffff
+
+static int dx_enabled(struct ext2_state *fs)
+{
+    return !!(fs->super.s_feature_compat & EXT2_FEATURE_COMPAT_DIR_INDEX);
+}
+
+static int dx_indexed(struct ext2_inode *inode)
+{
+    return !!(inode->i_flags & EXT2_INDEX_FL);
+}
+
+
+/*
+ * Hashes - as in Linux fs/ext4/hash.c
+ */
+
+#define DX_ROL(x,s) (((x) << (s)) | ((x) >> (32-(s))))
+
+#define DX_F(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define DX_G(x, y, z) (((x) & (y)) + (((x) ^ (y)) & (z)))
+#define DX_H(x, y, z) ((x) ^ (y) ^ (z))
+
+#define DX_ROUND(f, a, b, c, d, x, s) (a += f(b, c, d) + x, a = DX_ROL(a, s))
+#define DX_K1 0
+#define DX_K2 013240474631UL
+#define DX_K3 015666365641UL
+
+static void dx_half_md4(uint32_t buf[4], uint32_t const in[8])
+{
+    uint32_t a = buf[0], b = buf[1], c = buf[2], d = buf[3];
+
+    DX_ROUND(DX_F, a, b, c, d, in[0] + DX_K1,  3);
+    DX_ROUND(DX_F, d, a, b, c, in[1] + DX_K1,  7);
+    DX_ROUND(DX_F, c, d, a, b, in[2] + DX_K1, 11);
+    DX_ROUND(DX_F, b, c, d, a, in[3] + DX_K1, 19);
+    DX_ROUND(DX_F, a, b, c, d, in[4] + DX_K1,  3);
+    DX_ROUND(DX_F, d, a, b, c, in[5] + DX_K1,  7);
+    DX_ROUND(DX_F, c, d, a, b, in[6] + DX_K1, 11);
+    DX_ROUND(DX_F, b, c, d, a, in[7] + DX_K1, 19);
+
+    DX_ROUND(DX_G, a, b, c, d, in[1] + DX_K2,  3);
+    DX_ROUND(DX_G, d, a, b, c, in[3] + DX_K2,  5);
+    DX_ROUND(DX_G, c, d, a, b, in[5] + DX_K2,  9);
+    DX_ROUND(DX_G, b, c, d, a, in[7] + DX_K2, 13);
+    DX_ROUND(DX_G, a, b, c, d, in[0] + DX_K2,  3);
+    DX_ROUND(DX_G, d, a, b, c, in[2] + DX_K2,  5);
+    DX_ROUND(DX_G, c, d, a, b, in[4] + DX_K2,  9);
+    DX_ROUND(DX_G, b, c, d, a, in[6] + DX_K2, 13);
+
+    DX_ROUND(DX_H, a, b, c, d, in[3] + DX_K3,  3);
+    DX_ROUND(DX_H, d, a, b, c, in[7] + DX_K3,  9);
+    DX_ROUND(DX_H, c, d, a, b, in[2] + DX_K3, 11);
+    DX_ROUND(DX_H, b, c, d, a, in[6] + DX_K3, 15);
+    DX_ROUND(DX_H, a, b, c, d, in[1] + DX_K3,  3);
+    DX_ROUND(DX_H, d, a, b, c, in[5] + DX_K3,  9);
+    DX_ROUND(DX_H, c, d, a, b, in[0] + DX_K3, 11);
+    DX_ROUND(DX_H, b, c, d, a, in[4] + DX_K3, 15);
+
+    buf[0] += a;
+    buf[1] += b;
+    buf[2] += c;
+    buf[3] += d;
+}
+
+static void dx_tea(uint32_t buf[4], uint32_t const in[4])
+{
+    uint32_t sum = 0;
+    uint32_t b0 = buf[0], b1 = buf[1];
+    uint32_t a = in[0], b = in[1], c = in[2], d = in[3];
+    int n = 16;
+
+    do {
+	sum += 0x9E3779B9;
+	b0 += ((b1 << 4)+a) ^ (b1+sum) ^ ((b1 >> 5)+b);
+	b1 += ((b0 << 4)+c) ^ (b0+sum) ^ ((b0 >> 5)+d);
+    } while (--n);
+
+    buf[0] += b0;
+    buf[1] += b1;
+}
+
+static uint32_t dx_legacy(const char *name, int len, int unsigned_chars)
+{
+    uint32_t hash, hash0 = 0x12a3fe2d, hash1 = 0x37abe8f9;
+    int c;
+
+    while (len--) {
+	c = unsigned_chars ? (int)(unsigned char)*name : (int)(signed char)*name;
+	name++;
+	hash = hash1 + (hash0 ^ (c * 7152373));
+	if (hash & 0x80000000) {
+	    hash -= 0x7fffffff;
+	}
+	hash1 = hash0;
+	hash0 = hash;
+    }
+
+    return hash0 << 1;
+}
+
+static void dx_str2hashbuf(const char *msg, int len, uint32_t *buf, int num, int unsigned_chars)
+{
+    uint32_t pad, val;
+    int i, c;
+
+    pad = (uint32_t)len | ((uint32_t)len << 8);
+    pad |= pad << 16;
+
+    val = pad;
+    if (len > num*4) {
+	len = num*4;
+    }
+    for (i=0;i<len;i++) {
+	c = unsigned_chars ? (int)(unsigned char)msg[i] : (int)(signed char)msg[i];
+	val = c + (val << 8);
+	if ((i % 4) == 3) {
+	    *buf++ = val;
+	    val = pad;
+	    num--;
+	}
+    }
+    if (--num >= 0) {
+	*buf++ = val;
+    }
+    while (--num >= 0) {
+	*buf++ = pad;
+    }
+}
+
+// version already accounts for the filesystem's unsigned hash flag
+static uint32_t dx_hash(struct ext2_state *fs, int version, const char *name, int len)
+{
+    uint32_t buf[4] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476 };
+    uint32_t in[8], hash;
+    int i, uns = version >= DX_HASH_LEGACY_UNSIGNED;
+
+    for (i=0;i<4;i++) {
+	if (fs->super.s_hash_seed[i]) {
+	    memcpy(buf, fs->super.s_hash_seed, sizeof(buf));
+	    break;
+	}
+    }
+
+    switch (version) {
+    case DX_HASH_LEGACY:
+    case DX_HASH_LEGACY_UNSIGNED:
+	hash = dx_legacy(name, len, uns);
+	break;
+    case DX_HASH_HALF_MD4:
+    case DX_HASH_HALF_MD4_UNSIGNED:
+	for (; len > 0; len -= 32, name += 32) {
+	    dx_str2hashbuf(name, len, in, 8, uns);
+	    dx_half_md4(buf, in);
+	}
+	hash = buf[1];
+	break;
+    case DX_HASH_TEA:
+    case DX_HASH_TEA_UNSIGNED:
+	for (; len > 0; len -= 16, name += 16) {
+	    dx_str2hashbuf(name, len, in, 4, uns);
+	    dx_tea(buf, in);
+	}
+	hash = buf[0];
+	break;
+    default:
+	return 0;
+    }
+
+    hash &= ~1;
+    if (hash == (DX_HASH_EOF << 1)) {
+	hash = (DX_HASH_EOF - 1) << 1;
+    }
+
+    return hash;
+}
+
+// the hash version to compute with, given the one recorded in the root
+static int dx_version(struct ext2_state *fs, int recorded)
+{
+    if (recorded <= DX_HASH_TEA && (fs->super.s_flags & EXT2_FLAGS_UNSIGNED_HASH)) {
+	return recorded + DX_HASH_LEGACY_UNSIGNED;
+    }
+
+    return recorded;
+}
+
+
+/*
+ * Directory blocks
+ */
+
+static int dir_block_rw(struct ext2_state *fs, uint32_t inum, struct ext2_inode *inode, uint32_t logical, void *buf, int write)
+{
+    uint32_t phys;
+
+    if (map_logical_to_physical_get(fs,inum,inode,logical,&phys) || !phys) {
+	ERROR("Unable to map directory block %u\n",logical);
+	return -1;
+    }
+
+    return write ? write_block(fs,phys,buf) : read_block(fs,phys,buf);
+}
+
+#define dir_block_read(fs,inum,inode,logical,buf)  dir_block_rw(fs,inum,inode,logical,buf,0)
+#define dir_block_write(fs,inum,inode,logical,buf) dir_block_rw(fs,inum,inode,logical,buf,1)
+
+// adds buf as a new block at the end of the directory
+static int dir_append_block(struct ext2_state *fs, uint32_t inum, struct ext2_inode *inode, void *buf, uint32_t *logical)
+{
+    uint64_t block_size = get_block_size(fs);
+    uint32_t phys = 0;
+
+    *logical = get_file_size(fs,inode)/block_size;
+
+    // next to the directory's last block, if possible
+    if (*logical && !map_logical_to_physical_get(fs,inum,inode,*logical-1,&phys) && phys) {
+	phys++;
+    }
+
+    if (alloc_block(fs,&phys)) {
+	ERROR("Unable to allocate directory block\n");
+	return -1;
+    }
+
+    if (write_block(fs,phys,buf)) {
+	ERROR("Unable to write new directory block\n");
+	return -1;
+    }
+
+    if (map_logical_to_physical_put(fs,inum,inode,*logical,phys)) {
+	ERROR("Unable to map new directory block %u\n",*logical);
+	return -1;
+    }
+
+    // the block, and any indirect blocks the put had to add to map it
+    set_file_size(fs,inode,(uint64_t)(*logical+1)*block_size);
+    inode->i_blocks += (1 + indirect_blocks(fs,*logical+1) - indirect_blocks(fs,*logical)) * (block_size/512);
+
+    return write_inode(fs,inum,inode);
+}
+
+// returns whether the entry is sane within a block of block_size
+static int dirent_ok(struct ext2_dir_entry_2 *de, uint32_t offset, uint32_t block_size)
+{
+    return de->rec_len >= 8 && !(de->rec_len % 4) && offset + de->rec_len <= block_size &&
+	EXT2_DIR_REC_LEN(de->name_len) <= de->rec_len;
+}
+
+// places dentry in the block, in a free entry or in the slack after a
+// live one; returns -1 if there is no room
+static int dirent_insert(uint8_t *buf, uint32_t block_size, struct ext2_dir_entry_2 *dentry)
+{
+    uint32_t need = EXT2_DIR_REC_LEN(dentry->name_len);
+    uint32_t offset, used;
+    struct ext2_dir_entry_2 *de, *nde;
+
+    for (offset=0; offset<block_size; offset+=de->rec_len) {
+	de = (struct ext2_dir_entry_2 *)&buf[offset];
+	if (!dirent_ok(de,offset,block_size)) {
+	    return -1;
+	}
+	used = de->inode ? EXT2_DIR_REC_LEN(de->name_len) : 0;
+	if (de->rec_len - used >= need) {
+	    if (used) {
+		nde = (struct ext2_dir_entry_2 *)&buf[offset+used];
+		nde->rec_len = de->rec_len - used;
+		de->rec_len = used;
+		de = nde;
+	    }
+	    nde = de;
+	    uint16_t rec_len = nde->rec_len;
+	    memcpy(nde, dentry, 8 + dentry->name_len);
+	    nde->rec_len = rec_len;
+	    return 0;
+	}
+    }
+
+    return -1;
+}
+
+
+/*
+ * Index paths
+ */
+
+struct dx_frame {
+    uint32_t         logical;    // directory block holding these entries
+    uint8_t         *buf;
+    struct dx_entry *entries;
+    uint32_t         at;         // entry followed down
+};
+
+struct dx_path {
+    int              levels;     // indirect levels
+    int              version;    // hash version to compute with
+    uint32_t         hash;
+    struct dx_frame  frame[DX_MAX_LEVELS+1];
+};
+
+#define dx_count(f)  (((struct dx_countlimit *)(f)->entries)->count)
+#define dx_limit(f)  (((struct dx_countlimit *)(f)->entries)->limit)
+
+static void dx_release(struct dx_path *p)
+{
+    int i;
+
+    for (i=0;i<=DX_MAX_LEVELS;i++) {
+	free(p->frame[i].buf);
+	p->frame[i].buf = 0;
+    }
+}
+
+// follows the entry for p->hash in frame l
+static void dx_follow(struct dx_path *p, int l)
+{
+    struct dx_frame *f = &p->frame[l];
+    uint32_t lo = 1, hi = dx_count(f), mid;
+
+    // the last entry whose hash is <= the one sought; entry 0 has none
+    while (lo < hi) {
+	mid = (lo + hi)/2;
+	if (f->entries[mid].hash <= p->hash) {
+	    lo = mid + 1;
+	} else {
+	    hi = mid;
+	}
+    }
+
+    f->at = lo - 1;
+}
+
+static int dx_load(struct ext2_state *fs, uint32_t inum, struct ext2_inode *inode, struct dx_path *p, int l, uint32_t logical)
+{
+    uint32_t block_size = get_block_size(fs);
+    struct dx_frame *f = &p->frame[l];
+    uint32_t limit;
+
+    if (!f->buf && !(f->buf = malloc(block_size))) {
+	ERROR("Cannot allocate index block\n");
+	return -1;
+    }
+
+    if (dir_block_read(fs,inum,inode,logical,f->buf)) {
+	return -1;
+    }
+
+    f->logical = logical;
+
+    if (l) {
+	f->entries = (struct dx_entry *)(f->buf + DX_NODE_ENTRIES);
+	limit = (block_size - DX_NODE_ENTRIES)/sizeof(struct dx_entry);
+    } else {
+	f->entries = (struct dx_entry *)(f->buf + DX_ROOT_ENTRIES);
+	limit = (block_size - DX_ROOT_ENTRIES)/sizeof(struct dx_entry);
+    }
+
+    if (dx_limit(f) != limit || !dx_count(f) || dx_count(f) > limit) {
+	DEBUG("Bad index block %u in directory %u\n",logical,inum);
+	return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * walks the index from the root down to the leaf for name
+ * returns the leaf's logical block, or -1 if the index is unusable
+ */
+static sint64_t dx_probe(struct ext2_state *fs, uint32_t inum, struct ext2_inode *inode, char *name, int len, struct dx_path *p)
+{
+    struct dx_root_info *info;
+    int l;
+
+    memset(p,0,sizeof(*p));
+
+    if (dx_load(fs,inum,inode,p,0,0)) {
+	goto bad;
+    }
+
+    info = (struct dx_root_info *)(p->frame[0].buf + 24);
+
+    if (info->reserved_zero || info->info_length != 8 || info->indirect_levels > DX_MAX_LEVELS ||
+	info->hash_version > DX_HASH_TEA) {
+	DEBUG("Unsupported index in directory %u\n",inum);
+	goto bad;
+    }
+
+    p->levels = info->indirect_levels;
+    p->version = dx_version(fs,info->hash_version);
+    p->hash = dx_hash(fs,p->version,name,len);
+
+    for (l=0;;l++) {
+	dx_follow(p,l);
+	if (l == p->levels) {
+	    return p->frame[l].entries[p->frame[l].at].block;
+	}
+	if (dx_load(fs,inum,inode,p,l+1,p->frame[l].entries[p->frame[l].at].block)) {
+	    goto bad;
+	}
+    }
+
+ bad:
+    dx_release(p);
+    return -1;
+}
+
+// moves to the next leaf if entries with the sought hash continue
+// there; returns its logical block, or -1
+static sint64_t dx_next_leaf(struct ext2_state *fs, uint32_t inum, struct ext2_inode *inode, struct dx_path *p)
+{
+    struct dx_frame *f;
+    int l;
+
+    for (l=p->levels; l>=0 && p->frame[l].at+1 >= dx_count(&p->frame[l]); l--) {
+    }
+
+    if (l < 0) {
+	return -1;
+    }
+
+    f = &p->frame[l];
+
+    if ((f->entries[f->at+1].hash & ~1) != p->hash) {
+	return -1;
+    }
+
+    f->at++;
+
+    for (; l < p->levels; l++) {
+	if (dx_load(fs,inum,inode,p,l+1,p->frame[l].entries[p->frame[l].at].block)) {
+	    return -1;
+	}
+	p->frame[l+1].at = 0;
+    }
+
+    return p->frame[p->levels].entries[p->frame[p->levels].at].block;
+}
+
+
+/*
+ * Rebuilding
+ */
+
+struct dx_ent {
+    uint32_t hash;
+    uint32_t inode;
+    uint8_t  name_len;
+    uint8_t  file_type;
+    char    *name;
+};
+
+static int dx_ent_less(struct dx_ent *a, struct dx_ent *b)
+{
+    return a->hash < b->hash;
+}
+
+static void dx_sift(struct dx_ent *e, uint32_t root, uint32_t n)
+{
+    struct dx_ent t;
+    uint32_t child;
+
+    while ((child = 2*root+1) < n) {
+	if (child+1 < n && dx_ent_less(&e[child],&e[child+1])) {
+	    child++;
+	}
+	if (!dx_ent_less(&e[root],&e[child])) {
+	    return;
+	}
+	t = e[root]; e[root] = e[child]; e[child] = t;
+	root = child;
+    }
+}
+
+static void dx_sort(struct dx_ent *e, uint32_t n)
+{
+    struct dx_ent t;
+    uint32_t i;
+
+    for (i=n/2; i-- > 0;) {
+	dx_sift(e,i,n);
+    }
+    for (i=n; i-- > 1;) {
+	t = e[0]; e[0] = e[i]; e[i] = t;
+	dx_sift(e,0,i);
+    }
+}
+
+// lays out entries [first,first+n) as one leaf block
+static void dx_fill_leaf(uint8_t *buf, uint32_t block_size, struct dx_ent *e, uint32_t n)
+{
+    struct ext2_dir_entry_2 *de = 0;
+    uint32_t offset = 0, i;
+
+    memset(buf,0,block_size);
+
+    for (i=0;i<n;i++) {
+	de = (struct ext2_dir_entry_2 *)&buf[offset];
+	de->inode = e[i].inode;
+	de->name_len = e[i].name_len;
+	de->file_type = e[i].file_type;
+	de->rec_len = EXT2_DIR_REC_LEN(e[i].name_len);
+	memcpy(de->name,e[i].name,e[i].name_len);
+	offset += de->rec_len;
+    }
+
+    if (de) {
+	de->rec_len += block_size - offset;
+    } else {
+	de = (struct ext2_dir_entry_2 *)buf;
+	de->rec_len = block_size;
+    }
+}
+
+// the hash recorded for a block starting at entry i
+static uint32_t dx_split_hash(struct dx_ent *e, uint32_t i)
+{
+    return e[i].hash | (i && e[i].hash == e[i-1].hash);
+}
+
+static void dx_fill_node(uint8_t *buf, uint32_t block_size, int root, uint32_t dot, uint32_t dotdot,
+			 int version, int levels, struct dx_entry *entries, uint32_t n)
+{
+    struct ext2_dir_entry_2 *de = (struct ext2_dir_entry_2 *)buf;
+    struct dx_root_info *info;
+    struct dx_countlimit *cl;
+    uint32_t offset = root ? DX_ROOT_ENTRIES : DX_NODE_ENTRIES;
+
+    memset(buf,0,block_size);
+
+    if (root) {
+	de->inode = dot;
+	de->rec_len = 12;
+	de->name_len = 1;
+	de->file_type = EXT2_FT_DIR;
+	de->name[0] = '.';
+	de = (struct ext2_dir_entry_2 *)&buf[12];
+	de->inode = dotdot;
+	de->rec_len = block_size - 12;
+	de->name_len = 2;
+	de->file_type = EXT2_FT_DIR;
+	de->name[0] = de->name[1] = '.';
+	info = (struct dx_root_info *)&buf[24];
+	info->info_length = 8;
+	info->hash_version = version;
+	info->indirect_levels = levels;
+    } else {
+	de->rec_len = block_size;
+    }
+
+    memcpy(&buf[offset],entries,n*sizeof(struct dx_entry));
+    cl = (struct dx_countlimit *)&buf[offset];
+    cl->limit = (block_size - offset)/sizeof(struct dx_entry);
+    cl->count = n;
+}
+
+/*
+ * rewrites the whole directory as an index over leaves packed to
+ * DX_FILL quarters full, in hash order.  The directory's blocks are
+ * reused, and more are added as needed
+ */
+static int dx_build(struct ext2_state *fs, uint32_t inum, struct ext2_inode *inode)
+{
+    uint32_t block_size = get_block_size(fs);
+    uint32_t num_blocks = get_file_size(fs,inode)/block_size;
+    uint32_t root_limit = (block_size - DX_ROOT_ENTRIES)/sizeof(struct dx_entry);
+    uint32_t node_limit = (block_size - DX_NODE_ENTRIES)/sizeof(struct dx_entry);
+    int recorded = fs->super.s_def_hash_version <= DX_HASH_TEA ? fs->super.s_def_hash_version : DX_HASH_HALF_MD4;
+    int version = dx_version(fs,recorded);
+    struct dx_ent *ents = 0, *ne;
+    struct dx_entry *leaves = 0, *nodes = 0;
+    uint32_t *leaf_first = 0;
+    uint32_t n = 0, cap = 0, num_leaves, num_nodes, per_node, dot = inum, dotdot = inum;
+    uint32_t logical, offset, i, j, used, have;
+    uint8_t *buf = 0, *blocks = 0;
+    struct ext2_dir_entry_2 *de;
+    int levels, rc = -1;
+
+    DEBUG("building index for directory %u (%u blocks)\n",inum,num_blocks);
+
+    if (!(buf = malloc(block_size))) {
+	goto out;
+    }
+
+    // everything is read in first, since the blocks will be overwritten
+    if (!(blocks = malloc((uint64_t)num_blocks*block_size))) {
+	ERROR("Cannot allocate space to rebuild directory %u\n",inum);
+	goto out;
+    }
+
+    for (logical=0;logical<num_blocks;logical++) {
+	if (dir_block_read(fs,inum,inode,logical,&blocks[(uint64_t)logical*block_size])) {
+	    goto out;
+	}
+    }
+
+    for (logical=0;logical<num_blocks;logical++) {
+	uint8_t *b = &blocks[(uint64_t)logical*block_size];
+	for (offset=0;offset<block_size;offset+=de->rec_len) {
+	    de = (struct ext2_dir_entry_2 *)&b[offset];
+	    if (!dirent_ok(de,offset,block_size)) {
+		ERROR("Corrupt directory entry in block %u of directory %u\n",logical,inum);
+		goto out;
+	    }
+	    if (!de->inode) {
+		continue;
+	    }
+	    if (de->name_len==1 && de->name[0]=='.') {
+		dot = de->inode;
+		continue;
+	    }
+	    if (de->name_len==2 && de->name[0]=='.' && de->name[1]=='.') {
+		dotdot = de->inode;
+		continue;
+	    }
+	    if (n == cap) {
+		cap = cap ? 2*cap : 256;
+		if (!(ne = malloc(cap*sizeof(*ne)))) {
+		    ERROR("Cannot allocate space to rebuild directory %u\n",inum);
+		    goto out;
+		}
+		memcpy(ne,ents,n*sizeof(*ne));
+		free(ents);
+		ents = ne;
+	    }
+	    // names stay where they are in the copy
+	    ents[n].inode = de->inode;
+	    ents[n].name_len = de->name_len;
+	    ents[n].file_type = de->file_type;
+	    ents[n].name = de->name;
+	    ents[n].hash = dx_hash(fs,version,de->name,de->name_len);
+	    n++;
+	}
+    }
+
+    dx_sort(ents,n);
+
+    // pack the leaves
+    if (!(leaf_first = malloc((n+1)*sizeof(uint32_t))) || !(leaves = malloc((n+1)*sizeof(*leaves)))) {
+	goto out;
+    }
+
+    num_leaves = 0;
+    for (i=0;i<n || !num_leaves;) {
+	leaf_first[num_leaves] = i;
+	leaves[num_leaves].hash = num_leaves ? dx_split_hash(ents,i) : 0;
+	for (used=0; i<n && (used==0 || used + EXT2_DIR_REC_LEN(ents[i].name_len) <= block_size*DX_FILL/4); i++) {
+	    used += EXT2_DIR_REC_LEN(ents[i].name_len);
+	}
+	num_leaves++;
+    }
+    leaf_first[num_leaves] = n;
+
+    if (num_leaves <= root_limit*DX_FILL/4) {
+	levels = 0;
+	num_nodes = 0;
+	per_node = num_leaves;
+    } else {
+	levels = 1;
+	per_node = node_limit*DX_FILL/4;
+	num_nodes = CEIL_DIV(num_leaves,per_node);
+	if (num_nodes > root_limit) {
+	    ERROR("Directory %u is too large to index\n",inum);
+	    goto out;
+	}
+    }
+
+    // root, then index blocks, then leaves
+    for (have=num_blocks; have < 1 + num_nodes + num_leaves; have++) {
+	memset(buf,0,block_size);
+	((struct ext2_dir_entry_2 *)buf)->rec_len = block_size;
+	if (dir_append_block(fs,inum,inode,buf,&logical)) {
+	    goto out;
+	}
+    }
+
+    for (i=0;i<num_leaves;i++) {
+	leaves[i].block = 1 + num_nodes + i;
+	dx_fill_leaf(buf,block_size,&ents[leaf_first[i]],leaf_first[i+1]-leaf_first[i]);
+	if (dir_block_write(fs,inum,inode,leaves[i].block,buf)) {
+	    goto out;
+	}
+    }
+
+    if (levels) {
+	if (!(nodes = malloc(num_nodes*sizeof(*nodes)))) {
+	    goto out;
+	}
+	for (i=0;i<num_nodes;i++) {
+	    j = i*per_node;
+	    nodes[i].hash = i ? leaves[j].hash : 0;
+	    nodes[i].block = 1 + i;
+	    dx_fill_node(buf,block_size,0,0,0,0,0,&leaves[j],MIN(per_node,num_leaves-j));
+	    if (dir_block_write(fs,inum,inode,nodes[i].block,buf)) {
+		goto out;
+	    }
+	}
+	dx_fill_node(buf,block_size,1,dot,dotdot,recorded,levels,nodes,num_nodes);
+    } else {
+	dx_fill_node(buf,block_size,1,dot,dotdot,recorded,levels,leaves,num_leaves);
+    }
+
+    // blocks no longer needed are left empty; the copy is done with
+    if (have > 1 + num_nodes + num_leaves) {
+	memset(blocks,0,block_size);
+	((struct ext2_dir_entry_2 *)blocks)->rec_len = block_size;
+    }
+    for (logical=1+num_nodes+num_leaves; logical<have; logical++) {
+	if (dir_block_write(fs,inum,inode,logical,blocks)) {
+	    goto out;
+	}
+    }
+
+    // the root goes last, as it makes the rest reachable
+    if (dir_block_write(fs,inum,inode,0,buf)) {
+	goto out;
+    }
+
+    inode->i_flags |= EXT2_INDEX_FL;
+
+    if (write_inode(fs,inum,inode)) {
+	goto out;
+    }
+
+    DEBUG("directory %u: %u entries, %u leaves, %u index blocks\n",inum,n,num_leaves,num_nodes);
+
+    rc = 0;
+
+ out:
+    free(nodes);
+    free(leaves);
+    free(leaf_first);
+    free(ents);
+    free(blocks);
+    free(buf);
+
+    return rc;
+}
+
+
+/*
+ * Operations
+ */
+
+// drops a broken or unsupported index so the directory is linear again
+static int dx_drop(struct ext2_state *fs, uint32_t inum, struct ext2_inode *inode)
+{
+    ERROR("Dropping the index of directory %u\n",inum);
+
+    inode->i_flags &= ~EXT2_INDEX_FL;
+
+    return write_inode(fs,inum,inode);
+}
+
+/*
+ * GET or DEL_BY_NAME through the index
+ * returns 0 on success, -1 if the name is not there, and -2 if the
+ * index cannot be used
+ */
+static int dx_find(struct ext2_state *fs, uint32_t inum, struct ext2_inode *inode, struct ext2_dir_entry_2 *dentry, int del)
+{
+    uint32_t block_size = get_block_size(fs);
+    struct ext2_dir_entry_2 *de, *pde;
+    struct dx_path p;
+    uint32_t offset;
+    sint64_t leaf;
+    uint8_t *buf;
+    int rc = -1;
+
+    if ((leaf = dx_probe(fs,inum,inode,dentry->name,dentry->name_len,&p)) < 0) {
+	return -2;
+    }
+
+    if (!(buf = malloc(block_size))) {
+	dx_release(&p);
+	return -2;
+    }
+
+    for (; leaf >= 0; leaf = dx_next_leaf(fs,inum,inode,&p)) {
+	if (dir_block_read(fs,inum,inode,leaf,buf)) {
+	    rc = -2;
+	    break;
+	}
+	for (offset=0, pde=0; offset<block_size; offset+=de->rec_len, pde=de) {
+	    de = (struct ext2_dir_entry_2 *)&buf[offset];
+	    if (!dirent_ok(de,offset,block_size)) {
+		rc = -2;
+		goto out;
+	    }
+	    if (de->inode && de->name_len==dentry->name_len && !strncmp(de->name,dentry->name,de->name_len)) {
+		if (!del) {
+		    memcpy(dentry,de,8+de->name_len);
+		    rc = 0;
+		    goto out;
+		}
+		de->inode = 0;
+		if (pde) {
+		    pde->rec_len += de->rec_len;
+		}
+		rc = dir_block_write(fs,inum,inode,leaf,buf) ? -2 : 0;
+		goto out;
+	    }
+	}
+    }
+
+ out:
+    free(buf);
+    dx_release(&p);
+
+    return rc;
+}
+
+// inserts into the entries of frame f after the one followed
+static void dx_frame_insert(struct dx_frame *f, uint32_t hash, uint32_t block)
+{
+    struct dx_entry *at = &f->entries[f->at+1];
+
+    memmove(at+1, at, (dx_count(f) - f->at - 1)*sizeof(*at));
+    at->hash = hash;
+    at->block = block;
+    dx_count(f)++;
+}
+
+/*
+ * PUT through the index.  A full leaf is split in two by hash; a full
+ * index block makes for a rebuild.  Each split or rebuild uses up one
+ * of tries
+ * returns 0 on success, -1 on failure, -2 if the index cannot be used
+ */
+static int dx_insert(struct ext2_state *fs, uint32_t inum, struct ext2_inode *inode, struct ext2_dir_entry_2 *dentry, int tries)
+{
+    uint32_t block_size = get_block_size(fs);
+    uint32_t max_ents = block_size/12;
+    struct dx_ent *ents = 0;
+    struct ext2_dir_entry_2 *de;
+    struct dx_frame *f;
+    struct dx_path p;
+    uint32_t offset, n = 0, m, split, new_leaf, i;
+    uint8_t *buf = 0, *buf2 = 0;
+    sint64_t leaf;
+    int rc = -2;
+
+    if ((leaf = dx_probe(fs,inum,inode,dentry->name,dentry->name_len,&p)) < 0) {
+	return -2;
+    }
+
+    f = &p.frame[p.levels];
+
+    if (!(buf = malloc(block_size)) || !(buf2 = malloc(block_size)) ||
+	!(ents = malloc(max_ents*sizeof(*ents)))) {
+	goto out;
+    }
+
+    if (dir_block_read(fs,inum,inode,leaf,buf)) {
+	goto out;
+    }
+
+    if (!dirent_insert(buf,block_size,dentry)) {
+	rc = dir_block_write(fs,inum,inode,leaf,buf) ? -1 : 0;
+	goto out;
+    }
+
+    if (!tries) {
+	goto out;
+    }
+
+    if (dx_count(f) >= dx_limit(f)) {
+	// no room in the index for another leaf
+	dx_release(&p);
+	free(ents);
+	free(buf);
+	free(buf2);
+	if (dx_build(fs,inum,inode)) {
+	    return -2;
+	}
+	return dx_insert(fs,inum,inode,dentry,tries-1);
+    }
+
+    // split the leaf, upper half of the hashes going to a new one
+    for (offset=0; offset<block_size; offset+=de->rec_len) {
+	de = (struct ext2_dir_entry_2 *)&buf[offset];
+	if (!dirent_ok(de,offset,block_size) || n == max_ents) {
+	    goto out;
+	}
+	if (de->inode) {
+	    ents[n].inode = de->inode;
+	    ents[n].name_len = de->name_len;
+	    ents[n].file_type = de->file_type;
+	    ents[n].name = de->name;
+	    ents[n].hash = dx_hash(fs,p.version,de->name,de->name_len);
+	    n++;
+	}
+    }
+
+    if (n < 2) {
+	goto out;
+    }
+
+    dx_sort(ents,n);
+
+    m = n/2;
+    split = dx_split_hash(ents,m);
+
+    // the new leaf is filled from buf, so it must be written first
+    dx_fill_leaf(buf2,block_size,&ents[m],n-m);
+
+    if (dir_append_block(fs,inum,inode,buf2,&new_leaf)) {
+	rc = -1;
+	goto out;
+    }
+
+    memcpy(buf2,buf,block_size);
+    for (i=0;i<m;i++) {
+	ents[i].name = (char *)buf2 + ((uint8_t *)ents[i].name - buf);
+    }
+    dx_fill_leaf(buf,block_size,ents,m);
+
+    if (dir_block_write(fs,inum,inode,leaf,buf)) {
+	rc = -1;
+	goto out;
+    }
+
+    dx_frame_insert(f,split,new_leaf);
+
+    if (dir_block_write(fs,inum,inode,f->logical,f->buf)) {
+	rc = -1;
+	goto out;
+    }
+
+    DEBUG("split leaf %ld of directory %u at hash %x into %u\n",leaf,inum,split,new_leaf);
+
+    dx_release(&p);
+    free(ents);
+    free(buf);
+    free(buf2);
+
+    // now there should be room on one side or the other
+    return dx_insert(fs,inum,inode,dentry,tries-1);
+
+ out:
+    dx_release(&p);
+    free(ents);
+    free(buf);
+    free(buf2);
+
+    return rc;
+}
@@ -395,6 +395,51 @@ struct ext2_super_block {
 
 #define EXT2_GOOD_OLD_INODE_SIZE 128
 
+/*
+ * Feature set definitions
+ */
+#define EXT2_FEATURE_COMPAT_DIR_INDEX		0x0020
+
+/*
+ * Superblock s_flags
+ */
+#define EXT2_FLAGS_SIGNED_HASH		0x0001	/* Signed dirhash in use */
+#define EXT2_FLAGS_UNSIGNED_HASH	0x0002	/* Unsigned dirhash in use */
+
+/*
+ * Hash tree directories (dir_index)
+ *
+ * Block 0 of an indexed directory holds "." and "..", the latter's
+ * rec_len covering the rest of the block, which is a dx_root_info and
+ * an array of dx_entry.  The other index blocks start with an empty
+ * directory entry covering the whole block, followed by dx_entry's.
+ * In both, the first dx_entry's hash is a dx_countlimit instead.
+ */
+#define DX_HASH_LEGACY		0
+#define DX_HASH_HALF_MD4	1
+#define DX_HASH_TEA		2
+#define DX_HASH_LEGACY_UNSIGNED	3
+#define DX_HASH_HALF_MD4_UNSIGNED	4
+#define DX_HASH_TEA_UNSIGNED		5
+
+struct dx_root_info {
+	__u32	reserved_zero;
+	__u8	hash_version;
+	__u8	info_length;		/* 8 */
+	__u8	indirect_levels;
+	__u8	unused_flags;
+};
+
+struct dx_entry {
+	__u32	hash;
+	__u32	block;			/* logical block in the directory */
+};
+
+struct dx_countlimit {
+	__u16	limit;
+	__u16	count;
+};
+
 /*
  * Structure of a directory entry
  */
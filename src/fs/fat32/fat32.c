@@ -646,6 +646,22 @@ static void fat32_close(void *state, void *file)
     }
 }
 
+// every cluster, directory entry and FAT update goes to the device
+// with a blocking write as it is made; fat32 holds nothing back
+static int fat32_sync_fs(void *state)
+{
+    struct fat32_state *fs = (struct fat32_state *)state;
+
+    DEBUG("sync of %s\n", fs->fs->name);
+
+    if (nk_block_dev_flush(fs->dev, NK_DEV_REQ_BLOCKING, 0, 0)) {
+        ERROR("Failed to flush device\n");
+        return -1;
+    }
+
+    return 0;
+}
+
 static struct nk_fs_int fat32_inter = {
     .stat_path = fat32_stat_path,
     .create_file = fat32_create_file,
@@ -658,6 +674,7 @@ static struct nk_fs_int fat32_inter = {
     .close_file = fat32_close,
     .read_file = fat32_read,
     .write_file = fat32_write,
+    .sync_fs = fat32_sync_fs,
 };
 
 static void fat32_demo(struct fat32_state *s)
@@ -747,6 +764,8 @@ int nk_fs_fat32_attach(char *devname, char *fsname, int readonly)
 	return -1;
     }
 
+    nk_block_dev_attach(s->dev);
+
     INFO("filesystem %s on device %s is attached (%s)\n", fsname, devname, readonly ?  "readonly" : "read/write");
     
     //fat32_demo(s);
@@ -760,6 +779,11 @@ int nk_fs_fat32_detach(char *fsname)
     if (!fs) {
         return -1;
     } else {
-        return nk_fs_unregister(fs);
+        struct fat32_state *s = (struct fat32_state *)fs->state;
+        if (nk_fs_unregister(fs)) {
+            return -1;
+        }
+        nk_block_dev_detach(s->dev);
+        return 0;
     }
 }
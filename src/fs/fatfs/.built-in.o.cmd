@@ -0,0 +1 @@
+cmd_src/fs/fatfs/built-in.o :=  ld -z max-page-size=0x1000 -melf_x86_64 -dp  -r -o src/fs/fatfs/built-in.o src/fs/fatfs/diskio.o src/fs/fatfs/ff.o src/fs/fatfs/ffsystem.o src/fs/fatfs/ffunicode.o src/fs/fatfs/ffglue.o src/fs/fatfs/fatfs.o
@@ -1,252 +1,254 @@
-/*-----------------------------------------------------------------------*/
-/* Low level disk I/O module SKELETON for FatFs     (C)ChaN, 2019        */
-/*-----------------------------------------------------------------------*/
-/* If a working storage control module is available, it should be        */
-/* attached to the FatFs via a glue function rather than modifying it.   */
-/* This is an example of glue functions to attach various exsisting      */
-/* storage control modules to the FatFs module with a defined API.       */
-/*-----------------------------------------------------------------------*/
-
-#include "ff.h"			/* Obtains integer types */
-#include "diskio.h"		/* Declarations of disk functions */
-
-
-// PAD:  These need to be implemented based on include/nautilus/blkdev.h
-
-
-// PAD: they have a notion of a physical drive number that will be mapped
-// by this interface to the underlying drive.   What we need to do
-// is have physdrivenum <-> block device ptr mapping array
-// since the rest of the kernel assumes a file system is based on top
-// of a block device, not some weird physical drive thing
-// FATFS probably has this physical drive number concept to make it
-// easier to port to tiny environments
-
-/* Definitions of physical drive number for each drive */
-#define DEV_RAM		0	/* Example: Map Ramdisk to physical drive 0 */
-#define DEV_MMC		1	/* Example: Map MMC/SD card to physical drive 1 */
-#define DEV_USB		2	/* Example: Map USB MSD to physical drive 2 */
-
-
-
-/*-----------------------------------------------------------------------*/
-/* Get Drive Status                                                      */
-/*-----------------------------------------------------------------------*/
-
-DSTATUS disk_status (
-	BYTE pdrv		/* Physical drive nmuber to identify the drive */
-)
-{
-    /*
-      PAD, in our system, this will turn into
-
-
-      block_dev *b = map_pdrv_to_blkdev(pdrv);
-
-      nk_blk_dev_whatever(b, ...)
-
-
-     */
-	DSTATUS stat;
-	int result;
-
-	switch (pdrv) {
-	case DEV_RAM :
-	    // result = RAM_disk_status();
-
-		// translate the reslut code here
-
-		return stat;
-
-	case DEV_MMC :
-	    //	result = MMC_disk_status();
-
-		// translate the reslut code here
-
-		return stat;
-
-	case DEV_USB :
-	    //	result = USB_disk_status();
-
-		// translate the reslut code here
-
-		return stat;
-	}
-	return STA_NOINIT;
-}
-
-
-
-/*-----------------------------------------------------------------------*/
-/* Inidialize a Drive                                                    */
-/*-----------------------------------------------------------------------*/
-
-DSTATUS disk_initialize (
-	BYTE pdrv				/* Physical drive nmuber to identify the drive */
-)
-{
-	DSTATUS stat;
-	int result;
-
-	switch (pdrv) {
-	case DEV_RAM :
-	    //	result = RAM_disk_initialize();
-
-		// translate the reslut code here
-
-		return stat;
-
-	case DEV_MMC :
-	    //	result = MMC_disk_initialize();
-
-		// translate the reslut code here
-
-		return stat;
-
-	case DEV_USB :
-	    //	result = USB_disk_initialize();
-
-		// translate the reslut code here
-
-		return stat;
-	}
-	return STA_NOINIT;
-}
-
-
-
-/*-----------------------------------------------------------------------*/
-/* Read Sector(s)                                                        */
-/*-----------------------------------------------------------------------*/
-
-DRESULT disk_read (
-	BYTE pdrv,		/* Physical drive nmuber to identify the drive */
-	BYTE *buff,		/* Data buffer to store read data */
-	LBA_t sector,	/* Start sector in LBA */
-	UINT count		/* Number of sectors to read */
-)
-{
-	DRESULT res;
-	int result;
-
-	switch (pdrv) {
-	case DEV_RAM :
-		// translate the arguments here
-
-		// result = RAM_disk_read(buff, sector, count);
-
-		// translate the reslut code here
-
-		return res;
-
-	case DEV_MMC :
-		// translate the arguments here
-
-		// result = MMC_disk_read(buff, sector, count);
-
-		// translate the reslut code here
-
-		return res;
-
-	case DEV_USB :
-		// translate the arguments here
-
-		// result = USB_disk_read(buff, sector, count);
-
-		// translate the reslut code here
-
-		return res;
-	}
-
-	return RES_PARERR;
-}
-
-
-
-/*-----------------------------------------------------------------------*/
-/* Write Sector(s)                                                       */
-/*-----------------------------------------------------------------------*/
-
-#if FF_FS_READONLY == 0
-
-DRESULT disk_write (
-	BYTE pdrv,			/* Physical drive nmuber to identify the drive */
-	const BYTE *buff,	/* Data to be written */
-	LBA_t sector,		/* Start sector in LBA */
-	UINT count			/* Number of sectors to write */
-)
-{
-	DRESULT res=-1;
-	int result;
-
-	switch (pdrv) {
-	case DEV_RAM :
-		// translate the arguments here
-
-		//result = RAM_disk_write(buff, sector, count);
-
-		// translate the reslut code here
-
-		return res;
-
-	case DEV_MMC :
-		// translate the arguments here
-
-		//result = MMC_disk_write(buff, sector, count);
-
-		// translate the reslut code here
-
-		return res;
-
-	case DEV_USB :
-		// translate the arguments here
-
-		//result = USB_disk_write(buff, sector, count);
-
-		// translate the reslut code here
-
-		return res;
-	}
-
-	return RES_PARERR;
-}
-
-#endif
-
-
-/*-----------------------------------------------------------------------*/
-/* Miscellaneous Functions                                               */
-/*-----------------------------------------------------------------------*/
-
-DRESULT disk_ioctl (
-	BYTE pdrv,		/* Physical drive nmuber (0..) */
-	BYTE cmd,		/* Control code */
-	void *buff		/* Buffer to send/receive control data */
-)
-{
-	DRESULT res;
-	int result;
-
-	switch (pdrv) {
-	case DEV_RAM :
-
-		// Process of the command for the RAM drive
-
-		return res;
-
-	case DEV_MMC :
-
-		// Process of the command for the MMC/SD card
-
-		return res;
-
-	case DEV_USB :
-
-		// Process of the command the USB drive
-
-		return res;
-	}
-
-	return RES_PARERR;
-}
-
+/*-----------------------------------------------------------------------*/
+/* Low level disk I/O module for FatFs on Nautilus block devices         */
+/* Based on the skeleton (C)ChaN, 2019                                   */
+/*-----------------------------------------------------------------------*/
+/* FatFs names drives by physical drive number (pdrv).  Here each pdrv   */
+/* is a slot in a table of nk_block_devs, filled in by disk_bind when a  */
+/* volume is attached.  FatFs sectors are FF_MAX_SS bytes; devices with  */
+/* smaller blocks that divide a sector are scaled, and a multi-sector    */
+/* request becomes one device request.                                   */
+/*-----------------------------------------------------------------------*/
+
+#include <nautilus/nautilus.h>
+#include <nautilus/blkdev.h>
+#include <nautilus/spinlock.h>
+
+#include "ff.h"			/* Obtains integer types */
+#include "diskio.h"		/* Declarations of disk functions */
+
+
+static struct disk {
+    struct nk_block_dev *dev;
+    uint64_t             blocks_per_sector;
+    uint64_t             num_sectors;
+    DSTATUS              status;
+} disks[FF_VOLUMES];
+
+static spinlock_t disks_lock;
+
+#define DISKS_LOCK_CONF uint8_t _disks_lock_flags
+#define DISKS_LOCK() _disks_lock_flags = spin_lock_irq_save(&disks_lock)
+#define DISKS_UNLOCK() spin_unlock_irq_restore(&disks_lock, _disks_lock_flags)
+
+
+int disk_bind (
+	struct nk_block_dev *dev
+)
+{
+    DISKS_LOCK_CONF;
+    int pdrv;
+
+    DISKS_LOCK();
+    for (pdrv=0;pdrv<FF_VOLUMES;pdrv++) {
+	if (!disks[pdrv].dev) {
+	    disks[pdrv].dev = dev;
+	    disks[pdrv].status = STA_NOINIT;
+	    break;
+	}
+    }
+    DISKS_UNLOCK();
+
+    if (pdrv==FF_VOLUMES) {
+	ERROR("No free physical drive number for device %s\n",dev->dev.name);
+	return -1;
+    }
+
+    DEBUG("Device %s is physical drive %d\n",dev->dev.name,pdrv);
+
+    return pdrv;
+}
+
+
+void disk_unbind (
+	BYTE pdrv
+)
+{
+    DISKS_LOCK_CONF;
+
+    if (pdrv<FF_VOLUMES) {
+	DISKS_LOCK();
+	memset(&disks[pdrv],0,sizeof(disks[pdrv]));
+	DISKS_UNLOCK();
+    }
+}
+
+
+static struct disk *disk_get (
+	BYTE pdrv
+)
+{
+    return (pdrv<FF_VOLUMES && disks[pdrv].dev) ? &disks[pdrv] : 0;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Get Drive Status                                                      */
+/*-----------------------------------------------------------------------*/
+
+DSTATUS disk_status (
+	BYTE pdrv		/* Physical drive nmuber to identify the drive */
+)
+{
+    struct disk *d = disk_get(pdrv);
+
+    return d ? d->status : STA_NOINIT | STA_NODISK;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Inidialize a Drive                                                    */
+/*-----------------------------------------------------------------------*/
+
+DSTATUS disk_initialize (
+	BYTE pdrv				/* Physical drive nmuber to identify the drive */
+)
+{
+    struct disk *d = disk_get(pdrv);
+    struct nk_block_dev_characteristics c;
+
+    if (!d) {
+	return STA_NOINIT | STA_NODISK;
+    }
+
+    if (nk_block_dev_get_characteristics(d->dev,&c)) {
+	ERROR("Cannot get characteristics of device %s\n",d->dev->dev.name);
+	return STA_NOINIT;
+    }
+
+    if (!c.block_size || c.block_size > FF_MAX_SS || FF_MAX_SS % c.block_size) {
+	ERROR("Device %s has block size %lu, which does not divide a %u byte sector\n",
+	      d->dev->dev.name, c.block_size, FF_MAX_SS);
+	return STA_NOINIT;
+    }
+
+    d->blocks_per_sector = FF_MAX_SS / c.block_size;
+    d->num_sectors = c.num_blocks / d->blocks_per_sector;
+    d->status = 0;
+
+    DEBUG("Physical drive %u: %lu sectors\n",pdrv,d->num_sectors);
+
+    return d->status;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Read Sector(s)                                                        */
+/*-----------------------------------------------------------------------*/
+
+DRESULT disk_read (
+	BYTE pdrv,		/* Physical drive nmuber to identify the drive */
+	BYTE *buff,		/* Data buffer to store read data */
+	LBA_t sector,	/* Start sector in LBA */
+	UINT count		/* Number of sectors to read */
+)
+{
+    struct disk *d = disk_get(pdrv);
+
+    if (!d || !count) {
+	return RES_PARERR;
+    }
+
+    if (d->status & STA_NOINIT) {
+	return RES_NOTRDY;
+    }
+
+    if (sector + count > d->num_sectors) {
+	return RES_PARERR;
+    }
+
+    if (nk_block_dev_read(d->dev, sector*d->blocks_per_sector, (uint64_t)count*d->blocks_per_sector,
+			  buff, NK_DEV_REQ_BLOCKING, 0, 0)) {
+	ERROR("Failed to read %u sectors at %lu from physical drive %u\n",count,sector,pdrv);
+	return RES_ERROR;
+    }
+
+    return RES_OK;
+}
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Write Sector(s)                                                       */
+/*-----------------------------------------------------------------------*/
+
+#if FF_FS_READONLY == 0
+
+DRESULT disk_write (
+	BYTE pdrv,			/* Physical drive nmuber to identify the drive */
+	const BYTE *buff,	/* Data to be written */
+	LBA_t sector,		/* Start sector in LBA */
+	UINT count			/* Number of sectors to write */
+)
+{
+    struct disk *d = disk_get(pdrv);
+
+    if (!d || !count) {
+	return RES_PARERR;
+    }
+
+    if (d->status & STA_NOINIT) {
+	return RES_NOTRDY;
+    }
+
+    if (sector + count > d->num_sectors) {
+	return RES_PARERR;
+    }
+
+    if (nk_block_dev_write(d->dev, sector*d->blocks_per_sector, (uint64_t)count*d->blocks_per_sector,
+			   (void *)buff, NK_DEV_REQ_BLOCKING, 0, 0)) {
+	ERROR("Failed to write %u sectors at %lu to physical drive %u\n",count,sector,pdrv);
+	return RES_ERROR;
+    }
+
+    return RES_OK;
+}
+
+#endif
+
+
+/*-----------------------------------------------------------------------*/
+/* Miscellaneous Functions                                               */
+/*-----------------------------------------------------------------------*/
+
+DRESULT disk_ioctl (
+	BYTE pdrv,		/* Physical drive nmuber (0..) */
+	BYTE cmd,		/* Control code */
+	void *buff		/* Buffer to send/receive control data */
+)
+{
+    struct disk *d = disk_get(pdrv);
+
+    if (!d) {
+	return RES_PARERR;
+    }
+
+    if (d->status & STA_NOINIT) {
+	return RES_NOTRDY;
+    }
+
+    switch (cmd) {
+    case CTRL_SYNC:
+	// blocking requests are complete when they return, but may still
+	// be in the device's write cache
+	if (nk_block_dev_flush(d->dev, NK_DEV_REQ_BLOCKING, 0, 0)) {
+	    ERROR("Cannot flush device %s\n",d->dev->dev.name);
+	    return RES_ERROR;
+	}
+	return RES_OK;
+    case GET_SECTOR_COUNT:
+	*(LBA_t *)buff = d->num_sectors;
+	return RES_OK;
+    case GET_SECTOR_SIZE:
+	*(WORD *)buff = FF_MAX_SS;
+	return RES_OK;
+    case GET_BLOCK_SIZE:
+	// erase block size is unknown
+	*(DWORD *)buff = 1;
+	return RES_OK;
+    default:
+	return RES_PARERR;
+    }
+}
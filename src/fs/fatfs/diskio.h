@@ -25,7 +25,11 @@ typedef enum {
 /*---------------------------------------*/
 /* Prototypes for disk control functions */
 
-// PAD:  These need to be implemented based on include/nautilus/blkdev.h
+// Nautilus: a block device is bound to a free physical drive number
+// (returned, or -1) before its volume is mounted, and unbound after
+struct nk_block_dev;
+int disk_bind (struct nk_block_dev *dev);
+void disk_unbind (BYTE pdrv);
 
 DSTATUS disk_initialize (BYTE pdrv);
 DSTATUS disk_status (BYTE pdrv);
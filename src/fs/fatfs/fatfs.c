@@ -28,20 +28,34 @@
 
 #include <fs/fat32/fat32.h>
 
+#include <fs/fatfs/fatfs.h>
+
 #include "fatfs_helper.c"
 #include "fatfs.h"
+#include "ffglue.h"
 
-static int fatfs_exists(void *state, char *path)
+static int __fatfs_exists(void *state, char *path)
 {
     dir_entry dir_ent;
+    uint32_t dir_cluster_num;
     struct fatfs_state *fs = (struct fatfs_state *)state;
-    return path_lookup(fs, path, NULL, &dir_ent, 0) != -1;
+    return path_lookup(fs, path, &dir_cluster_num, &dir_ent, 0) != -1;
 }
 
-static ssize_t fatfs_read_write(void *state, void *file, void *srcdest, off_t offset, size_t num_bytes, int write)
+static int fatfs_exists(void *state, char *path)
 {
-    char *rw[2] = {"read","write"};
+    struct fatfs_state *fs = (struct fatfs_state *)state;
+    int rc;
+
+    NS_LOCK(fs);
+    rc = __fatfs_exists(state, path);
+    NS_UNLOCK(fs);
 
+    return rc;
+}
+
+static ssize_t fatfs_read_write(void *state, void *file, void *srcdest, off_t offset, size_t num_bytes, int write)
+{
     if (srcdest == NULL) {
         return -1; // if buffer is NULL
     }
@@ -53,7 +67,7 @@ static ssize_t fatfs_read_write(void *state, void *file, void *srcdest, off_t of
     uint32_t dir_cluster_num;
     dir_entry dir_ent;
 
-    DEBUG("%s from fs %s file %s offset %lu %lu bytes\n",rw[write], fs->fs->name, (char*) file, offset, num_bytes);
+    DEBUG("%s from fs %s file %s offset %lu %lu bytes\n",write ? "write" : "read", fs->fs->name, (char*) file, offset, num_bytes);
 
     int dir_num = path_lookup(fs, (char*) file, &dir_cluster_num, &dir_ent, 0);
     if (dir_num == -1) {
@@ -103,7 +117,7 @@ static ssize_t fatfs_read_write(void *state, void *file, void *srcdest, off_t of
     uint32_t cluster_max = fs->table_chars.data_end - fs->table_chars.data_start; // max valid cluster number
 
     // scan the FAT chain until we find the relevant cluster
-    while (remainder > cluster_size) {
+    while (remainder > cluster_size || (remainder == cluster_size && !write)) {
         uint32_t next = fs->table_chars.fatfs_begin[cluster_num];
         //check if next is valid
         if ( next >= EOC_MIN && next <= EOC_MAX ) {
@@ -123,7 +137,6 @@ static ssize_t fatfs_read_write(void *state, void *file, void *srcdest, off_t of
     char buf[cluster_size];
     if (write) { // write
         //suppose we have the file
-        int rc;
         long src_off = 0;
         if (offset + num_bytes < file_size ) {  //don't need to allocate new block
             //update file content
@@ -201,18 +214,7 @@ static ssize_t fatfs_read_write(void *state, void *file, void *srcdest, off_t of
             }
 
             //Update directory entry
-            dir_entry dir_buf[fs->bootrecord.directory_entry_num];
-            if (nk_block_dev_read(fs->dev, get_sector_num(dir_cluster_num, fs), fs->bootrecord.cluster_size, dir_buf, NK_DEV_REQ_BLOCKING,0,0)) {
-                ERROR("Failed to read block.\n");
-                // unwind...
-                return -1;
-            }
-
-            uint32_t new_file_size = offset + num_bytes;
-            dir_buf[dir_num].size = new_file_size;
-
-            if (nk_block_dev_write(fs->dev, get_sector_num(dir_cluster_num, fs), fs->bootrecord.cluster_size, dir_buf, NK_DEV_REQ_BLOCKING,0,0)) {
-                ERROR("Failed to write block.\n");
+            if (set_entry_size(fs, (char*) file, dir_cluster_num, dir_num, offset + num_bytes)) {
                 // unwind...
                 return -1;
             }
@@ -224,21 +226,25 @@ static ssize_t fatfs_read_write(void *state, void *file, void *srcdest, off_t of
         long dest_off = 0;
 
         do {
-            if (nk_block_dev_read(fs->dev, get_sector_num(cluster_num, fs), fs->bootrecord.cluster_size, buf, NK_DEV_REQ_BLOCKING,0,0)) {
-                ERROR("Failed to read block\n");
-                return -1;
+            // memory-backed devices let us copy straight out of the device
+            char *src = direct_cluster(fs, cluster_num);
+            if (!src) {
+                if (nk_block_dev_read(fs->dev, get_sector_num(cluster_num, fs), fs->bootrecord.cluster_size, buf, NK_DEV_REQ_BLOCKING,0,0)) {
+                    ERROR("Failed to read block\n");
+                    return -1;
+                }
+                src = buf;
             }
 
             if (remainder > 0) {
-                memcpy(srcdest + dest_off, (char *)buf + remainder, MIN(cluster_size - remainder, to_be_read));
+                memcpy(srcdest + dest_off, src + remainder, MIN(cluster_size - remainder, to_be_read));
+                dest_off += MIN(cluster_size - remainder, to_be_read);
                 to_be_read = to_be_read - cluster_size + remainder;
 
-                dest_off += MIN(cluster_size - remainder, to_be_read);
                 DEBUG("dest_off is %ld\n", dest_off);
                 remainder = 0;
             } else {
-                memcpy(srcdest + dest_off, buf, MIN(to_be_read, cluster_size));
-                DEBUG("read buf is %s\n", buf);
+                memcpy(srcdest + dest_off, src, MIN(to_be_read, cluster_size));
                 dest_off += MIN(to_be_read, cluster_size);
                 DEBUG("dest_off is %ld\n", dest_off);
                 to_be_read -= cluster_size;
@@ -261,20 +267,122 @@ static ssize_t fatfs_read_write(void *state, void *file, void *srcdest, off_t of
 
 static ssize_t fatfs_read(void *state, void *file, void *srcdest, off_t offset, size_t num_bytes)
 {
-    return fatfs_read_write(state,file,srcdest,offset,num_bytes,0);
+    struct fatfs_state *fs = (struct fatfs_state *)state;
+    ssize_t rc;
+
+    NS_LOCK(fs);
+    file_lock(fs, file, 0);
+    rc = fatfs_read_write(state,file,srcdest,offset,num_bytes,0);
+    file_unlock(fs, file, 0);
+    NS_UNLOCK(fs);
+
+    return rc;
 }
 
 static ssize_t fatfs_write(void *state, void *file, void *srcdest, off_t offset, size_t num_bytes)
 {
-    return fatfs_read_write(state,file,srcdest,offset,num_bytes,1);
+    struct fatfs_state *fs = (struct fatfs_state *)state;
+    ssize_t rc;
+
+    NS_LOCK(fs);
+    file_lock(fs, file, 1);
+    rc = fatfs_read_write(state,file,srcdest,offset,num_bytes,1);
+    file_unlock(fs, file, 1);
+    NS_UNLOCK(fs);
+
+    return rc;
+}
+
+static ssize_t __fatfs_read_direct(void *state, void *file, off_t offset, size_t num_bytes, void **ptr)
+{
+    struct fatfs_state *fs = (struct fatfs_state *) state;
+    uint32_t dir_cluster_num;
+    dir_entry dir_ent;
+
+    DEBUG("direct read from fs %s file %s offset %lu %lu bytes\n", fs->fs->name, (char*) file, offset, num_bytes);
+
+    if (path_lookup(fs, (char*) file, &dir_cluster_num, &dir_ent, 0) == -1) {
+        DEBUG("Directory entry does not exist\n");
+        return -1;
+    }
+
+    if (offset >= dir_ent.size) {
+        return 0;
+    }
+
+    num_bytes = MIN(num_bytes, dir_ent.size - offset);
+
+    uint32_t cluster_size = get_cluster_size(fs);
+    uint32_t cluster_num = DECODE_CLUSTER(dir_ent.high_cluster, dir_ent.low_cluster);
+    uint32_t cluster_min = fs->bootrecord.rootdir_cluster;
+    uint32_t cluster_max = fs->table_chars.data_end - fs->table_chars.data_start;
+    uint32_t *fat = fs->table_chars.fatfs_begin;
+    off_t remainder = offset;
+
+    while (remainder >= cluster_size) {
+        uint32_t next = fat[cluster_num];
+        if (next < cluster_min || next > cluster_max) {
+            DEBUG("Bogus next cluster value (%x)\n",next);
+            return -1;
+        }
+        cluster_num = next;
+        remainder -= cluster_size;
+    }
+
+    char *base = direct_cluster(fs, cluster_num);
+    if (!base) {
+        return -1;
+    }
+
+    // extend across clusters that follow each other in the chain and in memory
+    uint32_t first_cluster_num = cluster_num;
+    size_t avail = cluster_size - remainder;
+    while (avail < num_bytes &&
+           fat[cluster_num] == cluster_num + 1 &&
+           direct_cluster(fs, cluster_num + 1) == base + (cluster_num + 1 - first_cluster_num) * cluster_size) {
+        cluster_num++;
+        avail += cluster_size;
+    }
+
+    *ptr = base + remainder;
+
+    return MIN(avail, num_bytes);
+}
+
+static int defrag_running(struct fatfs_state *fs);
+
+// the pointer returned is only good until the file is next written or
+// moved, so none is handed out while the defragmenter runs
+static ssize_t fatfs_read_direct(void *state, void *file, off_t offset, size_t num_bytes, void **ptr)
+{
+    struct fatfs_state *fs = (struct fatfs_state *)state;
+    ssize_t rc;
+
+    NS_LOCK(fs);
+    if (defrag_running(fs)) {
+        NS_UNLOCK(fs);
+        return -1;
+    }
+    file_lock(fs, file, 0);
+    rc = __fatfs_read_direct(state, file, offset, num_bytes, ptr);
+    file_unlock(fs, file, 0);
+    NS_UNLOCK(fs);
+
+    return rc;
 }
 
 static int fatfs_stat_path(void *state, char *path, struct nk_fs_stat *st)
 {
     struct fatfs_state *fs = (struct fatfs_state *)state;
     dir_entry dir_ent;
-    int num;
+    uint32_t num;
+
+    NS_LOCK(fs);
+    file_lock(fs, path, 0);
     int dir_num = path_lookup(fs, (char*) path, &num, &dir_ent, 0);
+    file_unlock(fs, path, 0);
+    NS_UNLOCK(fs);
+
     if(dir_num == -1) return -1;
 
     st->st_size = dir_ent.size;
@@ -285,12 +393,11 @@ static int fatfs_stat_path(void *state, char *path, struct nk_fs_stat *st)
 
 static void *fatfs_create(void *state, char *path, int isdir)
 {
-    char *fd[2] = {"file","dir"};
     isdir &= 0x1;
     struct fatfs_state *fs = (struct fatfs_state *)state;
-    DEBUG("create %s %s on fs %s\n", fd[isdir], path, fs->fs->name);
+    DEBUG("create %s %s on fs %s\n", isdir ? "dir" : "file", path, fs->fs->name);
 
-    if (fatfs_exists(state, path)) {
+    if (__fatfs_exists(state, path)) {
         return NULL; // file already exists
     }
 
@@ -303,8 +410,8 @@ static void *fatfs_create(void *state, char *path, int isdir)
     }
 
     char *name = parts[num_parts - 1]; // get name of file
-    char path_without_name[strlen(path)];
-    strncpy(path_without_name, path, strlen(path));
+    char path_without_name[strlen(path)+1];
+    strcpy(path_without_name, path);
     for (int i = strlen(path_without_name); i >= 0; --i) {
         if (path_without_name[i] == '/') {
             path_without_name[i] = 0; // get path (excluding name) of file
@@ -316,7 +423,6 @@ static void *fatfs_create(void *state, char *path, int isdir)
     dir_entry dir_ent;
     uint32_t cluster_num;
     uint32_t num_dir_entry_per_file = FLOOR_DIV(fs->bootrecord.sector_size, sizeof(dir_entry));
-    dir_entry full_dirs[num_dir_entry_per_file]; // buffer for b
     DEBUG("path_without_name is %s\n", path_without_name);
     int dir_num = path_lookup(fs, path_without_name, &dir_cluster_num, &dir_ent, 1);
     DEBUG("dir_num is %d\n", dir_num);
@@ -330,11 +436,6 @@ static void *fatfs_create(void *state, char *path, int isdir)
             free_split_path(parts,num_parts);
             return NULL;
         }
-        if (nk_block_dev_read(fs->dev, get_sector_num(dir_cluster_num, fs), 1, full_dirs, NK_DEV_REQ_BLOCKING,0,0)) {
-            ERROR("block read failed\n");
-            free_split_path(parts,num_parts);
-            return NULL;
-        }
         cluster_num = DECODE_CLUSTER(dir_ent.high_cluster, dir_ent.low_cluster);
     }
 
@@ -343,7 +444,7 @@ static void *fatfs_create(void *state, char *path, int isdir)
     uint32_t cluster_min = fs->bootrecord.rootdir_cluster; // min valid cluster number
     uint32_t cluster_max = fs->table_chars.data_end - fs->table_chars.data_start; // max valid cluster number
     uint32_t * fat = fs->table_chars.fatfs_begin;
-    while (fat[cluster_num] >= cluster_min && fat[cluster_num] <= cluster_min) { // find the last cluster of c
+    while (fat[cluster_num] >= cluster_min && fat[cluster_num] <= cluster_max) { // find the last cluster of c
         cluster_num = fat[cluster_num];
     }
 
@@ -356,23 +457,25 @@ static void *fatfs_create(void *state, char *path, int isdir)
     }
 
     int i = 0;
-    while (full_dirs2[i].name[0] != 0) { // dir_entry already used
+    while (i < num_dir_entry_per_file && full_dirs2[i].name[0] != 0) { // dir_entry already used
         ++i;
     }
 
+    uint32_t grow_from = 0; // last cluster of c, if c has to be extended
     if (i == num_dir_entry_per_file) { // cluster is full of dir_entry ==> extend current file
-        if (grow_shrink_chain(fs, cluster_num, 1) == -1) { // out of memory
+        // the new cluster is only linked to c once it has been written,
+        // so that lookups in c never see it half done
+        int new_dir_cluster_num = grow_shrink_chain(fs, -1, 1);
+        if (new_dir_cluster_num == -1) { // out of memory
             ERROR("Failed to allocate block\n");
             free_split_path(parts,num_parts);
             return NULL;
         }
-        cluster_num = fat[cluster_num]; // advance to the allocated cluster
+        grow_from = cluster_num;
+        cluster_num = new_dir_cluster_num; // advance to the allocated cluster
         i = 0; // start of cluster
-        if (nk_block_dev_read(fs->dev, get_sector_num(cluster_num, fs), 1, full_dirs2, NK_DEV_REQ_BLOCKING,0,0)) { // read the new cluster of c
-            ERROR("Failed to read block\n");
-            free_split_path(parts,num_parts);
-            return NULL;
-        }
+        // the cluster may hold a removed file's data, which must not read as entries
+        memset(full_dirs2, 0, sizeof(full_dirs2));
     }
 
     // fill info in dir_entry full_dirs2[i]??
@@ -386,8 +489,31 @@ static void *fatfs_create(void *state, char *path, int isdir)
 
     DEBUG("updating dir_entry, new file cluster_num = %d\n", new_file_cluster_num);
 
+    int rc;
+    if (isdir) {
+        // an empty directory, for the same reason
+        void *empty = malloc(get_cluster_size(fs));
+        if (!empty) {
+            ERROR("Cannot allocate new directory\n");
+            free_split_path(parts,num_parts);
+            return NULL;
+        }
+        memset(empty, 0, get_cluster_size(fs));
+        rc = nk_block_dev_write(fs->dev, get_sector_num(new_file_cluster_num, fs), fs->bootrecord.cluster_size, empty, NK_DEV_REQ_BLOCKING,0,0);
+        free(empty);
+        if (rc) {
+            ERROR("Failed to clear new directory\n");
+            free_split_path(parts,num_parts);
+            return NULL;
+        }
+    }
+
+    // short names are padded with spaces, which is what other FAT readers match on
+    memset(full_dirs2[i].name, ' ', 8);
+    memset(full_dirs2[i].ext, ' ', 3);
+
     if (isdir) {
-        strncpy(full_dirs2[i].name, name, 8);
+        memcpy(full_dirs2[i].name, name, MIN(strlen(name), 8));
         full_dirs2[i].attri.attris = 0;
         full_dirs2[i].attri.each_att.dir = 1;
     } else {
@@ -404,15 +530,7 @@ static void *fatfs_create(void *state, char *path, int isdir)
     full_dirs2[i].high_cluster = EXTRACT_HIGH_CLUSTER(new_file_cluster_num);
     full_dirs2[i].low_cluster = EXTRACT_LOW_CLUSTER(new_file_cluster_num);
 
-    int rc;
-    if (path_without_name[0] != 0) { // make sure path not like "/name"
-        dir_ent.size += sizeof(dir_entry); // increment size of c in (dir entry of c in b)
-        if (nk_block_dev_write(fs->dev, get_sector_num(dir_cluster_num, fs), fs->bootrecord.cluster_size, full_dirs, NK_DEV_REQ_BLOCKING,0,0)) {
-            ERROR("Failed to write block for full_dirs.\n");
-            free_split_path(parts,num_parts);
-            return NULL;
-        }
-    }
+    // directories have no size in FAT, so the entry of c itself is left alone
 
     if (nk_block_dev_write(fs->dev, get_sector_num(cluster_num, fs), fs->bootrecord.cluster_size, full_dirs2, NK_DEV_REQ_BLOCKING,0,0)) {
         ERROR("Failed to write on block for full_dirs2.\n");
@@ -420,20 +538,56 @@ static void *fatfs_create(void *state, char *path, int isdir)
         return NULL;
     }
 
+    if (grow_from) {
+        ALLOC_LOCK(fs);
+        fat[grow_from] = cluster_num;
+        rc = write_FAT_entries(fs, grow_from, grow_from);
+        ALLOC_UNLOCK(fs);
+        if (rc) {
+            ERROR("Failed to extend directory\n");
+            free_split_path(parts,num_parts);
+            return NULL;
+        }
+    }
+
     free_split_path(parts,num_parts);
     //return ptr to the dir_entry of the newly created file
     // huh?
     return (void*) (1);
 }
 
+static void * fatfs_open(void *state, char *path);
+
 static void *fatfs_create_file(void *state, char *path)
 {
-    return fatfs_create(state, path, 0);
+    struct fatfs_state *fs = (struct fatfs_state *)state;
+    void *f;
+
+    // creates in one directory are serialized, from the check that the
+    // name is free to the write of the new entry
+    NS_LOCK(fs);
+    DIR_LOCK(fs, path);
+    f = fatfs_create(state, path, 0);
+    DIR_UNLOCK(fs, path);
+    NS_UNLOCK(fs);
+
+    if (!f) {
+        return NULL;
+    }
+    // files are named by their path, as fatfs_open names them
+    return fatfs_open(state, path);
 }
 
 static int fatfs_create_dir(void *state, char *path)
 {
-    void *f = fatfs_create(state,path,1);
+    struct fatfs_state *fs = (struct fatfs_state *)state;
+    void *f;
+
+    NS_LOCK(fs);
+    DIR_LOCK(fs, path);
+    f = fatfs_create(state,path,1);
+    DIR_UNLOCK(fs, path);
+    NS_UNLOCK(fs);
 
     if (!f) {
         return -1;
@@ -442,15 +596,15 @@ static int fatfs_create_dir(void *state, char *path)
     }
 }
 
-int fatfs_remove(void *state, char *path)
+static int __fatfs_remove(void *state, char *path)
 {
     struct fatfs_state *fs = (struct fatfs_state *) state;
     uint32_t * fat = fs->table_chars.fatfs_begin;
-    uint32_t fat_size = fs->table_chars.fatfs_size;
     uint32_t cluster_min = fs->bootrecord.rootdir_cluster; // min valid cluster number
     uint32_t cluster_max = fs->table_chars.data_end - fs->table_chars.data_start; // max valid cluster number
     uint32_t dir_cluster_num;
     dir_entry dir_ent;
+    int rc;
 
     DEBUG("remove %s from fs %s\n",path,fs->fs->name);
 
@@ -462,43 +616,51 @@ int fatfs_remove(void *state, char *path)
 
     //clear FAT table entries for the file
     uint32_t cluster_num = DECODE_CLUSTER(dir_ent.high_cluster, dir_ent.low_cluster);
+    uint32_t lo = cluster_num, hi = cluster_num;
+    ALLOC_LOCK(fs);
     do {
-        uint32_t next = fs->table_chars.fatfs_begin[cluster_num];
+        uint32_t next = fat[cluster_num];
         if( next < cluster_min || ( next > cluster_max && next < EOC_MIN ) ) {
             ERROR("Cluster chain has invalid entry\n");
+            write_FAT_entries(fs, lo, hi);
+            ALLOC_UNLOCK(fs);
             return -1;
         }
-        fs->table_chars.fatfs_begin[cluster_num] = FREE_CLUSTER;
+        fat[cluster_num] = FREE_CLUSTER;
+        lo = MIN(lo, cluster_num);
+        hi = MAX(hi, cluster_num);
         cluster_num = next;
     } while (! (cluster_num >= EOC_MIN && cluster_num <= EOC_MAX) );
 
-    fs->table_chars.fatfs_begin[cluster_num] = FREE_CLUSTER;
-    if (nk_block_dev_write(fs->dev, fs->bootrecord.reservedblock_size, fat_size, fat, NK_DEV_REQ_BLOCKING,0,0)) {
-        ERROR("Failed to write block\n");
-        return -1;
-    }
-
-    if (nk_block_dev_write(fs->dev, fs->bootrecord.reservedblock_size + fat_size, fat_size, fat, NK_DEV_REQ_BLOCKING,0,0)) {
+    rc = write_FAT_entries(fs, lo, hi);
+    ALLOC_UNLOCK(fs);
+    if (rc) {
         ERROR("Failed to write block\n");
         return -1;
     }
 
     //remove the directory entry
     dir_entry full_dirs[FLOOR_DIV(fs->bootrecord.sector_size, sizeof(dir_entry))];
+    DIR_LOCK(fs, path);
     if (nk_block_dev_read(fs->dev, get_sector_num(dir_cluster_num, fs), 1, full_dirs, NK_DEV_REQ_BLOCKING,0,0)) {
+        DIR_UNLOCK(fs, path);
         ERROR("Failed to read block\n");
         return -1;
     }
     DEBUG("dir_num is %d\n", dir_num);
+    // a zeroed entry would end the directory, hiding every entry after it
     memset(full_dirs + dir_num, 0, sizeof(dir_entry));
-    if (nk_block_dev_write(fs->dev, get_sector_num(dir_cluster_num, fs), 1, full_dirs, NK_DEV_REQ_BLOCKING,0,0)) {
+    full_dirs[dir_num].name[0] = 0xE5;
+    rc = nk_block_dev_write(fs->dev, get_sector_num(dir_cluster_num, fs), 1, full_dirs, NK_DEV_REQ_BLOCKING,0,0);
+    DIR_UNLOCK(fs, path);
+    if (rc) {
         ERROR("Failed to write block\n");
         return -1;
     }
     return 0;
 }
 
-static void * fatfs_open(void *state, char *path)
+static void * __fatfs_open(void *state, char *path)
 {
     struct fatfs_state *fs = (struct fatfs_state *)state;
 
@@ -515,12 +677,10 @@ static void * fatfs_open(void *state, char *path)
     dir_entry full_dirs[FLOOR_DIV(fs->bootrecord.sector_size, sizeof(dir_entry))];
     if(nk_block_dev_read(fs->dev, get_sector_num(dir_cluster_num, fs), 1, full_dirs, NK_DEV_REQ_BLOCKING, 0, 0)) {
         ERROR("FAiled to read block\n");
-        return;
+        return NULL;
     }
-    dir_entry *dir = &full_dirs[dir_num];
 
-    uint32_t cluster_num = DECODE_CLUSTER(dir_ent.high_cluster, dir_ent.low_cluster);
-    DEBUG("Open of %s returned cluster number %u\n", path, cluster_num);
+    DEBUG("Open of %s returned cluster number %u\n", path, DECODE_CLUSTER(dir_ent.high_cluster, dir_ent.low_cluster));
 
     return (void*)path;
 }
@@ -530,7 +690,7 @@ static int fatfs_stat(void *state, void *file, struct nk_fs_stat *st)
     return fatfs_stat_path(state, file, st);
 }
 
-static int fatfs_truncate(void *state, void *file, off_t len)
+static int __fatfs_truncate(void *state, void *file, off_t len)
 {
     struct fatfs_state *fs = (struct fatfs_state *)state;
     uint32_t dir_cluster_num;
@@ -598,23 +758,10 @@ static int fatfs_truncate(void *state, void *file, off_t len)
         return -1;
     }
     //set new file size and write directory entry back
-    dir_entry full_dirs[FLOOR_DIV(fs->bootrecord.sector_size, sizeof(dir_entry))];
-
-    if (nk_block_dev_read(fs->dev, get_sector_num(dir_cluster_num, fs), 1, full_dirs, NK_DEV_REQ_BLOCKING,0,0)) {
-        ERROR("FAiled to read block\n");
-        return -1;
-    }
-    full_dirs[dir_num].size = (uint32_t) new_file_size;
-
-    if (nk_block_dev_write(fs->dev, get_sector_num(dir_cluster_num, fs), 1, full_dirs, NK_DEV_REQ_BLOCKING,0,0)) {
-        ERROR("Failed to write block\n");
-        return -1;
-    }
-
-    return 0;
+    return set_entry_size(fs, (char*) file, dir_cluster_num, dir_num, (uint32_t) new_file_size);
 }
 
-static void fatfs_close(void *state, void *file)
+static void __fatfs_close(void *state, void *file)
 {
     uint32_t dir_cluster_num;
     dir_entry dir_ent;
@@ -634,15 +781,33 @@ static void fatfs_close(void *state, void *file)
         ERROR("FAiled to read block\n");
         return;
     }
-    dir_entry *dir = &full_dirs[dir_num];
 
-    uint32_t cluster_num = DECODE_CLUSTER(dir_ent.high_cluster, dir_ent.low_cluster);
-    DEBUG("Close of %s returned cluster number %u\n", fs->fs->name, cluster_num);
+    DEBUG("Close of %s returned cluster number %u\n", fs->fs->name, DECODE_CLUSTER(dir_ent.high_cluster, dir_ent.low_cluster));
+}
 
-    return (void*)path;
+static void *fatfs_open(void *state, char *path)
+{
+    struct fatfs_state *fs = (struct fatfs_state *)state;
+    void *f;
+
+    NS_LOCK(fs);
+    f = __fatfs_open(state, path);
+    NS_UNLOCK(fs);
+
+    return f;
 }
 
-static int fatfs_rename(void *state, char *path_old, char *path_new, int isdir) {
+static void fatfs_close(void *state, void *file)
+{
+    struct fatfs_state *fs = (struct fatfs_state *)state;
+
+    NS_LOCK(fs);
+    __fatfs_close(state, file);
+    NS_UNLOCK(fs);
+}
+
+static int __fatfs_rename(void *state, char *path_old, char *path_new, int isdir)
+{
     char *fd[2] = {"file","dir"};
     isdir &= 0x1;
 
@@ -656,61 +821,519 @@ static int fatfs_rename(void *state, char *path_old, char *path_new, int isdir)
         return -1;
     }
 
-    if (fatfs_exists(state, path_new)) {
+    if (__fatfs_exists(state, path_new)) {
         ERROR("The new %s already exists\n", fd[isdir]);
         return -1;
     }
 
     DEBUG("Rename %s %s on fs %s\n", fd[isdir], path_old, fs->fs->name);
 
-    if(isdir) {
-        //Update directory entry
-        dir_entry dir_buf[FLOOR_DIV(fs->bootrecord.sector_size, sizeof(dir_entry))];
-        if (nk_block_dev_read(fs->dev, get_sector_num(dir_cluster_num, fs), fs->bootrecord.cluster_size, dir_buf, NK_DEV_REQ_BLOCKING, 0, 0)) {
-            ERROR("Failed to read block.\n");
-            // unwind...
-            return -1;
+    // files and directories are renamed alike, in their directory entry
+    dir_entry dir_buf[get_cluster_size(fs) / sizeof(dir_entry)];
+    if (nk_block_dev_read(fs->dev, get_sector_num(dir_cluster_num, fs), fs->bootrecord.cluster_size, dir_buf, NK_DEV_REQ_BLOCKING, 0, 0)) {
+        ERROR("Failed to read block.\n");
+        // unwind...
+        return -1;
+    }
+
+    int num_parts;
+    char** parts = split_path(path_new, &num_parts); // upper case since fatfs_exists
+    char *name = parts[num_parts - 1]; // get name of file
+    int name_len, ext_len;
+
+    memset(dir_buf[dir_num].name, ' ', 8);
+    memset(dir_buf[dir_num].ext, ' ', 3);
+    filename_parser(name, dir_buf[dir_num].name, dir_buf[dir_num].ext, &name_len, &ext_len);
+    free_split_path(parts, num_parts);
+
+    if (nk_block_dev_write(fs->dev, get_sector_num(dir_cluster_num, fs), fs->bootrecord.cluster_size, dir_buf, NK_DEV_REQ_BLOCKING, 0, 0)) {
+        ERROR("Failed to write block.\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+static uint32_t dir_cluster_of(struct fatfs_state *fs, char *path)
+{
+    uint32_t dir_cluster_num;
+    dir_entry dir_ent;
+    int len = strlen(path);
+    char buf[len + 1];
+
+    while (len && path[len - 1] == '/') {
+        len--;
+    }
+
+    if (!len) {
+        return fs->bootrecord.rootdir_cluster;
+    }
+
+    // path_lookup upper-cases in place
+    strncpy(buf, path, len);
+    buf[len] = 0;
+
+    if (path_lookup(fs, buf, &dir_cluster_num, &dir_ent, 1) == -1 || !dir_ent.attri.each_att.dir) {
+        DEBUG("%s is not a directory\n", path);
+        return 0;
+    }
+
+    return DECODE_CLUSTER(dir_ent.high_cluster, dir_ent.low_cluster);
+}
+
+static void *fatfs_opendir(void *state, char *path)
+{
+    struct fatfs_state *fs = (struct fatfs_state *)state;
+    uint32_t cluster;
+
+    NS_LOCK(fs);
+    cluster = dir_cluster_of(fs, path);
+    NS_UNLOCK(fs);
+
+    DEBUG("opendir %s on fs %s is cluster %u\n", path, fs->fs->name, cluster);
+
+    return cluster ? dir_cursor_open(fs, cluster) : 0;
+}
+
+static ssize_t fatfs_readdir_batch(void *state, void *dir, struct nk_fs_dirent *ents, size_t n)
+{
+    struct fatfs_state *fs = (struct fatfs_state *)state;
+    size_t i;
+    int rc = 0;
+
+    NS_LOCK(fs);
+    for (i = 0; i < n; i++) {
+        rc = dir_cursor_next(fs, (struct dir_cursor *)dir, &ents[i], 0);
+        if (rc <= 0) {
+            break;
         }
+    }
+    NS_UNLOCK(fs);
 
-        int num_parts;
-        char** parts = split_path(path_new, &num_parts);
-        char *name = parts[num_parts - 1]; // get name of file
+    return rc < 0 && !i ? -1 : i;
+}
 
-        strncpy(dir_buf[dir_num].name, name, 8);
+static void fatfs_closedir(void *state, void *dir)
+{
+    dir_cursor_close((struct dir_cursor *)dir);
+}
 
-        if (nk_block_dev_write(fs->dev, get_sector_num(dir_cluster_num, fs), fs->bootrecord.cluster_size, dir_buf, NK_DEV_REQ_BLOCKING, 0, 0)) {
-            ERROR("Failed to write block.\n");
-            free_split_path(parts, num_parts);
+// names match either the long or the 8.3 name, ignoring case
+static int __fatfs_stat_many(void *state, char *dir, char **names, int n, struct nk_fs_stat *st, int *rc)
+{
+    struct fatfs_state *fs = (struct fatfs_state *)state;
+    uint32_t cluster = dir_cluster_of(fs, dir);
+    struct dir_cursor *d;
+    struct nk_fs_dirent ent;
+    char sname[SHORT_NAME_LEN];
+    int i, found = 0, r = 0;
+
+    for (i = 0; i < n; i++) {
+        rc[i] = -1;
+    }
+
+    if (!cluster || !(d = dir_cursor_open(fs, cluster))) {
+        return 0;
+    }
+
+    while (found < n && (r = dir_cursor_next(fs, d, &ent, sname)) > 0) {
+        for (i = 0; i < n; i++) {
+            if (rc[i] && (!strcasecmp(names[i], ent.name) || !strcasecmp(names[i], sname))) {
+                st[i].st_size = ent.size;
+                rc[i] = 0;
+                found++;
+            }
+        }
+    }
+
+    dir_cursor_close(d);
+
+    return r < 0 && !found ? -1 : found;
+}
+
+static int fatfs_stat_many(void *state, char *dir, char **names, int n, struct nk_fs_stat *st, int *rc)
+{
+    struct fatfs_state *fs = (struct fatfs_state *)state;
+    int found;
+
+    NS_LOCK(fs);
+    found = __fatfs_stat_many(state, dir, names, n, st, rc);
+    NS_UNLOCK(fs);
+
+    return found;
+}
+
+// largest piece of a device-level copy staged through memory at once
+#define COPY_BOUNCE_SIZE (64*1024)
+
+// copy count sectors on the device; a memory-backed device is
+// written straight from its own copy of the source
+static int copy_sectors(struct fatfs_state *fs, uint32_t src, uint32_t dest, uint32_t count)
+{
+    uint32_t sector_size = fs->bootrecord.sector_size;
+    uint32_t per_bounce = MAX(COPY_BOUNCE_SIZE / sector_size, 1);
+    uint32_t n;
+    void *ptr;
+    char *buf;
+
+    if (!nk_block_dev_direct_access(fs->dev, src, count, &ptr)) {
+        return nk_block_dev_write(fs->dev, dest, count, ptr, NK_DEV_REQ_BLOCKING, 0, 0);
+    }
+
+    buf = malloc(MIN(count, per_bounce) * sector_size);
+
+    if (!buf) {
+        ERROR("Cannot allocate copy buffer\n");
+        return -1;
+    }
+
+    while (count) {
+        n = MIN(count, per_bounce);
+        if (nk_block_dev_read(fs->dev, src, n, buf, NK_DEV_REQ_BLOCKING, 0, 0) ||
+            nk_block_dev_write(fs->dev, dest, n, buf, NK_DEV_REQ_BLOCKING, 0, 0)) {
+            ERROR("Failed to copy sectors %u-%u to %u\n", src, src + n - 1, dest);
+            free(buf);
             return -1;
         }
+        src += n;
+        dest += n;
+        count -= n;
+    }
+
+    free(buf);
+    return 0;
+}
+
+/*
+ * Copies whole sectors between two files by walking both cluster chains
+ * together and copying runs of clusters that are adjacent on disk in
+ * both with one multi-sector operation each.  Unaligned offsets and a
+ * partial last sector are left to the caller.
+ */
+static ssize_t __fatfs_copy_range(void *state, void *file_in, off_t off_in, void *file_out, off_t off_out, size_t num_bytes)
+{
+    struct fatfs_state *fs = (struct fatfs_state *)state;
+    uint32_t sector_size = fs->bootrecord.sector_size;
+    uint32_t cluster_size = get_cluster_size(fs);
+    uint32_t in_dir, out_dir, src, dest, have, need, keep, last, max, run;
+    off_t src_off, dest_off;
+    dir_entry in_ent, out_ent;
+    size_t done = 0, piece;
+    int out_num;
+
+    DEBUG("copy %lu bytes from %s:%lu to %s:%lu\n", num_bytes, (char*)file_in, off_in, (char*)file_out, off_out);
+
+    if (off_in % sector_size || off_out % sector_size) {
+        return -1;
+    }
+
+    if (path_lookup(fs, (char*)file_in, &in_dir, &in_ent, 0) == -1 ||
+        (out_num = path_lookup(fs, (char*)file_out, &out_dir, &out_ent, 0)) == -1) {
+        return -1;
+    }
 
+    if (off_in >= in_ent.size) {
         return 0;
-    } else {
-        //Update directory entry
-        dir_entry dir_buf[FLOOR_DIV(fs->bootrecord.sector_size, sizeof(dir_entry))];
-        if (nk_block_dev_read(fs->dev, get_sector_num(dir_cluster_num, fs), fs->bootrecord.cluster_size, dir_buf, NK_DEV_REQ_BLOCKING, 0, 0)) {
-            ERROR("Failed to read block.\n");
-            // unwind...
+    }
+
+    num_bytes = MIN(num_bytes, in_ent.size - off_in);
+    num_bytes -= num_bytes % sector_size;
+
+    if (!num_bytes || off_out > out_ent.size || out_ent.attri.each_att.readonly) {
+        return -1;
+    }
+
+    // extend the destination chain to cover the copy first
+    have = MAX(CEIL_DIV(out_ent.size, cluster_size), 1);
+    need = CEIL_DIV(off_out + num_bytes, cluster_size);
+    if (need > have) {
+        last = DECODE_CLUSTER(out_ent.high_cluster, out_ent.low_cluster);
+        if (chain_seek(fs, &last, (off_t)(have - 1) * cluster_size) ||
+            grow_shrink_chain(fs, last, need - have) == -1) {
+            ERROR("Cannot extend %s for copy\n", (char*)file_out);
             return -1;
         }
+    }
+
+    src = DECODE_CLUSTER(in_ent.high_cluster, in_ent.low_cluster);
+    dest = DECODE_CLUSTER(out_ent.high_cluster, out_ent.low_cluster);
+
+    if (chain_seek(fs, &src, off_in) || chain_seek(fs, &dest, off_out)) {
+        goto out;
+    }
+
+    src_off = off_in % cluster_size;
+    dest_off = off_out % cluster_size;
+    max = CEIL_DIV(num_bytes, cluster_size) + 1;
+
+    for (done = 0; done < num_bytes; done += piece) {
+        // the longer of the two runs is cut down to the shorter
+        run = chain_run(fs, src, max) * cluster_size - src_off;
+        piece = MIN(run, chain_run(fs, dest, max) * cluster_size - dest_off);
+        piece = MIN(piece, num_bytes - done);
+
+        if (copy_sectors(fs, get_sector_num(src, fs) + src_off / sector_size,
+                         get_sector_num(dest, fs) + dest_off / sector_size,
+                         piece / sector_size)) {
+            break;
+        }
 
-        int num_parts;
-        char** parts = split_path(path_new, &num_parts);
-        char *name = parts[num_parts - 1]; // get name of file
+        src_off += piece;
+        dest_off += piece;
+        if (done + piece < num_bytes &&
+            (chain_seek(fs, &src, src_off) || chain_seek(fs, &dest, dest_off))) {
+            done += piece;
+            break;
+        }
+        src_off %= cluster_size;
+        dest_off %= cluster_size;
+    }
+
+    if (off_out + done > out_ent.size && set_entry_size(fs, (char*)file_out, out_dir, out_num, off_out + done)) {
+        done = 0; // the entry still has the old size
+    }
+
+ out:
+    // give back whatever the extension added past what was copied
+    keep = MAX(have, CEIL_DIV(off_out + done, cluster_size));
+    if (need > keep) {
+        last = DECODE_CLUSTER(out_ent.high_cluster, out_ent.low_cluster);
+        if (chain_seek(fs, &last, (off_t)(keep - 1) * cluster_size) ||
+            grow_shrink_chain(fs, last, -(long)(need - keep)) == -1) {
+            ERROR("Cannot trim %s after a failed copy\n", (char*)file_out);
+        }
+    }
+
+    return done ? done : -1;
+}
 
-        strncpy(dir_buf[dir_num].name, name, 8);
+// the in-memory FAT is written out (write_FAT_entries) whenever a
+// chain changes, and data and dirents go straight to their clusters,
+// so the engine has no dirty state of its own to write back
+static int fatfs_sync_fs(void *state)
+{
+    struct fatfs_state *fs = (struct fatfs_state *)state;
+
+    DEBUG("sync of %s\n", fs->fs->name);
+
+    if (nk_block_dev_flush(fs->dev, NK_DEV_REQ_BLOCKING, 0, 0)) {
+        ERROR("Failed to flush device\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+// largest single device request issued for an O_DIRECT transfer
+#define UNCACHED_MAX_BYTES (4UL<<20)
+
+/*
+ * O_DIRECT - whole sectors move straight between the caller's buffer and
+ * the device, one request per run of clusters that is adjacent on disk.
+ * A write may start anywhere up to the end of the file, and grows the
+ * cluster chain first if it runs past the end.
+ */
+static ssize_t fatfs_rw_uncached(void *state, void *file, void *buf, off_t offset, size_t num_bytes, int write)
+{
+    char *rw[2] = {"read","write"};
+    struct fatfs_state *fs = (struct fatfs_state *)state;
+    uint32_t sector_size = fs->bootrecord.sector_size;
+    uint32_t cluster_size = get_cluster_size(fs);
+    uint32_t dir_cluster_num, cluster, have, need, last, max;
+    off_t cluster_off;
+    size_t done, piece, result;
+    dir_entry dir_ent;
+    int dir_num, rc;
+
+    DEBUG("uncached %s of %s %lu bytes at offset %lu\n", rw[write], (char*)file, num_bytes, offset);
+
+    if (offset % sector_size || num_bytes % sector_size || (uint64_t)buf % sector_size) {
+        ERROR("O_DIRECT %s is not sector aligned (buf=%p offset=%lu len=%lu)\n", rw[write], buf, offset, num_bytes);
+        return -1;
+    }
+
+    dir_num = path_lookup(fs, (char*)file, &dir_cluster_num, &dir_ent, 0);
+    if (dir_num == -1) {
+        DEBUG("Directory entry does not exist\n");
+        return -1;
+    }
 
-        if (nk_block_dev_write(fs->dev, get_sector_num(dir_cluster_num, fs), fs->bootrecord.cluster_size, dir_buf, NK_DEV_REQ_BLOCKING, 0, 0)) {
-            ERROR("Failed to write block.\n");
-            free_split_path(parts, num_parts);
+    if (write) {
+        if (offset > dir_ent.size || dir_ent.attri.each_att.readonly) {
+            DEBUG("Cannot write %s at offset %lu\n", (char*)file, offset);
             return -1;
         }
+        have = MAX(CEIL_DIV(dir_ent.size, cluster_size), 1);
+        need = CEIL_DIV(offset + num_bytes, cluster_size);
+        if (need > have) {
+            last = DECODE_CLUSTER(dir_ent.high_cluster, dir_ent.low_cluster);
+            if (chain_seek(fs, &last, (off_t)(have - 1) * cluster_size) ||
+                grow_shrink_chain(fs, last, need - have) == -1) {
+                ERROR("Cannot extend %s\n", (char*)file);
+                return -1;
+            }
+        }
+        result = num_bytes;
+    } else {
+        if (offset >= dir_ent.size) {
+            return 0;
+        }
+        result = MIN(num_bytes, dir_ent.size - offset);
+        // the tail of the last sector lands in the caller's buffer too
+        num_bytes = CEIL_DIV(result, sector_size) * sector_size;
+    }
 
-        return 0;
+    cluster = DECODE_CLUSTER(dir_ent.high_cluster, dir_ent.low_cluster);
+    if (chain_seek(fs, &cluster, offset)) {
+        ERROR("Broken cluster chain in %s\n", (char*)file);
+        return -1;
+    }
+
+    cluster_off = offset % cluster_size;
+    max = MAX(UNCACHED_MAX_BYTES / cluster_size, 1);
+
+    for (done = 0; done < num_bytes; done += piece) {
+        piece = chain_run(fs, cluster, max) * cluster_size - cluster_off;
+        piece = MIN(piece, num_bytes - done);
+
+        if (write) {
+            rc = nk_block_dev_write(fs->dev, get_sector_num(cluster, fs) + cluster_off / sector_size,
+                                    piece / sector_size, buf + done, NK_DEV_REQ_BLOCKING, 0, 0);
+        } else {
+            rc = nk_block_dev_read(fs->dev, get_sector_num(cluster, fs) + cluster_off / sector_size,
+                                   piece / sector_size, buf + done, NK_DEV_REQ_BLOCKING, 0, 0);
+        }
+
+        if (rc) {
+            ERROR("Failed to %s sectors at cluster %u\n", rw[write], cluster);
+            break;
+        }
+
+        cluster_off += piece;
+        if (done + piece < num_bytes && chain_seek(fs, &cluster, cluster_off)) {
+            ERROR("Broken cluster chain in %s\n", (char*)file);
+            done += piece;
+            break;
+        }
+        cluster_off %= cluster_size;
+    }
+
+    if (!done && num_bytes) {
+        return -1;
+    }
+
+    result = MIN(result, done);
+
+    if (write && offset + result > dir_ent.size &&
+        set_entry_size(fs, (char*)file, dir_cluster_num, dir_num, offset + result)) {
+        return -1;
     }
 
+    return result;
+}
+
+static ssize_t fatfs_rw_uncached_locked(void *state, void *file, void *buf, off_t offset, size_t num_bytes, int write)
+{
+    struct fatfs_state *fs = (struct fatfs_state *)state;
+    ssize_t rc;
+
+    NS_LOCK(fs);
+    file_lock(fs, file, write);
+    rc = fatfs_rw_uncached(state, file, buf, offset, num_bytes, write);
+    file_unlock(fs, file, write);
+    NS_UNLOCK(fs);
+
+    return rc;
+}
+
+static ssize_t fatfs_read_uncached(void *state, void *file, void *buf, off_t offset, size_t num_bytes)
+{
+    return fatfs_rw_uncached_locked(state, file, buf, offset, num_bytes, 0);
+}
+
+static ssize_t fatfs_write_uncached(void *state, void *file, void *buf, off_t offset, size_t num_bytes)
+{
+    return fatfs_rw_uncached_locked(state, file, buf, offset, num_bytes, 1);
 }
 
+// the rest of the operations, with their locks; remove and rename
+// change what paths name, so they have the volume to themselves
+
+static int fatfs_remove(void *state, char *path)
+{
+    struct fatfs_state *fs = (struct fatfs_state *)state;
+    int rc;
+
+    NS_WR_LOCK(fs);
+    file_lock(fs, path, 1);
+    rc = __fatfs_remove(state, path);
+    file_unlock(fs, path, 1);
+    NS_WR_UNLOCK(fs);
+
+    return rc;
+}
+
+static int fatfs_truncate(void *state, void *file, off_t len)
+{
+    struct fatfs_state *fs = (struct fatfs_state *)state;
+    int rc;
+
+    NS_LOCK(fs);
+    file_lock(fs, file, 1);
+    rc = __fatfs_truncate(state, file, len);
+    file_unlock(fs, file, 1);
+    NS_UNLOCK(fs);
+
+    return rc;
+}
+
+static int fatfs_rename(void *state, char *path_old, char *path_new, int isdir)
+{
+    struct fatfs_state *fs = (struct fatfs_state *)state;
+    int rc;
+
+    NS_WR_LOCK(fs);
+    file_lock(fs, path_old, 1);
+    rc = __fatfs_rename(state, path_old, path_new, isdir);
+    file_unlock(fs, path_old, 1);
+    NS_WR_UNLOCK(fs);
+
+    return rc;
+}
+
+static ssize_t fatfs_copy_range(void *state, void *file_in, off_t off_in, void *file_out, off_t off_out, size_t num_bytes)
+{
+    struct fatfs_state *fs = (struct fatfs_state *)state;
+    struct fatfs_file_lock *in = file_lock_of(fs, file_in);
+    struct fatfs_file_lock *out = file_lock_of(fs, file_out);
+    ssize_t rc;
+
+    // two files take their locks in stripe order; if they share a
+    // stripe, the one write lock covers both
+    NS_LOCK(fs);
+    if (in == out) {
+        file_lock(fs, file_out, 1);
+    } else if (in < out) {
+        file_lock(fs, file_in, 0);
+        file_lock(fs, file_out, 1);
+    } else {
+        file_lock(fs, file_out, 1);
+        file_lock(fs, file_in, 0);
+    }
+
+    rc = __fatfs_copy_range(state, file_in, off_in, file_out, off_out, num_bytes);
+
+    if (in != out) {
+        file_unlock(fs, file_in, 0);
+    }
+    file_unlock(fs, file_out, 1);
+    NS_UNLOCK(fs);
+
+    return rc;
+}
+
+#include "fatfs_defrag.c"
+
 static struct nk_fs_int fatfs_inter = {
         .stat = fatfs_stat,
         .stat_path = fatfs_stat_path,
@@ -724,12 +1347,19 @@ static struct nk_fs_int fatfs_inter = {
         .close_file = fatfs_close,
         .trunc_file = fatfs_truncate,
         .rename = fatfs_rename,
+        .read_direct = fatfs_read_direct,
+        .opendir = fatfs_opendir,
+        .readdir_batch = fatfs_readdir_batch,
+        .closedir = fatfs_closedir,
+        .stat_many = fatfs_stat_many,
+        .copy_range = fatfs_copy_range,
+        .sync_fs = fatfs_sync_fs,
+        .read_uncached = fatfs_read_uncached,
+        .write_uncached = fatfs_write_uncached,
 };
 
 static void fatfs_demo_create(struct fatfs_state *s)
 {
-    char src[600];
-
     // create a new dir and a new file under it
     fatfs_create_dir(s, "/live");
     fatfs_create_file(s, "/live/foo.txt");
@@ -772,6 +1402,15 @@ static void fatfs_demo_end(struct fatfs_state *s) {
 }
 
 
+int nk_fs_fatfs_attach_engine(char *devname, char *fsname, int readonly, int flags)
+{
+    if (flags & NK_FS_FATFS_CHAN) {
+        return ffglue_attach(devname, fsname, readonly, flags);
+    } else {
+        return nk_fs_fatfs_attach(devname, fsname, readonly);
+    }
+}
+
 int nk_fs_fatfs_attach(char *devname, char *fsname, int readonly)
 {
     struct nk_block_dev *dev = nk_block_dev_find(devname);
@@ -790,10 +1429,16 @@ int nk_fs_fatfs_attach(char *devname, char *fsname, int readonly)
 
     memset(s,0,sizeof(*s));
 
+    if (locks_init(s, fsname)) {
+        ERROR("Cannot allocate lock wait queue for fs %s\n", fsname);
+        free(s);
+        return -1;
+    }
     s->dev = dev;
 
     if (nk_block_dev_get_characteristics(dev,&s->chars)) {
         ERROR("Cannot get characteristics of device %s\n", devname);
+        locks_deinit(s);
         free(s);
         return -1;
     }
@@ -803,12 +1448,22 @@ int nk_fs_fatfs_attach(char *devname, char *fsname, int readonly)
     //read reserved block(boot record)
     if (read_bootrecord(s)) {
         ERROR("Cannot read bootrecord for fs fatfs %s on device %s\n", fsname, devname);
+        locks_deinit(s);
         free(s);
         return -1;
     }
 
+    // exFAT is only handled by the FatFs engine
+    if (!memcmp(s->bootrecord.OEM_identifier, "EXFAT   ", 8)) {
+        DEBUG("Device %s holds exFAT, attaching with FatFs\n", devname);
+        locks_deinit(s);
+        free(s);
+        return ffglue_attach(devname, fsname, readonly, NK_FS_FATFS_CHAN | NK_FS_FATFS_FASTSEEK);
+    }
+
     if (read_FAT(s)){
         ERROR("Cannot load FAT into memory");
+        locks_deinit(s);
         free(s);
         return -1;
     }
@@ -828,14 +1483,18 @@ int nk_fs_fatfs_attach(char *devname, char *fsname, int readonly)
     DEBUG("%lu hidden sectors\n",s->bootrecord.hidden_sector_num);
     DEBUG("%lu sectors total\n",s->bootrecord.total_sector_num);
 
-    s->fs = nk_fs_register(fsname, flags, &fatfs_inter, s);
+    // the defragmenter moves files' clusters
+    s->fs = nk_fs_register(fsname, flags | NK_FS_MOVES_DATA, &fatfs_inter, s);
 
     if (!s->fs) {
         ERROR("Unable to register filesystem %s\n", fsname);
+        locks_deinit(s);
         free(s);
         return -1;
     }
 
+    nk_block_dev_attach(dev);
+
     INFO("filesystem %s on device %s is attached (%s)\n", fsname, devname, readonly ?  "readonly" : "read/write");
 
     //fatfs_demo(s);
@@ -848,7 +1507,24 @@ int nk_fs_fatfs_detach(char *fsname)
     struct nk_fs *fs = nk_fs_find(fsname);
     if (!fs) {
         return -1;
+    } else if (ffglue_owns(fs)) {
+        return ffglue_detach(fs);
     } else {
-        return nk_fs_unregister(fs);
+        struct fatfs_state *s = (struct fatfs_state *)fs->state;
+        int rc;
+
+        defrag_stop(s);
+
+        rc = nk_fs_unregister(fs);
+        nk_block_dev_detach(s->dev);
+
+        if (s->defrag) {
+            free(s->defrag);
+        }
+        free(s->table_chars.fatfs_begin);
+        locks_deinit(s);
+        free(s);
+
+        return rc;
     }
 }
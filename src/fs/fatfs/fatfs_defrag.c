@@ -0,0 +1,764 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2017, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+
+/* fatfs_defrag.c
+ *
+ * Fragmentation report and online defragmenter for the native engine.
+ *
+ * Both walk the directory tree from the root.  A file's extents are the
+ * runs of its cluster chain that are adjacent on disk; free space is
+ * described by its runs of free clusters.
+ *
+ * The defragmenter moves one fragmented file at a time into the first
+ * run of free clusters that holds all of it.  The walk names files by
+ * their 8.3 paths, which are what the file locks are taken on (see
+ * fatfs_helper.c), and each move goes:
+ *
+ *   1. file read locked: the new run is taken in the in-memory FAT, as
+ *      a chain of its own, the file lock is set to watch the file's
+ *      path hash, and its generation is noted
+ *   2. unlocked: the data is copied over, no faster than the rate
+ *   3. file write locked, and only if the generation is unchanged, so
+ *      nothing has written the file meanwhile: the new chain is written
+ *      to every FAT, then the directory entry is pointed at it, then the
+ *      old chain is freed in memory and in every FAT
+ *
+ * so a crash at any point leaves at worst lost clusters, never two
+ * files sharing one.  If the file changed, the new run is given back
+ * and the file is tried again on a later pass.  Operations on other
+ * files go on throughout, and only writers of the watched file bump
+ * the generation, so other files on the same lock stripe do not abort
+ * the move.  A watch left behind on a stripe only bumps a generation
+ * that nothing is looking at.
+ *
+ * Freeing the old chain leaves no way to reach the file's old data, so
+ * nothing may point at it directly.  nk_fs_mmap never maps a file of
+ * this engine in place (it registers with NK_FS_MOVES_DATA), and
+ * read_direct declines while the defragmenter runs.  A read_direct
+ * pointer taken before it starts is not tracked, and must be used at
+ * once, as the VFS's own copy does.
+ *
+ * Directories are not moved.  Included by fatfs.c.
+ */
+
+#include <nautilus/thread.h>
+#include <nautilus/scheduler.h>
+#include <nautilus/timer.h>
+#include <nautilus/shell.h>
+
+#define FAT_ENTRY(x)        ((x) & 0x0FFFFFFF)   // the top 4 bits are reserved
+
+#define FRAG_PATH_LEN       512
+#define FRAG_MAX_DEPTH      32
+#define FRAG_BUCKETS        32     // free run lengths, by power of 2
+
+#define DEFRAG_CHUNK        (64*1024)     // bytes copied between rate and change checks
+#define DEFRAG_STOP_WAIT    1000000ULL    // ns
+#define DEFRAG_PASS_WAIT    1000000000ULL // ns between background passes that had to retry
+
+struct frag_file {
+    uint32_t dir_cluster;   // directory cluster holding the entry
+    uint32_t index;         // of the entry within that cluster
+    uint32_t first;         // cluster
+    uint32_t size;
+    uint8_t  name[11];      // 8.3, as in the entry, to spot a rename
+};
+
+struct fatfs_defrag {
+    uint64_t        rate;   // bytes/s, 0 for no limit
+    volatile int    stop;
+    uint64_t        copied; // this file, for the rate
+    uint64_t        start;  // ns
+    struct nk_fs_fatfs_defrag_stats stats;
+};
+
+// returns 0 to go on, 1 to stop the walk, -1 on error
+typedef int (*frag_fn_t)(struct fatfs_state *fs, struct frag_file *f, char *path, void *priv);
+
+
+/* chain_extents
+ *
+ * counts the clusters in the chain starting at first, and the extents
+ * they form.  An empty chain (first is 0) has neither
+ * returns -1 if the chain is corrupt
+ */
+static int chain_extents(struct fatfs_state *fs, uint32_t first, uint32_t *clusters, uint32_t *extents)
+{
+    uint32_t *fat = fs->table_chars.fatfs_begin;
+    uint32_t entries = fat_entries(fs);
+    uint32_t cluster = first, next, n = 0, e = 1;
+
+    *clusters = *extents = 0;
+
+    if (!first) {
+        return 0;
+    }
+
+    while (1) {
+        if (cluster < 2 || cluster >= entries || n >= entries) {
+            return -1;
+        }
+        n++;
+        next = FAT_ENTRY(fat[cluster]);
+        if (next >= EOC_MIN) {
+            break;
+        }
+        if (next != cluster + 1) {
+            e++;
+        }
+        cluster = next;
+    }
+
+    *clusters = n;
+    *extents = e;
+
+    return 0;
+}
+
+// walks the tree below the directory at cluster, calling fn on each file
+static int frag_walk(struct fatfs_state *fs, uint32_t cluster, char *path, int depth, frag_fn_t fn, void *priv)
+{
+    size_t len = strlen(path);
+    struct nk_fs_dirent ent;
+    char sname[SHORT_NAME_LEN];
+    struct dir_cursor *d;
+    struct frag_file f;
+    dir_entry *e;
+    int rc, frc = 0;
+
+    if (depth > FRAG_MAX_DEPTH) {
+        return 0;
+    }
+
+    if (!(d = dir_cursor_open(fs, cluster))) {
+        return -1;
+    }
+
+    while (!frc && (rc = dir_cursor_next(fs, d, &ent, sname)) == 1) {
+        // the entry just returned is the one before the cursor
+        e = (dir_entry *)(d->data + DIR_ENTRY_SIZE * (d->index - 1));
+        f.dir_cluster = d->cluster;
+        f.index = d->index - 1;
+        f.first = DECODE_CLUSTER(e->high_cluster, e->low_cluster);
+        f.size = e->size;
+        memcpy(f.name, e->name, sizeof(f.name));
+
+        snprintf(path + len, FRAG_PATH_LEN - len, "/%s", sname);
+        if (ent.attr & NK_FS_ATTR_DIR) {
+            frc = f.first ? frag_walk(fs, f.first, path, depth + 1, fn, priv) : 0;
+        } else {
+            frc = fn(fs, &f, path, priv);
+        }
+        path[len] = 0;
+    }
+
+    dir_cursor_close(d);
+
+    return frc ? frc : rc;
+}
+
+static int frag_walk_root(struct fatfs_state *fs, frag_fn_t fn, void *priv)
+{
+    char *path = malloc(FRAG_PATH_LEN);
+    int rc;
+
+    if (!path) {
+        ERROR("Cannot allocate path\n");
+        return -1;
+    }
+
+    path[0] = 0;
+    rc = frag_walk(fs, fs->bootrecord.rootdir_cluster, path, 0, fn, priv);
+    free(path);
+
+    return rc;
+}
+
+static struct fatfs_state *native_state(char *fsname)
+{
+    struct nk_fs *fs = nk_fs_find(fsname);
+
+    if (!fs) {
+        ERROR("Cannot find filesystem %s\n", fsname);
+        return 0;
+    }
+
+    if (ffglue_owns(fs)) {
+        ERROR("%s is not attached with the native engine\n", fsname);
+        return 0;
+    }
+
+    return (struct fatfs_state *)fs->state;
+}
+
+
+struct frag_report {
+    int      verbose;
+    uint64_t files;
+    uint64_t fragmented;
+    uint64_t clusters;
+    uint64_t extents;
+    uint64_t bad;
+};
+
+static int frag_report_file(struct fatfs_state *fs, struct frag_file *f, char *path, void *priv)
+{
+    struct frag_report *r = (struct frag_report *)priv;
+    uint32_t clusters, extents;
+
+    if (chain_extents(fs, f->first, &clusters, &extents)) {
+        nk_vc_printf("  %s: bad cluster chain\n", path);
+        r->bad++;
+        return 0;
+    }
+
+    r->files++;
+    r->fragmented += extents > 1;
+    r->clusters += clusters;
+    r->extents += extents;
+
+    if (r->verbose > 1 || (r->verbose && extents > 1)) {
+        nk_vc_printf("  %-40s %10u bytes %8u clusters %6u extents\n", path, f->size, clusters, extents);
+    }
+
+    return 0;
+}
+
+int nk_fs_fatfs_frag_report(char *fsname, int verbose)
+{
+    struct fatfs_state *fs = native_state(fsname);
+    struct frag_report r = { .verbose = verbose };
+    uint64_t runs[FRAG_BUCKETS], in_runs[FRAG_BUCKETS];
+    uint64_t free_clusters = 0, free_runs = 0, largest = 0, len;
+    uint32_t *fat, entries, i, b;
+    int rc;
+
+    if (!fs) {
+        return -1;
+    }
+
+    memset(runs, 0, sizeof(runs));
+    memset(in_runs, 0, sizeof(in_runs));
+
+    NS_LOCK(fs);
+
+    rc = frag_walk_root(fs, frag_report_file, &r);
+
+    ALLOC_LOCK(fs);
+
+    fat = fs->table_chars.fatfs_begin;
+    entries = fat_entries(fs);
+    for (i = 2; i < entries; i += len ? len : 1) {
+        for (len = 0; i + len < entries && !FAT_ENTRY(fat[i + len]); len++) {
+        }
+        if (len) {
+            for (b = 0; b < FRAG_BUCKETS - 1 && (2ULL << b) <= len; b++) {
+            }
+            runs[b]++;
+            in_runs[b] += len;
+            free_clusters += len;
+            free_runs++;
+            largest = MAX(largest, len);
+        }
+    }
+
+    ALLOC_UNLOCK(fs);
+    NS_UNLOCK(fs);
+
+    nk_vc_printf("%s: %lu files, %lu fragmented, %lu extents in %lu clusters (%lu.%02lu per file)\n",
+                 fsname, r.files, r.fragmented, r.extents, r.clusters,
+                 r.files ? r.extents / r.files : 0, r.files ? (r.extents * 100 / r.files) % 100 : 0);
+    if (r.bad) {
+        nk_vc_printf("%s: %lu files with bad cluster chains\n", fsname, r.bad);
+    }
+    nk_vc_printf("%s: %lu free clusters in %lu runs, largest %lu\n", fsname, free_clusters, free_runs, largest);
+    if (free_runs) {
+        nk_vc_printf("  %-21s %10s %10s\n", "free run length", "runs", "clusters");
+        for (b = 0; b < FRAG_BUCKETS; b++) {
+            if (runs[b]) {
+                nk_vc_printf("  %10lu-%-10lu %10lu %10lu\n", 1UL << b, (2UL << b) - 1, runs[b], in_runs[b]);
+            }
+        }
+    }
+
+    return rc < 0 ? -1 : 0;
+}
+
+
+// first run of n free clusters, or 0; the allocator lock must be held
+static uint32_t find_free_run(struct fatfs_state *fs, uint32_t n)
+{
+    uint32_t *fat = fs->table_chars.fatfs_begin;
+    uint32_t entries = fat_entries(fs);
+    uint32_t i, len = 0;
+
+    for (i = 2; i < entries; i++) {
+        len = FAT_ENTRY(fat[i]) ? 0 : len + 1;
+        if (len == n) {
+            return i - n + 1;
+        }
+    }
+
+    return 0;
+}
+
+// read_direct declines while this is true; it is only set under the
+// exclusive ns_lock, so holding that shared keeps it from becoming true
+static int defrag_running(struct fatfs_state *fs)
+{
+    return fs->defrag && fs->defrag->stats.running;
+}
+
+// gives back a run taken by defrag_file that was not committed
+static void release_run(struct fatfs_state *fs, uint32_t start, uint32_t n)
+{
+    uint32_t i;
+
+    ALLOC_LOCK(fs);
+    for (i = 0; i < n; i++) {
+        fs->table_chars.fatfs_begin[start + i] = FREE_CLUSTER;
+    }
+    // another operation's FAT write may have put the run on disk
+    write_FAT_entries(fs, start, start + n - 1);
+    ALLOC_UNLOCK(fs);
+}
+
+// re-reads f's directory entry, or points it at first
+static int entry_rw(struct fatfs_state *fs, struct frag_file *f, char *path, dir_entry *ent, uint32_t first, int write)
+{
+    uint32_t sector_size = fs->bootrecord.sector_size;
+    uint32_t sector = get_sector_num(f->dir_cluster, fs) + f->index * DIR_ENTRY_SIZE / sector_size;
+    uint8_t buf[sector_size];
+    dir_entry *e = (dir_entry *)(buf + f->index * DIR_ENTRY_SIZE % sector_size);
+    int rc = -1;
+
+    // the rest of the sector's entries may be changing under their own files
+    if (write) {
+        DIR_LOCK(fs, path);
+    }
+
+    if (nk_block_dev_read(fs->dev, sector, 1, buf, NK_DEV_REQ_BLOCKING, 0, 0)) {
+        ERROR("Failed to read directory sector %u\n", sector);
+        goto out;
+    }
+
+    if (!write) {
+        *ent = *e;
+        rc = 0;
+        goto out;
+    }
+
+    e->high_cluster = EXTRACT_HIGH_CLUSTER(first);
+    e->low_cluster = EXTRACT_LOW_CLUSTER(first);
+
+    if (nk_block_dev_write(fs->dev, sector, 1, buf, NK_DEV_REQ_BLOCKING, 0, 0)) {
+        ERROR("Failed to write directory sector %u\n", sector);
+        goto out;
+    }
+
+    rc = 0;
+ out:
+    if (write) {
+        DIR_UNLOCK(fs, path);
+    }
+    return rc;
+}
+
+// whether f's entry still names the same file as when the walk saw it
+static int entry_same(struct fatfs_state *fs, struct frag_file *f, char *path)
+{
+    dir_entry ent;
+
+    return !entry_rw(fs, f, path, &ent, 0, 0) &&
+        DECODE_CLUSTER(ent.high_cluster, ent.low_cluster) == f->first &&
+        !memcmp(ent.name, f->name, sizeof(f->name));
+}
+
+// sleeps off whatever the last copy took beyond the rate
+static void defrag_pace(struct fatfs_defrag *d, uint64_t bytes)
+{
+    uint64_t due, now;
+
+    d->copied += bytes;
+
+    if (!d->rate) {
+        return;
+    }
+
+    due = d->start + (d->copied / d->rate) * 1000000000ULL + (d->copied % d->rate) * 1000000000ULL / d->rate;
+    now = nk_sched_get_realtime();
+
+    if (due > now) {
+        nk_sleep(due - now);
+    }
+}
+
+// copies the n clusters of the chain at first to the run at dest
+static int defrag_copy(struct fatfs_state *fs, struct fatfs_defrag *d, uint32_t first, uint32_t dest, uint32_t n,
+                       struct fatfs_file_lock *l, uint64_t gen)
+{
+    uint32_t *fat = fs->table_chars.fatfs_begin;
+    uint32_t entries = fat_entries(fs);
+    uint32_t per_chunk = MAX(DEFRAG_CHUNK / get_cluster_size(fs), 1);
+    uint32_t spc = fs->bootrecord.cluster_size;
+    uint32_t src = first, run, k, next;
+
+    d->copied = 0;
+    d->start = nk_sched_get_realtime();
+
+    while (n) {
+        run = chain_run(fs, src, n);
+        while (run) {
+            if (d->stop || *(volatile uint64_t *)&l->gen != gen) {
+                return -1;
+            }
+            k = MIN(run, per_chunk);
+            if (copy_sectors(fs, get_sector_num(src, fs), get_sector_num(dest, fs), k * spc)) {
+                return -1;
+            }
+            defrag_pace(d, (uint64_t)k * get_cluster_size(fs));
+            src += k;
+            dest += k;
+            run -= k;
+            n -= k;
+        }
+        if (n) {
+            // src is one past the end of the run
+            next = FAT_ENTRY(fat[src - 1]);
+            if (next < 2 || next >= entries) {
+                return -1;
+            }
+            src = next;
+        }
+    }
+
+    return 0;
+}
+
+/* defrag_file
+ *
+ * moves f into a single run if it is fragmented and there is room
+ * returns 1 if the defragmenter has been stopped, 0 otherwise
+ */
+static int defrag_file(struct fatfs_state *fs, struct frag_file *f, char *path, void *priv)
+{
+    struct fatfs_defrag *d = (struct fatfs_defrag *)priv;
+    uint32_t h = path_hash(path, 0);
+    struct fatfs_file_lock *l = &fs->file_locks[h % FATFS_FILE_LOCKS];
+    uint32_t *fat = fs->table_chars.fatfs_begin;
+    uint32_t clusters, extents, start, i, c, next, lo;
+    uint64_t gen;
+
+    if (d->stop) {
+        return 1;
+    }
+
+    // a cheap look first, unlocked
+    if (chain_extents(fs, f->first, &clusters, &extents) || extents < 2) {
+        return 0;
+    }
+
+    NS_LOCK(fs);
+    file_lock(fs, path, 0);
+
+    // the walk read the entry without the file's lock
+    if (!entry_same(fs, f, path) ||
+        chain_extents(fs, f->first, &clusters, &extents) || extents < 2) {
+        file_unlock(fs, path, 0);
+        NS_UNLOCK(fs);
+        return 0;
+    }
+
+    ALLOC_LOCK(fs);
+    if ((start = find_free_run(fs, clusters))) {
+        for (i = 0; i < clusters; i++) {
+            fat[start + i] = i == clusters - 1 ? EOC_MAX : start + i + 1;
+        }
+    }
+    ALLOC_UNLOCK(fs);
+
+    // writers are kept out by the read lock
+    l->watch = h;
+    gen = l->gen;
+
+    file_unlock(fs, path, 0);
+    NS_UNLOCK(fs);
+
+    if (!start) {
+        DEBUG("no run of %u free clusters for %s\n", clusters, path);
+        d->stats.files_skipped++;
+        return 0;
+    }
+
+    DEBUG("moving %s (%u clusters, %u extents) to %u\n", path, clusters, extents, start);
+
+    if (defrag_copy(fs, d, f->first, start, clusters, l, gen)) {
+        release_run(fs, start, clusters);
+        d->stats.retries += !d->stop;
+        return d->stop;
+    }
+
+    // the generation is left alone, as the file's contents are
+    NS_LOCK(fs);
+    lock_wr(fs, &l->lock);
+
+    if (l->gen != gen || !entry_same(fs, f, path)) {
+        lock_wr_unlock(fs, &l->lock);
+        NS_UNLOCK(fs);
+        release_run(fs, start, clusters);
+        d->stats.retries++;
+        return 0;
+    }
+
+    ALLOC_LOCK(fs);
+    i = write_FAT_entries(fs, start, start + clusters - 1);
+    ALLOC_UNLOCK(fs);
+
+    if (i || entry_rw(fs, f, path, 0, start, 1)) {
+        // the old chain is still the file's
+        lock_wr_unlock(fs, &l->lock);
+        NS_UNLOCK(fs);
+        release_run(fs, start, clusters);
+        return 0;
+    }
+
+    // written out a run at a time, as the old chain can be spread
+    // across the whole FAT
+    ALLOC_LOCK(fs);
+    for (c = f->first, lo = c; ; c = next) {
+        next = FAT_ENTRY(fat[c]);
+        fat[c] = FREE_CLUSTER;
+        if (next != c + 1) {
+            write_FAT_entries(fs, lo, c);
+            lo = next;
+        }
+        if (next >= EOC_MIN) {
+            break;
+        }
+    }
+    ALLOC_UNLOCK(fs);
+
+    lock_wr_unlock(fs, &l->lock);
+    NS_UNLOCK(fs);
+
+    d->stats.files_moved++;
+    d->stats.clusters_moved += clusters;
+
+    return 0;
+}
+
+// one walk of the tree; returns 1 if stopped, -1 on error
+static int defrag_pass(struct fatfs_state *fs, struct fatfs_defrag *d)
+{
+    int rc = frag_walk_root(fs, defrag_file, d);
+
+    d->stats.passes++;
+
+    return rc;
+}
+
+static void defrag_thread(void *in, void **out)
+{
+    struct fatfs_state *fs = (struct fatfs_state *)in;
+    struct fatfs_defrag *d = fs->defrag;
+    uint64_t moved, retries;
+
+    while (!d->stop) {
+        moved = d->stats.files_moved;
+        retries = d->stats.retries;
+        if (defrag_pass(fs, d)) {
+            break;
+        }
+        if (d->stats.retries == retries) {
+            if (d->stats.files_moved == moved) {
+                break;
+            }
+        } else {
+            nk_sleep(DEFRAG_PASS_WAIT);
+        }
+    }
+
+    INFO("defragmenter done after %lu passes, %lu files moved\n", d->stats.passes, d->stats.files_moved);
+
+    d->stats.running = 0;
+}
+
+int nk_fs_fatfs_defrag(char *fsname, uint64_t rate, int background)
+{
+    struct fatfs_state *fs = native_state(fsname);
+    struct fatfs_defrag *d;
+    nk_thread_id_t tid;
+    int rc;
+
+    if (!fs) {
+        return -1;
+    }
+
+    if (fs->fs->flags & NK_FS_READONLY) {
+        ERROR("%s is read-only\n", fsname);
+        return -1;
+    }
+
+    NS_WR_LOCK(fs);
+    if (!fs->defrag) {
+        fs->defrag = malloc(sizeof(*fs->defrag));
+        if (fs->defrag) {
+            memset(fs->defrag, 0, sizeof(*fs->defrag));
+        }
+    }
+    d = fs->defrag;
+    if (!d || d->stats.running) {
+        NS_WR_UNLOCK(fs);
+        ERROR("%s\n", d ? "Defragmenter is already running" : "Cannot allocate defragmenter");
+        return -1;
+    }
+    memset(&d->stats, 0, sizeof(d->stats));
+    d->stats.running = 1;
+    d->rate = rate;
+    d->stop = 0;
+    NS_WR_UNLOCK(fs);
+
+    if (!background) {
+        rc = defrag_pass(fs, d);
+        d->stats.running = 0;
+        return rc < 0 ? -1 : 0;
+    }
+
+    if (nk_thread_start(defrag_thread, fs, 0, 1, TSTACK_1MB, &tid, CPU_ANY)) {
+        ERROR("Cannot start defragmenter thread\n");
+        d->stats.running = 0;
+        return -1;
+    }
+
+    nk_thread_name(tid, "fatfs-defrag");
+
+    return 0;
+}
+
+// stops the defragmenter and waits for it
+static void defrag_stop(struct fatfs_state *fs)
+{
+    if (fs->defrag) {
+        fs->defrag->stop = 1;
+        while (fs->defrag->stats.running) {
+            nk_sleep(DEFRAG_STOP_WAIT);
+        }
+    }
+}
+
+int nk_fs_fatfs_defrag_stop(char *fsname)
+{
+    struct fatfs_state *fs = native_state(fsname);
+
+    if (!fs) {
+        return -1;
+    }
+
+    defrag_stop(fs);
+
+    return 0;
+}
+
+int nk_fs_fatfs_defrag_stats(char *fsname, struct nk_fs_fatfs_defrag_stats *stats)
+{
+    struct fatfs_state *fs = native_state(fsname);
+
+    if (!fs) {
+        return -1;
+    }
+
+    if (fs->defrag) {
+        *stats = fs->defrag->stats;
+    } else {
+        memset(stats, 0, sizeof(*stats));
+    }
+
+    return 0;
+}
+
+
+static int
+handle_fatfrag (char * buf, void * priv)
+{
+    char fsname[FS_NAME_LEN], what[16] = "";
+
+    if (sscanf(buf,"fatfrag %31s %15s",fsname,what)<1 ||
+        (what[0] && strcmp(what,"frag") && strcmp(what,"all"))) {
+        nk_vc_printf("fatfrag fsname [frag|all]\n");
+        return -1;
+    }
+
+    return nk_fs_fatfs_frag_report(fsname, !what[0] ? 0 : !strcmp(what,"frag") ? 1 : 2);
+}
+
+static struct shell_cmd_impl fatfrag_impl = {
+    .cmd      = "fatfrag",
+    .help_str = "fatfrag fsname [frag|all]",
+    .handler  = handle_fatfrag,
+};
+nk_register_shell_cmd(fatfrag_impl);
+
+static int
+handle_fatdefrag (char * buf, void * priv)
+{
+    char fsname[FS_NAME_LEN], what[16];
+    struct nk_fs_fatfs_defrag_stats s;
+    uint64_t kbps = 0;
+    int n;
+
+    if ((n = sscanf(buf,"fatdefrag %31s %15s %lu",fsname,what,&kbps))<2) {
+        nk_vc_printf("fatdefrag fsname start|run|stop|status [KB/s]\n");
+        return -1;
+    }
+
+    if (!strcmp(what,"start") || !strcmp(what,"run")) {
+        if (nk_fs_fatfs_defrag(fsname, kbps*1024, !strcmp(what,"start"))) {
+            nk_vc_printf("Cannot defragment %s\n", fsname);
+            return -1;
+        }
+        if (!strcmp(what,"start")) {
+            return 0;
+        }
+    } else if (!strcmp(what,"stop")) {
+        if (nk_fs_fatfs_defrag_stop(fsname)) {
+            return -1;
+        }
+    } else if (strcmp(what,"status")) {
+        nk_vc_printf("fatdefrag fsname start|run|stop|status [KB/s]\n");
+        return -1;
+    }
+
+    if (nk_fs_fatfs_defrag_stats(fsname, &s)) {
+        return -1;
+    }
+
+    nk_vc_printf("%s: %s, %lu passes, %lu files moved (%lu clusters), %lu skipped, %lu retries\n",
+                 fsname, s.running ? "running" : "idle", s.passes, s.files_moved,
+                 s.clusters_moved, s.files_skipped, s.retries);
+
+    return 0;
+}
+
+static struct shell_cmd_impl fatdefrag_impl = {
+    .cmd      = "fatdefrag",
+    .help_str = "fatdefrag fsname start|run|stop|status [KB/s]",
+    .handler  = handle_fatdefrag,
+};
+nk_register_shell_cmd(fatdefrag_impl);
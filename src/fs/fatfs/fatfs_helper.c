@@ -23,7 +23,7 @@
  */
 
 #include "fatfs.h"
-#include "fatfs_types.h"
+#include "fatfs_type.h"
 
 #define FLOOR_DIV(x,y) ((x)/(y))
 #define CEIL_DIV(x,y)  (((x)/(y)) + !!((x)%(y)))
@@ -71,6 +71,193 @@ static int read_write_bootrecord(struct fatfs_state *fs, int write)
 #define read_bootrecord(fs)  read_write_bootrecord(fs,0)
 #define write_bootrecord(fs) read_write_bootrecord(fs,1)
 
+// number of FAT entries that map clusters, which can be fewer than the FAT holds
+static uint32_t fat_entries(struct fatfs_state *fs)
+{
+    uint32_t clusters = (fs->bootrecord.total_sector_num - fs->table_chars.data_start) / fs->bootrecord.cluster_size + 2;
+    uint32_t entries = fs->table_chars.fatfs_size * (fs->bootrecord.sector_size / 4);
+
+    return clusters < entries ? clusters : entries;
+}
+
+// writes the FAT sectors holding entries lo..hi to every copy of the FAT
+static int write_FAT_entries(struct fatfs_state *fs, uint32_t lo, uint32_t hi)
+{
+    uint32_t sector_size = fs->bootrecord.sector_size;
+    uint32_t first = lo / (sector_size / 4);
+    uint32_t count = hi / (sector_size / 4) - first + 1;
+    uint8_t *src = (uint8_t *)fs->table_chars.fatfs_begin + first * sector_size;
+    int i;
+
+    for (i = 0; i < fs->bootrecord.FAT_num; i++) {
+        if (nk_block_dev_write(fs->dev, fs->bootrecord.reservedblock_size + i * fs->table_chars.fatfs_size + first,
+                               count, src, NK_DEV_REQ_BLOCKING, 0, 0)) {
+            ERROR("Failed to write FAT %d\n", i);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* sleeping locks
+ *
+ * Every lock of a filesystem is waited for on its one wait queue.  A
+ * release that may let a waiter in wakes all of them, and each looks
+ * again at the lock it wants; the check and the queueing are atomic
+ * with respect to the wake, so none is missed.  Waiting writers hold
+ * off new sharers, so remove and rename are not starved by a steady
+ * stream of other operations.  Nothing takes a lock it already holds
+ * shared, so that cannot deadlock against a waiting writer.
+ */
+static int lock_can_rd(void *state)
+{
+    struct fatfs_lock *l = (struct fatfs_lock *)state;
+
+    return !l->writers && l->count >= 0;
+}
+
+static int lock_can_wr(void *state)
+{
+    return !((struct fatfs_lock *)state)->count;
+}
+
+static void lock_rd(struct fatfs_state *fs, struct fatfs_lock *l)
+{
+    int c;
+
+    while (1) {
+        c = l->count;
+        if (!l->writers && c >= 0 && __sync_bool_compare_and_swap(&l->count, c, c + 1)) {
+            return;
+        }
+        nk_wait_queue_sleep_extended(fs->waitq, lock_can_rd, l);
+    }
+}
+
+static void lock_rd_unlock(struct fatfs_state *fs, struct fatfs_lock *l)
+{
+    if (!__sync_sub_and_fetch(&l->count, 1)) {
+        nk_wait_queue_wake_all(fs->waitq);
+    }
+}
+
+static void lock_wr(struct fatfs_state *fs, struct fatfs_lock *l)
+{
+    __sync_fetch_and_add(&l->writers, 1);
+    while (!__sync_bool_compare_and_swap(&l->count, 0, -1)) {
+        nk_wait_queue_sleep_extended(fs->waitq, lock_can_wr, l);
+    }
+    __sync_fetch_and_sub(&l->writers, 1);
+}
+
+static void lock_wr_unlock(struct fatfs_state *fs, struct fatfs_lock *l)
+{
+    __sync_fetch_and_add(&l->count, 1);
+    nk_wait_queue_wake_all(fs->waitq);
+}
+
+static int locks_init(struct fatfs_state *fs, char *fsname)
+{
+    char buf[NK_WAIT_QUEUE_NAME_LEN];
+
+    // the lock state itself starts zeroed, with fs
+    snprintf(buf, NK_WAIT_QUEUE_NAME_LEN, "%s-locks", fsname);
+    fs->waitq = nk_wait_queue_create(buf);
+
+    return fs->waitq ? 0 : -1;
+}
+
+static void locks_deinit(struct fatfs_state *fs)
+{
+    nk_wait_queue_destroy(fs->waitq);
+}
+
+/* path_hash
+ *
+ * hashes path as path_lookup sees it, ignoring case and repeated or
+ * trailing slashes.  With parent, the last component is left out, so
+ * the hash is that of the directory holding the entry
+ */
+static uint32_t path_hash(char *path, int parent)
+{
+    char *end = path + strlen(path);
+    uint32_t h = 2166136261U;
+    int slash = 0;
+
+    if (parent) {
+        while (end > path && end[-1] == '/') {
+            end--;
+        }
+        while (end > path && end[-1] != '/') {
+            end--;
+        }
+    }
+
+    for (; path < end; path++) {
+        if (*path == '/') {
+            slash = 1;
+            continue;
+        }
+        if (slash) {
+            h = (h ^ '/') * 16777619U;
+            slash = 0;
+        }
+        h = (h ^ (uint8_t)toupper(*path)) * 16777619U;
+    }
+
+    return h;
+}
+
+static struct fatfs_file_lock *file_lock_of(struct fatfs_state *fs, char *path)
+{
+    return &fs->file_locks[path_hash(path, 0) % FATFS_FILE_LOCKS];
+}
+
+static void file_lock(struct fatfs_state *fs, char *path, int write)
+{
+    uint32_t h = path_hash(path, 0);
+    struct fatfs_file_lock *l = &fs->file_locks[h % FATFS_FILE_LOCKS];
+
+    if (write) {
+        lock_wr(fs, &l->lock);
+        // files sharing the stripe do not hold up a move of this one
+        if (l->watch == h) {
+            l->gen++;
+        }
+    } else {
+        lock_rd(fs, &l->lock);
+    }
+}
+
+static void file_unlock(struct fatfs_state *fs, char *path, int write)
+{
+    struct fatfs_file_lock *l = file_lock_of(fs, path);
+
+    if (write) {
+        lock_wr_unlock(fs, &l->lock);
+    } else {
+        lock_rd_unlock(fs, &l->lock);
+    }
+}
+
+// the directory holding the entry for path
+static struct fatfs_lock *dir_lock_of(struct fatfs_state *fs, char *path)
+{
+    return &fs->dir_locks[path_hash(path, 1) % FATFS_DIR_LOCKS];
+}
+
+#define NS_LOCK(fs)      lock_rd(fs, &(fs)->ns_lock)
+#define NS_UNLOCK(fs)    lock_rd_unlock(fs, &(fs)->ns_lock)
+#define NS_WR_LOCK(fs)   lock_wr(fs, &(fs)->ns_lock)
+#define NS_WR_UNLOCK(fs) lock_wr_unlock(fs, &(fs)->ns_lock)
+
+#define DIR_LOCK(fs,path)   lock_wr(fs, dir_lock_of(fs,path))
+#define DIR_UNLOCK(fs,path) lock_wr_unlock(fs, dir_lock_of(fs,path))
+
+#define ALLOC_LOCK(fs)   lock_wr(fs, &(fs)->alloc_lock)
+#define ALLOC_UNLOCK(fs) lock_wr_unlock(fs, &(fs)->alloc_lock)
+
 static int read_FAT(struct fatfs_state *fs)
 {
     int rc = 0;
@@ -116,6 +303,23 @@ static uint32_t get_sector_num(uint32_t cluster_num, struct fatfs_state* fs)
     return num;
 }
 
+/*
+ * returns a pointer to the device's own copy of the cluster if the
+ * device is memory-backed, so readers can copy file data out once
+ * instead of staging it in a cluster buffer.  The memory is read-only.
+ * returns 0 if the caller must read the cluster instead
+ */
+static void *direct_cluster(struct fatfs_state *fs, uint32_t cluster_num)
+{
+    void *ptr;
+
+    if (nk_block_dev_direct_access(fs->dev, get_sector_num(cluster_num, fs), fs->bootrecord.cluster_size, &ptr)) {
+        return 0;
+    }
+
+    return ptr;
+}
+
 
 /* split_path
  *
@@ -146,6 +350,7 @@ static char** split_path(char *path, int *num_parts)
             goto out_bad;
         }
         strncpy(parts[i], piece_start, part_len);
+        parts[i][part_len] = 0;
         piece_start = slash + 1;
         i++;
     }
@@ -191,20 +396,26 @@ static void filename_parser(char* path, char* name, char* ext, int* name_s, int*
     //validate file name(eg: length)
     //further optimization: handle long file name; handle relative path 
     DEBUG("PARSER  path = %s\n", path);
-    while(path[i] != '.' && path[i]!= 0) {
+    while(path[i] != '.' && path[i]!= 0 && i < 8) {
         name[i] = path[i];
         i++;
     }
 
     *name_s = i;
 
+    while(path[i] != '.' && path[i]!= 0) {
+        i++; // longer than 8.3 names are cut short
+    }
+
     while (*name_s < 8) {
         name[(*name_s)++] = ' '; // append a space if name < 8 chars
     }
 
-    i++;
+    if (path[i] == '.') {
+        i++;
+    }
 
-    while(path[i] != '\0') {
+    while(path[i] != '\0' && ext_i < 3) {
         ext[ext_i] = path[i];
         i++;
         ext_i++;
@@ -330,8 +541,8 @@ static int path_lookup( struct fatfs_state* state, char* path, uint32_t* dir_clu
     if (is_dir == 0){
         filename_parser(parts[num_parts-1], file_name, file_ext, &name_size, &ext_size);
     }else{
-        name_size = strlen(parts[num_parts-1]);
-        strncpy(file_name, parts[num_parts-1], name_size);
+        name_size = MIN(strlen(parts[num_parts-1]), 8);
+        memcpy(file_name, parts[num_parts-1], name_size);
         ext_size = 0;
 
     }
@@ -351,8 +562,7 @@ static int path_lookup( struct fatfs_state* state, char* path, uint32_t* dir_clu
             if ( strncmp(data.name, file_name, name_size) == 0 ){
                 DEBUG("enter if statement.\n");
                 if (ext_size == 0 ){
-                    uint32_t cluster_num = DECODE_CLUSTER(data.high_cluster,data.low_cluster);
-                    DEBUG("cluster num is %d\n", cluster_num);
+                    DEBUG("cluster num is %d\n", DECODE_CLUSTER(data.high_cluster,data.low_cluster));
                     //debug_print_file(state, cluster_num, root_data[i].size);
                     *file_entry = data;
                     free_split_path(parts, num_parts);
@@ -360,8 +570,7 @@ static int path_lookup( struct fatfs_state* state, char* path, uint32_t* dir_clu
                 } else {
                     if (strncmp(data.ext, file_ext, ext_size) == 0) {
                         *file_entry = data;
-                        uint32_t cluster_num = DECODE_CLUSTER(data.high_cluster, data.low_cluster);
-                        DEBUG("cluster num is %d\n", cluster_num);
+                        DEBUG("cluster num is %d\n", DECODE_CLUSTER(data.high_cluster, data.low_cluster));
                         //debug_print_file(state, cluster_num, root_data[i].size);
                         free_split_path(parts, num_parts);
                         return i; //return the position of file in the directory
@@ -384,28 +593,38 @@ static int path_lookup( struct fatfs_state* state, char* path, uint32_t* dir_clu
 }
 
 // misnamed function - this expands or shrinks a cluster chain
-static int grow_shrink_chain(struct fatfs_state* state, uint32_t cluster_entry, long num)
+//
+// only the FAT sectors that changed are written out, under the
+// allocator lock so that concurrent allocations see each other
+static int __grow_shrink_chain(struct fatfs_state* state, uint32_t cluster_entry, long num)
 {
     uint32_t * fat = state->table_chars.fatfs_begin;
-    uint32_t size = state->table_chars.fatfs_size;
+    uint32_t entries = fat_entries(state);
     uint32_t start = state->bootrecord.rootdir_cluster;
     uint32_t cluster_entry_cpy = cluster_entry;
     uint32_t count = 0;
+    uint32_t lo = cluster_entry, hi = cluster_entry; // entries changed
 
     if (num > 0) {
         //grow chain
-        for(uint32_t i = start; i < size; i++) {
+        for(uint32_t i = start; i < entries; i++) {
             uint32_t tmp = fat[i];
             if( (tmp << 1) == FREE_CLUSTER ){
                 //update FAT table
                 DEBUG("ALLOC BLOCK: i is %u\n", i);
                 if (cluster_entry_cpy == -1) { // alloc block for new file
                     fat[i] = EOC_MIN;
+                    if (write_FAT_entries(state, i, i)) {
+                        fat[i] = FREE_CLUSTER;
+                        return -1;
+                    }
                     return i;
                 } else { // extend current file
                     fat[cluster_entry] = i;
                     count++;
                     cluster_entry = i;
+                    lo = MIN(lo, i);
+                    hi = MAX(hi, i);
                 }
             }
             if (count == num) {
@@ -430,9 +649,6 @@ static int grow_shrink_chain(struct fatfs_state* state, uint32_t cluster_entry,
                 fat[cluster_entry_cpy] = FREE_CLUSTER;
                 cluster_entry_cpy = next;
             }
-            fat[cluster_entry_cpy] = FREE_CLUSTER;
-            // 
-            // nk_block_dev_read(state->dev, state->bootrecord.reservedblock_size, size, state->table_chars.fatfs_begin, NK_DEV_REQ_BLOCKING);
             return -1;
         }
     } else if(num < 0) {
@@ -440,38 +656,369 @@ static int grow_shrink_chain(struct fatfs_state* state, uint32_t cluster_entry,
         long n = -(num);
         uint32_t cluster_min = state->bootrecord.rootdir_cluster; // min valid cluster number
         uint32_t cluster_max = state->table_chars.data_end - state->table_chars.data_start; // max valid cluster number
+        uint32_t c = fat[cluster_entry]; // first cluster to free
+        fat[cluster_entry_cpy] = EOC_MIN;
         for(uint32_t i = 0; i < n; i++) {
-            uint32_t next = fat[cluster_entry];
-            if (next < cluster_min || next > cluster_max ) {
-                return -1;
-            }
-            if (next >= EOC_MIN && next <= EOC_MAX) {
-                return -1;
+            if (c < cluster_min || c > cluster_max ) {
+                break; // chain ended or is corrupt; what was freed is still written out
             }
-            fat[next] = FREE_CLUSTER;
-            cluster_entry = next;
+            uint32_t next = fat[c];
+            fat[c] = FREE_CLUSTER;
+            lo = MIN(lo, c);
+            hi = MAX(hi, c);
+            c = next;
         }
-        fat[cluster_entry_cpy] = EOC_MIN;
 
     }
 
-    // flush fat back to disk
-
-    // copy 1
-    if (nk_block_dev_write(state->dev, state->bootrecord.reservedblock_size, size, fat, NK_DEV_REQ_BLOCKING,0,0)) {
+    // flush fat back to disk, every copy
+    if (write_FAT_entries(state, lo, hi)) {
         ERROR("Failed to write blocks\n");
         return -1;
     }
 
-    // copy 2
-    if (nk_block_dev_write(state->dev, state->bootrecord.reservedblock_size+size, size, fat, NK_DEV_REQ_BLOCKING,0,0)) {
-        ERROR("Failed to write blocks\n");
+    return 0;
+}
+
+static int grow_shrink_chain(struct fatfs_state* state, uint32_t cluster_entry, long num)
+{
+    int rc;
+
+    ALLOC_LOCK(state);
+    rc = __grow_shrink_chain(state, cluster_entry, num);
+    ALLOC_UNLOCK(state);
+
+    return rc;
+}
+
+
+/* directory iteration
+ *
+ * A cursor walks the cluster chain of a directory once, a cluster at a
+ * time, and decodes each entry in place.  Long file name (VFAT) entries
+ * precede the short entry they belong to, last part first, and are
+ * collected until that short entry is reached.
+ */
+#define DIR_ENTRY_SIZE   32
+#define ATTR_READONLY    0x01
+#define ATTR_HIDDEN      0x02
+#define ATTR_SYSTEM      0x04
+#define ATTR_VOLUMEID    0x08
+#define ATTR_DIR         0x10
+#define ATTR_LFN         0x0F
+#define LFN_LAST         0x40
+#define LFN_CHARS        13    // per entry
+#define LFN_MAX_ENTRIES  20
+#define NT_LOWER_NAME    0x08  // short name was all lower case
+#define NT_LOWER_EXT     0x10
+#define SHORT_NAME_LEN   13    // 8.3 plus null
+
+struct dir_cursor {
+    uint32_t  cluster;      // current cluster of the directory
+    uint32_t  index;        // next entry within it
+    int       done;
+    uint8_t  *data;         // entries of the current cluster, 0 if not loaded
+    uint8_t  *buf;          // for devices that are not memory-backed
+    uint16_t  lfn[LFN_MAX_ENTRIES*LFN_CHARS];
+    int       lfn_ord;      // sequence number of the last long entry seen, 0 if none
+    int       lfn_len;      // in characters
+    uint8_t   lfn_sum;      // checksum of the short name it belongs to
+};
+
+static const uint8_t lfn_offsets[LFN_CHARS] = { 1, 3, 5, 7, 9, 14, 16, 18, 20, 22, 24, 28, 30 };
+
+static struct dir_cursor *dir_cursor_open(struct fatfs_state *fs, uint32_t cluster)
+{
+    struct dir_cursor *d = malloc(sizeof(*d));
+
+    if (!d) {
+        ERROR("Cannot allocate directory cursor\n");
+        return 0;
+    }
+
+    memset(d, 0, sizeof(*d));
+    d->cluster = cluster;
+
+    return d;
+}
+
+static void dir_cursor_close(struct dir_cursor *d)
+{
+    if (d->buf) {
+        free(d->buf);
+    }
+    free(d);
+}
+
+static uint8_t short_name_checksum(uint8_t *e)
+{
+    uint8_t sum = 0;
+    int i;
+
+    for (i = 0; i < 11; i++) {
+        sum = ((sum & 1) << 7) + (sum >> 1) + e[i];
+    }
+    return sum;
+}
+
+static void lfn_collect(struct dir_cursor *d, uint8_t *e)
+{
+    int ord = e[0] & 0x3F;
+    int i;
+
+    if (ord < 1 || ord > LFN_MAX_ENTRIES) {
+        d->lfn_ord = 0;
+        return;
+    }
+
+    if (e[0] & LFN_LAST) {
+        d->lfn_len = ord * LFN_CHARS;
+        d->lfn_sum = e[13];
+    } else if (!d->lfn_ord || ord != d->lfn_ord - 1 || e[13] != d->lfn_sum) {
+        // out of sequence, so whatever we had is an orphan
+        d->lfn_ord = 0;
+        return;
+    }
+
+    d->lfn_ord = ord;
+
+    for (i = 0; i < LFN_CHARS; i++) {
+        d->lfn[(ord - 1) * LFN_CHARS + i] = e[lfn_offsets[i]] | (e[lfn_offsets[i] + 1] << 8);
+    }
+}
+
+// UCS-2 to UTF-8, truncating to fit
+static void lfn_to_utf8(uint16_t *lfn, int len, char *name, int size)
+{
+    int i, j = 0;
+    uint16_t c;
+
+    for (i = 0; i < len && lfn[i] && lfn[i] != 0xFFFF; i++) {
+        c = lfn[i];
+        if (c < 0x80) {
+            if (j + 1 >= size) break;
+            name[j++] = c;
+        } else if (c < 0x800) {
+            if (j + 2 >= size) break;
+            name[j++] = 0xC0 | (c >> 6);
+            name[j++] = 0x80 | (c & 0x3F);
+        } else {
+            if (j + 3 >= size) break;
+            name[j++] = 0xE0 | (c >> 12);
+            name[j++] = 0x80 | ((c >> 6) & 0x3F);
+            name[j++] = 0x80 | (c & 0x3F);
+        }
+    }
+    name[j] = 0;
+}
+
+static void short_name_decode(uint8_t *e, char *name)
+{
+    int i, j = 0;
+
+    for (i = 0; i < 8 && e[i] != ' '; i++) {
+        char c = (i == 0 && e[i] == 0x05) ? 0xE5 : e[i];   // 0x05 stands in for a leading 0xE5
+        name[j++] = ((e[12] & NT_LOWER_NAME) && c >= 'A' && c <= 'Z') ? c - 'A' + 'a' : c;
+    }
+    if (e[8] != ' ') {
+        name[j++] = '.';
+        for (i = 8; i < 11 && e[i] != ' '; i++) {
+            name[j++] = ((e[12] & NT_LOWER_EXT) && e[i] >= 'A' && e[i] <= 'Z') ? e[i] - 'A' + 'a' : e[i];
+        }
+    }
+    name[j] = 0;
+}
+
+// load the entries of the cursor's current cluster
+static int dir_cursor_load(struct fatfs_state *fs, struct dir_cursor *d)
+{
+    d->data = direct_cluster(fs, d->cluster);
+
+    if (d->data) {
+        return 0;
+    }
+
+    if (!d->buf) {
+        d->buf = malloc(get_cluster_size(fs));
+        if (!d->buf) {
+            ERROR("Cannot allocate directory buffer\n");
+            return -1;
+        }
+    }
+
+    if (nk_block_dev_read(fs->dev, get_sector_num(d->cluster, fs), fs->bootrecord.cluster_size, d->buf, NK_DEV_REQ_BLOCKING,0,0)) {
+        ERROR("Failed to read directory cluster %u\n", d->cluster);
         return -1;
     }
 
+    d->data = d->buf;
+
     return 0;
 }
 
+/* dir_cursor_next
+ *
+ * decodes the next entry other than "." and "..", giving its name (long
+ * if it has one) and, if short_name is given, its 8.3 name as well
+ * returns 1 if there is an entry, 0 at the end, -1 on error
+ */
+static int dir_cursor_next(struct fatfs_state *fs, struct dir_cursor *d, struct nk_fs_dirent *ent, char *short_name)
+{
+    uint32_t per_cluster = get_cluster_size(fs) / DIR_ENTRY_SIZE;
+    uint32_t cluster_min = fs->bootrecord.rootdir_cluster;
+    uint32_t cluster_max = fs->table_chars.data_end - fs->table_chars.data_start;
+    char sname[SHORT_NAME_LEN];
+    uint8_t *e;
+
+    while (!d->done) {
+        if (d->index == per_cluster) {
+            uint32_t next = fs->table_chars.fatfs_begin[d->cluster];
+            if (next >= EOC_MIN && next <= EOC_MAX) {
+                d->done = 1;
+                break;
+            }
+            if (next < cluster_min || next > cluster_max) {
+                ERROR("Bogus next cluster value (%x) in directory\n", next);
+                return -1;
+            }
+            d->cluster = next;
+            d->index = 0;
+            d->data = 0;
+        }
+
+        if (!d->data && dir_cursor_load(fs, d)) {
+            return -1;
+        }
+
+        e = d->data + DIR_ENTRY_SIZE * d->index++;
+
+        if (e[0] == 0) {
+            // no entries after this one
+            d->done = 1;
+            break;
+        }
+
+        if (e[0] == 0xE5) {
+            d->lfn_ord = 0;
+            continue;
+        }
+
+        if ((e[11] & 0x3F) == ATTR_LFN) {
+            lfn_collect(d, e);
+            continue;
+        }
+
+        if (e[11] & ATTR_VOLUMEID) {
+            d->lfn_ord = 0;
+            continue;
+        }
+
+        short_name_decode(e, sname);
+
+        if (!strcmp(sname, ".") || !strcmp(sname, "..")) {
+            d->lfn_ord = 0;
+            continue;
+        }
+
+        if (d->lfn_ord == 1 && d->lfn_sum == short_name_checksum(e)) {
+            lfn_to_utf8(d->lfn, d->lfn_len, ent->name, NK_FS_DIRENT_NAME_LEN);
+        } else {
+            strcpy(ent->name, sname);
+        }
+        d->lfn_ord = 0;
+
+        if (short_name) {
+            strcpy(short_name, sname);
+        }
+
+        ent->size = ((dir_entry *)e)->size;
+        ent->attr = ((e[11] & ATTR_DIR) ? NK_FS_ATTR_DIR : 0) |
+                    ((e[11] & ATTR_READONLY) ? NK_FS_ATTR_READONLY : 0) |
+                    ((e[11] & ATTR_HIDDEN) ? NK_FS_ATTR_HIDDEN : 0) |
+                    ((e[11] & ATTR_SYSTEM) ? NK_FS_ATTR_SYSTEM : 0);
+
+        return 1;
+    }
+
+    return 0;
+}
+
+
+/* chain_seek
+ *
+ * follows a cluster chain from *cluster to the cluster holding byte
+ * offset off, updating *cluster
+ * returns -1 if the chain ends or is corrupt first
+ */
+static int chain_seek(struct fatfs_state *fs, uint32_t *cluster, off_t off)
+{
+    uint32_t cluster_size = get_cluster_size(fs);
+    uint32_t cluster_min = fs->bootrecord.rootdir_cluster;
+    uint32_t cluster_max = fs->table_chars.data_end - fs->table_chars.data_start;
+    uint32_t next;
+
+    while (off >= cluster_size) {
+        next = fs->table_chars.fatfs_begin[*cluster];
+        if (next < cluster_min || next > cluster_max) {
+            return -1;
+        }
+        *cluster = next;
+        off -= cluster_size;
+    }
+
+    return 0;
+}
+
+/* chain_run
+ *
+ * returns how many clusters, up to max, starting with cluster are both
+ * consecutive in the chain and adjacent on disk
+ */
+static uint32_t chain_run(struct fatfs_state *fs, uint32_t cluster, uint32_t max)
+{
+    uint32_t *fat = fs->table_chars.fatfs_begin;
+    uint32_t count = 1;
+
+    while (count < max && fat[cluster] == cluster + 1) {
+        cluster++;
+        count++;
+    }
+
+    return count;
+}
+
+/* set_entry_size
+ *
+ * writes size into the entry for path, which is entry dir_num of the
+ * directory sector at dir_cluster_num; other entries in that sector
+ * may be changing at the same time, so the sector is read and written
+ * under the directory's lock
+ */
+static int set_entry_size(struct fatfs_state *fs, char *path, uint32_t dir_cluster_num, int dir_num, uint32_t size)
+{
+    dir_entry full_dirs[FLOOR_DIV(fs->bootrecord.sector_size, sizeof(dir_entry))];
+    int rc = -1;
+
+    DIR_LOCK(fs, path);
+
+    if (nk_block_dev_read(fs->dev, get_sector_num(dir_cluster_num, fs), 1, full_dirs, NK_DEV_REQ_BLOCKING,0,0)) {
+        ERROR("Failed to read block\n");
+        goto out;
+    }
+
+    full_dirs[dir_num].size = size;
+
+    if (nk_block_dev_write(fs->dev, get_sector_num(dir_cluster_num, fs), 1, full_dirs, NK_DEV_REQ_BLOCKING,0,0)) {
+        ERROR("Failed to write block\n");
+        goto out;
+    }
+
+    rc = 0;
+ out:
+    DIR_UNLOCK(fs, path);
+    return rc;
+}
+
 
 #define BYTES_PER_LINE 16
 static void mem_print(char *addr, int len)
@@ -479,7 +1026,7 @@ static void mem_print(char *addr, int len)
     int i, j, k;
     int size = 1;
     for (i=0;i<len;i+=BYTES_PER_LINE) {
-        nk_vc_printf("%016lx :",addr+i);
+        nk_vc_printf("%016lx :",(uint64_t)(addr+i));
         nk_vc_printf(" ");
         for (j=0;j<BYTES_PER_LINE && (i+j)<len; j+=size) {
             for (k=0;k<size;k++) {
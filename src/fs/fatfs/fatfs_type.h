@@ -5,6 +5,8 @@
 #ifndef NAUTILUS_FATFS_TYPE_H
 #define NAUTILUS_FATFS_TYPE_H
 
+#include <nautilus/waitqueue.h>
+
 #include "fatfs.h"
 
 #define INFO(fmt, args...)  INFO_PRINT("fat32: " fmt, ##args)
@@ -18,6 +20,27 @@
 
 #define BLOCK_SIZE 512
 
+// lock stripes; files and directories are named by path, and hash to one
+#define FATFS_FILE_LOCKS 64
+#define FATFS_DIR_LOCKS  64
+
+/*
+ * the locks below are held across device I/O, so they sleep rather
+ * than spin; see fatfs_helper.c.  count is -1 while held exclusive,
+ * and otherwise the number of sharers; writers counts those waiting
+ * to take it exclusive, and holds off new sharers
+ */
+struct fatfs_lock {
+    volatile int        count;
+    volatile int        writers;
+};
+
+struct fatfs_file_lock {
+    struct fatfs_lock   lock;
+    uint32_t            watch;     // path hash of the file being moved, see fatfs_defrag.c
+    uint64_t            gen;       // bumped by every writer of that file
+};
+
 struct fatfs_state {
     struct nk_block_dev_characteristics chars;
     struct nk_block_dev *dev;
@@ -27,6 +50,20 @@ struct fatfs_state {
     // probably at least the mapping <-> blockdev / pdrv
     struct fatfs_bootrecord bootrecord;
     struct fatfs_char	table_chars;
+
+    // locks are taken in this order, and are held across device I/O:
+    //   ns_lock      shared by every operation, exclusive for remove and rename
+    //   file_locks   shared by readers of a file, exclusive for writers
+    //   dir_locks    exclusive, while changing entries in a directory
+    //   alloc_lock   exclusive, while changing fatfs_begin[] and writing it out
+    // all of them are waited for on waitq
+    nk_wait_queue_t       *waitq;
+    struct fatfs_lock      ns_lock;
+    struct fatfs_file_lock file_locks[FATFS_FILE_LOCKS];
+    struct fatfs_lock      dir_locks[FATFS_DIR_LOCKS];
+    struct fatfs_lock      alloc_lock;
+
+    struct fatfs_defrag *defrag;   // defragmenter, once one has been started
 };
 
 #endif //NAUTILUS_FATFS_TYPE_H
@@ -1019,6 +1019,212 @@ static void clear_lock (	/* Clear lock entries of the volume */
 
 
 
+/*-----------------------------------------------------------------------*/
+/* Window cache                                                          */
+/*-----------------------------------------------------------------------*/
+/* With a cache given by f_wincache(), a sector leaving the window stays */
+/* in a cache line, dirty or not, so switching between FAT and directory */
+/* sectors costs a copy instead of a write and a read.  win[] itself is  */
+/* unchanged, so pointers into it keep their meaning.  A dirty line is   */
+/* written back when it is evicted, and all of them by sync_window().    */
+/* The 2nd FAT is only brought up to date by sync_window().              */
+
+static FFWC* wc_find (	/* Line holding the sector, or null */
+	FATFS* fs,		/* Filesystem object */
+	LBA_t sect		/* Sector LBA */
+)
+{
+	UINT i;
+
+
+	for (i = 0; i < fs->n_wc; i++) {
+		if (fs->wc[i].sect == sect) return &fs->wc[i];
+	}
+	return 0;
+}
+
+
+static void wc_reset (	/* Forget everything in the cache, dirty or not */
+	FATFS* fs		/* Filesystem object */
+)
+{
+	UINT i;
+
+
+	for (i = 0; i < fs->n_wc; i++) {
+		fs->wc[i].sect = (LBA_t)0 - 1;
+		fs->wc[i].dirty = 0;
+	}
+	fs->wc_cur = 0;
+	fs->wc_mlo = fs->wc_mhi = 0;
+}
+
+
+static void wc_put (	/* Put the window back into its line */
+	FATFS* fs		/* Filesystem object */
+)
+{
+	if (fs->wc_cur && fs->wflag) {
+		memcpy(fs->wc_cur->buf, fs->win, SS(fs));
+		fs->wc_cur->dirty = 1;
+		fs->wflag = 0;
+	}
+}
+
+
+#if !FF_FS_READONLY
+static void wc_drop (	/* Forget the clean lines for sectors the window is bypassed for */
+	FATFS* fs,		/* Filesystem object */
+	LBA_t sect,		/* First sector */
+	UINT n			/* Number of sectors */
+)
+{
+	UINT i;
+
+
+	for (i = 0; i < fs->n_wc; i++) {
+		if (fs->wc[i].sect - sect < n) {
+			fs->wc[i].sect = (LBA_t)0 - 1;
+			fs->wc[i].dirty = 0;
+			if (fs->wc_cur == &fs->wc[i]) fs->wc_cur = 0;
+		}
+	}
+}
+
+
+static void wc_claim (	/* win[] was filled in place for winsect and written: make the cache agree (all lines clean) */
+	FATFS* fs		/* Filesystem object */
+)
+{
+	FFWC* wc;
+
+
+	if (fs->n_wc == 0) return;
+	wc = wc_find(fs, fs->winsect);
+	if (!wc) wc = fs->wc_cur ? fs->wc_cur : &fs->wc[0];
+	wc->sect = fs->winsect;
+	memcpy(wc->buf, fs->win, SS(fs));
+	wc->dirty = 0;
+	wc->used = ++fs->wc_clock;
+	fs->wc_cur = wc;
+	fs->wflag = 0;
+}
+
+
+static int wc_fat2 (	/* Does the sector have a copy in the 2nd FAT? */
+	FATFS* fs,		/* Filesystem object */
+	LBA_t sect		/* Sector LBA */
+)
+{
+	return fs->n_fats == 2 && sect - fs->fatbase < fs->fsize;
+}
+
+
+static FRESULT wc_evict (	/* Write back a line leaving the cache, to the 1st FAT only */
+	FATFS* fs,		/* Filesystem object */
+	FFWC* wc		/* Line */
+)
+{
+	if (wc->dirty) {
+		if (disk_write(fs->pdrv, wc->buf, wc->sect, 1) != RES_OK) return FR_DISK_ERR;
+		wc->dirty = 0;
+		if (wc_fat2(fs, wc->sect)) {	/* Mirror it at the next sync */
+			if (fs->wc_mlo == fs->wc_mhi) {
+				fs->wc_mlo = wc->sect; fs->wc_mhi = wc->sect + 1;
+			} else {
+				if (wc->sect < fs->wc_mlo) fs->wc_mlo = wc->sect;
+				if (wc->sect >= fs->wc_mhi) fs->wc_mhi = wc->sect + 1;
+			}
+		}
+	}
+	return FR_OK;
+}
+
+
+static FRESULT wc_sync (	/* Write back every dirty line and bring the 2nd FAT up to date */
+	FATFS* fs		/* Filesystem object */
+)
+{
+	FRESULT res = FR_OK;
+	FFWC *wc, *w;
+	LBA_t sect;
+	UINT i;
+
+
+	wc_put(fs);
+	for (;;) {	/* Dirty lines in ascending sector order */
+		wc = 0;
+		for (i = 0; i < fs->n_wc; i++) {
+			w = &fs->wc[i];
+			if (w->dirty && (!wc || w->sect < wc->sect)) wc = w;
+		}
+		if (!wc) break;
+		if (disk_write(fs->pdrv, wc->buf, wc->sect, 1) != RES_OK) return FR_DISK_ERR;
+		wc->dirty = 0;
+		if (wc_fat2(fs, wc->sect)) disk_write(fs->pdrv, wc->buf, wc->sect + fs->fsize, 1);	/* Reflect it to 2nd FAT */
+	}
+	if (fs->wc_mlo != fs->wc_mhi) {	/* Reflect evicted FAT sectors, using win[] as a buffer */
+		for (sect = fs->wc_mlo; res == FR_OK && sect < fs->wc_mhi; sect++) {
+			if ((w = wc_find(fs, sect)) != 0) {
+				disk_write(fs->pdrv, w->buf, sect + fs->fsize, 1);
+			} else if (disk_read(fs->pdrv, fs->win, sect, 1) == RES_OK) {
+				disk_write(fs->pdrv, fs->win, sect + fs->fsize, 1);
+			} else {
+				res = FR_DISK_ERR;
+			}
+		}
+		if (res == FR_OK) fs->wc_mlo = fs->wc_mhi = 0;
+		if (fs->wc_cur) {
+			memcpy(fs->win, fs->wc_cur->buf, SS(fs));
+		} else {
+			fs->winsect = (LBA_t)0 - 1;
+		}
+	}
+	return res;
+}
+#endif
+
+
+static FRESULT wc_move (	/* move_window() through the cache */
+	FATFS* fs,		/* Filesystem object */
+	LBA_t sect		/* Sector LBA to make appearance in the fs->win[] */
+)
+{
+	FFWC *wc, *w;
+	UINT i;
+
+
+	wc_put(fs);
+	wc = wc_find(fs, sect);
+	if (!wc) {	/* Miss: take a free line or the least recently used one */
+		wc = &fs->wc[0];
+		for (i = 0; i < fs->n_wc; i++) {
+			w = &fs->wc[i];
+			if (w->sect == (LBA_t)0 - 1) { wc = w; break; }
+			if (w->used < wc->used) wc = w;
+		}
+#if !FF_FS_READONLY
+		if (wc_evict(fs, wc) != FR_OK) return FR_DISK_ERR;
+#endif
+		wc->sect = (LBA_t)0 - 1;
+		if (fs->wc_cur == wc) {
+			fs->wc_cur = 0; fs->winsect = (LBA_t)0 - 1;
+		}
+		if (disk_read(fs->pdrv, wc->buf, sect, 1) != RES_OK) {
+			fs->wc_cur = 0; fs->winsect = (LBA_t)0 - 1;	/* Invalidate window */
+			return FR_DISK_ERR;
+		}
+		wc->sect = sect;
+	}
+	memcpy(fs->win, wc->buf, SS(fs));
+	wc->used = ++fs->wc_clock;
+	fs->wc_cur = wc;
+	fs->winsect = sect;
+	return FR_OK;
+}
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Move/Flush disk access window in the filesystem object                */
 /*-----------------------------------------------------------------------*/
@@ -1030,6 +1236,7 @@ static FRESULT sync_window (	/* Returns FR_OK or FR_DISK_ERR */
 	FRESULT res = FR_OK;
 
 
+	if (fs->n_wc) return wc_sync(fs);	/* Flush the whole cache */
 	if (fs->wflag) {	/* Is the disk access window dirty? */
 		if (disk_write(fs->pdrv, fs->win, fs->winsect, 1) == RES_OK) {	/* Write it back into the volume */
 			fs->wflag = 0;	/* Clear window dirty flag */
@@ -1054,6 +1261,7 @@ static FRESULT move_window (	/* Returns FR_OK or FR_DISK_ERR */
 
 
 	if (sect != fs->winsect) {	/* Window offset changed? */
+		if (fs->n_wc) return wc_move(fs, sect);
 #if !FF_FS_READONLY
 		res = sync_window(fs);		/* Flush the window */
 #endif
@@ -1095,6 +1303,7 @@ static FRESULT sync_fs (	/* Returns FR_OK or FR_DISK_ERR */
 			st_dword(fs->win + FSI_Nxt_Free, fs->last_clst);	/* Last allocated culuster */
 			fs->winsect = fs->volbase + 1;						/* Write it into the FSInfo sector (Next to VBR) */
 			disk_write(fs->pdrv, fs->win, fs->winsect, 1);
+			wc_claim(fs);
 			fs->fsi_flag = 0;
 		}
 		/* Make sure that no pending write process in the lower layer */
@@ -1639,6 +1848,8 @@ static FRESULT dir_clear (	/* Returns FR_OK or FR_DISK_ERR */
 	sect = clst2sect(fs, clst);		/* Top of the cluster */
 	fs->winsect = sect;				/* Set window to top of the cluster */
 	memset(fs->win, 0, sizeof fs->win);	/* Clear window buffer */
+	wc_drop(fs, sect, fs->csize);	/* The cluster is written around the cache */
+	wc_claim(fs);
 #if FF_USE_LFN == 3		/* Quick table clear by using multi-secter write */
 	/* Allocate a temporary buffer */
 	for (szb = ((DWORD)fs->csize * SS(fs) >= MAX_MALLOC) ? MAX_MALLOC : fs->csize * SS(fs), ibuf = 0; szb > SS(fs) && (ibuf = ff_memalloc(szb)) == 0; szb /= 2) ;
@@ -3246,6 +3457,7 @@ static UINT check_fs (	/* 0:FAT/FAT32 VBR, 1:exFAT VBR, 2:Not FAT and valid BS,
 
 
 	fs->wflag = 0; fs->winsect = (LBA_t)0 - 1;		/* Invaidate window */
+	wc_reset(fs);
 	if (move_window(fs, sect) != FR_OK) return 4;	/* Load the boot sector */
 	sign = ld_word(fs->win + BS_55AA);
 #if FF_FS_EXFAT
@@ -3647,6 +3859,29 @@ FRESULT f_mount (
 
 
 
+/*-----------------------------------------------------------------------*/
+/* Give a Volume a Window Cache                                          */
+/*-----------------------------------------------------------------------*/
+
+FRESULT f_wincache (
+	FATFS* fs,		/* Filesystem object, before f_mount() */
+	FFWC* wc,		/* n cache lines, or null for the window alone */
+	UINT n			/* Number of cache lines */
+)
+{
+	if (!fs) return FR_INVALID_OBJECT;
+	if (fs->fs_type) return FR_DENIED;	/* Not while mounted */
+
+	fs->wc = wc;
+	fs->n_wc = wc ? n : 0;
+	fs->wc_clock = 0;
+	wc_reset(fs);
+	return FR_OK;
+}
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Open or Create a File                                                 */
 /*-----------------------------------------------------------------------*/
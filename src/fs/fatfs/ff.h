@@ -127,6 +127,17 @@ extern const char* VolumeStr[FF_VOLUMES];	/* User defied volume ID */
 
 
 
+/* Window cache line (FFWC), see f_wincache() */
+
+typedef struct {
+	LBA_t	sect;			/* Sector held in buf[] ((LBA_t)0-1: none) */
+	DWORD	used;			/* Last use, by the volume's LRU clock */
+	BYTE	dirty;			/* buf[] is newer than the sector */
+	BYTE	buf[FF_MAX_SS];	/* Sector data */
+} FFWC;
+
+
+
 /* Filesystem object structure (FATFS) */
 
 typedef struct {
@@ -172,6 +183,11 @@ typedef struct {
 	LBA_t	bitbase;		/* Allocation bitmap base sector */
 #endif
 	LBA_t	winsect;		/* Current sector appearing in the win[] */
+	FFWC*	wc;				/* Window cache lines (null: none) */
+	FFWC*	wc_cur;			/* Line holding the sector in win[] */
+	UINT	n_wc;			/* Number of window cache lines */
+	DWORD	wc_clock;		/* LRU clock of the window cache */
+	LBA_t	wc_mlo, wc_mhi;	/* FAT sectors written to the 1st FAT only since the last sync */
 	BYTE	win[FF_MAX_SS];	/* Disk access window for Directory, FAT (and file data at tiny cfg) */
 } FATFS;
 
@@ -328,6 +344,7 @@ FRESULT f_setlabel (const TCHAR* label);							/* Set volume label */
 FRESULT f_forward (FIL* fp, UINT(*func)(const BYTE*,UINT), UINT btf, UINT* bf);	/* Forward data to the stream */
 FRESULT f_expand (FIL* fp, FSIZE_t fsz, BYTE opt);					/* Allocate a contiguous block to the file */
 FRESULT f_mount (FATFS* fs, const TCHAR* path, BYTE opt);			/* Mount/Unmount a logical drive */
+FRESULT f_wincache (FATFS* fs, FFWC* wc, UINT n);					/* Give a volume n sectors of cache behind its window, before mounting */
 FRESULT f_mkfs (const TCHAR* path, const MKFS_PARM* opt, void* work, UINT len);	/* Create a FAT volume */
 FRESULT f_fdisk (BYTE pdrv, const LBA_t ptbl[], void* work);		/* Divide a physical drive into some partitions */
 FRESULT f_setcp (WORD cp);											/* Set current code page */
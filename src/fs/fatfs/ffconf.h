@@ -308,17 +308,13 @@
 
 /* #include <somertos.h>	// O/S definitions */
 #include <nautilus/nautilus.h>
-#include <nautilus/spinlock.h>
-
-typedef struct nk_syncobj {
-    spinlock_t lock;
-    uint8_t    irqstate;
-} nk_syncobj_t;
+#include <nautilus/semaphore.h>
 
 // PAD - we really need to be able to call this on multiple threads
+// the volume is held across device I/O, so it is a semaphore, not a spinlock
 #define FF_FS_REENTRANT	1
 #define FF_FS_TIMEOUT	1000
-#define FF_SYNC_t	nk_syncobj_t *
+#define FF_SYNC_t	struct nk_semaphore *
 /* The option FF_FS_REENTRANT switches the re-entrancy (thread safe) of the FatFs
 /  module itself. Note that regardless of this option, file access to different
 /  volume is always re-entrant and volume control functions, f_mount(), f_mkfs()
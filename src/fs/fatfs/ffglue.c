@@ -0,0 +1,881 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2017, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+
+/*
+ * An nk_fs backend on ChaN's FatFs.  Each attached volume gets a
+ * physical drive number from diskio.c, which is also its FatFs logical
+ * drive, so paths on it are "N:/path".  Each open file is a FIL of its
+ * own.  With NK_FS_FATFS_FASTSEEK, an open file also keeps a cluster
+ * link map (CLMT), so seeks do not walk the FAT.  The map only covers
+ * the clusters the file has, so it is set aside while a write extends
+ * the file, and rebuilt after.
+ *
+ * A file whose data is one run of clusters - a NoFatChain file on
+ * exFAT, or one the map shows to be a single fragment - is read and
+ * written inside its size by offset arithmetic straight to the device,
+ * without FatFs.  nk_fs_fatfs_create_contig makes such files.
+ */
+
+#include <nautilus/nautilus.h>
+#include <nautilus/blkdev.h>
+#include <nautilus/fs.h>
+#include <nautilus/list.h>
+#include <nautilus/spinlock.h>
+#include <nautilus/shell.h>
+#include <nautilus/thread.h>
+
+#include <fs/fatfs/fatfs.h>
+
+#include "ff.h"
+#include "diskio.h"
+#include "ffglue.h"
+
+#define FFG_PATH_LEN   512
+// initial size of a cluster link map, in DWORDs - 31 fragments
+#define FFG_CLMT_INIT  64
+// largest transfer handed to f_read/f_write at once
+#define FFG_MAX_XFER   (1UL<<30)
+
+#define MIN(x,y) ((x)<(y) ? (x) : (y))
+
+struct ffg_state {
+    struct nk_fs        *fs;
+    struct nk_block_dev *dev;
+    int                  pdrv;
+    int                  readonly;
+    int                  flags;
+    char                 drive[8];    // "N:"
+    FATFS                vol;
+    FFWC                *cache;       // behind vol's window
+
+    spinlock_t           lock;        // protects files, syncing
+    struct list_head     files;
+    int                  syncing;     // files stay listed while nonzero
+};
+
+struct ffg_file {
+    struct list_head node;
+    spinlock_t       lock;       // protects busy
+    int              busy;       // claimed: the FIL's position, and the map
+    FIL              fil;
+    DWORD           *clmt;       // cluster link map, if fast seeking
+    DWORD            clmt_len;   // in DWORDs
+    LBA_t            contig;     // first sector, if the data is one run
+};
+
+#define STATE_LOCK_CONF uint8_t _state_lock_flags
+#define STATE_LOCK(s) _state_lock_flags = spin_lock_irq_save(&(s)->lock)
+#define STATE_UNLOCK(s) spin_unlock_irq_restore(&(s)->lock, _state_lock_flags)
+
+#define FILE_LOCK_CONF uint8_t _file_lock_flags
+#define FILE_LOCK(f) _file_lock_flags = spin_lock_irq_save(&(f)->lock)
+#define FILE_UNLOCK(f) spin_unlock_irq_restore(&(f)->lock, _file_lock_flags)
+
+// a file is claimed across FatFs calls, which do device I/O and may
+// sleep, so the claim is a flag that others yield on, not a lock
+static void file_claim(struct ffg_file *f)
+{
+    FILE_LOCK_CONF;
+
+    FILE_LOCK(f);
+    while (f->busy) {
+	FILE_UNLOCK(f);
+	nk_yield();
+	FILE_LOCK(f);
+    }
+    f->busy = 1;
+    FILE_UNLOCK(f);
+}
+
+static void file_release(struct ffg_file *f)
+{
+    FILE_LOCK_CONF;
+
+    FILE_LOCK(f);
+    f->busy = 0;
+    FILE_UNLOCK(f);
+}
+
+static const uint8_t ffg_zeros[FF_MAX_SS];
+
+static struct nk_fs_int ffglue_inter;
+
+static const char *ffg_strerror(FRESULT res)
+{
+    static const char *str[] = {
+	"ok", "disk error", "internal error", "not ready", "no file", "no path",
+	"invalid name", "denied", "exists", "invalid object", "write protected",
+	"invalid drive", "not enabled", "no filesystem", "mkfs aborted", "timeout",
+	"locked", "not enough memory", "too many open files", "invalid parameter" };
+
+    return res < sizeof(str)/sizeof(str[0]) ? str[res] : "unknown error";
+}
+
+// the FatFs path for path on this volume
+static int ffg_path(struct ffg_state *s, char *path, char *buf)
+{
+    if (strlen(s->drive) + strlen(path) + 1 > FFG_PATH_LEN) {
+	ERROR("Path %s is too long\n", path);
+	return -1;
+    }
+
+    strcpy(buf, s->drive);
+    strcat(buf, path);
+
+    return 0;
+}
+
+static int ffg_is_root(char *path)
+{
+    return !path[0] || !strcmp(path, "/");
+}
+
+// (re)builds the file's cluster link map; without one, seeks walk the
+// FAT as usual
+static void ffg_map(struct ffg_file *f)
+{
+    FRESULT res;
+    DWORD *n;
+
+    if (!f->clmt) {
+	return;
+    }
+
+    f->clmt[0] = f->clmt_len;
+    f->fil.cltbl = f->clmt;
+
+    res = f_lseek(&f->fil, CREATE_LINKMAP);
+
+    if (res == FR_NOT_ENOUGH_CORE) {
+	// clmt[0] is now the size needed
+	f->fil.cltbl = 0;
+	if (!(n = realloc(f->clmt, f->clmt[0]*sizeof(DWORD)))) {
+	    ERROR("Cannot grow cluster link map to %u entries\n", f->clmt[0]);
+	    return;
+	}
+	f->clmt_len = n[0];
+	f->clmt = n;
+	f->fil.cltbl = f->clmt;
+	res = f_lseek(&f->fil, CREATE_LINKMAP);
+    }
+
+    if (res != FR_OK) {
+	DEBUG("No cluster link map (%s)\n", ffg_strerror(res));
+	f->fil.cltbl = 0;
+    }
+}
+
+// notes whether the file's data is one run of sectors
+static void ffg_find_contig(struct ffg_file *f)
+{
+    FATFS *v = f->fil.obj.fs;
+    int one_run = 0;
+
+    f->contig = 0;
+
+    if (!f->fil.obj.sclust) {
+	return;
+    }
+
+#if FF_FS_EXFAT
+    // NoFatChain
+    if (v->fs_type == FS_EXFAT && (f->fil.obj.stat & 3) == 2) {
+	one_run = 1;
+    }
+#endif
+
+    // a map of a single fragment: size, length, start, terminator
+    if (f->fil.cltbl && f->clmt[0] == 4) {
+	one_run = 1;
+    }
+
+    if (one_run) {
+	f->contig = v->database + (LBA_t)v->csize * (f->fil.obj.sclust - 2);
+    }
+}
+
+// transfers within the size of a file that is one run, without FatFs
+static ssize_t ffg_contig_rw(struct ffg_file *f, uint8_t *buf, FSIZE_t offset, size_t n, int write)
+{
+    BYTE pdrv = f->fil.obj.fs->pdrv;
+    BYTE bounce[FF_MAX_SS];
+    size_t left, chunk, in;
+    LBA_t sect;
+    UINT count;
+    DRESULT dr;
+
+    n = MIN(n, f_size(&f->fil) - offset);
+
+    for (left = n; left; left -= chunk, buf += chunk, offset += chunk) {
+	sect = f->contig + offset / FF_MAX_SS;
+	in = offset % FF_MAX_SS;
+	if (in || left < FF_MAX_SS) {
+	    // partial sector
+	    chunk = MIN(left, FF_MAX_SS - in);
+	    if (disk_read(pdrv, bounce, sect, 1) != RES_OK) {
+		return -1;
+	    }
+	    if (write) {
+		memcpy(bounce + in, buf, chunk);
+		if (disk_write(pdrv, bounce, sect, 1) != RES_OK) {
+		    return -1;
+		}
+	    } else {
+		memcpy(buf, bounce + in, chunk);
+	    }
+	} else {
+	    count = MIN(left, FFG_MAX_XFER) / FF_MAX_SS;
+	    chunk = (size_t)count * FF_MAX_SS;
+	    dr = write ? disk_write(pdrv, buf, sect, count) : disk_read(pdrv, buf, sect, count);
+	    if (dr != RES_OK) {
+		return -1;
+	    }
+	}
+    }
+
+    if (write) {
+	// FatFs' copy of a sector of the file may now be stale
+	f->fil.sect = 0;
+    }
+
+    return n;
+}
+
+// writes zeros from from to to, where from is the file size
+static FRESULT ffg_zero_fill(struct ffg_file *f, FSIZE_t from, FSIZE_t to)
+{
+    FRESULT res;
+    UINT bw, n;
+
+    if ((res = f_lseek(&f->fil, from)) != FR_OK) {
+	return res;
+    }
+
+    while (from < to) {
+	n = MIN(to - from, sizeof(ffg_zeros));
+	if ((res = f_write(&f->fil, ffg_zeros, n, &bw)) != FR_OK) {
+	    return res;
+	}
+	if (bw != n) {
+	    return FR_DENIED;   // volume full
+	}
+	from += n;
+    }
+
+    return FR_OK;
+}
+
+static void *ffg_open_mode(struct ffg_state *s, char *path, BYTE mode)
+{
+    char p[FFG_PATH_LEN];
+    struct ffg_file *f;
+    FRESULT res;
+    STATE_LOCK_CONF;
+
+    if (ffg_path(s, path, p)) {
+	return 0;
+    }
+
+    if (!(f = malloc(sizeof(*f)))) {
+	ERROR("Cannot allocate file\n");
+	return 0;
+    }
+
+    memset(f, 0, sizeof(*f));
+    spinlock_init(&f->lock);
+
+    if (!s->readonly) {
+	mode |= FA_WRITE;
+    }
+
+    if ((res = f_open(&f->fil, p, FA_READ | mode)) != FR_OK) {
+	DEBUG("Cannot open %s (%s)\n", p, ffg_strerror(res));
+	free(f);
+	return 0;
+    }
+
+    if (s->flags & NK_FS_FATFS_FASTSEEK) {
+	if ((f->clmt = malloc(FFG_CLMT_INIT*sizeof(DWORD)))) {
+	    f->clmt_len = FFG_CLMT_INIT;
+	    ffg_map(f);
+	}
+    }
+
+    ffg_find_contig(f);
+
+    STATE_LOCK(s);
+    list_add(&f->node, &s->files);
+    STATE_UNLOCK(s);
+
+    DEBUG("Opened %s as %p\n", p, f);
+
+    return f;
+}
+
+static void *ffg_open(void *state, char *path)
+{
+    return ffg_open_mode((struct ffg_state *)state, path, FA_OPEN_EXISTING);
+}
+
+static void *ffg_create_file(void *state, char *path)
+{
+    return ffg_open_mode((struct ffg_state *)state, path, FA_CREATE_NEW);
+}
+
+static void ffg_close(void *state, void *file)
+{
+    struct ffg_state *s = (struct ffg_state *)state;
+    struct ffg_file *f = (struct ffg_file *)file;
+    FRESULT res;
+    STATE_LOCK_CONF;
+
+    // a sync walking the list may be about to use this file
+    STATE_LOCK(s);
+    while (s->syncing) {
+	STATE_UNLOCK(s);
+	nk_yield();
+	STATE_LOCK(s);
+    }
+    list_del(&f->node);
+    STATE_UNLOCK(s);
+
+    if ((res = f_close(&f->fil)) != FR_OK) {
+	ERROR("Failed to close file (%s)\n", ffg_strerror(res));
+    }
+
+    free(f->clmt);
+    free(f);
+}
+
+static ssize_t ffg_read(void *state, void *file, void *dest, off_t offset, size_t n)
+{
+    struct ffg_file *f = (struct ffg_file *)file;
+    FRESULT res;
+    UINT br = 0;
+
+    n = MIN(n, FFG_MAX_XFER);
+
+    file_claim(f);
+    if (f->contig && offset < f_size(&f->fil)) {
+	ssize_t rc = ffg_contig_rw(f, dest, offset, n, 0);
+	file_release(f);
+	if (rc < 0) {
+	    ERROR("Failed to read %lu bytes at %lu\n", n, offset);
+	}
+	return rc;
+    }
+    if ((res = f_lseek(&f->fil, offset)) == FR_OK) {
+	res = f_read(&f->fil, dest, n, &br);
+    }
+    file_release(f);
+
+    if (res != FR_OK) {
+	ERROR("Failed to read %lu bytes at %lu (%s)\n", n, offset, ffg_strerror(res));
+	return -1;
+    }
+
+    return br;
+}
+
+static ssize_t ffg_write(void *state, void *file, void *src, off_t offset, size_t n)
+{
+    struct ffg_file *f = (struct ffg_file *)file;
+    FSIZE_t size;
+    FRESULT res = FR_OK;
+    UINT bw = 0;
+    int grow;
+
+    n = MIN(n, FFG_MAX_XFER);
+
+    file_claim(f);
+
+    size = f_size(&f->fil);
+    grow = offset + n > size;
+
+    if (f->contig && !grow) {
+	ssize_t rc = ffg_contig_rw(f, src, offset, n, 1);
+	file_release(f);
+	if (rc < 0) {
+	    ERROR("Failed to write %lu bytes at %lu\n", n, offset);
+	}
+	return rc;
+    }
+
+    if (grow) {
+	// the map does not cover the clusters about to be added
+	f->fil.cltbl = 0;
+	if (offset > size) {
+	    res = ffg_zero_fill(f, size, offset);
+	}
+    }
+
+    if (res == FR_OK && (res = f_lseek(&f->fil, offset)) == FR_OK) {
+	res = f_write(&f->fil, src, n, &bw);
+    }
+
+    if (grow) {
+	// make the new size visible to other opens
+	if (res == FR_OK) {
+	    res = f_sync(&f->fil);
+	}
+	ffg_map(f);
+	ffg_find_contig(f);
+    }
+
+    file_release(f);
+
+    if (res != FR_OK) {
+	ERROR("Failed to write %lu bytes at %lu (%s)\n", n, offset, ffg_strerror(res));
+	return -1;
+    }
+
+    return bw;
+}
+
+static int ffg_truncate(void *state, void *file, off_t len)
+{
+    struct ffg_file *f = (struct ffg_file *)file;
+    FSIZE_t size;
+    FRESULT res = FR_OK;
+
+    file_claim(f);
+
+    f->fil.cltbl = 0;
+    size = f_size(&f->fil);
+
+    if (len < size) {
+	if ((res = f_lseek(&f->fil, len)) == FR_OK) {
+	    res = f_truncate(&f->fil);
+	}
+    } else if (len > size) {
+	res = ffg_zero_fill(f, size, len);
+    }
+
+    if (res == FR_OK) {
+	res = f_sync(&f->fil);
+    }
+
+    ffg_map(f);
+    ffg_find_contig(f);
+
+    file_release(f);
+
+    if (res != FR_OK) {
+	ERROR("Failed to truncate to %lu (%s)\n", len, ffg_strerror(res));
+	return -1;
+    }
+
+    return 0;
+}
+
+static int ffg_stat(void *state, void *file, struct nk_fs_stat *st)
+{
+    struct ffg_file *f = (struct ffg_file *)file;
+
+    st->st_size = f_size(&f->fil);
+
+    return 0;
+}
+
+static int ffg_stat_path(void *state, char *path, struct nk_fs_stat *st)
+{
+    struct ffg_state *s = (struct ffg_state *)state;
+    char p[FFG_PATH_LEN];
+    FILINFO fno;
+    FRESULT res;
+
+    if (ffg_is_root(path)) {
+	st->st_size = 0;
+	return 0;
+    }
+
+    if (ffg_path(s, path, p)) {
+	return -1;
+    }
+
+    if ((res = f_stat(p, &fno)) != FR_OK) {
+	DEBUG("Cannot stat %s (%s)\n", p, ffg_strerror(res));
+	return -1;
+    }
+
+    st->st_size = fno.fsize;
+
+    return 0;
+}
+
+static int ffg_exists(void *state, char *path)
+{
+    struct nk_fs_stat st;
+
+    return !ffg_stat_path(state, path, &st);
+}
+
+static int ffg_create_dir(void *state, char *path)
+{
+    struct ffg_state *s = (struct ffg_state *)state;
+    char p[FFG_PATH_LEN];
+    FRESULT res;
+
+    if (ffg_path(s, path, p)) {
+	return -1;
+    }
+
+    if ((res = f_mkdir(p)) != FR_OK) {
+	ERROR("Cannot create directory %s (%s)\n", p, ffg_strerror(res));
+	return -1;
+    }
+
+    return 0;
+}
+
+static int ffg_remove(void *state, char *path)
+{
+    struct ffg_state *s = (struct ffg_state *)state;
+    char p[FFG_PATH_LEN];
+    FRESULT res;
+
+    if (ffg_path(s, path, p)) {
+	return -1;
+    }
+
+    if ((res = f_unlink(p)) != FR_OK) {
+	ERROR("Cannot remove %s (%s)\n", p, ffg_strerror(res));
+	return -1;
+    }
+
+    return 0;
+}
+
+static int ffg_rename(void *state, char *old_path, char *new_path, int isdir)
+{
+    struct ffg_state *s = (struct ffg_state *)state;
+    char op[FFG_PATH_LEN], np[FFG_PATH_LEN];
+    FRESULT res;
+
+    if (ffg_path(s, old_path, op) || ffg_path(s, new_path, np)) {
+	return -1;
+    }
+
+    if ((res = f_rename(op, np)) != FR_OK) {
+	ERROR("Cannot rename %s to %s (%s)\n", op, np, ffg_strerror(res));
+	return -1;
+    }
+
+    return 0;
+}
+
+static void *ffg_opendir(void *state, char *path)
+{
+    struct ffg_state *s = (struct ffg_state *)state;
+    char p[FFG_PATH_LEN];
+    FRESULT res;
+    DIR *d;
+
+    if (ffg_path(s, path, p)) {
+	return 0;
+    }
+
+    if (!(d = malloc(sizeof(*d)))) {
+	ERROR("Cannot allocate directory\n");
+	return 0;
+    }
+
+    if ((res = f_opendir(d, p)) != FR_OK) {
+	DEBUG("Cannot open directory %s (%s)\n", p, ffg_strerror(res));
+	free(d);
+	return 0;
+    }
+
+    return d;
+}
+
+static ssize_t ffg_readdir_batch(void *state, void *dir, struct nk_fs_dirent *ents, size_t n)
+{
+    DIR *d = (DIR *)dir;
+    FILINFO fno;
+    FRESULT res;
+    size_t i = 0;
+
+    while (i < n) {
+	if ((res = f_readdir(d, &fno)) != FR_OK) {
+	    ERROR("Cannot read directory (%s)\n", ffg_strerror(res));
+	    return i ? i : -1;
+	}
+	if (!fno.fname[0]) {
+	    break;
+	}
+	if (!strcmp(fno.fname, ".") || !strcmp(fno.fname, "..")) {
+	    continue;
+	}
+	strncpy(ents[i].name, fno.fname, NK_FS_DIRENT_NAME_LEN-1);
+	ents[i].name[NK_FS_DIRENT_NAME_LEN-1] = 0;
+	ents[i].size = fno.fsize;
+	ents[i].attr =
+	    ((fno.fattrib & AM_DIR) ? NK_FS_ATTR_DIR : 0) |
+	    ((fno.fattrib & AM_RDO) ? NK_FS_ATTR_READONLY : 0) |
+	    ((fno.fattrib & AM_HID) ? NK_FS_ATTR_HIDDEN : 0) |
+	    ((fno.fattrib & AM_SYS) ? NK_FS_ATTR_SYSTEM : 0);
+	i++;
+    }
+
+    return i;
+}
+
+static void ffg_closedir(void *state, void *dir)
+{
+    f_closedir((DIR *)dir);
+    free(dir);
+}
+
+static int ffg_sync_file(void *state, void *file, int data_only)
+{
+    struct ffg_file *f = (struct ffg_file *)file;
+    FRESULT res;
+
+    file_claim(f);
+    res = f_sync(&f->fil);
+    file_release(f);
+
+    if (res != FR_OK) {
+	ERROR("Failed to sync file (%s)\n", ffg_strerror(res));
+	return -1;
+    }
+
+    return 0;
+}
+
+static int ffg_sync_fs(void *state)
+{
+    struct ffg_state *s = (struct ffg_state *)state;
+    struct list_head *cur;
+    int rc = 0;
+    STATE_LOCK_CONF;
+
+    // everything else FatFs writes through by the end of each call.
+    // Each file is synced with the state lock dropped; closes wait
+    // until the walk is done, so the list stays intact under it
+    STATE_LOCK(s);
+    s->syncing++;
+    for (cur = s->files.next; cur != &s->files; cur = cur->next) {
+	STATE_UNLOCK(s);
+	rc |= ffg_sync_file(state, list_entry(cur, struct ffg_file, node), 0);
+	STATE_LOCK(s);
+    }
+    s->syncing--;
+    STATE_UNLOCK(s);
+
+    // with no file open there is nothing for f_sync to flush
+    if (nk_block_dev_flush(s->dev, NK_DEV_REQ_BLOCKING, 0, 0)) {
+	ERROR("Failed to flush device\n");
+	rc = -1;
+    }
+
+    return rc;
+}
+
+static struct nk_fs_int ffglue_inter = {
+    .stat_path = ffg_stat_path,
+    .create_file = ffg_create_file,
+    .create_dir = ffg_create_dir,
+    .exists = ffg_exists,
+    .remove = ffg_remove,
+    .open_file = ffg_open,
+    .stat = ffg_stat,
+    .trunc_file = ffg_truncate,
+    .read_file = ffg_read,
+    .write_file = ffg_write,
+    .close_file = ffg_close,
+    .rename = ffg_rename,
+    .opendir = ffg_opendir,
+    .readdir_batch = ffg_readdir_batch,
+    .closedir = ffg_closedir,
+    .sync_file = ffg_sync_file,
+    .sync_fs = ffg_sync_fs,
+};
+
+int ffglue_owns(struct nk_fs *fs)
+{
+    return fs->interface == &ffglue_inter;
+}
+
+int ffglue_attach(char *devname, char *fsname, int readonly, int flags)
+{
+    static const char *types[] = { "?", "FAT12", "FAT16", "FAT32", "exFAT" };
+    struct nk_block_dev *dev = nk_block_dev_find(devname);
+    struct ffg_state *s;
+    UINT cache;
+    FRESULT res;
+
+    if (!dev) {
+	ERROR("Cannot find device %s\n", devname);
+	return -1;
+    }
+
+    if (!(s = malloc(sizeof(*s)))) {
+	ERROR("Cannot allocate space for fs %s\n", fsname);
+	return -1;
+    }
+
+    memset(s, 0, sizeof(*s));
+    spinlock_init(&s->lock);
+    INIT_LIST_HEAD(&s->files);
+
+    s->dev = dev;
+    s->readonly = readonly;
+    s->flags = flags;
+
+    if ((s->pdrv = disk_bind(dev)) < 0) {
+	free(s);
+	return -1;
+    }
+
+    snprintf(s->drive, sizeof(s->drive), "%u:", (BYTE)s->pdrv);
+
+    // FAT and directory sectors cached behind the window
+    cache = (flags >> 8) ? (flags >> 8) - 1 : NAUT_CONFIG_FATFS_WINDOW_CACHE;
+
+    if (cache) {
+	if (!(s->cache = malloc(cache*sizeof(FFWC)))) {
+	    ERROR("Cannot allocate %u sector window cache, using none\n", cache);
+	    cache = 0;
+	} else {
+	    f_wincache(&s->vol, s->cache, cache);
+	}
+    }
+
+    if ((res = f_mount(&s->vol, s->drive, 1)) != FR_OK) {
+	ERROR("Cannot mount FAT volume on device %s (%s)\n", devname, ffg_strerror(res));
+	goto out_mount;
+    }
+
+    s->fs = nk_fs_register(fsname, readonly ? NK_FS_READONLY : 0, &ffglue_inter, s);
+
+    if (!s->fs) {
+	ERROR("Unable to register filesystem %s\n", fsname);
+	goto out_mount;
+    }
+
+    nk_block_dev_attach(dev);
+
+    INFO("filesystem %s on device %s is attached (FatFs %s%s, %u sector cache, %s)\n", fsname, devname,
+	 types[s->vol.fs_type <= FS_EXFAT ? s->vol.fs_type : 0],
+	 (flags & NK_FS_FATFS_FASTSEEK) ? ", fast seek" : "",
+	 cache, readonly ? "readonly" : "read/write");
+
+    return 0;
+
+ out_mount:
+    f_mount(0, s->drive, 0);
+    disk_unbind(s->pdrv);
+    free(s->cache);
+    free(s);
+    return -1;
+}
+
+int ffglue_detach(struct nk_fs *fs)
+{
+    struct ffg_state *s = (struct ffg_state *)fs->state;
+
+    if (!list_empty(&s->files)) {
+	ERROR("Cannot detach %s with files open\n", fs->name);
+	return -1;
+    }
+
+    if (nk_fs_unregister(fs)) {
+	return -1;
+    }
+
+    nk_block_dev_detach(s->dev);
+
+    // everything was written back when the last file closed
+    f_mount(0, s->drive, 0);
+    disk_unbind(s->pdrv);
+    free(s->cache);
+    free(s);
+
+    return 0;
+}
+
+int nk_fs_fatfs_create_contig(char *fsname, char *path, uint64_t size)
+{
+    struct nk_fs *fs = nk_fs_find(fsname);
+    struct ffg_state *s;
+    struct ffg_file *f;
+    FRESULT res;
+
+    if (!fs || !ffglue_owns(fs)) {
+	ERROR("%s is not a FatFs mount\n", fsname);
+	return -1;
+    }
+
+    s = (struct ffg_state *)fs->state;
+
+    if (s->readonly) {
+	ERROR("%s is readonly\n", fsname);
+	return -1;
+    }
+
+    if (!(f = ffg_open_mode(s, path, FA_CREATE_NEW))) {
+	ERROR("Cannot create %s\n", path);
+	return -1;
+    }
+
+    // one run, allocated now; on exFAT without a FAT chain
+    res = f_expand(&f->fil, size, 1);
+
+    ffg_close(s, f);
+
+    if (res != FR_OK) {
+	ERROR("Cannot allocate %lu contiguous bytes for %s (%s)\n", size, path, ffg_strerror(res));
+	ffg_remove(s, path);
+	return -1;
+    }
+
+    return 0;
+}
+
+
+static int
+handle_ffcontig (char * buf, void * priv)
+{
+    char fsname[FS_NAME_LEN], path[FFG_PATH_LEN];
+    uint64_t mb;
+
+    if (sscanf(buf,"ffcontig %31s %511s %lu",fsname,path,&mb)!=3) {
+	nk_vc_printf("ffcontig fsname path size_mb\n");
+	return -1;
+    }
+
+    if (nk_fs_fatfs_create_contig(fsname, path, mb<<20)) {
+	nk_vc_printf("Failed to create %s on %s\n",path,fsname);
+	return -1;
+    }
+
+    nk_vc_printf("%s on %s is %lu MB in one run\n",path,fsname,mb);
+
+    return 0;
+}
+
+static struct shell_cmd_impl ffcontig_impl = {
+    .cmd      = "ffcontig",
+    .help_str = "ffcontig fsname path size_mb",
+    .handler  = handle_ffcontig,
+};
+nk_register_shell_cmd(ffcontig_impl);
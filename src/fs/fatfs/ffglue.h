@@ -0,0 +1,31 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2017, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+
+#ifndef __FS_FATFS_FFGLUE_H__
+#define __FS_FATFS_FFGLUE_H__
+
+// nk_fs backend on ChaN's FatFs (ff.c), used by nk_fs_fatfs_attach_engine
+// flags are the NK_FS_FATFS_* flags from <fs/fatfs/fatfs.h>
+int ffglue_attach(char *devname, char *fsname, int readonly, int flags);
+// nonzero if fs is served by ffglue
+int ffglue_owns(struct nk_fs *fs);
+int ffglue_detach(struct nk_fs *fs);
+
+#endif
@@ -4,7 +4,7 @@
 /*------------------------------------------------------------------------*/
 
 #include <nautilus/nautilus.h>
-#include <nautilus/spinlock.h>
+#include <nautilus/semaphore.h>
 #include "ff.h"
 
 /*
@@ -64,17 +64,13 @@ int ff_cre_syncobj (	/* 1:Function succeeded, 0:Could not create the sync object
     //	*sobj = CreateMutex(NULL, FALSE, NULL);
     //	return (int)(*sobj != INVALID_HANDLE_VALUE);
 
-    *sobj = malloc(sizeof(nk_syncobj_t));
+    *sobj = nk_semaphore_create(0, 1, NK_SEMAPHORE_DEFAULT, 0);
 
     if (!*sobj) {
 	return 0;  // 0 means fail here
     }
-    
-    memset(*sobj,0,sizeof(*sobj));
-
-    spinlock_init(&((*sobj)->lock));
 
-    return 0;
+    return 1;
     
 	/* uITRON */
 //	T_CSEM csem = {TA_TPRI,1,1};
@@ -109,7 +105,7 @@ int ff_del_syncobj (	/* 1:Function succeeded, 0:Could not delete due to an error
 )
 {
 
-    free(sobj);
+    nk_semaphore_release(sobj);
     return 1;
     
     //	/* Win32 */
@@ -143,7 +139,9 @@ int ff_req_grant (	/* 1:Got a grant to access the volume, 0:Could not get a gran
 	FF_SYNC_t sobj	/* Sync object to wait */
 )
 {
-    sobj->irqstate = spin_lock_irq_save(&(sobj->lock));
+    // sleeps while another thread is in the volume, perhaps waiting
+    // on the device
+    nk_semaphore_down(sobj);
 
     return 1;
     
@@ -176,7 +174,7 @@ void ff_rel_grant (
 	FF_SYNC_t sobj	/* Sync object to be signaled */
 )
 {
-    spin_unlock_irq_restore(&(sobj->lock),sobj->irqstate);
+    nk_semaphore_up(sobj);
     //	/* Win32 */
     //	ReleaseMutex(sobj);
 
@@ -0,0 +1,1137 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2017, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+
+/*
+ * overlay - a writeable view of a read-only filesystem
+ *
+ * Lookups try the upper layer first and then the lower one.  Nothing
+ * is written to the lower layer: the first write or truncation of a
+ * lower file copies it to the upper layer (creating its directories
+ * there as needed), and open files switch over to the copy.
+ *
+ * Removing something that exists in the lower layer masks its path.  A
+ * mask hides the lower layer at and below that path, and stays in
+ * place if something new is created there, so a new directory does not
+ * show the old one's contents.  Masks live in memory, like the upper
+ * layer they go with.
+ *
+ * Directories in the lower layer cannot be renamed.
+ */
+
+#include <nautilus/nautilus.h>
+#include <nautilus/fs.h>
+#include <nautilus/shell.h>
+#include <nautilus/thread.h>
+
+#include <fs/overlay/overlay.h>
+
+#define INFO(fmt, args...)  INFO_PRINT("overlay: " fmt, ##args)
+#define DEBUG(fmt, args...) DEBUG_PRINT("overlay: " fmt, ##args)
+#define ERROR(fmt, args...) ERROR_PRINT("overlay: " fmt, ##args)
+
+#ifndef NAUT_CONFIG_DEBUG_OVERLAY_FILESYSTEM_DRIVER
+#undef DEBUG
+#define DEBUG(fmt, args...)
+#endif
+
+#define MIN(x,y) ((x)<(y) ? (x) : (y))
+
+#define MASK_BUCKETS 64
+#define COPY_CHUNK   (64*1024)
+#define DIR_BATCH    16
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME  0x100000001b3ULL
+
+struct mask {
+    struct mask *next;
+    uint64_t     hash;
+    char         path[0];
+};
+
+struct ovl_state {
+    struct nk_fs *fs;
+    struct nk_fs *lower;
+    struct nk_fs *upper;
+
+    spinlock_t    lock;          // masks, copy_gen, copying, open_files
+    struct mask  *masks[MASK_BUCKETS];
+    uint64_t      copy_gen;      // bumped by every copy-up
+    uint64_t      open_files;
+    int           copying;       // a copy-up or switch-over is in progress
+};
+
+struct ovl_file {
+    spinlock_t  lock;
+    int         upper;        // file is in the upper layer
+    void       *file;
+    uint64_t    gen;          // copy_gen when last resolved, under the copy claim
+    char       *layer_path;   // some filesystems hold on to the open path
+    char        path[0];
+};
+
+#define STATE_LOCK_CONF uint8_t _state_lock_flags
+#define STATE_LOCK(s) _state_lock_flags = spin_lock_irq_save(&(s)->lock)
+#define STATE_UNLOCK(s) spin_unlock_irq_restore(&(s)->lock, _state_lock_flags);
+
+#define FILE_LOCK_CONF uint8_t _file_lock_flags
+#define FILE_LOCK(f) _file_lock_flags = spin_lock_irq_save(&(f)->lock)
+#define FILE_UNLOCK(f) spin_unlock_irq_restore(&(f)->lock, _file_lock_flags);
+
+// some layers rewrite the path they are given in place
+#define LAYER_PATH(tmp,path) char tmp[strlen(path)+1]; strcpy(tmp,path)
+
+
+/*
+ * Paths are kept in one canonical form - leading slash, no empty, "."
+ * or ".." components, no trailing slash - so masks compare as strings.
+ * out needs strlen(path)+2 bytes
+ */
+static void canon(char *path, char *out)
+{
+    char *o = out, *c;
+    size_t len;
+
+    while (*path) {
+	while (*path == '/') {
+	    path++;
+	}
+	for (c = path; *c && *c != '/'; c++) {
+	}
+	len = c - path;
+	if (len == 1 && path[0] == '.') {
+	} else if (len == 2 && path[0] == '.' && path[1] == '.') {
+	    while (o > out && *--o != '/') {
+	    }
+	} else if (len) {
+	    *o++ = '/';
+	    memcpy(o, path, len);
+	    o += len;
+	}
+	path = c;
+    }
+
+    if (o == out) {
+	*o++ = '/';
+    }
+    *o = 0;
+}
+
+static uint64_t path_hash(char *path, size_t len)
+{
+    uint64_t h = FNV_OFFSET;
+    size_t i;
+
+    for (i=0;i<len;i++) {
+	h ^= (uint8_t)path[i];
+	h *= FNV_PRIME;
+    }
+
+    return h;
+}
+
+// caller holds the state lock
+static struct mask *mask_find(struct ovl_state *s, char *path, size_t len)
+{
+    uint64_t h = path_hash(path, len);
+    struct mask *m;
+
+    for (m = s->masks[h % MASK_BUCKETS]; m; m = m->next) {
+	if (m->hash == h && !strncmp(m->path, path, len) && !m->path[len]) {
+	    return m;
+	}
+    }
+
+    return 0;
+}
+
+static int mask_add(struct ovl_state *s, char *path)
+{
+    size_t len = strlen(path);
+    struct mask *m;
+    STATE_LOCK_CONF;
+
+    m = malloc(sizeof(*m) + len + 1);
+
+    if (!m) {
+	ERROR("Cannot allocate mask for %s\n", path);
+	return -1;
+    }
+
+    m->hash = path_hash(path, len);
+    strcpy(m->path, path);
+
+    STATE_LOCK(s);
+    if (mask_find(s, path, len)) {
+	STATE_UNLOCK(s);
+	free(m);
+	return 0;
+    }
+    m->next = s->masks[m->hash % MASK_BUCKETS];
+    s->masks[m->hash % MASK_BUCKETS] = m;
+    STATE_UNLOCK(s);
+
+    DEBUG("masked %s\n", path);
+
+    return 0;
+}
+
+// whether the lower layer shows through at path
+static int lower_visible(struct ovl_state *s, char *path)
+{
+    size_t len;
+    int visible = 1;
+    STATE_LOCK_CONF;
+
+    STATE_LOCK(s);
+    for (len = 1; visible && path[len-1]; len++) {
+	if (!path[len] || path[len] == '/') {
+	    visible = !mask_find(s, path, len);
+	}
+    }
+    STATE_UNLOCK(s);
+
+    return visible;
+}
+
+
+/*
+ * Layer access
+ */
+
+static int l_exists(struct nk_fs *l, char *path)
+{
+    LAYER_PATH(tmp, path);
+
+    return l->interface->exists && l->interface->exists(l->state, tmp);
+}
+
+static int l_stat(struct nk_fs *l, char *path, struct nk_fs_stat *st)
+{
+    LAYER_PATH(tmp, path);
+
+    return l->interface->stat_path ? l->interface->stat_path(l->state, tmp, st) : -1;
+}
+
+static int l_is_dir(struct nk_fs *l, char *path)
+{
+    LAYER_PATH(tmp, path);
+    void *d;
+
+    if (!l->interface->opendir || !(d = l->interface->opendir(l->state, tmp))) {
+	return 0;
+    }
+
+    l->interface->closedir(l->state, d);
+
+    return 1;
+}
+
+static int in_lower(struct ovl_state *s, char *path)
+{
+    return lower_visible(s, path) && l_exists(s->lower, path);
+}
+
+static int is_dir(struct ovl_state *s, char *path)
+{
+    if (l_exists(s->upper, path)) {
+	return l_is_dir(s->upper, path);
+    }
+
+    return lower_visible(s, path) && l_is_dir(s->lower, path);
+}
+
+// creates the directories above path in the upper layer
+static int upper_parents(struct ovl_state *s, char *path)
+{
+    char tmp[strlen(path)+1];
+    char *slash;
+
+    strcpy(tmp, path);
+
+    for (slash = strchr(tmp+1, '/'); slash; slash = strchr(slash+1, '/')) {
+	*slash = 0;
+	if (!l_exists(s->upper, tmp)) {
+	    LAYER_PATH(dir, tmp);
+	    if (!s->upper->interface->create_dir || s->upper->interface->create_dir(s->upper->state, dir)) {
+		ERROR("Cannot create %s in upper layer\n", tmp);
+		return -1;
+	    }
+	}
+	*slash = '/';
+    }
+
+    return 0;
+}
+
+
+/*
+ * Open files
+ */
+
+static struct nk_fs *file_layer(struct ovl_state *s, struct ovl_file *f)
+{
+    return f->upper ? s->upper : s->lower;
+}
+
+static int file_open_layer(struct ovl_state *s, struct ovl_file *f, int upper)
+{
+    struct nk_fs *l = upper ? s->upper : s->lower;
+    char *p = malloc(strlen(f->path)+1);
+    void *file;
+
+    if (!p) {
+	return -1;
+    }
+
+    strcpy(p, f->path);
+
+    file = l->interface->open_file ? l->interface->open_file(l->state, p) : 0;
+
+    if (!file) {
+	free(p);
+	return -1;
+    }
+
+    free(f->layer_path);
+    f->layer_path = p;
+    f->file = file;
+    f->upper = upper;
+
+    return 0;
+}
+
+static void file_close_layer(struct ovl_state *s, struct ovl_file *f)
+{
+    struct nk_fs *l = file_layer(s, f);
+
+    if (l->interface->close_file) {
+	l->interface->close_file(l->state, f->file);
+    }
+
+    free(f->layer_path);
+    f->layer_path = 0;
+    f->file = 0;
+}
+
+// one copy-up, or switch-over to a copy, at a time.  The claim is
+// waited for with interrupts on, and a long copy holds up only other
+// copy-ups, not operations on files that are already resolved
+static void copy_claim(struct ovl_state *s)
+{
+    STATE_LOCK_CONF;
+
+    STATE_LOCK(s);
+    while (s->copying) {
+	STATE_UNLOCK(s);
+	nk_yield();
+	STATE_LOCK(s);
+    }
+    s->copying = 1;
+    STATE_UNLOCK(s);
+}
+
+static void copy_release(struct ovl_state *s, int copied)
+{
+    STATE_LOCK_CONF;
+
+    STATE_LOCK(s);
+    if (copied) {
+	s->copy_gen++;
+    }
+    s->copying = 0;
+    STATE_UNLOCK(s);
+}
+
+// points f at the upper layer's copy of its file.  The copy is opened,
+// and the lower file closed, outside the file lock; only the handles
+// are swapped under it.  Caller holds the copy claim
+static int file_switch(struct ovl_state *s, struct ovl_file *f)
+{
+    char *p = malloc(strlen(f->path)+1);
+    void *file = 0, *old_file;
+    char *old_path;
+    FILE_LOCK_CONF;
+
+    if (p) {
+	strcpy(p, f->path);
+	file = s->upper->interface->open_file ? s->upper->interface->open_file(s->upper->state, p) : 0;
+    }
+
+    if (!file) {
+	ERROR("Cannot reopen %s in upper layer\n", f->path);
+	free(p);
+	return -1;
+    }
+
+    FILE_LOCK(f);
+    old_file = f->file;
+    old_path = f->layer_path;
+    f->file = file;
+    f->layer_path = p;
+    f->upper = 1;
+    FILE_UNLOCK(f);
+
+    if (s->lower->interface->close_file) {
+	s->lower->interface->close_file(s->lower->state, old_file);
+    }
+    free(old_path);
+
+    return 0;
+}
+
+// follows a copy-up done through another open of the same file
+// caller does not hold the file lock
+static void file_refresh(struct ovl_state *s, struct ovl_file *f)
+{
+    if (f->upper || f->gen == s->copy_gen) {
+	return;
+    }
+
+    // an upper file that is still being copied is not switched to
+    copy_claim(s);
+
+    if (!f->upper && l_exists(s->upper, f->path)) {
+	DEBUG("%s was copied up elsewhere\n", f->path);
+	file_switch(s, f);
+    }
+    f->gen = s->copy_gen;
+
+    copy_release(s, 0);
+}
+
+// copies at most limit bytes of f's lower file to a new upper file
+// caller holds the copy claim, which keeps f on the lower layer
+static int copy_file(struct ovl_state *s, struct ovl_file *f, uint64_t limit)
+{
+    struct nk_fs_stat st;
+    void *upper_file = 0;
+    char *buf = 0;
+    uint64_t off, len;
+    ssize_t n;
+    int rc = -1;
+
+    DEBUG("copying up %s\n", f->path);
+
+    if (s->lower->interface->stat(s->lower->state, f->file, &st) || upper_parents(s, f->path)) {
+	return -1;
+    }
+
+    {
+	LAYER_PATH(tmp, f->path);
+	upper_file = s->upper->interface->create_file(s->upper->state, tmp);
+    }
+
+    if (!upper_file) {
+	ERROR("Cannot create %s in upper layer\n", f->path);
+	return -1;
+    }
+
+    len = MIN(st.st_size, limit);
+
+    if (len && !(buf = malloc(MIN(len, COPY_CHUNK)))) {
+	ERROR("Cannot allocate copy buffer\n");
+	goto out_remove;
+    }
+
+    for (off = 0; off < len; off += n) {
+	n = s->lower->interface->read_file(s->lower->state, f->file, buf, off, MIN(len - off, COPY_CHUNK));
+	if (n <= 0 || s->upper->interface->write_file(s->upper->state, upper_file, buf, off, n) != n) {
+	    ERROR("Failed to copy %s at offset %lu\n", f->path, off);
+	    goto out_remove;
+	}
+    }
+
+    rc = 0;
+    goto out_close;
+
+ out_remove:
+    {
+	LAYER_PATH(tmp, f->path);
+	s->upper->interface->remove(s->upper->state, tmp);
+    }
+
+ out_close:
+    // the create handle may hold on to the path it was given
+    if (s->upper->interface->close_file) {
+	s->upper->interface->close_file(s->upper->state, upper_file);
+    }
+
+    free(buf);
+
+    return rc;
+}
+
+// moves the file to the upper layer, keeping at most limit bytes
+// caller does not hold the file lock; the copy runs under the copy
+// claim alone and is published by switching f over to it
+static int copy_up(struct ovl_state *s, struct ovl_file *f, uint64_t limit)
+{
+    int rc = 0;
+
+    file_refresh(s, f);
+
+    if (f->upper) {
+	return 0;
+    }
+
+    copy_claim(s);
+
+    // someone may have beaten us to it
+    if (!f->upper) {
+	if (!l_exists(s->upper, f->path)) {
+	    rc = copy_file(s, f, limit);
+	}
+	if (!rc) {
+	    rc = file_switch(s, f);
+	}
+    }
+
+    copy_release(s, !rc);
+
+    return rc;
+}
+
+
+/*
+ * nk_fs_int
+ */
+
+static int ovl_stat_path(void *state, char *path, struct nk_fs_stat *st)
+{
+    struct ovl_state *s = (struct ovl_state *)state;
+    char p[strlen(path)+2];
+
+    canon(path, p);
+
+    if (!l_stat(s->upper, p, st)) {
+	return 0;
+    }
+
+    return lower_visible(s, p) ? l_stat(s->lower, p, st) : -1;
+}
+
+static int ovl_exists(void *state, char *path)
+{
+    struct ovl_state *s = (struct ovl_state *)state;
+    char p[strlen(path)+2];
+
+    canon(path, p);
+
+    return l_exists(s->upper, p) || in_lower(s, p);
+}
+
+static int create(struct ovl_state *s, char *p, int dir, void **file)
+{
+    char parent[strlen(p)+2];
+    char *slash;
+
+    strcpy(parent, p);
+    slash = strrchr(parent, '/');
+    if (slash == parent) {
+	slash++;
+    }
+    *slash = 0;
+
+    if (!strcmp(p, "/") || l_exists(s->upper, p) || in_lower(s, p) || !is_dir(s, parent)) {
+	DEBUG("cannot create %s\n", p);
+	return -1;
+    }
+
+    if (upper_parents(s, p)) {
+	return -1;
+    }
+
+    // anything the lower layer still has here must stay hidden
+    if (l_exists(s->lower, p) && mask_add(s, p)) {
+	return -1;
+    }
+
+    {
+	LAYER_PATH(tmp, p);
+	if (dir) {
+	    return s->upper->interface->create_dir(s->upper->state, tmp);
+	}
+	*file = s->upper->interface->create_file(s->upper->state, tmp);
+    }
+
+    return *file ? 0 : -1;
+}
+
+static void *ovl_create_file(void *state, char *path)
+{
+    struct ovl_state *s = (struct ovl_state *)state;
+    char p[strlen(path)+2];
+    struct ovl_file *f;
+    void *file;
+    STATE_LOCK_CONF;
+
+    canon(path, p);
+
+    f = malloc(sizeof(*f) + strlen(p) + 1);
+
+    if (!f) {
+	ERROR("Cannot allocate open file\n");
+	return 0;
+    }
+
+    memset(f, 0, sizeof(*f));
+    spinlock_init(&f->lock);
+    strcpy(f->path, p);
+
+    if (create(s, p, 0, &file)) {
+	free(f);
+	return 0;
+    }
+
+    // reopen under a path the upper layer can keep
+    if (s->upper->interface->close_file) {
+	s->upper->interface->close_file(s->upper->state, file);
+    }
+
+    if (file_open_layer(s, f, 1)) {
+	ERROR("Cannot open new file %s\n", p);
+	free(f);
+	return 0;
+    }
+
+    STATE_LOCK(s);
+    f->gen = s->copy_gen;
+    s->open_files++;
+    STATE_UNLOCK(s);
+
+    return f;
+}
+
+static int ovl_create_dir(void *state, char *path)
+{
+    struct ovl_state *s = (struct ovl_state *)state;
+    char p[strlen(path)+2];
+
+    canon(path, p);
+
+    return create(s, p, 1, 0);
+}
+
+static int dir_empty(struct ovl_state *s, char *path);
+
+static int ovl_remove(void *state, char *path)
+{
+    struct ovl_state *s = (struct ovl_state *)state;
+    char p[strlen(path)+2];
+    int upper, lower;
+
+    canon(path, p);
+
+    upper = l_exists(s->upper, p);
+    lower = in_lower(s, p);
+
+    if ((!upper && !lower) || !strcmp(p, "/")) {
+	return -1;
+    }
+
+    if (is_dir(s, p) && !dir_empty(s, p)) {
+	DEBUG("directory %s is not empty\n", p);
+	return -1;
+    }
+
+    if (upper) {
+	LAYER_PATH(tmp, p);
+	if (s->upper->interface->remove(s->upper->state, tmp)) {
+	    return -1;
+	}
+    }
+
+    return lower ? mask_add(s, p) : 0;
+}
+
+static void *ovl_open(void *state, char *path)
+{
+    struct ovl_state *s = (struct ovl_state *)state;
+    char p[strlen(path)+2];
+    struct ovl_file *f;
+    STATE_LOCK_CONF;
+
+    canon(path, p);
+
+    f = malloc(sizeof(*f) + strlen(p) + 1);
+
+    if (!f) {
+	ERROR("Cannot allocate open file\n");
+	return 0;
+    }
+
+    memset(f, 0, sizeof(*f));
+    spinlock_init(&f->lock);
+    strcpy(f->path, p);
+
+    STATE_LOCK(s);
+    f->gen = s->copy_gen;
+    STATE_UNLOCK(s);
+
+    if (file_open_layer(s, f, 1) && (!lower_visible(s, p) || file_open_layer(s, f, 0))) {
+	DEBUG("cannot open %s\n", p);
+	free(f);
+	return 0;
+    }
+
+    DEBUG("opened %s in %s layer\n", p, f->upper ? "upper" : "lower");
+
+    STATE_LOCK(s);
+    s->open_files++;
+    STATE_UNLOCK(s);
+
+    return f;
+}
+
+static void ovl_close(void *state, void *file)
+{
+    struct ovl_state *s = (struct ovl_state *)state;
+    struct ovl_file *f = (struct ovl_file *)file;
+    STATE_LOCK_CONF;
+
+    file_close_layer(s, f);
+    free(f);
+
+    STATE_LOCK(s);
+    s->open_files--;
+    STATE_UNLOCK(s);
+}
+
+static int ovl_stat(void *state, void *file, struct nk_fs_stat *st)
+{
+    struct ovl_state *s = (struct ovl_state *)state;
+    struct ovl_file *f = (struct ovl_file *)file;
+    struct nk_fs *l;
+    int rc;
+    FILE_LOCK_CONF;
+
+    file_refresh(s, f);
+
+    FILE_LOCK(f);
+    l = file_layer(s, f);
+    rc = f->file ? l->interface->stat(l->state, f->file, st) : -1;
+    FILE_UNLOCK(f);
+
+    return rc;
+}
+
+static int ovl_truncate(void *state, void *file, off_t len)
+{
+    struct ovl_state *s = (struct ovl_state *)state;
+    struct ovl_file *f = (struct ovl_file *)file;
+    int rc = -1;
+    FILE_LOCK_CONF;
+
+    if (!copy_up(s, f, len)) {
+	FILE_LOCK(f);
+	rc = s->upper->interface->trunc_file(s->upper->state, f->file, len);
+	FILE_UNLOCK(f);
+    }
+
+    return rc;
+}
+
+static ssize_t ovl_read(void *state, void *file, void *dest, off_t offset, size_t num_bytes)
+{
+    struct ovl_state *s = (struct ovl_state *)state;
+    struct ovl_file *f = (struct ovl_file *)file;
+    struct nk_fs *l;
+    ssize_t n;
+    FILE_LOCK_CONF;
+
+    file_refresh(s, f);
+
+    FILE_LOCK(f);
+    l = file_layer(s, f);
+    n = f->file ? l->interface->read_file(l->state, f->file, dest, offset, num_bytes) : -1;
+    FILE_UNLOCK(f);
+
+    return n;
+}
+
+static ssize_t ovl_write(void *state, void *file, void *src, off_t offset, size_t num_bytes)
+{
+    struct ovl_state *s = (struct ovl_state *)state;
+    struct ovl_file *f = (struct ovl_file *)file;
+    ssize_t n = -1;
+    FILE_LOCK_CONF;
+
+    if (!copy_up(s, f, ~0ULL)) {
+	FILE_LOCK(f);
+	n = s->upper->interface->write_file(s->upper->state, f->file, src, offset, num_bytes);
+	FILE_UNLOCK(f);
+    }
+
+    return n;
+}
+
+static ssize_t ovl_read_direct(void *state, void *file, off_t offset, size_t num_bytes, void **ptr)
+{
+    struct ovl_state *s = (struct ovl_state *)state;
+    struct ovl_file *f = (struct ovl_file *)file;
+    struct nk_fs *l;
+    ssize_t n = -1;
+    FILE_LOCK_CONF;
+
+    file_refresh(s, f);
+
+    FILE_LOCK(f);
+    l = file_layer(s, f);
+    if (f->file && l->interface->read_direct) {
+	n = l->interface->read_direct(l->state, f->file, offset, num_bytes, ptr);
+    }
+    FILE_UNLOCK(f);
+
+    return n;
+}
+
+static int ovl_rename(void *state, char *old_path, char *new_path, int isdir)
+{
+    struct ovl_state *s = (struct ovl_state *)state;
+    char op[strlen(old_path)+2], np[strlen(new_path)+2];
+    int old_lower;
+    struct ovl_file *f;
+
+    canon(old_path, op);
+    canon(new_path, np);
+
+    if (!s->upper->interface->rename || !strcmp(op, "/") || !strcmp(np, "/")) {
+	return -1;
+    }
+
+    old_lower = in_lower(s, op);
+
+    if (isdir) {
+	if (old_lower || !l_exists(s->upper, op)) {
+	    ERROR("Cannot rename directory %s of the lower layer\n", op);
+	    return -1;
+	}
+    } else if (!l_exists(s->upper, op)) {
+	// bring the file up so the upper layer can rename it
+	if (!(f = ovl_open(s, op))) {
+	    return -1;
+	}
+	int rc = copy_up(s, f, ~0ULL);
+	ovl_close(s, f);
+	if (rc) {
+	    return -1;
+	}
+    }
+
+    if (upper_parents(s, np) || (l_exists(s->lower, np) && mask_add(s, np))) {
+	return -1;
+    }
+
+    {
+	LAYER_PATH(otmp, op);
+	LAYER_PATH(ntmp, np);
+	if (s->upper->interface->rename(s->upper->state, otmp, ntmp, isdir)) {
+	    return -1;
+	}
+    }
+
+    return old_lower ? mask_add(s, op) : 0;
+}
+
+
+/*
+ * Directories are merged into a snapshot at opendir
+ */
+
+struct ovl_dir {
+    size_t               num;
+    size_t               cap;
+    size_t               pos;
+    struct nk_fs_dirent *ents;
+};
+
+static int dir_add(struct ovl_dir *d, struct nk_fs_dirent *e)
+{
+    struct nk_fs_dirent *n;
+
+    if (d->num == d->cap) {
+	d->cap = d->cap ? 2*d->cap : DIR_BATCH;
+	n = malloc(d->cap*sizeof(*n));
+	if (!n) {
+	    return -1;
+	}
+	memcpy(n, d->ents, d->num*sizeof(*n));
+	free(d->ents);
+	d->ents = n;
+    }
+
+    d->ents[d->num++] = *e;
+
+    return 0;
+}
+
+// adds the entries of one layer's directory; lower entries are skipped
+// if the upper layer has the same name or they are masked
+static int dir_merge(struct ovl_state *s, struct ovl_dir *d, struct nk_fs *l, char *path, int lower, int upper_has_dir)
+{
+    struct nk_fs_dirent ents[DIR_BATCH];
+    char child[strlen(path) + NK_FS_DIRENT_NAME_LEN + 2];
+    ssize_t n, i;
+    void *dir;
+
+    {
+	LAYER_PATH(tmp, path);
+	dir = l->interface->opendir ? l->interface->opendir(l->state, tmp) : 0;
+    }
+
+    if (!dir) {
+	return -1;
+    }
+
+    while ((n = l->interface->readdir_batch(l->state, dir, ents, DIR_BATCH)) > 0) {
+	for (i=0;i<n;i++) {
+	    if (lower) {
+		strcpy(child, path);
+		if (strcmp(path, "/")) {
+		    strcat(child, "/");
+		}
+		strcat(child, ents[i].name);
+		if ((upper_has_dir && l_exists(s->upper, child)) || !lower_visible(s, child)) {
+		    continue;
+		}
+	    }
+	    if (dir_add(d, &ents[i])) {
+		n = -1;
+		break;
+	    }
+	}
+    }
+
+    l->interface->closedir(l->state, dir);
+
+    return n < 0 ? -1 : 0;
+}
+
+static void *ovl_opendir(void *state, char *path)
+{
+    struct ovl_state *s = (struct ovl_state *)state;
+    char p[strlen(path)+2];
+    struct ovl_dir *d;
+    int upper, lower;
+
+    canon(path, p);
+
+    upper = l_is_dir(s->upper, p);
+    lower = !(upper ? 0 : l_exists(s->upper, p)) && lower_visible(s, p) && l_is_dir(s->lower, p);
+
+    if (!upper && !lower) {
+	return 0;
+    }
+
+    d = malloc(sizeof(*d));
+
+    if (!d) {
+	ERROR("Cannot allocate directory\n");
+	return 0;
+    }
+
+    memset(d, 0, sizeof(*d));
+
+    if ((upper && dir_merge(s, d, s->upper, p, 0, 0)) ||
+	(lower && dir_merge(s, d, s->lower, p, 1, upper))) {
+	ERROR("Cannot read directory %s\n", p);
+	free(d->ents);
+	free(d);
+	return 0;
+    }
+
+    return d;
+}
+
+static ssize_t ovl_readdir_batch(void *state, void *dir, struct nk_fs_dirent *ents, size_t n)
+{
+    struct ovl_dir *d = (struct ovl_dir *)dir;
+
+    n = MIN(n, d->num - d->pos);
+    memcpy(ents, &d->ents[d->pos], n*sizeof(*ents));
+    d->pos += n;
+
+    return n;
+}
+
+static void ovl_closedir(void *state, void *dir)
+{
+    struct ovl_dir *d = (struct ovl_dir *)dir;
+
+    free(d->ents);
+    free(d);
+}
+
+static int dir_empty(struct ovl_state *s, char *path)
+{
+    struct ovl_dir *d = ovl_opendir(s, path);
+    int empty;
+
+    if (!d) {
+	return 0;
+    }
+
+    empty = !d->num;
+    ovl_closedir(s, d);
+
+    return empty;
+}
+
+static int ovl_sync_fs(void *state)
+{
+    struct ovl_state *s = (struct ovl_state *)state;
+
+    return s->upper->interface->sync_fs ? s->upper->interface->sync_fs(s->upper->state) : 0;
+}
+
+static struct nk_fs_int ovl_inter = {
+    .stat_path = ovl_stat_path,
+    .create_file = ovl_create_file,
+    .create_dir = ovl_create_dir,
+    .exists = ovl_exists,
+    .remove = ovl_remove,
+    .open_file = ovl_open,
+    .stat = ovl_stat,
+    .trunc_file = ovl_truncate,
+    .close_file = ovl_close,
+    .read_file = ovl_read,
+    .write_file = ovl_write,
+    .rename = ovl_rename,
+    .read_direct = ovl_read_direct,
+    .opendir = ovl_opendir,
+    .readdir_batch = ovl_readdir_batch,
+    .closedir = ovl_closedir,
+    .sync_fs = ovl_sync_fs,
+};
+
+
+int nk_fs_overlay_attach(char *fsname, char *lower, char *upper)
+{
+    struct nk_fs *l = nk_fs_find(lower);
+    struct nk_fs *u = nk_fs_find(upper);
+    struct ovl_state *s;
+
+    if (!l || !u || l == u) {
+	ERROR("Cannot find distinct layers %s and %s\n", lower, upper);
+	return -1;
+    }
+
+    if ((u->flags & NK_FS_READONLY) || !u->interface->create_file || !u->interface->create_dir ||
+	!u->interface->write_file || !u->interface->remove || !u->interface->opendir) {
+	ERROR("Upper layer %s is not a writeable filesystem\n", upper);
+	return -1;
+    }
+
+    s = malloc(sizeof(*s));
+
+    if (!s) {
+	ERROR("Cannot allocate space for fs %s\n", fsname);
+	return -1;
+    }
+
+    memset(s, 0, sizeof(*s));
+
+    spinlock_init(&s->lock);
+    s->lower = l;
+    s->upper = u;
+
+    s->fs = nk_fs_register(fsname, (l->flags | u->flags) & NK_FS_MOVES_DATA, &ovl_inter, s);
+
+    if (!s->fs) {
+	ERROR("Unable to register filesystem %s\n", fsname);
+	free(s);
+	return -1;
+    }
+
+    INFO("filesystem %s is %s over %s\n", fsname, upper, lower);
+
+    return 0;
+}
+
+int nk_fs_overlay_detach(char *fsname)
+{
+    struct nk_fs *fs = nk_fs_find(fsname);
+    struct ovl_state *s;
+    struct mask *m, *next;
+    int i;
+
+    if (!fs || fs->interface != &ovl_inter) {
+	return -1;
+    }
+
+    s = (struct ovl_state *)fs->state;
+
+    if (s->open_files) {
+	ERROR("Cannot detach %s with %lu open files\n", fsname, s->open_files);
+	return -1;
+    }
+
+    if (nk_fs_unregister(fs)) {
+	return -1;
+    }
+
+    for (i=0;i<MASK_BUCKETS;i++) {
+	for (m = s->masks[i]; m; m = next) {
+	    next = m->next;
+	    free(m);
+	}
+    }
+
+    free(s);
+
+    return 0;
+}
+
+
+static int
+handle_overlay (char * buf, void * priv)
+{
+    char fsname[FS_NAME_LEN], lower[FS_NAME_LEN], upper[FS_NAME_LEN];
+
+    if (sscanf(buf,"overlay detach %31s",fsname)==1) {
+	if (nk_fs_overlay_detach(fsname)) {
+	    nk_vc_printf("Failed to detach %s\n",fsname);
+	    return -1;
+	}
+	return 0;
+    }
+
+    if (sscanf(buf,"overlay %31s %31s %31s",fsname,lower,upper)!=3) {
+	nk_vc_printf("overlay fsname lower upper | overlay detach fsname\n");
+	return -1;
+    }
+
+    if (nk_fs_overlay_attach(fsname,lower,upper)) {
+	nk_vc_printf("Failed to create overlay %s\n",fsname);
+	return -1;
+    }
+
+    nk_vc_printf("overlay %s created\n",fsname);
+
+    return 0;
+}
+
+static struct shell_cmd_impl overlay_impl = {
+    .cmd      = "overlay",
+    .help_str = "overlay fsname lower upper | overlay detach fsname",
+    .handler  = handle_overlay,
+};
+nk_register_shell_cmd(overlay_impl);
@@ -0,0 +1 @@
+cmd_src/fs/tmpfs/built-in.o :=  ld -z max-page-size=0x1000 -melf_x86_64 -dp  -r -o src/fs/tmpfs/built-in.o src/fs/tmpfs/tmpfs.o
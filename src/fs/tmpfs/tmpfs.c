@@ -0,0 +1,1158 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2017, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+
+/*
+ * tmpfs - files that live only in memory
+ *
+ * Every file and directory is an inode.  Names are found through one
+ * hash table per filesystem keyed by (parent directory, name), so a path
+ * lookup costs one probe per component no matter how big a directory
+ * is.  Each directory also keeps a list of its children for readdir.
+ *
+ * File data is kept in pages indexed by a radix tree, 64 slots per
+ * node, grown upward as files get bigger.  Missing pages are holes that
+ * read as zero.  Each file remembers the last page it touched, so
+ * sequential reads and appends do not walk the tree at all.
+ *
+ * Pages come from small per-CPU free lists, refilled from and spilled
+ * to the local kmem zone.  Only file data pages count against the
+ * size limit.
+ *
+ * Locking: the namespace (hash, children lists, open counts) is under
+ * the per-filesystem lock, file contents are under the per-inode lock.
+ * Neither is held while the other is taken.
+ */
+
+#include <nautilus/nautilus.h>
+#include <nautilus/fs.h>
+#include <nautilus/shell.h>
+
+#include <fs/tmpfs/tmpfs.h>
+
+#define INFO(fmt, args...)  INFO_PRINT("tmpfs: " fmt, ##args)
+#define DEBUG(fmt, args...) DEBUG_PRINT("tmpfs: " fmt, ##args)
+#define ERROR(fmt, args...) ERROR_PRINT("tmpfs: " fmt, ##args)
+
+#ifndef NAUT_CONFIG_DEBUG_TMPFS_FILESYSTEM_DRIVER
+#undef DEBUG
+#define DEBUG(fmt, args...)
+#endif
+
+#define MIN(x,y) ((x)<(y) ? (x) : (y))
+
+#define TMPFS_PAGE_SHIFT 12
+#define TMPFS_PAGE_SIZE  (1UL<<TMPFS_PAGE_SHIFT)
+#define TMPFS_PAGE_MASK  (TMPFS_PAGE_SIZE-1)
+
+#define TMPFS_NAME_LEN   (NK_FS_DIRENT_NAME_LEN-1)
+
+#define RADIX_SHIFT 6
+#define RADIX_SLOTS (1<<RADIX_SHIFT)
+#define RADIX_MASK  (RADIX_SLOTS-1)
+
+#define HASH_INIT_BUCKETS 256
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME  0x100000001b3ULL
+
+struct radix_node {
+    void *slots[RADIX_SLOTS];
+};
+
+struct tmpfs_inode {
+    struct tmpfs_inode *hash_next;   // chain in the name hash
+    struct tmpfs_inode *parent;      // 0 for the root
+    struct list_head    sibling;     // in parent's children
+    struct list_head    children;    // directories only
+    char               *name;
+    uint64_t            hash;
+    uint64_t            ino;
+    int                 is_dir;
+    int                 unlinked;    // removed while open
+    uint64_t            refs;        // opens
+    uint64_t            num_children;
+
+    spinlock_t          lock;        // everything below
+    uint64_t            size;
+    struct radix_node  *root;
+    int                 height;      // levels in the tree, 0 if empty
+    uint64_t            tail_index;  // last page touched
+    void               *tail_page;
+};
+
+struct tmpfs_state {
+    struct nk_fs       *fs;
+    spinlock_t          lock;
+    struct tmpfs_inode *root;
+    struct tmpfs_inode **buckets;
+    uint64_t            num_buckets;   // power of two
+    uint64_t            num_names;
+    uint64_t            next_ino;
+    uint64_t            open_files;
+
+    uint64_t            max_bytes;     // 0 => no limit
+    volatile uint64_t   used_bytes;
+};
+
+#define NS_LOCK_CONF uint8_t _ns_lock_flags
+#define NS_LOCK(fs) _ns_lock_flags = spin_lock_irq_save(&(fs)->lock)
+#define NS_UNLOCK(fs) spin_unlock_irq_restore(&(fs)->lock, _ns_lock_flags);
+
+#define INODE_LOCK_CONF uint8_t _inode_lock_flags
+#define INODE_LOCK(in) _inode_lock_flags = spin_lock_irq_save(&(in)->lock)
+#define INODE_UNLOCK(in) spin_unlock_irq_restore(&(in)->lock, _inode_lock_flags);
+
+
+/*
+ * Pages
+ */
+
+#define PAGE_CACHE_MAX 64
+
+// free pages linked through their first word
+static struct page_cache {
+    void     *free;
+    uint64_t  count;
+} __attribute__((aligned(64))) page_caches[NAUT_CONFIG_MAX_CPUS];
+
+static void *page_alloc(struct tmpfs_state *fs, int zero)
+{
+    struct page_cache *c;
+    uint8_t flags;
+    void *p;
+
+    if (__sync_add_and_fetch(&fs->used_bytes, TMPFS_PAGE_SIZE) > fs->max_bytes && fs->max_bytes) {
+	__sync_fetch_and_sub(&fs->used_bytes, TMPFS_PAGE_SIZE);
+	DEBUG("%s is full\n", fs->fs->name);
+	return 0;
+    }
+
+    flags = irq_disable_save();
+    c = &page_caches[my_cpu_id()];
+    p = c->free;
+    if (p) {
+	c->free = *(void **)p;
+	c->count--;
+    }
+    irq_enable_restore(flags);
+
+    if (!p) {
+	p = malloc_specific(TMPFS_PAGE_SIZE, my_cpu_id());
+	if (!p) {
+	    __sync_fetch_and_sub(&fs->used_bytes, TMPFS_PAGE_SIZE);
+	    ERROR("Cannot allocate page\n");
+	    return 0;
+	}
+    }
+
+    if (zero) {
+	memset(p, 0, TMPFS_PAGE_SIZE);
+    }
+
+    return p;
+}
+
+static void page_free(struct tmpfs_state *fs, void *p)
+{
+    struct page_cache *c;
+    uint8_t flags;
+
+    __sync_fetch_and_sub(&fs->used_bytes, TMPFS_PAGE_SIZE);
+
+    flags = irq_disable_save();
+    c = &page_caches[my_cpu_id()];
+    if (c->count < PAGE_CACHE_MAX) {
+	*(void **)p = c->free;
+	c->free = p;
+	c->count++;
+	p = 0;
+    }
+    irq_enable_restore(flags);
+
+    if (p) {
+	free(p);
+    }
+}
+
+
+/*
+ * Page index.  A tree of height h holds indices below 64^h
+ */
+
+static inline uint64_t radix_limit(int height)
+{
+    return height >= 64/RADIX_SHIFT ? ~0ULL : (1ULL << (RADIX_SHIFT*height)) - 1;
+}
+
+static struct radix_node *radix_node_alloc(void)
+{
+    struct radix_node *n = malloc(sizeof(*n));
+
+    if (n) {
+	memset(n, 0, sizeof(*n));
+    }
+
+    return n;
+}
+
+// returns the slot for index, creating the path to it if asked
+static void **radix_slot(struct tmpfs_inode *in, uint64_t index, int create)
+{
+    struct radix_node *n;
+    int level;
+
+    if (!in->root) {
+	if (!create) {
+	    return 0;
+	}
+	if (!(in->root = radix_node_alloc())) {
+	    return 0;
+	}
+	in->height = 1;
+    }
+
+    while (index > radix_limit(in->height)) {
+	if (!create) {
+	    return 0;
+	}
+	if (!(n = radix_node_alloc())) {
+	    return 0;
+	}
+	n->slots[0] = in->root;
+	in->root = n;
+	in->height++;
+    }
+
+    n = in->root;
+    for (level = in->height - 1; level > 0; level--) {
+	void **slot = &n->slots[(index >> (RADIX_SHIFT*level)) & RADIX_MASK];
+	if (!*slot) {
+	    if (!create || !(*slot = radix_node_alloc())) {
+		return 0;
+	    }
+	}
+	n = *slot;
+    }
+
+    return &n->slots[index & RADIX_MASK];
+}
+
+// frees every page at index first or above under node, which is at
+// the given level and starts at index base; returns 1 if node is
+// left empty
+static int radix_trunc(struct tmpfs_state *fs, struct radix_node *node, int level, uint64_t base, uint64_t first)
+{
+    uint64_t span = 1ULL << (RADIX_SHIFT*level);
+    uint64_t slot_base;
+    int i, empty = 1;
+
+    for (i=0;i<RADIX_SLOTS;i++) {
+	if (!node->slots[i]) {
+	    continue;
+	}
+	slot_base = base + i*span;
+	if (slot_base + span <= first) {
+	    empty = 0;
+	    continue;
+	}
+	if (!level) {
+	    page_free(fs, node->slots[i]);
+	    node->slots[i] = 0;
+	} else if (radix_trunc(fs, node->slots[i], level-1, slot_base, first)) {
+	    free(node->slots[i]);
+	    node->slots[i] = 0;
+	} else {
+	    empty = 0;
+	}
+    }
+
+    return empty;
+}
+
+// caller holds the inode lock
+static void pages_trunc(struct tmpfs_state *fs, struct tmpfs_inode *in, uint64_t first)
+{
+    if (in->root && radix_trunc(fs, in->root, in->height-1, 0, first)) {
+	free(in->root);
+	in->root = 0;
+	in->height = 0;
+    }
+    in->tail_page = 0;
+}
+
+// caller holds the inode lock
+static void *page_get(struct tmpfs_state *fs, struct tmpfs_inode *in, uint64_t index, int create, int zero)
+{
+    void **slot;
+
+    if (in->tail_page && in->tail_index == index) {
+	return in->tail_page;
+    }
+
+    slot = radix_slot(in, index, create);
+
+    if (!slot) {
+	return 0;
+    }
+
+    if (!*slot) {
+	if (!create || !(*slot = page_alloc(fs, zero))) {
+	    return 0;
+	}
+    }
+
+    in->tail_index = index;
+    in->tail_page = *slot;
+
+    return *slot;
+}
+
+
+/*
+ * Namespace
+ */
+
+static uint64_t name_hash(struct tmpfs_inode *parent, const char *name, size_t len)
+{
+    uint64_t h = FNV_OFFSET ^ parent->ino;
+    size_t i;
+
+    for (i=0;i<len;i++) {
+	h ^= (uint8_t)name[i];
+	h *= FNV_PRIME;
+    }
+
+    return h;
+}
+
+static struct tmpfs_inode *hash_find(struct tmpfs_state *fs, struct tmpfs_inode *parent, const char *name, size_t len)
+{
+    uint64_t h = name_hash(parent, name, len);
+    struct tmpfs_inode *in;
+
+    for (in = fs->buckets[h & (fs->num_buckets-1)]; in; in = in->hash_next) {
+	if (in->hash == h && in->parent == parent &&
+	    !strncmp(in->name, name, len) && !in->name[len]) {
+	    return in;
+	}
+    }
+
+    return 0;
+}
+
+// doubling is best effort - a failed allocation just leaves longer chains
+static void hash_grow(struct tmpfs_state *fs)
+{
+    uint64_t n = fs->num_buckets*2, i;
+    struct tmpfs_inode **b = malloc(n*sizeof(*b));
+    struct tmpfs_inode *in, *next;
+
+    if (!b) {
+	return;
+    }
+
+    memset(b, 0, n*sizeof(*b));
+
+    for (i=0;i<fs->num_buckets;i++) {
+	for (in = fs->buckets[i]; in; in = next) {
+	    next = in->hash_next;
+	    in->hash_next = b[in->hash & (n-1)];
+	    b[in->hash & (n-1)] = in;
+	}
+    }
+
+    free(fs->buckets);
+    fs->buckets = b;
+    fs->num_buckets = n;
+}
+
+static void hash_insert(struct tmpfs_state *fs, struct tmpfs_inode *in)
+{
+    uint64_t b;
+
+    if (fs->num_names >= 2*fs->num_buckets) {
+	hash_grow(fs);
+    }
+
+    b = in->hash & (fs->num_buckets-1);
+    in->hash_next = fs->buckets[b];
+    fs->buckets[b] = in;
+    fs->num_names++;
+}
+
+static void hash_remove(struct tmpfs_state *fs, struct tmpfs_inode *in)
+{
+    struct tmpfs_inode **p = &fs->buckets[in->hash & (fs->num_buckets-1)];
+
+    while (*p && *p != in) {
+	p = &(*p)->hash_next;
+    }
+
+    if (*p) {
+	*p = in->hash_next;
+	fs->num_names--;
+    }
+}
+
+// names in[parent] name[0..len) and adds it to the namespace
+static int link_inode(struct tmpfs_state *fs, struct tmpfs_inode *in, struct tmpfs_inode *parent, const char *name, size_t len)
+{
+    char *n = malloc(len+1);
+
+    if (!n) {
+	return -1;
+    }
+
+    memcpy(n, name, len);
+    n[len] = 0;
+
+    free(in->name);
+    in->name = n;
+    in->parent = parent;
+    in->hash = name_hash(parent, name, len);
+    hash_insert(fs, in);
+    list_add_tail(&in->sibling, &parent->children);
+    parent->num_children++;
+
+    return 0;
+}
+
+static void unlink_inode(struct tmpfs_state *fs, struct tmpfs_inode *in)
+{
+    hash_remove(fs, in);
+    list_del_init(&in->sibling);
+    in->parent->num_children--;
+}
+
+static struct tmpfs_inode *inode_alloc(struct tmpfs_state *fs, int is_dir)
+{
+    struct tmpfs_inode *in = malloc(sizeof(*in));
+
+    if (!in) {
+	return 0;
+    }
+
+    memset(in, 0, sizeof(*in));
+    in->ino = ++fs->next_ino;
+    in->is_dir = is_dir;
+    INIT_LIST_HEAD(&in->sibling);
+    INIT_LIST_HEAD(&in->children);
+    spinlock_init(&in->lock);
+
+    return in;
+}
+
+// the inode is out of the namespace and no longer open
+static void inode_free(struct tmpfs_state *fs, struct tmpfs_inode *in)
+{
+    pages_trunc(fs, in, 0);
+    free(in->name);
+    free(in);
+}
+
+// splits off the next component of *path, skipping slashes
+static size_t next_component(char **path, char **comp)
+{
+    char *p = *path;
+    size_t len;
+
+    while (*p == '/') {
+	p++;
+    }
+
+    *comp = p;
+
+    for (len = 0; p[len] && p[len] != '/'; len++) {
+    }
+
+    *path = p + len;
+
+    return len;
+}
+
+// caller holds the namespace lock
+static struct tmpfs_inode *walk(struct tmpfs_state *fs, char *path)
+{
+    struct tmpfs_inode *in = fs->root;
+    char *comp;
+    size_t len;
+
+    while (in && (len = next_component(&path, &comp))) {
+	if (len == 1 && comp[0] == '.') {
+	    continue;
+	}
+	if (len == 2 && comp[0] == '.' && comp[1] == '.') {
+	    in = in->parent ? in->parent : in;
+	    continue;
+	}
+	if (!in->is_dir) {
+	    return 0;
+	}
+	in = hash_find(fs, in, comp, len);
+    }
+
+    return in;
+}
+
+// finds the directory that would hold path, and its last component
+// caller holds the namespace lock
+static struct tmpfs_inode *walk_parent(struct tmpfs_state *fs, char *path, char **name, size_t *len)
+{
+    struct tmpfs_inode *dir = fs->root;
+    char *comp, *rest = path;
+    size_t n;
+
+    n = next_component(&rest, &comp);
+
+    while (n) {
+	char *next;
+	size_t m;
+	char *probe = rest;
+
+	m = next_component(&probe, &next);
+	if (!m) {
+	    break;
+	}
+
+	// comp is an intermediate directory
+	if (n == 1 && comp[0] == '.') {
+	} else if (n == 2 && comp[0] == '.' && comp[1] == '.') {
+	    dir = dir->parent ? dir->parent : dir;
+	} else {
+	    dir = hash_find(fs, dir, comp, n);
+	    if (!dir || !dir->is_dir) {
+		return 0;
+	    }
+	}
+
+	comp = next;
+	n = m;
+	rest = probe;
+    }
+
+    if (!n || n > TMPFS_NAME_LEN || (n == 1 && comp[0] == '.') ||
+	(n == 2 && comp[0] == '.' && comp[1] == '.')) {
+	return 0;
+    }
+
+    *name = comp;
+    *len = n;
+
+    return dir;
+}
+
+static struct tmpfs_inode *create(struct tmpfs_state *fs, char *path, int is_dir)
+{
+    struct tmpfs_inode *dir, *in = 0;
+    char *name;
+    size_t len;
+    NS_LOCK_CONF;
+
+    NS_LOCK(fs);
+
+    dir = walk_parent(fs, path, &name, &len);
+
+    if (!dir || hash_find(fs, dir, name, len)) {
+	DEBUG("cannot create %s\n", path);
+	goto out;
+    }
+
+    in = inode_alloc(fs, is_dir);
+
+    if (!in) {
+	ERROR("Cannot allocate inode for %s\n", path);
+	goto out;
+    }
+
+    if (link_inode(fs, in, dir, name, len)) {
+	ERROR("Cannot allocate name for %s\n", path);
+	free(in);
+	in = 0;
+	goto out;
+    }
+
+    if (!is_dir) {
+	in->refs++;
+	fs->open_files++;
+    }
+
+ out:
+    NS_UNLOCK(fs);
+
+    return in;
+}
+
+
+/*
+ * nk_fs_int
+ */
+
+static void fill_stat(struct tmpfs_inode *in, struct nk_fs_stat *st)
+{
+    memset(st, 0, sizeof(*st));
+    st->st_size = in->is_dir ? 0 : in->size;
+}
+
+static int tmpfs_stat_path(void *state, char *path, struct nk_fs_stat *st)
+{
+    struct tmpfs_state *fs = (struct tmpfs_state *)state;
+    struct tmpfs_inode *in;
+    NS_LOCK_CONF;
+
+    NS_LOCK(fs);
+    in = walk(fs, path);
+    if (in) {
+	fill_stat(in, st);
+    }
+    NS_UNLOCK(fs);
+
+    return in ? 0 : -1;
+}
+
+static void *tmpfs_create_file(void *state, char *path)
+{
+    return create((struct tmpfs_state *)state, path, 0);
+}
+
+static int tmpfs_create_dir(void *state, char *path)
+{
+    return create((struct tmpfs_state *)state, path, 1) ? 0 : -1;
+}
+
+static int tmpfs_exists(void *state, char *path)
+{
+    struct tmpfs_state *fs = (struct tmpfs_state *)state;
+    struct tmpfs_inode *in;
+    NS_LOCK_CONF;
+
+    NS_LOCK(fs);
+    in = walk(fs, path);
+    NS_UNLOCK(fs);
+
+    return in != 0;
+}
+
+static int tmpfs_remove(void *state, char *path)
+{
+    struct tmpfs_state *fs = (struct tmpfs_state *)state;
+    struct tmpfs_inode *in;
+    int rc = -1, dead = 0;
+    NS_LOCK_CONF;
+
+    NS_LOCK(fs);
+
+    in = walk(fs, path);
+
+    if (!in || in == fs->root || (in->is_dir && in->num_children)) {
+	DEBUG("cannot remove %s\n", path);
+	goto out;
+    }
+
+    unlink_inode(fs, in);
+
+    if (in->refs) {
+	in->unlinked = 1;
+    } else {
+	dead = 1;
+    }
+    rc = 0;
+
+ out:
+    NS_UNLOCK(fs);
+
+    if (dead) {
+	inode_free(fs, in);
+    }
+
+    return rc;
+}
+
+static void *tmpfs_open(void *state, char *path)
+{
+    struct tmpfs_state *fs = (struct tmpfs_state *)state;
+    struct tmpfs_inode *in;
+    NS_LOCK_CONF;
+
+    NS_LOCK(fs);
+    in = walk(fs, path);
+    if (in) {
+	in->refs++;
+	fs->open_files++;
+    }
+    NS_UNLOCK(fs);
+
+    return in;
+}
+
+static void tmpfs_close(void *state, void *file)
+{
+    struct tmpfs_state *fs = (struct tmpfs_state *)state;
+    struct tmpfs_inode *in = (struct tmpfs_inode *)file;
+    int dead;
+    NS_LOCK_CONF;
+
+    NS_LOCK(fs);
+    in->refs--;
+    fs->open_files--;
+    dead = in->unlinked && !in->refs;
+    NS_UNLOCK(fs);
+
+    if (dead) {
+	DEBUG("last close of removed inode %lu\n", in->ino);
+	inode_free(fs, in);
+    }
+}
+
+static int tmpfs_stat(void *state, void *file, struct nk_fs_stat *st)
+{
+    struct tmpfs_inode *in = (struct tmpfs_inode *)file;
+    INODE_LOCK_CONF;
+
+    INODE_LOCK(in);
+    fill_stat(in, st);
+    INODE_UNLOCK(in);
+
+    return 0;
+}
+
+// bytes past the size are always zero, so growing only moves the size
+static int tmpfs_truncate(void *state, void *file, off_t len)
+{
+    struct tmpfs_state *fs = (struct tmpfs_state *)state;
+    struct tmpfs_inode *in = (struct tmpfs_inode *)file;
+    void *page;
+    INODE_LOCK_CONF;
+
+    if (in->is_dir) {
+	return -1;
+    }
+
+    INODE_LOCK(in);
+
+    if (len < in->size) {
+	pages_trunc(fs, in, (len + TMPFS_PAGE_MASK) >> TMPFS_PAGE_SHIFT);
+	if ((len & TMPFS_PAGE_MASK) && (page = page_get(fs, in, len >> TMPFS_PAGE_SHIFT, 0, 0))) {
+	    memset(page + (len & TMPFS_PAGE_MASK), 0, TMPFS_PAGE_SIZE - (len & TMPFS_PAGE_MASK));
+	}
+    }
+
+    in->size = len;
+
+    INODE_UNLOCK(in);
+
+    return 0;
+}
+
+static ssize_t tmpfs_read(void *state, void *file, void *dest, off_t offset, size_t num_bytes)
+{
+    struct tmpfs_state *fs = (struct tmpfs_state *)state;
+    struct tmpfs_inode *in = (struct tmpfs_inode *)file;
+    size_t done, n, off;
+    void *page;
+    INODE_LOCK_CONF;
+
+    if (in->is_dir) {
+	return -1;
+    }
+
+    INODE_LOCK(in);
+
+    if (offset >= in->size) {
+	INODE_UNLOCK(in);
+	return 0;
+    }
+
+    num_bytes = MIN(num_bytes, in->size - offset);
+
+    for (done = 0; done < num_bytes; done += n) {
+	off = (offset + done) & TMPFS_PAGE_MASK;
+	n = MIN(TMPFS_PAGE_SIZE - off, num_bytes - done);
+	page = page_get(fs, in, (offset + done) >> TMPFS_PAGE_SHIFT, 0, 0);
+	if (page) {
+	    memcpy(dest + done, page + off, n);
+	} else {
+	    memset(dest + done, 0, n);
+	}
+    }
+
+    INODE_UNLOCK(in);
+
+    return num_bytes;
+}
+
+static ssize_t tmpfs_write(void *state, void *file, void *src, off_t offset, size_t num_bytes)
+{
+    struct tmpfs_state *fs = (struct tmpfs_state *)state;
+    struct tmpfs_inode *in = (struct tmpfs_inode *)file;
+    size_t done, n, off;
+    void *page;
+    INODE_LOCK_CONF;
+
+    if (in->is_dir) {
+	return -1;
+    }
+
+    INODE_LOCK(in);
+
+    for (done = 0; done < num_bytes; done += n) {
+	off = (offset + done) & TMPFS_PAGE_MASK;
+	n = MIN(TMPFS_PAGE_SIZE - off, num_bytes - done);
+	// a new page that is about to be entirely overwritten need not be zeroed
+	page = page_get(fs, in, (offset + done) >> TMPFS_PAGE_SHIFT, 1, n != TMPFS_PAGE_SIZE);
+	if (!page) {
+	    break;
+	}
+	memcpy(page + off, src + done, n);
+    }
+
+    if (offset + done > in->size) {
+	in->size = offset + done;
+    }
+
+    INODE_UNLOCK(in);
+
+    return done || !num_bytes ? done : -1;
+}
+
+static int tmpfs_rename(void *state, char *old_path, char *new_path, int isdir)
+{
+    struct tmpfs_state *fs = (struct tmpfs_state *)state;
+    struct tmpfs_inode *in, *dir, *old = 0, *p;
+    char *name;
+    size_t len;
+    int rc = -1, dead = 0;
+    NS_LOCK_CONF;
+
+    NS_LOCK(fs);
+
+    in = walk(fs, old_path);
+    dir = walk_parent(fs, new_path, &name, &len);
+
+    if (!in || in == fs->root || !dir || in->is_dir != !!isdir) {
+	goto out;
+    }
+
+    // a directory cannot move underneath itself
+    for (p = dir; p; p = p->parent) {
+	if (p == in) {
+	    goto out;
+	}
+    }
+
+    old = hash_find(fs, dir, name, len);
+
+    if (old == in) {
+	rc = 0;
+	goto out;
+    }
+
+    if (old && (old->is_dir != in->is_dir || (old->is_dir && old->num_children))) {
+	goto out;
+    }
+
+    unlink_inode(fs, in);
+
+    if (link_inode(fs, in, dir, name, len)) {
+	// put it back under its old name, which cannot fail as it was there
+	ERROR("Cannot allocate name for %s\n", new_path);
+	hash_insert(fs, in);
+	list_add_tail(&in->sibling, &in->parent->children);
+	in->parent->num_children++;
+	goto out;
+    }
+
+    if (old) {
+	unlink_inode(fs, old);
+	if (old->refs) {
+	    old->unlinked = 1;
+	} else {
+	    dead = 1;
+	}
+    }
+
+    rc = 0;
+
+ out:
+    NS_UNLOCK(fs);
+
+    if (dead) {
+	inode_free(fs, old);
+    }
+
+    return rc;
+}
+
+// a page is as much contiguous data as there is
+static ssize_t tmpfs_read_direct(void *state, void *file, off_t offset, size_t num_bytes, void **ptr)
+{
+    struct tmpfs_state *fs = (struct tmpfs_state *)state;
+    struct tmpfs_inode *in = (struct tmpfs_inode *)file;
+    ssize_t n = -1;
+    void *page;
+    INODE_LOCK_CONF;
+
+    if (in->is_dir) {
+	return -1;
+    }
+
+    INODE_LOCK(in);
+
+    if (offset >= in->size) {
+	n = 0;
+    } else if ((page = page_get(fs, in, offset >> TMPFS_PAGE_SHIFT, 0, 0))) {
+	*ptr = page + (offset & TMPFS_PAGE_MASK);
+	n = MIN(num_bytes, MIN(TMPFS_PAGE_SIZE - (offset & TMPFS_PAGE_MASK), in->size - offset));
+    }
+
+    INODE_UNLOCK(in);
+
+    return n;
+}
+
+// directories are read from a snapshot taken at opendir
+struct tmpfs_dir {
+    size_t               num;
+    size_t               pos;
+    struct nk_fs_dirent  ents[0];
+};
+
+static void *tmpfs_opendir(void *state, char *path)
+{
+    struct tmpfs_state *fs = (struct tmpfs_state *)state;
+    struct tmpfs_inode *dir, *in;
+    struct tmpfs_dir *d = 0;
+    struct list_head *cur;
+    size_t i = 0;
+    NS_LOCK_CONF;
+
+    NS_LOCK(fs);
+
+    dir = walk(fs, path);
+
+    if (!dir || !dir->is_dir) {
+	goto out;
+    }
+
+    d = malloc(sizeof(*d) + dir->num_children*sizeof(struct nk_fs_dirent));
+
+    if (!d) {
+	ERROR("Cannot allocate directory snapshot\n");
+	goto out;
+    }
+
+    list_for_each(cur, &dir->children) {
+	in = list_entry(cur, struct tmpfs_inode, sibling);
+	strncpy(d->ents[i].name, in->name, NK_FS_DIRENT_NAME_LEN);
+	d->ents[i].name[NK_FS_DIRENT_NAME_LEN-1] = 0;
+	// unlocked read of the size is fine for a listing
+	d->ents[i].size = in->is_dir ? 0 : in->size;
+	d->ents[i].attr = in->is_dir ? NK_FS_ATTR_DIR : 0;
+	i++;
+    }
+
+    d->num = i;
+    d->pos = 0;
+
+ out:
+    NS_UNLOCK(fs);
+
+    return d;
+}
+
+static ssize_t tmpfs_readdir_batch(void *state, void *dir, struct nk_fs_dirent *ents, size_t n)
+{
+    struct tmpfs_dir *d = (struct tmpfs_dir *)dir;
+
+    n = MIN(n, d->num - d->pos);
+    memcpy(ents, &d->ents[d->pos], n*sizeof(*ents));
+    d->pos += n;
+
+    return n;
+}
+
+static void tmpfs_closedir(void *state, void *dir)
+{
+    free(dir);
+}
+
+static int tmpfs_stat_many(void *state, char *dir_path, char **names, int n, struct nk_fs_stat *st, int *rc)
+{
+    struct tmpfs_state *fs = (struct tmpfs_state *)state;
+    struct tmpfs_inode *dir, *in;
+    int i, found = 0;
+    NS_LOCK_CONF;
+
+    NS_LOCK(fs);
+
+    dir = walk(fs, dir_path);
+
+    for (i=0;i<n;i++) {
+	in = dir && dir->is_dir ? hash_find(fs, dir, names[i], strlen(names[i])) : 0;
+	if (in) {
+	    fill_stat(in, &st[i]);
+	    rc[i] = 0;
+	    found++;
+	} else {
+	    rc[i] = -1;
+	}
+    }
+
+    NS_UNLOCK(fs);
+
+    return dir ? found : -1;
+}
+
+static struct nk_fs_int tmpfs_inter = {
+    .stat_path = tmpfs_stat_path,
+    .create_file = tmpfs_create_file,
+    .create_dir = tmpfs_create_dir,
+    .exists = tmpfs_exists,
+    .remove = tmpfs_remove,
+    .open_file = tmpfs_open,
+    .stat = tmpfs_stat,
+    .trunc_file = tmpfs_truncate,
+    .close_file = tmpfs_close,
+    .read_file = tmpfs_read,
+    .write_file = tmpfs_write,
+    .rename = tmpfs_rename,
+    .read_direct = tmpfs_read_direct,
+    .opendir = tmpfs_opendir,
+    .readdir_batch = tmpfs_readdir_batch,
+    .closedir = tmpfs_closedir,
+    .stat_many = tmpfs_stat_many,
+};
+
+
+static void free_tree(struct tmpfs_state *fs, struct tmpfs_inode *in)
+{
+    struct list_head *cur, *next;
+
+    list_for_each_safe(cur, next, &in->children) {
+	free_tree(fs, list_entry(cur, struct tmpfs_inode, sibling));
+    }
+
+    inode_free(fs, in);
+}
+
+int nk_fs_tmpfs_attach(char *fsname, uint64_t max_bytes)
+{
+    struct tmpfs_state *s = malloc(sizeof(*s));
+
+    if (!s) {
+	ERROR("Cannot allocate space for fs %s\n", fsname);
+	return -1;
+    }
+
+    memset(s, 0, sizeof(*s));
+
+    spinlock_init(&s->lock);
+    s->max_bytes = max_bytes;
+    s->num_buckets = HASH_INIT_BUCKETS;
+    s->buckets = malloc(s->num_buckets*sizeof(*s->buckets));
+    s->root = inode_alloc(s, 1);
+
+    if (!s->buckets || !s->root) {
+	ERROR("Cannot allocate namespace for fs %s\n", fsname);
+	free(s->buckets);
+	free(s->root);
+	free(s);
+	return -1;
+    }
+
+    memset(s->buckets, 0, s->num_buckets*sizeof(*s->buckets));
+
+    s->fs = nk_fs_register(fsname, 0, &tmpfs_inter, s);
+
+    if (!s->fs) {
+	ERROR("Unable to register filesystem %s\n", fsname);
+	free(s->buckets);
+	free(s->root);
+	free(s);
+	return -1;
+    }
+
+    INFO("filesystem %s is attached (limit %lu bytes)\n", fsname, max_bytes);
+
+    return 0;
+}
+
+int nk_fs_tmpfs_detach(char *fsname)
+{
+    struct nk_fs *fs = nk_fs_find(fsname);
+    struct tmpfs_state *s;
+
+    if (!fs || fs->interface != &tmpfs_inter) {
+	return -1;
+    }
+
+    s = (struct tmpfs_state *)fs->state;
+
+    if (s->open_files) {
+	ERROR("Cannot detach %s with %lu open files\n", fsname, s->open_files);
+	return -1;
+    }
+
+    if (nk_fs_unregister(fs)) {
+	return -1;
+    }
+
+    free_tree(s, s->root);
+    free(s->buckets);
+    free(s);
+
+    return 0;
+}
+
+
+static int
+handle_tmpfs (char * buf, void * priv)
+{
+    char fsname[FS_NAME_LEN];
+    uint64_t mb = 0;
+
+    if (sscanf(buf,"tmpfs detach %31s",fsname)==1) {
+	if (nk_fs_tmpfs_detach(fsname)) {
+	    nk_vc_printf("Failed to detach %s\n",fsname);
+	    return -1;
+	}
+	return 0;
+    }
+
+    if (sscanf(buf,"tmpfs %31s %lu",fsname,&mb)<1) {
+	nk_vc_printf("tmpfs fsname [limit_mb] | tmpfs detach fsname\n");
+	return -1;
+    }
+
+    if (nk_fs_tmpfs_attach(fsname, mb<<20)) {
+	nk_vc_printf("Failed to create tmpfs %s\n",fsname);
+	return -1;
+    }
+
+    nk_vc_printf("tmpfs %s created\n",fsname);
+
+    return 0;
+}
+
+static struct shell_cmd_impl tmpfs_impl = {
+    .cmd      = "tmpfs",
+    .help_str = "tmpfs fsname [limit_mb] | tmpfs detach fsname",
+    .handler  = handle_tmpfs,
+};
+nk_register_shell_cmd(tmpfs_impl);
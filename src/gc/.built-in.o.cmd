@@ -0,0 +1 @@
+cmd_src/gc/built-in.o :=  rm -f src/gc/built-in.o; ar rcs src/gc/built-in.o
@@ -0,0 +1 @@
+cmd_src/nautilus/built-in.o :=  ld -z max-page-size=0x1000 -melf_x86_64 -dp  -r -o src/nautilus/built-in.o src/nautilus/fmtout.o src/nautilus/printk.o src/nautilus/doprnt.o src/nautilus/vc.o src/nautilus/idt.o src/nautilus/queue.o src/nautilus/irq.o src/nautilus/mb_utils.o src/nautilus/paging.o src/nautilus/naut_string.o src/nautilus/msr.o src/nautilus/cpuid.o src/nautilus/mtrr.o src/nautilus/fpu.o src/nautilus/spinlock.o src/nautilus/ticketlock.o src/nautilus/rwlock.o src/nautilus/condvar.o src/nautilus/semaphore.o src/nautilus/msg_queue.o src/nautilus/hashtable.o src/nautilus/rbtree.o src/nautilus/random.o src/nautilus/smp.o src/nautilus/idle.o src/nautilus/thread.o src/nautilus/task.o src/nautilus/future.o src/nautilus/waitqueue.o src/nautilus/group.o src/nautilus/timer.o src/nautilus/scheduler.o src/nautilus/group_sched.o src/nautilus/barrier.o src/nautilus/backtrace.o src/nautilus/cpu.o src/nautilus/acpi.o src/nautilus/numa.o src/nautilus/libccompat.o src/nautilus/nemo.o src/nautilus/pmc.o src/nautilus/setjmp.o src/nautilus/mm/built-in.o src/nautilus/dev.o src/nautilus/chardev.o src/nautilus/blkdev.o src/nautilus/netdev.o src/nautilus/gpudev.o src/nautilus/fs.o src/nautilus/loader.o src/nautilus/shell.o src/nautilus/fprintk.o src/nautilus/dtoa.o src/nautilus/module.o src/nautilus/linker.o src/nautilus/prog.o src/nautilus/getopt.o src/nautilus/cmdline.o src/nautilus/aspace.o
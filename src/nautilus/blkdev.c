@@ -73,7 +73,7 @@ struct nk_block_dev * nk_block_dev_find(char *name)
 {
     DEBUG("find %s\n",name);
     struct nk_dev *d = nk_dev_find(name);
-    if (d->type!=NK_DEV_BLK) {
+    if (!d || d->type!=NK_DEV_BLK) {
 	DEBUG("%s not found\n",name);
 	return 0;
     } else {
@@ -82,6 +82,23 @@ struct nk_block_dev * nk_block_dev_find(char *name)
     }
 }
 
+void nk_block_dev_attach(struct nk_block_dev *dev)
+{
+    DEBUG("attach to %s\n",dev->dev.name);
+    __sync_fetch_and_add(&dev->dev.attached,1);
+}
+
+void nk_block_dev_detach(struct nk_block_dev *dev)
+{
+    DEBUG("detach from %s\n",dev->dev.name);
+    __sync_fetch_and_sub(&dev->dev.attached,1);
+}
+
+int nk_block_dev_attached(struct nk_block_dev *dev)
+{
+    return *(volatile int *)&dev->dev.attached;
+}
+
 int nk_block_dev_get_characteristics(struct nk_block_dev *dev, struct nk_block_dev_characteristics *c)
 {
     struct nk_dev *d = (struct nk_dev *)(&(dev->dev));
@@ -245,6 +262,77 @@ int nk_block_dev_write(struct nk_block_dev *dev,
 
 }
 
+int nk_block_dev_direct_access(struct nk_block_dev *dev, 
+			       uint64_t blocknum, 
+			       uint64_t count, 
+			       void **ptr)
+{
+    struct nk_dev *d = (struct nk_dev *)(&(dev->dev));
+    struct nk_block_dev_int *di = (struct nk_block_dev_int *)(d->interface);
+
+    DEBUG("direct access %s (start=%lu, count=%lu)\n", d->name,blocknum,count);
+
+    if (!di->direct_access) {
+	DEBUG("direct access not possible\n");
+	return -1;
+    }
+
+    return di->direct_access(d->state,blocknum,count,ptr);
+}
+
+int nk_block_dev_flush(struct nk_block_dev *dev,
+		       nk_dev_request_type_t type,
+		       void (*callback)(nk_block_dev_status_t status, void *state),
+		       void *state)
+{
+    struct nk_dev *d = (struct nk_dev *)(&(dev->dev));
+    struct nk_block_dev_int *di = (struct nk_block_dev_int *)(d->interface);
+
+    DEBUG("flush %s (type=%lx)\n", d->name, type);
+
+    if (!di->flush) {
+	// write-through device - nothing is held back
+	DEBUG("no write cache on %s\n", d->name);
+	if (type==NK_DEV_REQ_CALLBACK && callback) {
+	    callback(NK_BLOCK_DEV_STATUS_SUCCESS,state);
+	}
+	return 0;
+    }
+
+    switch (type) {
+    case NK_DEV_REQ_CALLBACK:
+	return di->flush(d->state,callback,state);
+	break;
+    case NK_DEV_REQ_NONBLOCKING:
+	if (di->flush(d->state,0,0)) {
+	    ERROR("failed to start up flush\n");
+	    return -1;
+	}
+	return 0;
+	break;
+    case NK_DEV_REQ_BLOCKING: {
+	volatile struct op o;
+
+	o.completed = 0;
+	o.status = 0;
+	o.dev = dev;
+
+	if (di->flush(d->state,generic_write_callback,(void*)&o)) {
+	    ERROR("failed to start up flush\n");
+	    return -1;
+	}
+	DEBUG("flush started, waiting for completion\n");
+	while (!o.completed) {
+	    nk_dev_wait((struct nk_dev *)d, generic_cond_check, (void*)&o);
+	}
+	return o.status==NK_BLOCK_DEV_STATUS_SUCCESS ? 0 : -1;
+    }
+	break;
+    default:
+	return -1;
+    }
+}
+
 static int 
 handle_blktest (char * buf, void * priv)
 {
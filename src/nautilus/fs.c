@@ -28,6 +28,16 @@
 #include <nautilus/testfs.h>
 #include <nautilus/shell.h>
 #include <nautilus/blkdev.h>
+#include <nautilus/netdev.h>
+#include <nautilus/thread.h>
+#include <nautilus/aspace.h>
+#ifdef NAUT_CONFIG_NET_ETHERNET
+#include <net/ethernet/ethernet_packet.h>
+#endif
+
+#ifdef NAUT_CONFIG_FATFS_FILESYSTEM_DRIVER
+#include <fs/fatfs/fatfs.h>
+#endif
 
 #define INFO(fmt, args...)  INFO_PRINT("fs: " fmt, ##args)
 #define DEBUG(fmt, args...) DEBUG_PRINT("fs: " fmt, ##args)
@@ -42,6 +52,8 @@
 #define STATE_LOCK() _state_lock_flags = spin_lock_irq_save(&state_lock)
 #define STATE_UNLOCK() spin_unlock_irq_restore(&state_lock, _state_lock_flags);
 
+#define MIN(x,y) ((x)<(y) ? (x) : (y))
+
 #define FILE_LOCK_CONF uint8_t _file_lock_flags
 #define FILE_LOCK(fd) _file_lock_flags = spin_lock_irq_save(&fd->lock)
 #define FILE_UNLOCK(fd) spin_unlock_irq_restore(&fd->lock, _file_lock_flags);
@@ -54,32 +66,232 @@
 struct nk_fs_open_file_state {
     spinlock_t lock;
 
-    struct list_head file_node;
-    
     struct nk_fs  *fs;
     void          *file;
     
     size_t   position;
     int      flags;
+
+    int      in_use;
+    struct nk_fs_open_file_state *next_free;
+};
+
+
+struct nk_fs_dir_state {
+    struct nk_fs  *fs;
+    void          *dir;
+};
+
+
+// The registry of filesystems is an open-addressed hash table keyed
+// by name.  Lookups are lock-free: they copy out what they need and
+// retry if a registration or unregistration happened concurrently, as
+// indicated by the sequence number.  Writers, which are rare, serialize
+// on state_lock, which also protects fs_list.  The table is not grown,
+// so at most FS_TABLE_SIZE filesystems can be registered at once.
+#define FS_TABLE_SIZE 64  // power of two
+
+// names and paths are hashed with FNV-1a
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME  0x100000001b3ULL
+
+struct fs_slot {
+    struct nk_fs *fs;                // 0 => no filesystem here
+    int           used;              // ever used, so probes continue past it
+    uint64_t      gen;               // the newest of same-named filesystems wins
+    char          name[FS_NAME_LEN];
 };
 
+// Mount points are in a similar table keyed by mount path (without its
+// trailing slash, so "/" is the empty string).  A path is resolved by
+// probing for each of its directory prefixes, longest first, so the
+// cost depends on the depth of the path, not on the number of mounts.
+// The sequence number covers both tables.
+#define MOUNT_TABLE_SIZE 64  // power of two
+#define MOUNT_MAX_DEPTH  64  // mount points deeper than this are not seen
+
+struct mount_slot {
+    struct nk_fs *fs;                // 0 => nothing mounted here
+    int           used;
+    uint64_t      hash;
+    uint64_t      len;               // of the key, a prefix of fs->mount_path
+};
 
 static spinlock_t state_lock;
 static struct list_head fs_list;
-static struct list_head open_files;
+static struct fs_slot fs_table[FS_TABLE_SIZE];
+static struct mount_slot mount_table[MOUNT_TABLE_SIZE];
+static uint64_t num_mounts;
+static volatile uint64_t fs_table_seq;  // odd => update in progress
+
+// Open file entries come from slabs that are never freed, so they can
+// always be enumerated.  Free entries are cached per cpu, and allocation
+// and release touch only the local cache with interrupts off.  Caches
+// that grow past FD_CACHE_MAX spill half their entries to a shared pool,
+// which is also where a cpu with an empty cache looks before making a
+// new slab.
+#define FD_SLAB_SIZE 64
+#define FD_CACHE_MAX 256
+
+struct fd_slab {
+    struct fd_slab *next;
+    struct nk_fs_open_file_state fds[FD_SLAB_SIZE];
+};
+
+struct fd_cache {
+    struct nk_fs_open_file_state *free;
+    uint64_t count;
+} __attribute__((aligned(64)));
+
+static struct fd_slab * volatile fd_slabs;
+static struct fd_cache fd_caches[NAUT_CONFIG_MAX_CPUS];
+static spinlock_t fd_pool_lock;
+
+// Memory mappings of files.  Each one is either the device's own copy
+// of the data (read-only maps of memory-backed devices) or pages filled
+// from the file when mapped and written back on msync/munmap
+struct fs_mapping {
+    struct list_head    node;
+    nk_fs_fd_t          fd;
+    void               *addr;
+    size_t              len;       // whole pages
+    off_t               offset;    // file offset of addr
+    size_t              file_len;  // bytes of the mapping inside the file
+    int                 prot;
+    int                 in_place;
+    nk_aspace_t        *aspace;    // region was added here, if nonzero
+    nk_aspace_region_t  region;
+};
+
+static spinlock_t mmap_lock;
+static struct list_head mmap_list;
+static struct nk_fs_open_file_state *fd_pool;
 
 static void map_over_open_files(void (*callback)(nk_fs_fd_t)) 
 {
-    struct list_head *cur;
-    struct list_head *temp;
-    nk_fs_fd_t fd;
+    struct fd_slab *slab;
+    int i;
+    
+    for (slab=fd_slabs; slab; slab=slab->next) {
+	for (i=0;i<FD_SLAB_SIZE;i++) {
+	    if (slab->fds[i].in_use) {
+		callback(&slab->fds[i]);
+	    }
+	}
+    }
+}
+
+static int any_open_files(void)
+{
+    struct fd_slab *slab;
+    int i;
     
-    list_for_each_safe(cur, temp, &open_files) {
-	fd = list_entry(cur,struct nk_fs_open_file_state, file_node);
-	callback(fd);
+    for (slab=fd_slabs; slab; slab=slab->next) {
+	for (i=0;i<FD_SLAB_SIZE;i++) {
+	    if (slab->fds[i].in_use) {
+		return 1;
+	    }
+	}
+    }
+    return 0;
+}
+
+// called with interrupts off
+static int fd_cache_refill(struct fd_cache *c)
+{
+    struct nk_fs_open_file_state *fd;
+    struct fd_slab *slab, *old;
+    int i;
+
+    spin_lock(&fd_pool_lock);
+    for (i=0;i<FD_SLAB_SIZE && fd_pool;i++) {
+	fd = fd_pool;
+	fd_pool = fd->next_free;
+	fd->next_free = c->free;
+	c->free = fd;
+	c->count++;
+    }
+    spin_unlock(&fd_pool_lock);
+
+    if (c->free) {
+	return 0;
+    }
+
+    slab = malloc(sizeof(*slab));
+
+    if (!slab) {
+	return -1;
+    }
+
+    memset(slab,0,sizeof(*slab));
+
+    for (i=0;i<FD_SLAB_SIZE;i++) {
+	slab->fds[i].next_free = c->free;
+	c->free = &slab->fds[i];
+    }
+    c->count += FD_SLAB_SIZE;
+
+    do {
+	old = fd_slabs;
+	slab->next = old;
+    } while (!__sync_bool_compare_and_swap(&fd_slabs,old,slab));
+
+    return 0;
+}
+
+static nk_fs_fd_t fd_alloc(void)
+{
+    uint8_t flags = irq_disable_save();
+    struct fd_cache *c = &fd_caches[my_cpu_id()];
+    nk_fs_fd_t fd = 0;
+
+    if (c->free || !fd_cache_refill(c)) {
+	fd = c->free;
+	c->free = fd->next_free;
+	c->count--;
+    }
+
+    irq_enable_restore(flags);
+
+    if (fd) {
+	memset(fd,0,sizeof(*fd));
+	spinlock_init(&fd->lock);
+	fd->in_use = 1;
     }
+
+    return fd;
 }
 
+static void fd_release(nk_fs_fd_t fd)
+{
+    uint8_t flags;
+    struct fd_cache *c;
+    struct nk_fs_open_file_state *cur;
+    uint64_t i;
+
+    fd->in_use = 0;
+
+    flags = irq_disable_save();
+    c = &fd_caches[my_cpu_id()];
+
+    fd->next_free = c->free;
+    c->free = fd;
+    c->count++;
+
+    if (c->count > FD_CACHE_MAX) {
+	spin_lock(&fd_pool_lock);
+	for (i=0;i<FD_CACHE_MAX/2;i++) {
+	    cur = c->free;
+	    c->free = cur->next_free;
+	    cur->next_free = fd_pool;
+	    fd_pool = cur;
+	}
+	c->count -= FD_CACHE_MAX/2;
+	spin_unlock(&fd_pool_lock);
+    }
+
+    irq_enable_restore(flags);
+}
 
 //TODO: deal with hard links
 
@@ -126,43 +338,100 @@ static void *file_create(struct nk_fs *fs, char* path)
     }
 }
 
+static int mapped_in_place(nk_fs_fd_t fd, off_t len);
+
 static int file_trunc(nk_fs_fd_t fd, off_t len)
 {
     if (fd && fd->fs && fd->fs->interface && fd->fs->interface->trunc_file) {
+	if (mapped_in_place(fd,len)) {
+	    ERROR("Cannot truncate file below a mapping of its device memory\n");
+	    return -1;
+	}
 	return fd->fs->interface->trunc_file(fd->fs->state,fd->file,len);
     } else {
 	return -1;
     }
 }
 
-static inline ssize_t file_read(nk_fs_fd_t fd, char *buf, size_t num_bytes) 
+static inline ssize_t file_read(nk_fs_fd_t fd, char *buf, off_t offset, size_t num_bytes) 
 {
+    if (!FS_FD_ERR(fd) && (fd->flags & O_DIRECT)) {
+	// checked at open
+	return fd->fs->interface->read_uncached(fd->fs->state, fd->file, buf, offset, num_bytes);
+    }
     if (!FS_FD_ERR(fd) && fd->fs && fd->fs->interface 
 	&& fd->fs->interface->read_file) {
 	return fd->fs->interface->read_file(fd->fs->state, 
 					    fd->file, 
 					    buf, 
-					    fd->position,
+					    offset,
 					    num_bytes);
     } else {
 	return -1;
     }
 }
 
-static inline ssize_t file_write(nk_fs_fd_t fd, char *buf, size_t num_bytes) 
+static inline ssize_t file_write(nk_fs_fd_t fd, char *buf, off_t offset, size_t num_bytes) 
 {
+    if (!FS_FD_ERR(fd) && (fd->flags & O_DIRECT)) {
+	return fd->fs->interface->write_uncached(fd->fs->state, fd->file, buf, offset, num_bytes);
+    }
     if (!FS_FD_ERR(fd) && fd->fs && fd->fs->interface 
 	&& fd->fs->interface->write_file) {
 	return fd->fs->interface->write_file(fd->fs->state, 
 					     fd->file, 
 					     buf, 
-					     fd->position,
+					     offset,
 					     num_bytes);
     } else {
 	return -1;
     }
 }
 
+// segment by segment, stopping at the first short transfer
+static ssize_t file_rw_iov(nk_fs_fd_t fd, const struct nk_fs_iovec *iov, int iovcnt, off_t offset, int write)
+{
+    ssize_t total = 0, n;
+    int i;
+
+    for (i=0;i<iovcnt;i++) {
+	if (write) {
+	    n = file_write(fd, iov[i].base, offset+total, iov[i].len);
+	} else {
+	    n = file_read(fd, iov[i].base, offset+total, iov[i].len);
+	}
+	if (n<0) {
+	    return total ? total : -1;
+	}
+	total += n;
+	if (n<iov[i].len) {
+	    break;
+	}
+    }
+
+    return total;
+}
+
+static inline ssize_t file_readv(nk_fs_fd_t fd, const struct nk_fs_iovec *iov, int iovcnt, off_t offset) 
+{
+    if (!FS_FD_ERR(fd) && !(fd->flags & O_DIRECT) && fd->fs && fd->fs->interface 
+	&& fd->fs->interface->readv_file) {
+	return fd->fs->interface->readv_file(fd->fs->state, fd->file, iov, iovcnt, offset);
+    } else {
+	return file_rw_iov(fd, iov, iovcnt, offset, 0);
+    }
+}
+
+static inline ssize_t file_writev(nk_fs_fd_t fd, const struct nk_fs_iovec *iov, int iovcnt, off_t offset) 
+{
+    if (!FS_FD_ERR(fd) && !(fd->flags & O_DIRECT) && fd->fs && fd->fs->interface 
+	&& fd->fs->interface->writev_file) {
+	return fd->fs->interface->writev_file(fd->fs->state, fd->file, iov, iovcnt, offset);
+    } else {
+	return file_rw_iov(fd, iov, iovcnt, offset, 1);
+    }
+}
+
 
 static int exists(struct nk_fs *fs, char *path) 
 {
@@ -174,7 +443,7 @@ static int exists(struct nk_fs *fs, char *path)
     }
 }
 
-static int remove(struct nk_fs *fs, char* path) 
+static int fs_remove(struct nk_fs *fs, char* path) 
 {
     if (fs && fs->interface && fs->interface->remove) { 
 	return fs->interface->remove(fs->state, path);
@@ -186,15 +455,17 @@ static int remove(struct nk_fs *fs, char* path)
 int nk_fs_init(void) 
 {
     INIT_LIST_HEAD(&fs_list);
-    INIT_LIST_HEAD(&open_files);
     spinlock_init(&state_lock);
+    spinlock_init(&fd_pool_lock);
+    INIT_LIST_HEAD(&mmap_list);
+    spinlock_init(&mmap_lock);
     INFO("inited\n");
     return 0;
 }
 
 int nk_deinit_fs(void) 
 {
-    if (!list_empty(&open_files)) {
+    if (any_open_files()) {
 	ERROR("Open files remain.. closing them\n");
 	map_over_open_files((void (*)(nk_fs_fd_t))nk_fs_close);
     }
@@ -206,10 +477,64 @@ int nk_deinit_fs(void)
     return 0;
 }
 
+static uint64_t fs_name_hash(char *name)
+{
+    uint64_t h = FNV_OFFSET;
+    int i;
+
+    // names match case-insensitively, so they hash that way too
+    for (i=0;i<FS_NAME_LEN && name[i];i++) {
+	h ^= (uint8_t)((name[i]>='A' && name[i]<='Z') ? name[i]-'A'+'a' : name[i]);
+	h *= FNV_PRIME;
+    }
+
+    return h;
+}
+
+// called with state_lock held
+static void fs_table_update_begin(void)
+{
+    fs_table_seq++;
+    __sync_synchronize();
+}
+
+static void fs_table_update_end(void)
+{
+    __sync_synchronize();
+    fs_table_seq++;
+}
+
+static struct fs_slot *fs_table_probe(char *name, int for_insert)
+{
+    uint64_t h = fs_name_hash(name);
+    struct fs_slot *slot, *best = 0;
+    uint64_t i;
+
+    for (i=0;i<FS_TABLE_SIZE;i++) {
+	slot = &fs_table[(h+i) & (FS_TABLE_SIZE-1)];
+	if (for_insert) {
+	    if (!slot->fs) {
+		return slot;
+	    }
+	} else {
+	    if (!slot->used) {
+		break;
+	    }
+	    if (slot->fs && !strncasecmp(slot->name,name,FS_NAME_LEN)
+		&& (!best || slot->gen > best->gen)) {
+		best = slot;
+	    }
+	}
+    }
+
+    return best;
+}
+
 struct nk_fs *nk_fs_register(char *name, uint64_t flags, struct nk_fs_int *inter, void *state)
 {
     STATE_LOCK_CONF;
     struct nk_fs *f = malloc(sizeof(*f));
+    struct fs_slot *slot;
 
     DEBUG("register fs with name %s, flags 0x%lx, interface %p, and state %p\n", name, flags, inter, state);
 
@@ -227,6 +552,19 @@ struct nk_fs *nk_fs_register(char *name, uint64_t flags, struct nk_fs_int *inter
     f->state = state;
 
     STATE_LOCK();
+    slot = fs_table_probe(f->name,1);
+    if (!slot) {
+	STATE_UNLOCK();
+	ERROR("Cannot register %s: all %d filesystem slots are in use (FS_TABLE_SIZE)\n",f->name,FS_TABLE_SIZE);
+	free(f);
+	return 0;
+    }
+    fs_table_update_begin();
+    strcpy(slot->name,f->name);
+    slot->fs = f;
+    slot->used = 1;
+    slot->gen = fs_table_seq;
+    fs_table_update_end();
     list_add(&f->fs_list_node,&fs_list);
     STATE_UNLOCK();
     
@@ -238,7 +576,26 @@ struct nk_fs *nk_fs_register(char *name, uint64_t flags, struct nk_fs_int *inter
 int            nk_fs_unregister(struct nk_fs *f)
 {
     STATE_LOCK_CONF;
+    struct fs_slot *slot;
+    int i;
+
     STATE_LOCK();
+    fs_table_update_begin();
+    for (i=0;i<FS_TABLE_SIZE;i++) {
+	slot = &fs_table[i];
+	if (slot->fs==f) {
+	    slot->fs = 0;   // stays used, since later entries may have probed past it
+	    break;
+	}
+    }
+    for (i=0;i<MOUNT_TABLE_SIZE;i++) {
+	if (mount_table[i].fs==f) {
+	    mount_table[i].fs = 0;
+	    num_mounts--;
+	    break;
+	}
+    }
+    fs_table_update_end();
     list_del(&f->fs_list_node);
     STATE_UNLOCK();
     INFO("Unregistered filesystem %s\n",f->name);
@@ -246,221 +603,1119 @@ int            nk_fs_unregister(struct nk_fs *f)
     return 0;
 }
 
+// lock-free; see the comment at fs_table
 static struct nk_fs *__fs_find(char *name)
 {
-    struct list_head *cur;
-    struct nk_fs *target=0;
-    list_for_each(cur,&fs_list) {
-	if (!strncasecmp(list_entry(cur,struct nk_fs,fs_list_node)->name,name,FS_NAME_LEN)) { 
-	    target = list_entry(cur,struct nk_fs, fs_list_node);
+    struct fs_slot *slot;
+    struct nk_fs *target;
+    uint64_t seq;
+
+    do {
+	while ((seq = fs_table_seq) & 1) {
+	    // update in progress
+	}
+	__sync_synchronize();
+	slot = fs_table_probe(name,0);
+	target = slot ? slot->fs : 0;
+	__sync_synchronize();
+    } while (seq != fs_table_seq);
+
+    return target;
+}
+
+struct nk_fs *nk_fs_find(char *name)
+{
+    return __fs_find(name);
+}
+
+static inline uint64_t mount_hash_step(uint64_t h, char c)
+{
+    return (h ^ (uint8_t)c) * FNV_PRIME;
+}
+
+// called with state_lock held, or from mount_lookup; a slot's fs can be
+// cleared under the latter, so it is read only once
+static struct mount_slot *mount_table_find(char *path, uint64_t len, uint64_t hash)
+{
+    struct mount_slot *slot;
+    struct nk_fs *fs;
+    uint64_t i;
+
+    for (i=0;i<MOUNT_TABLE_SIZE;i++) {
+	slot = &mount_table[(hash+i) & (MOUNT_TABLE_SIZE-1)];
+	if (!slot->used) {
+	    return 0;
+	}
+	fs = *(struct nk_fs * volatile *)&slot->fs;
+	if (fs && slot->hash==hash && slot->len==len 
+	    && !strncmp(fs->mount_path,path,len)) {
+	    return slot;
+	}
+    }
+    return 0;
+}
+
+// lock-free, like __fs_find
+static struct nk_fs *mount_lookup(char *path, uint64_t len, uint64_t hash)
+{
+    struct mount_slot *slot;
+    struct nk_fs *target;
+    uint64_t seq;
+
+    do {
+	while ((seq = fs_table_seq) & 1) {
+	    // update in progress
+	}
+	__sync_synchronize();
+	slot = mount_table_find(path,len,hash);
+	target = slot ? slot->fs : 0;
+	__sync_synchronize();
+    } while (seq != fs_table_seq);
+
+    return target;
+}
+
+// strip trailing slashes to get the key for a mount path
+static uint64_t mount_key(char *path, uint64_t *hash)
+{
+    uint64_t len = strlen(path), i;
+
+    while (len && path[len-1]=='/') {
+	len--;
+    }
+
+    *hash = FNV_OFFSET;
+    for (i=0;i<len;i++) {
+	*hash = mount_hash_step(*hash,path[i]);
+    }
+
+    return len;
+}
+
+int nk_fs_mount(char *fs_name, char *path)
+{
+    STATE_LOCK_CONF;
+    struct nk_fs *fs = __fs_find(fs_name);
+    struct mount_slot *slot;
+    uint64_t len, hash, i;
+
+    if (!fs) {
+	ERROR("Cannot find filesystem named %s\n",fs_name);
+	return -1;
+    }
+
+    if (path[0]!='/' || strlen(path)>=MOUNT_PATH_LEN) {
+	ERROR("Mount point %s must be an absolute path shorter than %d\n",path,MOUNT_PATH_LEN);
+	return -1;
+    }
+
+    len = mount_key(path,&hash);
+
+    STATE_LOCK();
+
+    if (fs->mount_path[0]) {
+	STATE_UNLOCK();
+	ERROR("Filesystem %s is already mounted at %s\n",fs->name,fs->mount_path);
+	return -1;
+    }
+
+    if (mount_table_find(path,len,hash)) {
+	STATE_UNLOCK();
+	ERROR("Something is already mounted at %s\n",path);
+	return -1;
+    }
+
+    for (i=0;i<MOUNT_TABLE_SIZE;i++) {
+	slot = &mount_table[(hash+i) & (MOUNT_TABLE_SIZE-1)];
+	if (!slot->fs) {
+	    break;
+	}
+    }
+
+    if (i==MOUNT_TABLE_SIZE) {
+	STATE_UNLOCK();
+	ERROR("Too many mount points to mount %s\n",fs->name);
+	return -1;
+    }
+
+    fs_table_update_begin();
+    strcpy(fs->mount_path,path);
+    slot->fs = fs;
+    slot->used = 1;
+    slot->hash = hash;
+    slot->len = len;
+    num_mounts++;
+    fs_table_update_end();
+
+    STATE_UNLOCK();
+
+    INFO("Mounted %s at %s\n",fs->name,path);
+
+    return 0;
+}
+
+int nk_fs_umount(char *path)
+{
+    STATE_LOCK_CONF;
+    struct mount_slot *slot;
+    struct nk_fs *fs;
+    uint64_t len, hash;
+
+    len = mount_key(path,&hash);
+
+    STATE_LOCK();
+
+    slot = mount_table_find(path,len,hash);
+
+    if (!slot) {
+	STATE_UNLOCK();
+	ERROR("Nothing is mounted at %s\n",path);
+	return -1;
+    }
+
+    fs = slot->fs;
+
+    fs_table_update_begin();
+    slot->fs = 0;
+    num_mounts--;
+    fs->mount_path[0] = 0;
+    fs_table_update_end();
+
+    STATE_UNLOCK();
+
+    INFO("Unmounted %s from %s\n",fs->name,path);
+
+    return 0;
+}
+
+// Find the filesystem for a path and return the path within it.
+// "fsname:/path" names the filesystem directly.  Otherwise the
+// deepest mount point containing the path is used, falling back
+// to the filesystem named rootfs.  scratch must be at least as long
+// as the path.
+static char *resolve_path(char *path, struct nk_fs **fs, char *scratch)
+{
+    uint64_t n = strlen(path);
+    uint64_t bounds[MOUNT_MAX_DEPTH+1], hashes[MOUNT_MAX_DEPTH+1];
+    uint64_t i, count = 0, h;
+
+    DEBUG("resolve path %s\n",path);
+
+    for (i=0;(i<n) && (path[i]!=':') && (path[i]!='/');i++) {}
+
+    if (i<n && path[i]==':') {
+	// i=index of first ":", split name
+	strncpy(scratch,path,i);
+	scratch[i]=0;
+	path=path+i+1;
+	*fs = __fs_find(scratch);
+	DEBUG("resolved as fs %s and path %s\n",scratch, path);
+	return path;
+    }
+
+    *fs = 0;
+
+    if (num_mounts) {
+	// hash of each prefix that ends at a directory boundary
+	h = FNV_OFFSET;
+	for (i=0;i<=n && count<=MOUNT_MAX_DEPTH;i++) {
+	    if (i==n || path[i]=='/') {
+		bounds[count] = i;
+		hashes[count] = h;
+		count++;
+	    }
+	    if (i<n) {
+		h = mount_hash_step(h,path[i]);
+	    }
+	}
+	while (count-- > 0) {
+	    *fs = mount_lookup(path,bounds[count],hashes[count]);
+	    if (*fs) {
+		path += bounds[count];
+		if (!*path) {
+		    strcpy(scratch,"/");
+		    path = scratch;
+		}
+		break;
+	    }
+	}
+    }
+
+    if (!*fs) {
+	// nothing mounted above it, assume rootfs is meant
+	*fs = __fs_find("rootfs");
+    }
+
+    DEBUG("resolved as fs %s and path %s\n",*fs ? (*fs)->name : "(none)", path);
+    return path;
+}
+
+int nk_fs_stat(char *path, struct nk_fs_stat *st)
+{
+    struct nk_fs *fs;
+    char scratch[strlen(path)+2];
+
+    path = resolve_path(path,&fs,scratch);
+
+    if (!fs) { 
+	ERROR("Cannot find filesystem for %s\n",path);
+	return -1;
+    }
+
+    return path_stat(fs, path, st);
+}
+
+int nk_fs_stat_many(char **paths, int n, struct nk_fs_stat *st, int *rc)
+{
+    struct nk_fs *fs, *next_fs;
+    char *path, *next, *slash, *next_slash;
+    char **names;
+    uint64_t dir_len;
+    int i, j, found = 0;
+
+    names = malloc(sizeof(char*)*(n ? n : 1));
+
+    if (!names) {
+	ERROR("Cannot allocate name list\n");
+	return -1;
+    }
+
+    for (i=0;i<n;i=j) {
+	char scratch[strlen(paths[i])+2];
+
+	path = resolve_path(paths[i],&fs,scratch);
+	slash = strrchr(path,'/');
+	j = i+1;
+	rc[i] = -1;
+
+	if (!fs) {
+	    ERROR("Cannot find filesystem for %s\n",path);
+	    continue;
+	}
+
+	if (!fs->interface->stat_many || !slash || !slash[1]) {
+	    rc[i] = path_stat(fs,path,&st[i]);
+	    found += !rc[i];
+	    continue;
+	}
+
+	// gather the following paths in the same directory
+	dir_len = slash-path;
+	names[0] = slash+1;
+	for (;j<n;j++) {
+	    char next_scratch[strlen(paths[j])+2];
+	    next = resolve_path(paths[j],&next_fs,next_scratch);
+	    next_slash = strrchr(next,'/');
+	    if (next_fs!=fs || !next_slash || !next_slash[1] || next_slash-next!=dir_len 
+		|| strncmp(next,path,dir_len)) {
+		break;
+	    }
+	    names[j-i] = next_slash+1;
+	}
+
+	char dir[dir_len+2];
+	if (dir_len) {
+	    strncpy(dir,path,dir_len);
+	    dir[dir_len] = 0;
+	} else {
+	    strcpy(dir,"/");
+	}
+
+	if (fs->interface->stat_many(fs->state,dir,names,j-i,&st[i],&rc[i])<0) {
+	    ERROR("Failed to stat entries of %s\n",dir);
+	} else {
+	    int k;
+	    for (k=i;k<j;k++) {
+		found += !rc[k];
+	    }
+	}
+    }
+
+    free(names);
+
+    return found;
+}
+
+int nk_fs_truncate(char *path, off_t len)
+{
+    nk_fs_fd_t fd = nk_fs_open(path,O_RDWR,0);
+    
+    if (FS_FD_ERR(fd)) { 
+	return -1;
+    } else{
+	if (nk_fs_ftruncate(fd,len)) { 
+	    return -1;
+	} else {
+	    return nk_fs_close(fd);
+	}
+    }
+}	
+
+int nk_fs_unlink(char *path)
+{
+    struct nk_fs *fs;
+    char scratch[strlen(path)+2];
+
+    path = resolve_path(path,&fs,scratch);
+
+    if (!fs) { 
+	ERROR("Cannot find filesystem for %s\n",path);
+	return -1;
+    }
+
+    if (fs->flags & NK_FS_READONLY) {
+	ERROR("Filesystem %s is not writeable so cannot remove %s\n",fs->name,path);
+	return -1;
+    }
+
+    return fs_remove(fs,path);
+}
+
+int nk_fs_rename(char *old_path, char *new_path)
+{
+    struct nk_fs *fs, *new_fs;
+    char old_scratch[strlen(old_path)+2];
+    char new_scratch[strlen(new_path)+2];
+
+    old_path = resolve_path(old_path,&fs,old_scratch);
+    new_path = resolve_path(new_path,&new_fs,new_scratch);
+
+    if (!fs || fs!=new_fs) { 
+	ERROR("Cannot rename %s to %s, which is not on the same filesystem\n",old_path,new_path);
+	return -1;
+    }
+
+    if (fs->flags & NK_FS_READONLY) {
+	ERROR("Filesystem %s is not writeable so cannot rename %s\n",fs->name,old_path);
+	return -1;
+    }
+
+    if (!fs->interface->rename) {
+	ERROR("Filesystem %s does not support rename\n",fs->name);
+	return -1;
+    }
+
+    return fs->interface->rename(fs->state,old_path,new_path,0);
+}
+
+nk_fs_fd_t nk_fs_creat(char *path, int mode) 
+{
+    return nk_fs_open(path,O_WRONLY|O_TRUNC|O_CREAT,0);
+}
+
+nk_fs_fd_t nk_fs_open(char *path, int flags, int mode) 
+{
+    struct nk_fs *fs;
+    char scratch[strlen(path)+2];
+
+    DEBUG("open path %s, flags=%d, mode=%d\n",path,flags,mode);
+
+    path=resolve_path(path,&fs,scratch);
+
+    if (!fs) { 
+	ERROR("Cannot find filesystem for %s\n",path);
+	return FS_BAD_FD;
+    }
+
+    if ((flags & O_DIRECT) && 
+	(!fs->interface->read_uncached || !fs->interface->write_uncached)) {
+	ERROR("Filesystem %s does not support O_DIRECT\n", fs->name);
+	return FS_BAD_FD;
+    }
+
+    nk_fs_fd_t fd = fd_alloc();
+    if (!fd) { 
+	ERROR("Can't allocate new open file entry\n");
+	return FS_BAD_FD;
+    }
+
+    fd->fs = fs;
+    fd->flags = flags;
+
+    if (exists(fs,path)) {
+	DEBUG("path %s exists\n", path);
+	fd->file = file_open(fs, path, flags);
+    } else if (flags & O_CREAT) {
+	DEBUG("path %s does not exist, but creating file\n",path);
+	if ((fs->flags & NK_FS_READONLY)) { 
+	    ERROR("Filesystem is not writeable so cannot create file\n");
+	    fd_release(fd);
+	    return FS_BAD_FD;
+	}
+	fd->file = file_create(fs, path);
+	if (!fd->file) {
+	    ERROR("Cannot create file %s\n", path);
+	    fd_release(fd);
+	    return FS_BAD_FD;
+	} else {
+	    DEBUG("Created file %s on fs %s file=%p ", path, fs->name, fd);
+	} 
+    } else {
+	DEBUG("path %s does not exist, and no creation requested\n",path);
+	fd_release(fd);
+	return FS_BAD_FD;
+    }
+
+    if (flags & O_TRUNC) { 
+	file_trunc(fd,0);
+    }
+
+    if (flags & O_APPEND) {
+	__seek(fd, 0, 2);
+    }
+
+    DEBUG("Opened file %s on fs %s file=%p ", path, fs->name, fd);
+
+    return fd;
+}
+
+int nk_fs_close(nk_fs_fd_t fd) 
+{
+    if (FS_FD_ERR(fd)) {
+	return -1;
+    }
+
+    if (fd->fs->interface->close_file) {
+	fd->fs->interface->close_file(fd->fs->state, fd->file);
+    }
+
+    fd_release(fd);
+    
+    return 0;
+}
+
+static int fs_sync(struct nk_fs *fs)
+{
+    if (fs->flags & NK_FS_READONLY) {
+	return 0;
+    }
+
+    if (!fs->interface->sync_fs) {
+	DEBUG("filesystem %s writes through, nothing to sync\n", fs->name);
+	return 0;
+    }
+
+    return fs->interface->sync_fs(fs->state);
+}
+
+static int file_sync(nk_fs_fd_t fd, int data_only)
+{
+    if (FS_FD_ERR(fd)) {
+	ERROR("Cannot sync a bad file descriptor\n");
+	return -1;
+    }
+
+    if (fd->fs->interface->sync_file) {
+	return fd->fs->interface->sync_file(fd->fs->state, fd->file, data_only);
+    }
+
+    // no finer grain available, so sync everything
+    return fs_sync(fd->fs);
+}
+
+int nk_fs_fsync(nk_fs_fd_t fd)
+{
+    return file_sync(fd,0);
+}
+
+int nk_fs_fdatasync(nk_fs_fd_t fd)
+{
+    return file_sync(fd,1);
+}
+
+int nk_fs_syncfs(nk_fs_fd_t fd)
+{
+    if (FS_FD_ERR(fd)) {
+	ERROR("Cannot sync a bad file descriptor\n");
+	return -1;
+    }
+
+    return fs_sync(fd->fs);
+}
+
+static int check_readable(nk_fs_fd_t fd)
+{
+    if (FS_FD_ERR(fd) || !(fd->flags & O_RDONLY)) { // includes RDWR
+	ERROR("Cannot read file not opened for reading\n");
+	return -1;
+    }
+    return 0;
+}
+
+static int check_writeable(nk_fs_fd_t fd)
+{
+    if (FS_FD_ERR(fd) || !(fd->flags & O_WRONLY)) { // includes RDWR
+	ERROR("Cannot write file not opened for writing\n");
+	return -1;
+    }
+
+    if (fd->fs->flags & NK_FS_READONLY) { 
+	ERROR("Not a writeable filesystem\n");
+	return -1;
+    }
+    return 0;
+}
+
+ssize_t nk_fs_read(nk_fs_fd_t fd, void *buf, size_t num_bytes) 
+{
+    FILE_LOCK_CONF;
+
+    if (check_readable(fd)) {
+	return -1;
+    }
+
+    DEBUG("attempt read of %ld bytes starting at position %lu\n", num_bytes, fd->position);
+
+    FILE_LOCK(fd);
+    ssize_t n = file_read(fd, buf, fd->position, num_bytes);
+    if (n>=0) {fd->position += n; }
+    FILE_UNLOCK(fd);
+
+    DEBUG("read %ld bytes ending at position %lu\n", n, fd->position);
+
+    return n;
+}
+
+ssize_t nk_fs_write(nk_fs_fd_t fd, void *buf, size_t num_bytes) 
+{
+    FILE_LOCK_CONF;
+
+    if (check_writeable(fd)) {
+	return -1;
+    }
+
+    DEBUG("attempt write of %ld bytes starting at position %lu\n", num_bytes, fd->position);
+
+    FILE_LOCK(fd);
+    ssize_t n = file_write(fd, buf, fd->position, num_bytes);
+    if (n>=0) {fd->position += n; }
+    FILE_UNLOCK(fd);
+
+    DEBUG("wrote %ld bytes ending at position %lu\n", n, fd->position);
+
+    return n;
+}
+
+// the positional calls go straight to the filesystem - no file lock
+ssize_t nk_fs_pread(nk_fs_fd_t fd, void *buf, size_t num_bytes, off_t offset)
+{
+    DEBUG("attempt pread of %ld bytes at offset %lu\n", num_bytes, offset);
+
+    if (check_readable(fd)) {
+	return -1;
+    }
+
+    return file_read(fd, buf, offset, num_bytes);
+}
+
+ssize_t nk_fs_pwrite(nk_fs_fd_t fd, void *buf, size_t num_bytes, off_t offset)
+{
+    DEBUG("attempt pwrite of %ld bytes at offset %lu\n", num_bytes, offset);
+
+    if (check_writeable(fd)) {
+	return -1;
+    }
+
+    return file_write(fd, buf, offset, num_bytes);
+}
+
+ssize_t nk_fs_preadv(nk_fs_fd_t fd, const struct nk_fs_iovec *iov, int iovcnt, off_t offset)
+{
+    DEBUG("attempt preadv of %d segments at offset %lu\n", iovcnt, offset);
+
+    if (check_readable(fd)) {
+	return -1;
+    }
+
+    return file_readv(fd, iov, iovcnt, offset);
+}
+
+ssize_t nk_fs_pwritev(nk_fs_fd_t fd, const struct nk_fs_iovec *iov, int iovcnt, off_t offset)
+{
+    DEBUG("attempt pwritev of %d segments at offset %lu\n", iovcnt, offset);
+
+    if (check_writeable(fd)) {
+	return -1;
+    }
+
+    return file_writev(fd, iov, iovcnt, offset);
+}
+
+ssize_t nk_fs_readv(nk_fs_fd_t fd, const struct nk_fs_iovec *iov, int iovcnt)
+{
+    FILE_LOCK_CONF;
+
+    if (check_readable(fd)) {
+	return -1;
+    }
+
+    FILE_LOCK(fd);
+    ssize_t n = file_readv(fd, iov, iovcnt, fd->position);
+    if (n>=0) {fd->position += n; }
+    FILE_UNLOCK(fd);
+
+    return n;
+}
+
+ssize_t nk_fs_writev(nk_fs_fd_t fd, const struct nk_fs_iovec *iov, int iovcnt)
+{
+    FILE_LOCK_CONF;
+
+    if (check_writeable(fd)) {
+	return -1;
+    }
+
+    FILE_LOCK(fd);
+    ssize_t n = file_writev(fd, iov, iovcnt, fd->position);
+    if (n>=0) {fd->position += n; }
+    FILE_UNLOCK(fd);
+
+    return n;
+}
+
+ssize_t nk_fs_read_direct(nk_fs_fd_t fd, off_t offset, size_t num_bytes, const void **buf)
+{
+    DEBUG("attempt direct read of %ld bytes at offset %lu\n", num_bytes, offset);
+
+    if (FS_FD_ERR(fd) || !(fd->flags & O_RDONLY)) { // includes RDWR
+	ERROR("Cannot read file not opened for reading\n");
+	return -1;
+    }
+
+    if (!fd->fs) {
+	ERROR("File is not on a filesystem\n");
+	return -1;
+    }
+
+    if (!fd->fs->interface || !fd->fs->interface->read_direct) {
+	DEBUG("filesystem %s does not support direct reads\n", fd->fs->name);
+	return -1;
+    }
+
+    // no position update, so there is no need for the file lock
+    return fd->fs->interface->read_direct(fd->fs->state, fd->file, offset, num_bytes, (void **)buf);
+}
+
+nk_fs_dir_t nk_fs_opendir(char *path)
+{
+    struct nk_fs *fs;
+    char scratch[strlen(path)+2];
+    nk_fs_dir_t d;
+
+    path = resolve_path(path,&fs,scratch);
+
+    if (!fs) {
+	ERROR("Cannot find filesystem for %s\n",path);
+	return 0;
+    }
+
+    if (!fs->interface->opendir) {
+	ERROR("Filesystem %s does not support directory listing\n",fs->name);
+	return 0;
+    }
+
+    d = malloc(sizeof(*d));
+
+    if (!d) {
+	ERROR("Cannot allocate directory state\n");
+	return 0;
+    }
+
+    d->fs = fs;
+    d->dir = fs->interface->opendir(fs->state,path);
+
+    if (!d->dir) {
+	DEBUG("Cannot open directory %s on %s\n",path,fs->name);
+	free(d);
+	return 0;
+    }
+
+    return d;
+}
+
+ssize_t nk_fs_readdir_batch(nk_fs_dir_t d, struct nk_fs_dirent *ents, size_t n)
+{
+    if (!d) {
+	ERROR("Cannot read a directory that failed to open\n");
+	return -1;
+    }
+
+    return d->fs->interface->readdir_batch(d->fs->state,d->dir,ents,n);
+}
+
+int nk_fs_closedir(nk_fs_dir_t d)
+{
+    if (!d) {
+	return 0;
+    }
+
+    if (d->fs->interface->closedir) {
+	d->fs->interface->closedir(d->fs->state,d->dir);
+    }
+    free(d);
+    return 0;
+}
+
+// largest piece moved through a bounce buffer at once
+#define FS_COPY_CHUNK (64*1024)
+
+// move up to len bytes through memory, straight out of the device's
+// copy of the source if possible, otherwise via buf
+static ssize_t copy_through_memory(nk_fs_fd_t fd_in, off_t off_in, nk_fs_fd_t fd_out, off_t off_out, size_t len, char **buf)
+{
+    void *src;
+    ssize_t n;
+
+    if (fd_in->fs->interface->read_direct &&
+	(n = fd_in->fs->interface->read_direct(fd_in->fs->state, fd_in->file, off_in, len, &src)) >= 0) {
+	return n ? file_write(fd_out, src, off_out, n) : 0;
+    }
+
+    if (!*buf && !(*buf = malloc(FS_COPY_CHUNK))) {
+	ERROR("Cannot allocate copy buffer\n");
+	return -1;
+    }
+
+    n = file_read(fd_in, *buf, off_in, MIN(len,FS_COPY_CHUNK));
+
+    return n>0 ? file_write(fd_out, *buf, off_out, n) : n;
+}
+
+ssize_t nk_fs_copy_range(nk_fs_fd_t fd_in, off_t off_in, nk_fs_fd_t fd_out, off_t off_out, size_t len)
+{
+    struct nk_fs *fs;
+    char *buf = 0;
+    size_t done = 0;
+    ssize_t n = 0;
+
+    DEBUG("copy %lu bytes from offset %lu to offset %lu\n", len, off_in, off_out);
+
+    if (check_readable(fd_in) || check_writeable(fd_out)) {
+	return -1;
+    }
+
+    fs = fd_in->fs;
+
+    while (done < len) {
+	n = -1;
+	if (fs==fd_out->fs && fs->interface->copy_range) {
+	    n = fs->interface->copy_range(fs->state, fd_in->file, off_in+done, fd_out->file, off_out+done, len-done);
+	}
+	if (n<0) {
+	    n = copy_through_memory(fd_in, off_in+done, fd_out, off_out+done, len-done, &buf);
+	}
+	if (n<=0) {
 	    break;
 	}
+	done += n;
     }
-    return target;
-}
 
-struct nk_fs *nk_fs_find(char *name)
-{
-    STATE_LOCK_CONF;
-    struct nk_fs *fs=0;
-    STATE_LOCK();
-    fs = __fs_find(name);
-    STATE_UNLOCK();
-    return fs;
+    if (buf) {
+	free(buf);
+    }
+
+    return (n<0 && !done) ? -1 : done;
 }
 
-static char *decode_path(char *path, char *fs_name)
+ssize_t nk_fs_sendfile(nk_fs_fd_t fd, off_t offset, size_t len, struct nk_net_dev *dev, uint8_t *dest_mac, uint16_t ethertype)
 {
-    uint64_t n = strlen(path);
-    uint64_t i;
+#ifdef NAUT_CONFIG_NET_ETHERNET
+    struct nk_net_dev_characteristics c;
+    nk_ethernet_packet_t *p;
+    uint64_t payload;
+    size_t done = 0;
+    ssize_t n = 0;
+    void *src;
 
-    DEBUG("decode path %s\n",path);
+    DEBUG("send %lu bytes at offset %lu to %s\n", len, offset, dev->dev.name);
 
-    for (i=0;(i<n) && (path[i]!=':');i++) {}
+    if (check_readable(fd)) {
+	return -1;
+    }
 
-    if (i>=n) {
-	// no devicename found, assume rootfs is meant
-	strcpy(fs_name,"rootfs");
-    } else {
-	// i=index of first ":", split name
-	strncpy(fs_name,path,i);
-	fs_name[i]=0;
-	path=path+i+1;
+    if (nk_net_dev_get_characteristics(dev,&c)) {
+	ERROR("Cannot get characteristics of %s\n",dev->dev.name);
+	return -1;
     }
-    DEBUG("decoded as fs %s and path %s\n",fs_name, path);
-    return path;
-}
 
-int nk_fs_stat(char *path, struct nk_fs_stat *st)
-{
-    STATE_LOCK_CONF;
-    struct nk_fs *fs;
-    char fs_name[strlen(path)+1];
+    payload = MAX_ETHERNET_PACKET_DATA_LEN;
+    if (c.max_tu > ETHERNET_HEADER_LEN && c.max_tu - ETHERNET_HEADER_LEN < payload) {
+	payload = c.max_tu - ETHERNET_HEADER_LEN;
+    }
 
-    path = decode_path(path,fs_name);
+    while (done < len) {
+	p = nk_net_ethernet_alloc_packet(-1);
+	if (!p) {
+	    ERROR("Cannot allocate packet\n");
+	    n = -1;
+	    break;
+	}
 
-    DEBUG("decode has fs_name %s path %s\n", fs_name,path);
+	memcpy(p->header.dst,dest_mac,ETHER_MAC_LEN);
+	memcpy(p->header.src,c.mac,ETHER_MAC_LEN);
+	p->header.type = htons(ethertype);
 
-    STATE_LOCK();
-    fs = __fs_find(fs_name);
-    STATE_UNLOCK();
+	// the payload is filled straight from the device if we can
+	if (fd->fs->interface->read_direct &&
+	    (n = fd->fs->interface->read_direct(fd->fs->state, fd->file, offset+done, MIN(len-done,payload), &src)) >= 0) {
+	    memcpy(p->data,src,n);
+	} else {
+	    n = file_read(fd, (char*)p->data, offset+done, MIN(len-done,payload));
+	}
 
-    if (!fs) { 
-	ERROR("Cannot find filesystem named %s\n",fs_name);
-	return -1;
+	if (n<=0) {
+	    nk_net_ethernet_release_packet(p);
+	    break;
+	}
+
+	p->len = ETHERNET_HEADER_LEN + n;
+	if (p->len < c.min_tu) {
+	    memset(p->raw + p->len, 0, c.min_tu - p->len);
+	    p->len = c.min_tu;
+	}
+
+	if (nk_net_dev_send_packet(dev, p->raw, p->len, NK_DEV_REQ_BLOCKING, 0, 0)) {
+	    ERROR("Failed to send packet\n");
+	    nk_net_ethernet_release_packet(p);
+	    n = -1;
+	    break;
+	}
+
+	nk_net_ethernet_release_packet(p);
+	done += n;
     }
 
-    return path_stat(fs, path, st);
+    return (n<0 && !done) ? -1 : done;
+#else
+    ERROR("sendfile requires ethernet support\n");
+    return -1;
+#endif
 }
 
-int nk_fs_truncate(char *path, off_t len)
+#define MMAP_PAGE_SIZE PAGE_SIZE_4KB
+
+// loop over a staged read or write until done or a short transfer;
+// mappings are staged copies, so O_DIRECT does not apply to them
+static ssize_t mapping_rw(nk_fs_fd_t fd, char *buf, off_t offset, size_t len, int write)
 {
-    nk_fs_fd_t fd = nk_fs_open(path,O_RDWR,0);
-    
-    if (FS_FD_ERR(fd)) { 
-	return -1;
-    } else{
-	if (nk_fs_ftruncate(fd,len)) { 
-	    return -1;
+    size_t done = 0;
+    ssize_t n;
+
+    while (done < len) {
+	if (write) {
+	    n = fd->fs->interface->write_file(fd->fs->state, fd->file, buf+done, offset+done, len-done);
 	} else {
-	    return nk_fs_close(fd);
+	    n = fd->fs->interface->read_file(fd->fs->state, fd->file, buf+done, offset+done, len-done);
+	}
+	if (n<0) {
+	    return done ? done : -1;
+	}
+	if (!n) {
+	    break;
 	}
+	done += n;
     }
-}	
 
-nk_fs_fd_t nk_fs_creat(char *path, int mode) 
+    return done;
+}
+
+static struct fs_mapping *mapping_find(void *addr)
 {
-    return nk_fs_open(path,O_WRONLY|O_TRUNC|O_CREAT,0);
+    struct list_head *cur;
+    struct fs_mapping *m, *found = 0;
+    uint8_t flags;
+
+    flags = spin_lock_irq_save(&mmap_lock);
+    list_for_each(cur,&mmap_list) {
+	m = list_entry(cur,struct fs_mapping,node);
+	if ((char*)addr >= (char*)m->addr && (char*)addr < (char*)m->addr + m->len) {
+	    found = m;
+	    break;
+	}
+    }
+    spin_unlock_irq_restore(&mmap_lock,flags);
+
+    return found;
 }
 
-nk_fs_fd_t nk_fs_open(char *path, int flags, int mode) 
+// nonzero if the file has an in-place mapping reaching past len, whose
+// blocks a truncate to len would free
+static int mapped_in_place(nk_fs_fd_t fd, off_t len)
 {
-    STATE_LOCK_CONF;
-    struct nk_fs *fs;
-    char fs_name[strlen(path)+1];
+    struct list_head *cur;
+    struct fs_mapping *m;
+    int found = 0;
+    uint8_t flags;
+
+    flags = spin_lock_irq_save(&mmap_lock);
+    list_for_each(cur,&mmap_list) {
+	m = list_entry(cur,struct fs_mapping,node);
+	if (m->in_place && m->fd->fs == fd->fs && m->fd->file == fd->file &&
+	    m->offset + m->file_len > len) {
+	    found = 1;
+	    break;
+	}
+    }
+    spin_unlock_irq_restore(&mmap_lock,flags);
 
-    DEBUG("open path %s, flags=%d, mode=%d\n",path,flags,mode);
+    return found;
+}
 
-    path=decode_path(path,fs_name);
+void *nk_fs_mmap(nk_fs_fd_t fd, off_t offset, size_t len, int prot)
+{
+    struct fs_mapping *m;
+    struct nk_fs_stat st;
+    nk_thread_t *t = get_cur_thread();
+    void *direct;
+    ssize_t n;
+    uint8_t flags;
 
-    STATE_LOCK();
-    fs = __fs_find(fs_name);
-    STATE_UNLOCK();
+    DEBUG("mmap %lu bytes at offset %lu prot 0x%x\n", len, offset, prot);
 
-    if (!fs) { 
-	ERROR("Cannot find filesystem named %s\n",fs_name);
-	return FS_BAD_FD;
+    if (FS_FD_ERR(fd) || !len || offset % MMAP_PAGE_SIZE || !(prot & NK_ASPACE_READ)) {
+	ERROR("Invalid mapping request\n");
+	return 0;
     }
 
-    nk_fs_fd_t fd = malloc(sizeof(*fd));
-    if (!fd) { 
-	ERROR("Can't allocate new open file entry\n");
-	return FS_BAD_FD;
+    if (check_readable(fd) || ((prot & NK_ASPACE_WRITE) && check_writeable(fd))) {
+	return 0;
     }
 
-    memset(fd,0,sizeof(*fd));
-    spinlock_init(&fd->lock);
-    fd->fs = fs;
-    fd->flags = flags;
+    if (!fd->fs->interface->read_file || file_stat(fd->fs,fd->file,&st)) {
+	ERROR("Cannot stat file to map\n");
+	return 0;
+    }
 
-    if (exists(fs,path)) {
-	DEBUG("path %s exists\n", path);
-	fd->file = file_open(fs, path, flags);
-    } else if (flags & O_CREAT) {
-	DEBUG("path %s does not exist, but creating file\n",path);
-	if ((fs->flags & NK_FS_READONLY)) { 
-	    ERROR("Filesystem is not writeable so cannot create file\n");
-	    return FS_BAD_FD;
-	}
-	fd->file = file_create(fs, path);
-	if (!fd->file) {
-	    ERROR("Cannot create file %s\n", path);
-	    free(fd);
-	    return FS_BAD_FD;
-	} else {
-	    DEBUG("Created file %s on fs %s file=%p ", path, fs_name, fd);
-	} 
+    m = malloc(sizeof(*m));
+    if (!m) {
+	ERROR("Cannot allocate mapping\n");
+	return 0;
+    }
+    memset(m,0,sizeof(*m));
+
+    m->fd = fd;
+    m->offset = offset;
+    m->prot = prot;
+    m->len = ((len + MMAP_PAGE_SIZE - 1) / MMAP_PAGE_SIZE) * MMAP_PAGE_SIZE;
+    m->file_len = offset < st.st_size ? MIN(len, st.st_size - offset) : 0;
+
+    // a read-only map of whole pages that sit contiguously and page
+    // aligned in device memory can simply be that memory, as long as
+    // the filesystem never moves the data underneath it.  Anything
+    // less would expose, or unprotect, whatever is next to the file
+    if (!(prot & NK_ASPACE_WRITE) && m->file_len == len && len == m->len &&
+	!(fd->fs->flags & NK_FS_MOVES_DATA) &&
+	fd->fs->interface->read_direct &&
+	fd->fs->interface->read_direct(fd->fs->state, fd->file, offset, len, &direct) == len &&
+	!((uint64_t)direct % MMAP_PAGE_SIZE)) {
+	DEBUG("mapping device memory at %p in place\n", direct);
+	m->addr = direct;
+	m->in_place = 1;
     } else {
-	DEBUG("path %s does not exist, and no creation requested\n",path);
-	free(fd);
-	return FS_BAD_FD;
+	m->addr = malloc(m->len);
+	if (!m->addr || (uint64_t)m->addr % MMAP_PAGE_SIZE) {
+	    ERROR("Cannot allocate %lu page-aligned bytes for mapping\n", m->len);
+	    free(m->addr);
+	    free(m);
+	    return 0;
+	}
+	n = mapping_rw(fd, m->addr, offset, m->file_len, 0);
+	if (n<0) {
+	    ERROR("Cannot read file into mapping\n");
+	    free(m->addr);
+	    free(m);
+	    return 0;
+	}
+	memset(m->addr + n, 0, m->len - n);
     }
-    
-    STATE_LOCK();
-    list_add(&fd->file_node, &open_files);
-    STATE_UNLOCK();
 
-    if (flags & O_TRUNC) { 
-	file_trunc(fd,0);
+    // a thread in its own address space needs the memory made visible
+    // there; the base address space already maps all of it 1:1
+    if (t && t->aspace) {
+	m->region.va_start = m->addr;
+	m->region.pa_start = m->addr;
+	m->region.len_bytes = m->len;
+	m->region.protect.flags = prot & (NK_ASPACE_READ | NK_ASPACE_WRITE);
+	if (nk_aspace_add_region(t->aspace, &m->region)) {
+	    ERROR("Cannot add mapping region to address space %s\n", t->aspace->name);
+	    if (!m->in_place) {
+		free(m->addr);
+	    }
+	    free(m);
+	    return 0;
+	}
+	m->aspace = t->aspace;
     }
 
-    if (flags & O_APPEND) {
-	__seek(fd, 0, 2);
-    }
+    flags = spin_lock_irq_save(&mmap_lock);
+    list_add_tail(&m->node,&mmap_list);
+    spin_unlock_irq_restore(&mmap_lock,flags);
 
-    DEBUG("Opened file %s on fs %s file=%p ", path, fs_name, fd);
+    DEBUG("mapped at %p (%s)\n", m->addr, m->in_place ? "in place" : "copy");
 
-    return fd;
+    return m->addr;
 }
 
-int nk_fs_close(nk_fs_fd_t fd) 
+int nk_fs_msync(void *addr, size_t len)
 {
-    STATE_LOCK_CONF;
-
-    STATE_LOCK();
-    list_del(&fd->file_node);
-    STATE_UNLOCK();
+    struct fs_mapping *m = mapping_find(addr);
+    size_t start, end;
 
-    free(fd);
-    
-    return 0;
-}
+    if (!m) {
+	ERROR("No mapping at %p\n", addr);
+	return -1;
+    }
 
-ssize_t nk_fs_read(nk_fs_fd_t fd, void *buf, size_t num_bytes) 
-{
-    FILE_LOCK_CONF;
+    if (m->in_place || !(m->prot & NK_ASPACE_WRITE)) {
+	return 0;
+    }
 
-    DEBUG("attempt read of %ld bytes starting at position %lu\n", num_bytes, fd->position);
+    // write back the pages covering [addr, addr+len) that are in the file
+    start = (((char*)addr - (char*)m->addr) / MMAP_PAGE_SIZE) * MMAP_PAGE_SIZE;
+    end = MIN((char*)addr - (char*)m->addr + len, m->file_len);
 
-    if (FS_FD_ERR(fd) || !(fd->flags & O_RDONLY)) { // includes RDWR
-	ERROR("Cannot read file not opened for reading\n");
-	return -1;
+    if (start >= end) {
+	return 0;
     }
 
-    FILE_LOCK(fd);
-    ssize_t n = file_read(fd, buf, num_bytes);
-    if (n>=0) {fd->position += n; }
-    FILE_UNLOCK(fd);
+    DEBUG("msync %p bytes [%lu,%lu) of mapping\n", m->addr, start, end);
 
-    DEBUG("read %ld bytes ending at position %lu\n", n, fd->position);
+    if (mapping_rw(m->fd, m->addr + start, m->offset + start, end - start, 1) != end - start) {
+	ERROR("Failed to write back mapping\n");
+	return -1;
+    }
 
-    return n;
+    return 0;
 }
 
-ssize_t nk_fs_write(nk_fs_fd_t fd, void *buf, size_t num_bytes) 
+int nk_fs_munmap(void *addr, size_t len)
 {
-    FILE_LOCK_CONF;
-
-    DEBUG("attempt write of %ld bytes starting at position %lu\n", num_bytes, fd->position);
+    struct fs_mapping *m = mapping_find(addr);
+    uint8_t flags;
+    int rc;
 
-    if (FS_FD_ERR(fd) || !(fd->flags & O_WRONLY)) { // includes RDWR
-	ERROR("Cannot write file not opened for writing\n");
+    if (!m || m->addr != addr) {
+	ERROR("No mapping starts at %p\n", addr);
 	return -1;
     }
 
-    if (fd->fs->flags & NK_FS_READONLY) { 
-	ERROR("Not a writeable filesystem\n");
-	return -1;
-    }
+    rc = nk_fs_msync(addr, m->len);
 
-    FILE_LOCK(fd);
-    ssize_t n = file_read(fd, buf, num_bytes);
-    if (n>=0) {fd->position += n; }
-    FILE_UNLOCK(fd);
+    flags = spin_lock_irq_save(&mmap_lock);
+    list_del_init(&m->node);
+    spin_unlock_irq_restore(&mmap_lock,flags);
 
-    DEBUG("wrote %ld bytes ending at position %lu\n", n, fd->position);
+    if (m->aspace && nk_aspace_remove_region(m->aspace, &m->region)) {
+	ERROR("Failed to remove mapping region from address space %s\n", m->aspace->name);
+	rc = -1;
+    }
 
-    return n;
+    if (!m->in_place) {
+	free(m->addr);
+    }
+    free(m);
+
+    return rc;
 }
 
 int nk_fs_ftruncate(nk_fs_fd_t fd, off_t len)
@@ -533,24 +1788,24 @@ void nk_fs_dump_filesystems()
 
     list_for_each(cur,&fs_list) {
 	struct nk_fs *fs = list_entry(cur,struct nk_fs,fs_list_node);
-	nk_vc_printf("%s:\n", fs->name);
+	if (fs->mount_path[0]) {
+	    nk_vc_printf("%s: mounted at %s\n", fs->name, fs->mount_path);
+	} else {
+	    nk_vc_printf("%s:\n", fs->name);
+	}
     }
     STATE_UNLOCK();
 }
 
 
-void nk_fs_dump_files()
+static void dump_file(nk_fs_fd_t f)
 {
-    STATE_LOCK_CONF;
-    struct list_head *cur;
-
-    STATE_LOCK();
+    nk_vc_printf("%s:%p at %lu flags %x\n", f->fs->name,f->file,f->position,f->flags);
+}
 
-    list_for_each(cur,&open_files) {
-	struct nk_fs_open_file_state *f = list_entry(cur,struct nk_fs_open_file_state,file_node);
-	nk_vc_printf("%s:%p at %lu flags %x\n", f->fs->name,f->file,f->position,f->flags);
-    }
-    STATE_UNLOCK();
+void nk_fs_dump_files()
+{
+    map_over_open_files(dump_file);
 }
 
 
@@ -558,10 +1813,6 @@ static int
 handle_attach (char * buf, void * priv)
 {
     char type[32], devname[32], fsname[32]; 
-    uint64_t start, count;
-    struct nk_block_dev *d;
-    struct nk_block_dev_characteristics c;
-    int rc;
 
     if (sscanf(buf,"attach %s %s %s",devname, type, fsname)!=3) {
         nk_vc_printf("Don't understand %s\n",buf);
@@ -580,6 +1831,21 @@ handle_attach (char * buf, void * priv)
             nk_vc_printf("Device %s attached as ext2 volume with name %s\n", devname,fsname);
             return 0;
         }
+#endif
+    } else if (!strcmp(type,"fatfs") || !strcmp(type,"ff") || !strcmp(type,"ff-fastseek")) {
+#ifndef NAUT_CONFIG_FATFS_FILESYSTEM_DRIVER
+        nk_vc_printf("Not compiled with FATFS support, cannot attach\n");
+        return -1;
+#else
+        int flags = !strcmp(type,"fatfs") ? NK_FS_FATFS_NATIVE :
+            !strcmp(type,"ff") ? NK_FS_FATFS_CHAN : NK_FS_FATFS_CHAN | NK_FS_FATFS_FASTSEEK;
+        if (nk_fs_fatfs_attach_engine(devname,fsname,0,flags)) {
+            nk_vc_printf("Failed to attach %s as %s volume with name %s\n", devname,type,fsname);
+            return -1;
+        } else {
+            nk_vc_printf("Device %s attached as %s volume with name %s\n", devname,type,fsname);
+            return 0;
+        }
 #endif
     } else {
         nk_vc_printf("FS type %s is not supported\n", type);
@@ -589,7 +1855,7 @@ handle_attach (char * buf, void * priv)
 
 static struct shell_cmd_impl attach_impl = {
     .cmd      = "attach",
-    .help_str = "attach",
+    .help_str = "attach dev ext2|fatfs|ff|ff-fastseek fsname",
     .handler  = handle_attach,
 };
 nk_register_shell_cmd(attach_impl);
@@ -725,6 +1991,104 @@ handle_ofs (char * buf, void * priv)
     return 0;
 }
 
+static int
+handle_mount (char * buf, void * priv)
+{
+    char fsname[FS_NAME_LEN], path[SHELL_MAX_CMD];
+
+    if (sscanf(buf,"mount %31s %s",fsname,path)==2) {
+	return nk_fs_mount(fsname,path);
+    }
+
+    nk_fs_dump_filesystems();
+    return 0;
+}
+
+static int
+handle_umount (char * buf, void * priv)
+{
+    char path[SHELL_MAX_CMD];
+
+    if (sscanf(buf,"umount %s",path)==1) {
+	return nk_fs_umount(path);
+    }
+
+    nk_vc_printf("umount path\n");
+    return -1;
+}
+
+static int
+handle_sync (char * buf, void * priv)
+{
+    char fsname[FS_NAME_LEN];
+    struct nk_fs *fs;
+
+    if (sscanf(buf,"sync %31s",fsname)!=1) {
+	nk_vc_printf("sync fsname\n");
+	return -1;
+    }
+
+    if (!(fs = nk_fs_find(fsname))) {
+	nk_vc_printf("Cannot find filesystem %s\n",fsname);
+	return -1;
+    }
+
+    if (fs_sync(fs)) {
+	nk_vc_printf("Failed to sync %s\n",fsname);
+	return -1;
+    }
+
+    return 0;
+}
+
+#define LS_BATCH 16
+
+static int
+handle_ls (char * buf, void * priv)
+{
+    char path[SHELL_MAX_CMD];
+    struct nk_fs_dirent *ents;
+    nk_fs_dir_t d;
+    ssize_t n, i;
+
+    if (sscanf(buf,"ls %s",path)!=1) {
+	strcpy(path,"/");
+    }
+
+    d = nk_fs_opendir(path);
+
+    if (!d) {
+	nk_vc_printf("Cannot open directory \"%s\"\n",path);
+	return 0;
+    }
+
+    ents = malloc(sizeof(*ents)*LS_BATCH);
+
+    if (!ents) {
+	nk_fs_closedir(d);
+	return -1;
+    }
+
+    while ((n = nk_fs_readdir_batch(d,ents,LS_BATCH))>0) {
+	for (i=0;i<n;i++) {
+	    nk_vc_printf("%c%c%c %12lu %s\n",
+			 ents[i].attr & NK_FS_ATTR_DIR ? 'd' : '-',
+			 ents[i].attr & NK_FS_ATTR_READONLY ? 'r' : '-',
+			 ents[i].attr & NK_FS_ATTR_HIDDEN ? 'h' : '-',
+			 ents[i].size, ents[i].name);
+	}
+    }
+
+    if (n<0) {
+	nk_vc_printf("Error reading directory\n");
+    }
+
+    free(ents);
+    nk_fs_closedir(d);
+
+    return 0;
+}
+
 static int
 handle_cat (char * buf, void * priv)
 {
@@ -776,6 +2140,34 @@ static struct shell_cmd_impl ofs_impl = {
 };
 nk_register_shell_cmd(ofs_impl);
 
+static struct shell_cmd_impl mount_impl = {
+    .cmd      = "mount",
+    .help_str = "mount [fsname path]",
+    .handler  = handle_mount,
+};
+nk_register_shell_cmd(mount_impl);
+
+static struct shell_cmd_impl umount_impl = {
+    .cmd      = "umount",
+    .help_str = "umount path",
+    .handler  = handle_umount,
+};
+nk_register_shell_cmd(umount_impl);
+
+static struct shell_cmd_impl sync_impl = {
+    .cmd      = "sync",
+    .help_str = "sync fsname",
+    .handler  = handle_sync,
+};
+nk_register_shell_cmd(sync_impl);
+
+static struct shell_cmd_impl ls_impl = {
+    .cmd      = "ls",
+    .help_str = "ls [path]",
+    .handler  = handle_ls,
+};
+nk_register_shell_cmd(ls_impl);
+
 static struct shell_cmd_impl cat_impl = {
     .cmd      = "cat",
     .help_str = "cat [path]",
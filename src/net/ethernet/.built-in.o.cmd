@@ -0,0 +1 @@
+cmd_src/net/ethernet/built-in.o :=  ld -z max-page-size=0x1000 -melf_x86_64 -dp  -r -o src/net/ethernet/built-in.o src/net/ethernet/ethernet_packet.o src/net/ethernet/ethernet_agent.o src/net/ethernet/ethernet_arp.o
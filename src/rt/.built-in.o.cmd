@@ -0,0 +1 @@
+cmd_src/rt/built-in.o :=  rm -f src/rt/built-in.o; ar rcs src/rt/built-in.o
@@ -0,0 +1,611 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2017, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+
+/*
+ * fsbench - throughput and latency of whatever filesystem is mounted
+ * at (or named by) a path, using only the nk_fs_* calls
+ *
+ *   fsbench dir [tests=all] [bs=4096] [qd=1] [threads=1] [size=16M]
+ *               [ops=N] [files=256] [seed=1] [direct=0] [keep=0]
+ *
+ * tests is a comma separated list of seqwrite, seqread, randwrite,
+ * randread, create, stat, rename, unlink, or io, meta, all.
+ *
+ * Each of the threads has its own file of size bytes, dir/fsbench.T,
+ * and runs qd workers against it, bound to the same CPU.  The nk_fs
+ * calls are synchronous, so qd is the number of requests each thread
+ * has in flight.  Sequential workers take the next block of the file
+ * in turn; random workers pick blocks from a seeded generator, so runs
+ * with the same arguments issue the same offsets.  Each I/O test does
+ * ops requests per thread, by default size/bs.
+ *
+ * The metadata tests work on files names per thread, dir/T_I, which
+ * are 8.3 names for up to 99 threads of 99999 files, so that engines
+ * without long names can run them.  They are best run in order, as
+ * meta does.
+ *
+ * One line per test is printed, as key=value pairs, so that results
+ * from two builds can be diffed or scraped:
+ *
+ *   fsbench test=randread ... mbps=12.34 iops=3159 lat_p50=... status=ok
+ *
+ * Latencies are from rdtsc around each call, converted to ns when the
+ * CPU frequency is known (lat_unit says which).
+ */
+
+#include <nautilus/nautilus.h>
+#include <nautilus/shell.h>
+#include <nautilus/thread.h>
+#include <nautilus/scheduler.h>
+#include <nautilus/fs.h>
+
+#define ERROR(fmt, args...) ERROR_PRINT("fsbench: " fmt, ##args)
+
+#define FSB_PATH_LEN  256
+
+#define FSB_SEQWRITE  0x01
+#define FSB_SEQREAD   0x02
+#define FSB_RANDWRITE 0x04
+#define FSB_RANDREAD  0x08
+#define FSB_CREATE    0x10
+#define FSB_STAT      0x20
+#define FSB_RENAME    0x40
+#define FSB_UNLINK    0x80
+#define FSB_IO        (FSB_SEQWRITE | FSB_SEQREAD | FSB_RANDWRITE | FSB_RANDREAD)
+#define FSB_META      (FSB_CREATE | FSB_STAT | FSB_RENAME | FSB_UNLINK)
+#define FSB_WRITES    (FSB_SEQWRITE | FSB_RANDWRITE)
+#define FSB_RANDOM    (FSB_RANDWRITE | FSB_RANDREAD)
+
+static struct {
+    char *name;
+    int   tests;
+} fsb_names[] = {
+    { "seqwrite",  FSB_SEQWRITE },
+    { "seqread",   FSB_SEQREAD },
+    { "randwrite", FSB_RANDWRITE },
+    { "randread",  FSB_RANDREAD },
+    { "create",    FSB_CREATE },
+    { "stat",      FSB_STAT },
+    { "rename",    FSB_RENAME },
+    { "unlink",    FSB_UNLINK },
+    { "io",        FSB_IO },
+    { "meta",      FSB_META },
+    { "all",       FSB_IO | FSB_META },
+};
+
+#define FSB_NUM_NAMES (sizeof(fsb_names)/sizeof(fsb_names[0]))
+
+struct fsb_config {
+    char     dir[FSB_PATH_LEN-48];   // leaves room for the file names
+    int      tests;
+    uint64_t bs;
+    uint64_t qd;
+    uint64_t threads;
+    uint64_t size;
+    uint64_t ops;      // per thread, 0 => size/bs
+    uint64_t files;    // per thread
+    uint64_t seed;
+    int      direct;
+    int      keep;
+};
+
+// the per-thread state of a test
+struct fsb_stream {
+    char              path[FSB_PATH_LEN];
+    volatile uint64_t next;     // next op to claim
+    uint64_t         *lat;      // cycles, one per op
+};
+
+// one test, run by threads*qd workers
+struct fsb_run {
+    struct fsb_config *cfg;
+    int                test;
+    int                renamed;  // the rename test has been run
+    uint64_t           nops;     // per thread
+    struct fsb_stream *streams;
+    volatile int       go;
+    volatile int       failed;
+};
+
+struct fsb_worker {
+    struct fsb_run *run;
+    uint64_t        thread;
+    uint64_t        rng;
+};
+
+
+static char *fsb_test_name(int test)
+{
+    int i;
+
+    for (i=0;i<FSB_NUM_NAMES;i++) {
+	if (fsb_names[i].tests==test) {
+	    return fsb_names[i].name;
+	}
+    }
+    return "unknown";
+}
+
+// xorshift64*, which is plenty for picking offsets
+static uint64_t fsb_rand(uint64_t *x)
+{
+    *x ^= *x >> 12;
+    *x ^= *x << 25;
+    *x ^= *x >> 27;
+    return *x * 0x2545f4914f6cdd1dULL;
+}
+
+static void fsb_meta_path(struct fsb_run *run, uint64_t t, uint64_t i, int renamed, char *path)
+{
+    snprintf(path,FSB_PATH_LEN,"%s/%lu_%lu%s",run->cfg->dir,t,i,renamed ? ".r" : "");
+}
+
+static int fsb_io_op(struct fsb_worker *w, nk_fs_fd_t fd, uint8_t *buf, uint64_t i)
+{
+    struct fsb_run *run = w->run;
+    struct fsb_config *cfg = run->cfg;
+    uint64_t nblocks = cfg->size / cfg->bs;
+    uint64_t block, start, end;
+    ssize_t rc;
+
+    if (run->test & FSB_RANDOM) {
+	block = fsb_rand(&w->rng) % nblocks;
+    } else {
+	block = i % nblocks;
+    }
+
+    start = rdtsc();
+    if (run->test & FSB_WRITES) {
+	rc = nk_fs_pwrite(fd, buf, cfg->bs, block*cfg->bs);
+    } else {
+	rc = nk_fs_pread(fd, buf, cfg->bs, block*cfg->bs);
+    }
+    end = rdtsc();
+
+    run->streams[w->thread].lat[i] = end - start;
+
+    if (rc != cfg->bs) {
+	ERROR("%s of %lu bytes at %lu of %s returned %ld\n", fsb_test_name(run->test),
+	      cfg->bs, block*cfg->bs, run->streams[w->thread].path, rc);
+	return -1;
+    }
+
+    return 0;
+}
+
+static int fsb_meta_op(struct fsb_worker *w, uint64_t i)
+{
+    struct fsb_run *run = w->run;
+    char path[FSB_PATH_LEN], new_path[FSB_PATH_LEN];
+    struct nk_fs_stat st;
+    uint64_t start, end;
+    nk_fs_fd_t fd;
+    int rc = 0;
+
+    fsb_meta_path(run,w->thread,i,0,path);
+
+    start = rdtsc();
+    switch (run->test) {
+    case FSB_CREATE:
+	fd = nk_fs_open(path, O_RDWR | O_CREAT, 0);
+	if (FS_FD_ERR(fd)) {
+	    rc = -1;
+	} else {
+	    rc = nk_fs_close(fd);
+	}
+	break;
+    case FSB_STAT:
+	rc = nk_fs_stat(path, &st);
+	break;
+    case FSB_RENAME:
+	fsb_meta_path(run,w->thread,i,1,new_path);
+	rc = nk_fs_rename(path, new_path);
+	break;
+    case FSB_UNLINK:
+	if (run->renamed) {
+	    fsb_meta_path(run,w->thread,i,1,path);
+	}
+	rc = nk_fs_unlink(path);
+	break;
+    }
+    end = rdtsc();
+
+    run->streams[w->thread].lat[i] = end - start;
+
+    if (rc) {
+	ERROR("%s of %s failed\n", fsb_test_name(run->test), path);
+    }
+
+    return rc;
+}
+
+static void fsb_worker_func(void *in, void **out)
+{
+    struct fsb_worker *w = (struct fsb_worker *)in;
+    struct fsb_run *run = w->run;
+    struct fsb_config *cfg = run->cfg;
+    struct fsb_stream *s = &run->streams[w->thread];
+    nk_fs_fd_t fd = FS_BAD_FD;
+    uint8_t *buf = 0;
+    uint64_t i;
+
+    if (run->test & FSB_IO) {
+	fd = nk_fs_open(s->path, ((run->test & FSB_WRITES) ? O_RDWR : O_RDONLY) |
+			(cfg->direct ? O_DIRECT : 0), 0);
+	buf = malloc(cfg->bs);
+	if (FS_FD_ERR(fd) || !buf) {
+	    ERROR("Cannot set up worker on %s\n", s->path);
+	    run->failed = 1;
+	    goto out;
+	}
+	for (i=0;i<cfg->bs;i++) {
+	    buf[i] = (uint8_t)(i ^ w->thread);
+	}
+    }
+
+    while (!run->go) {
+	nk_yield();
+    }
+
+    while (!run->failed) {
+	i = __sync_fetch_and_add(&s->next, 1);
+	if (i >= run->nops) {
+	    break;
+	}
+	if (run->test & FSB_IO) {
+	    if (fsb_io_op(w, fd, buf, i)) {
+		run->failed = 1;
+	    }
+	} else {
+	    if (fsb_meta_op(w, i)) {
+		run->failed = 1;
+	    }
+	}
+    }
+
+ out:
+    if (!FS_FD_ERR(fd)) {
+	nk_fs_close(fd);
+    }
+    if (buf) {
+	free(buf);
+    }
+    free(w);
+}
+
+// Shell sort; the latency arrays are too big for insertion sort and
+// there is no qsort
+static void fsb_sort(uint64_t *a, uint64_t n)
+{
+    uint64_t gap, i, j, x;
+
+    for (gap=1;gap<n/3;gap=gap*3+1) {}
+
+    for (;gap>0;gap/=3) {
+	for (i=gap;i<n;i++) {
+	    x = a[i];
+	    for (j=i;j>=gap && a[j-gap]>x;j-=gap) {
+		a[j] = a[j-gap];
+	    }
+	    a[j] = x;
+	}
+    }
+}
+
+static uint64_t fsb_lat(uint64_t cycles, uint64_t khz)
+{
+    return khz ? cycles * 1000000 / khz : cycles;
+}
+
+static void fsb_report(struct fsb_run *run, uint64_t ns)
+{
+    struct fsb_config *cfg = run->cfg;
+    uint64_t khz = nk_get_nautilus_info()->sys.cpus[my_cpu_id()]->cpu_khz;
+    uint64_t n = run->nops * cfg->threads;
+    uint64_t bytes = (run->test & FSB_IO) ? n * cfg->bs : 0;
+    uint64_t mbps100, iops, *lat;
+
+    if (!ns) {
+	ns = 1;
+    }
+
+    mbps100 = bytes * 100000 / ns;
+    iops = n * 1000000000ULL / ns;
+
+    nk_vc_printf("fsbench test=%s dir=%s bs=%lu qd=%lu threads=%lu direct=%d ops=%lu bytes=%lu ns=%lu mbps=%lu.%02lu iops=%lu",
+		 fsb_test_name(run->test), cfg->dir, cfg->bs, cfg->qd, cfg->threads,
+		 cfg->direct, n, bytes, ns, mbps100/100, mbps100%100, iops);
+
+    // the per-thread arrays are contiguous
+    lat = run->streams[0].lat;
+
+    if (!run->failed && n) {
+	fsb_sort(lat, n);
+	nk_vc_printf(" lat_unit=%s lat_min=%lu lat_p50=%lu lat_p90=%lu lat_p99=%lu lat_p999=%lu lat_max=%lu",
+		     khz ? "ns" : "cycles",
+		     fsb_lat(lat[0],khz), fsb_lat(lat[n/2],khz), fsb_lat(lat[n*9/10],khz),
+		     fsb_lat(lat[n*99/100],khz), fsb_lat(lat[n*999/1000],khz), fsb_lat(lat[n-1],khz));
+    }
+
+    nk_vc_printf(" status=%s\n", run->failed ? "failed" : "ok");
+}
+
+static int fsb_run_test(struct fsb_run *run, int test, int report)
+{
+    struct fsb_config *cfg = run->cfg;
+    uint64_t t, q, start, end;
+    struct fsb_worker *w;
+    uint32_t ncpus = nk_get_num_cpus();
+
+    run->test = test;
+    run->go = 0;
+    run->failed = 0;
+
+    if (test & FSB_IO) {
+	run->nops = (!cfg->ops || !report) ? cfg->size / cfg->bs : cfg->ops;
+    } else {
+	run->nops = cfg->files;
+    }
+
+    for (t=0;t<cfg->threads;t++) {
+	run->streams[t].next = 0;
+	run->streams[t].lat = run->streams[0].lat + t * run->nops;
+    }
+
+    for (t=0;t<cfg->threads;t++) {
+	for (q=0;q<cfg->qd;q++) {
+	    if (!(w = malloc(sizeof(*w)))) {
+		run->failed = 1;
+		break;
+	    }
+	    w->run = run;
+	    w->thread = t;
+	    w->rng = (cfg->seed * 0x9e3779b97f4a7c15ULL) ^ ((t << 32) | q) ^ test;
+	    if (!w->rng) {
+		w->rng = 1;
+	    }
+	    if (nk_thread_start(fsb_worker_func, w, 0, 0, 0, NULL, t % ncpus)) {
+		ERROR("Failed to launch worker %lu of thread %lu\n", q, t);
+		free(w);
+		run->failed = 1;
+		break;
+	    }
+	}
+    }
+
+    start = nk_sched_get_realtime();
+    run->go = 1;
+    nk_join_all_children(0);
+    end = nk_sched_get_realtime();
+    nk_sched_reap(1);
+
+    if (report) {
+	fsb_report(run, end - start);
+    }
+
+    return run->failed ? -1 : 0;
+}
+
+static uint64_t fsb_max_ops(struct fsb_config *cfg)
+{
+    uint64_t n = cfg->size / cfg->bs;
+
+    if (cfg->ops > n) {
+	n = cfg->ops;
+    }
+    if (cfg->files > n) {
+	n = cfg->files;
+    }
+    return n;
+}
+
+static int fsbench(struct fsb_config *cfg)
+{
+    struct fsb_run run;
+    uint64_t t;
+    int i, rc = 0;
+
+    memset(&run, 0, sizeof(run));
+    run.cfg = cfg;
+
+    run.streams = malloc(sizeof(struct fsb_stream) * cfg->threads);
+    if (!run.streams) {
+	ERROR("Cannot allocate streams\n");
+	return -1;
+    }
+    memset(run.streams, 0, sizeof(struct fsb_stream) * cfg->threads);
+
+    run.streams[0].lat = malloc(sizeof(uint64_t) * fsb_max_ops(cfg) * cfg->threads);
+    if (!run.streams[0].lat) {
+	ERROR("Cannot allocate latency records\n");
+	free(run.streams);
+	return -1;
+    }
+
+    for (t=0;t<cfg->threads;t++) {
+	snprintf(run.streams[t].path, FSB_PATH_LEN, "%s/fsbench.%lu", cfg->dir, t);
+    }
+
+    if (cfg->tests & FSB_IO) {
+	// create the files, and fill them if seqwrite will not
+	for (t=0;t<cfg->threads;t++) {
+	    nk_fs_fd_t fd = nk_fs_open(run.streams[t].path, O_RDWR | O_CREAT, 0);
+	    if (FS_FD_ERR(fd)) {
+		ERROR("Cannot create %s\n", run.streams[t].path);
+		rc = -1;
+		goto out;
+	    }
+	    nk_fs_close(fd);
+	}
+	if (!(cfg->tests & FSB_SEQWRITE) || (cfg->ops && cfg->ops < cfg->size / cfg->bs)) {
+	    if (fsb_run_test(&run, FSB_SEQWRITE, 0)) {
+		ERROR("Cannot fill the files\n");
+		rc = -1;
+		goto remove;
+	    }
+	}
+    }
+
+    for (i=0;i<8;i++) {
+	int test = 1 << i;
+	if (!(cfg->tests & test)) {
+	    continue;
+	}
+	if (test == FSB_UNLINK && !(cfg->tests & FSB_CREATE)) {
+	    // nothing of ours to remove
+	    continue;
+	}
+	if (fsb_run_test(&run, test, 1)) {
+	    rc = -1;
+	    if (test == FSB_CREATE) {
+		break;
+	    }
+	}
+	if (test == FSB_RENAME) {
+	    run.renamed = !run.failed;
+	}
+    }
+
+ remove:
+    if ((cfg->tests & FSB_IO) && !cfg->keep) {
+	for (t=0;t<cfg->threads;t++) {
+	    nk_fs_unlink(run.streams[t].path);
+	}
+    }
+
+ out:
+    free(run.streams[0].lat);
+    free(run.streams);
+
+    return rc;
+}
+
+
+// number with an optional K, M or G suffix
+static uint64_t fsb_num(char *s)
+{
+    char *end;
+    uint64_t n = simple_strtoull(s, &end, 0);
+
+    switch (*end) {
+    case 'k': case 'K': n <<= 10; break;
+    case 'm': case 'M': n <<= 20; break;
+    case 'g': case 'G': n <<= 30; break;
+    }
+    return n;
+}
+
+static int fsb_parse_tests(char *list)
+{
+    char *name;
+    int i, tests = 0;
+
+    while ((name = strsep(&list, ","))) {
+	for (i=0;i<FSB_NUM_NAMES;i++) {
+	    if (!strcmp(name, fsb_names[i].name)) {
+		tests |= fsb_names[i].tests;
+		break;
+	    }
+	}
+	if (i==FSB_NUM_NAMES) {
+	    nk_vc_printf("Unknown test %s\n", name);
+	    return 0;
+	}
+    }
+    return tests;
+}
+
+static int
+handle_fsbench (char * buf, void * priv)
+{
+    struct fsb_config cfg;
+    char line[SHELL_MAX_CMD], *rest = line, *tok, *val;
+    int have_dir = 0;
+
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.tests = FSB_IO | FSB_META;
+    cfg.bs = 4096;
+    cfg.qd = 1;
+    cfg.threads = 1;
+    cfg.size = 16 << 20;
+    cfg.files = 256;
+    cfg.seed = 1;
+
+    strncpy(line, buf, SHELL_MAX_CMD-1);
+    line[SHELL_MAX_CMD-1] = 0;
+
+    strsep(&rest, " ");   // the command
+
+    while ((tok = strsep(&rest, " "))) {
+	if (!*tok) {
+	    continue;
+	}
+	if (!(val = strchr(tok, '='))) {
+	    strncpy(cfg.dir, tok, sizeof(cfg.dir)-1);
+	    have_dir = 1;
+	    continue;
+	}
+	*val++ = 0;
+	if (!strcmp(tok, "tests")) {
+	    cfg.tests = fsb_parse_tests(val);
+	} else if (!strcmp(tok, "bs")) {
+	    cfg.bs = fsb_num(val);
+	} else if (!strcmp(tok, "qd")) {
+	    cfg.qd = fsb_num(val);
+	} else if (!strcmp(tok, "threads")) {
+	    cfg.threads = fsb_num(val);
+	} else if (!strcmp(tok, "size")) {
+	    cfg.size = fsb_num(val);
+	} else if (!strcmp(tok, "ops")) {
+	    cfg.ops = fsb_num(val);
+	} else if (!strcmp(tok, "files")) {
+	    cfg.files = fsb_num(val);
+	} else if (!strcmp(tok, "seed")) {
+	    cfg.seed = fsb_num(val);
+	} else if (!strcmp(tok, "direct")) {
+	    cfg.direct = fsb_num(val);
+	} else if (!strcmp(tok, "keep")) {
+	    cfg.keep = fsb_num(val);
+	} else {
+	    cfg.tests = 0;
+	}
+    }
+
+    if (!have_dir || !cfg.tests || !cfg.bs || !cfg.qd || !cfg.threads || cfg.size < cfg.bs || !cfg.files) {
+	nk_vc_printf("fsbench dir [tests=all|io|meta|seqwrite,seqread,randwrite,randread,create,stat,rename,unlink]\n"
+		     "        [bs=4096] [qd=1] [threads=1] [size=16M] [ops=size/bs] [files=256]\n"
+		     "        [seed=1] [direct=0] [keep=0]\n");
+	return -1;
+    }
+
+    // "/" would give "//fsbench.0"
+    if (!strcmp(cfg.dir, "/")) {
+	cfg.dir[0] = 0;
+    }
+
+    return fsbench(&cfg);
+}
+
+static struct shell_cmd_impl fsbench_impl = {
+    .cmd      = "fsbench",
+    .help_str = "fsbench dir [tests=..] [bs=n] [qd=n] [threads=n] [size=n] [ops=n] [files=n] [seed=n] [direct=0|1] [keep=0|1]",
+    .handler  = handle_fsbench,
+};
+nk_register_shell_cmd(fsbench_impl);
@@ -0,0 +1,82 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2017, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+
+/*
+ * fshost bench - the kernel's fsbench (src/test/fsbench.c), run on
+ * the image through the kernel's VFS (src/nautilus/fs.c)
+ *
+ *   bench [key=value ...]
+ *
+ * takes fsbench's arguments, less the directory: the filesystem is
+ * mounted at / for the run, and the benchmark works in its root.
+ * fsbench prints its line per test; a last line gives the device
+ * traffic of the whole run.
+ *
+ * ext2 has no rename, so leave it out of tests for ext2.
+ */
+
+#include "host.h"
+
+#include <nautilus/nautilus.h>
+#include <nautilus/blkdev.h>
+#include <nautilus/fs.h>
+#include <nautilus/shell.h>
+
+#include "shim.h"
+#include "fshost.h"
+
+extern struct shell_cmd_impl *fshost_cmd_fsbench_impl;
+
+int fshost_bench(char *fs_name, struct nk_block_dev *dev, char *engine, int argc, char **argv)
+{
+    char line[SHELL_MAX_CMD];
+    struct fshost_disk_stats ds;
+    size_t n;
+    int i, rc;
+
+    n = snprintf(line, sizeof(line), "fsbench /");
+    for (i=0;i<argc && n<sizeof(line);i++) {
+	n += snprintf(line + n, sizeof(line) - n, " %s", argv[i]);
+    }
+    if (n >= sizeof(line)) {
+	fprintf(stderr, "bench arguments are too long\n");
+	return -1;
+    }
+
+    if (nk_fs_mount(fs_name, "/")) {
+	return -1;
+    }
+
+    fshost_disk_stats(dev, &ds, 1);
+
+    rc = fshost_cmd_fsbench_impl->handler(line, 0);
+
+    fshost_disk_stats(dev, &ds, 1);
+
+    printf("fsbench engine=%s dev_reads=%lu dev_writes=%lu dev_blocks_read=%lu dev_blocks_written=%lu dev_flushes=%lu status=%s\n",
+	   engine, ds.reads, ds.writes, ds.blocks_read, ds.blocks_written, ds.flushes,
+	   rc ? "failed" : "ok");
+
+    if (nk_fs_umount("/")) {
+	rc = -1;
+    }
+
+    return rc;
+}
@@ -0,0 +1,151 @@
+#!/bin/sh
+#
+# Builds a small tree, puts it on fresh ext2, FAT32 and exFAT images,
+# and checks that every engine that can read an image sees the same
+# tree, that fsbench runs through the VFS on each, and that the host's
+# fsck (where there is one) agrees afterwards.
+#
+# FAT images are made with FatFs itself (fshost mkfs) and written by
+# FatFs and read by the native engine, and the reverse.  A file the
+# native engine fragments is defragmented and read back with FatFs.  ext2 images
+# need 128 byte inodes, which is all the ext2 engine handles.
+#
+
+FSHOST=${FSHOST:-./fshost}
+DIR=$(mktemp -d /tmp/fshost.XXXXXX)
+FAILED=0
+
+trap 'rm -rf $DIR' EXIT
+
+fail() {
+    echo "FAIL: $*"
+    FAILED=1
+}
+
+run() {
+    if ! "$FSHOST" "$@" > $DIR/out 2>&1; then
+	cat $DIR/out
+	fail "fshost $*"
+	return 1
+    fi
+    grep '^fsbench\|match\|^defrag' $DIR/out
+    return 0
+}
+
+mkdir -p $DIR/tree/sub/deeper
+head -c 100000 /dev/urandom > $DIR/tree/a.bin
+echo hello > $DIR/tree/readme
+head -c 3000000 /dev/urandom > $DIR/tree/sub/big
+head -c 4097 /dev/urandom > $DIR/tree/sub/deeper/odd
+
+FILES="a.bin readme sub/big sub/deeper/odd"
+
+put_tree() {
+    run "$@" mkdir /sub && run "$@" mkdir /sub/deeper || return 1
+    for f in $FILES; do
+	run "$@" put $DIR/tree/$f /$f || return 1
+    done
+}
+
+BENCH="bench size=4M files=64"
+# ext2 has no rename
+EXT2_BENCH="$BENCH tests=io,create,stat,unlink"
+
+echo "== ext2"
+if command -v mkfs.ext2 > /dev/null; then
+    mkfs.ext2 -q -F -I 128 -b 1024 -d $DIR/tree $DIR/ext2.img 32M > /dev/null 2>&1
+    run $DIR/ext2.img check $DIR/tree
+    run $DIR/ext2.img $EXT2_BENCH
+    run -p $DIR/ext2.img $EXT2_BENCH direct=1
+    run $DIR/ext2.img put $DIR/tree/sub/big /copy
+    if command -v debugfs > /dev/null; then
+	debugfs -R "dump /copy $DIR/copy" $DIR/ext2.img 2> /dev/null
+	cmp -s $DIR/copy $DIR/tree/sub/big || fail "ext2 /copy as seen by debugfs"
+    fi
+    if command -v e2fsck > /dev/null; then
+	e2fsck -fn $DIR/ext2.img > $DIR/fsck 2>&1 || { cat $DIR/fsck; fail "e2fsck"; }
+    fi
+else
+    echo "no mkfs.ext2, skipped"
+fi
+
+# a new directory, and a file created and one removed in a directory
+# that is not the root
+echo "== ext2 subdirectory"
+if command -v mkfs.ext2 > /dev/null && command -v debugfs > /dev/null && command -v e2fsck > /dev/null; then
+    mkfs.ext2 -q -F -I 128 -b 1024 -d $DIR/tree $DIR/sub.img 8M > /dev/null 2>&1
+    run $DIR/sub.img mkdir /new
+    run $DIR/sub.img put $DIR/tree/readme /new/y
+    run $DIR/sub.img put $DIR/tree/readme /sub/y
+    run $DIR/sub.img rm /sub/big
+    debugfs -R "ls -p /" $DIR/sub.img 2> /dev/null | grep -q "/y/" && fail "ext2 /sub/y or /new/y is in the root"
+    debugfs -R "ls -p /new" $DIR/sub.img 2> /dev/null | grep -q "/y/" || fail "ext2 /new/y is not in /new"
+    debugfs -R "ls -p /sub" $DIR/sub.img 2> /dev/null | grep -q "/y/" || fail "ext2 /sub/y is not in /sub"
+    debugfs -R "ls -p /sub" $DIR/sub.img 2> /dev/null | grep -q "/big/" && fail "ext2 /sub/big was not removed"
+    e2fsck -fn $DIR/sub.img > $DIR/fsck 2>&1 || { cat $DIR/fsck; fail "e2fsck after subdirectory changes"; }
+else
+    echo "no mkfs.ext2, debugfs or e2fsck, skipped"
+fi
+
+# long names fill a 1K block with four entries, so 60 of them grow the
+# root directory past its 12 direct blocks, linear and indexed
+echo "== ext2 large directory"
+LONG=$(printf 'f%.0s' $(seq 200))
+if command -v mkfs.ext2 > /dev/null && command -v e2fsck > /dev/null; then
+    for features in ^dir_index dir_index; do
+	mkfs.ext2 -q -F -I 128 -b 1024 -O $features $DIR/dir.img 8M > /dev/null 2>&1
+	for i in $(seq 60); do
+	    run $DIR/dir.img put $DIR/tree/readme /$LONG$i || break
+	done
+	e2fsck -fn $DIR/dir.img > $DIR/fsck 2>&1 || { cat $DIR/fsck; fail "e2fsck of a large directory ($features)"; }
+    done
+else
+    echo "no mkfs.ext2 or e2fsck, skipped"
+fi
+
+echo "== fat32"
+truncate -s 64M $DIR/fat32.img
+run $DIR/fat32.img mkfs fat32
+put_tree -e ff $DIR/fat32.img
+run -e fatfs $DIR/fat32.img check $DIR/tree
+run -e fatfs $DIR/fat32.img $BENCH
+run -e fatfs $DIR/fat32.img $BENCH threads=4
+run -e ff-fastseek -p $DIR/fat32.img $BENCH threads=2
+run -e fatfs $DIR/fat32.img put $DIR/tree/sub/big /copy
+run -e ff $DIR/fat32.img get /copy $DIR/copy
+cmp -s $DIR/copy $DIR/tree/sub/big || fail "fat32 /copy as seen by FatFs"
+run -e ff $DIR/fat32.img check $DIR/tree
+if command -v fsck.fat > /dev/null; then
+    fsck.fat -n $DIR/fat32.img > $DIR/fsck 2>&1 || { cat $DIR/fsck; fail "fsck.fat"; }
+fi
+
+echo "== fat32 defrag"
+for i in 1 2 3 4 5 6 7 8; do
+    run -e fatfs $DIR/fat32.img put $DIR/tree/sub/deeper/odd /hole$i
+done
+for i in 1 3 5 7; do
+    run -e fatfs $DIR/fat32.img rm /hole$i
+done
+run -e fatfs $DIR/fat32.img put $DIR/tree/sub/big /frag
+run -e fatfs $DIR/fat32.img defrag
+"$FSHOST" -e fatfs $DIR/fat32.img frag 2> /dev/null | grep -q " 0 fragmented" || fail "fat32 still fragmented"
+run -e ff $DIR/fat32.img get /frag $DIR/copy
+cmp -s $DIR/copy $DIR/tree/sub/big || fail "fat32 /frag after defrag"
+run -e ff $DIR/fat32.img check $DIR/tree
+if command -v fsck.fat > /dev/null; then
+    fsck.fat -n $DIR/fat32.img > $DIR/fsck 2>&1 || { cat $DIR/fsck; fail "fsck.fat after defrag"; }
+fi
+
+echo "== exfat"
+truncate -s 64M $DIR/exfat.img
+run $DIR/exfat.img mkfs exfat
+put_tree $DIR/exfat.img
+run $DIR/exfat.img check $DIR/tree
+run $DIR/exfat.img $BENCH threads=2
+run -p $DIR/exfat.img $BENCH
+
+if [ $FAILED -ne 0 ]; then
+    echo "check FAILED"
+    exit 1
+fi
+echo "check passed"
@@ -0,0 +1,475 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2017, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+
+/*
+ * fshost - drive the kernel's filesystem engines from a Linux shell
+ *
+ *   fshost [-e engine] [-b blocksize] [-p] [-r] image command [args]
+ *
+ * engine is ext2, fatfs (the native FAT32 engine), ff or ff-fastseek
+ * (FatFs), and by default is picked from the image's superblock.  The
+ * image is mmap'd, as a ramdisk would be, unless -p asks for pread and
+ * pwrite, as for a disk.  Commands:
+ *
+ *   mkfs fat32|exfat [cluster]    format with FatFs (no engine attached)
+ *   ls [path]
+ *   cat path
+ *   put hostfile path
+ *   get path hostfile
+ *   mkdir path
+ *   rm path
+ *   check hostdir [path]          compare a host tree with the image's
+ *   bench [key=value ...]         fsbench, see bench.c
+ *
+ * check is meant for images built from hostdir by another
+ * implementation (mkfs.ext2 -d, mcopy, or the other FAT engine), and
+ * fails on the first file whose size or contents differ.
+ */
+
+#include "host.h"
+#include <dirent.h>
+
+#include <nautilus/nautilus.h>
+#include <nautilus/blkdev.h>
+#include <nautilus/fs.h>
+#include <fs/fatfs/fatfs.h>
+#include <fs/ext2/ext2.h>
+
+#include "shim.h"
+#include "fshost.h"
+
+#define DEV_NAME "image"
+#define FS_NAME  "fshost"
+
+#define XFER     (1UL << 20)
+
+static struct nk_block_dev *dev;
+static struct nk_fs        *fs;
+static char                *engine;
+
+
+static int attach(int readonly)
+{
+    struct nk_block_dev_characteristics c;
+    uint64_t n;
+    uint8_t *sb;
+    int rc;
+
+    if (!engine) {
+	// the ext2 magic is at 1080, exFAT's name at 3
+	nk_block_dev_get_characteristics(dev, &c);
+	n = (1082 + c.block_size - 1) / c.block_size;
+	if (n > c.num_blocks || !(sb = calloc(n, c.block_size))) {
+	    return -1;
+	}
+	nk_block_dev_read(dev, 0, n, sb, NK_DEV_REQ_BLOCKING, 0, 0);
+	if (sb[1080] == 0x53 && sb[1081] == 0xef) {
+	    engine = "ext2";
+	} else if (!memcmp(sb + 3, "EXFAT   ", 8)) {
+	    engine = "ff";
+	} else {
+	    engine = "fatfs";
+	}
+	free(sb);
+    }
+
+    if (!strcmp(engine, "ext2")) {
+	rc = nk_fs_ext2_attach(DEV_NAME, FS_NAME, readonly);
+    } else if (!strcmp(engine, "fatfs")) {
+	rc = nk_fs_fatfs_attach(DEV_NAME, FS_NAME, readonly);
+    } else if (!strcmp(engine, "ff")) {
+	rc = nk_fs_fatfs_attach_engine(DEV_NAME, FS_NAME, readonly, NK_FS_FATFS_CHAN);
+    } else if (!strcmp(engine, "ff-fastseek")) {
+	rc = nk_fs_fatfs_attach_engine(DEV_NAME, FS_NAME, readonly, NK_FS_FATFS_CHAN | NK_FS_FATFS_FASTSEEK);
+    } else {
+	fprintf(stderr, "Unknown engine %s\n", engine);
+	return -1;
+    }
+
+    if (rc || !(fs = nk_fs_find(FS_NAME))) {
+	fprintf(stderr, "Cannot attach %s engine to the image\n", engine);
+	return -1;
+    }
+
+    return 0;
+}
+
+static int detach(void)
+{
+    if (fs->interface->sync_fs && fs->interface->sync_fs(fs->state)) {
+	fprintf(stderr, "Sync failed\n");
+	return -1;
+    }
+    if (!strcmp(engine, "ext2")) {
+	return nk_fs_ext2_detach(FS_NAME);
+    } else {
+	return nk_fs_fatfs_detach(FS_NAME);
+    }
+}
+
+
+static void *open_file(char *path, int create)
+{
+    struct nk_fs_int *in = fs->interface;
+
+    if (in->exists(fs->state, path)) {
+	return in->open_file(fs->state, path);
+    } else if (create) {
+	return in->create_file(fs->state, path);
+    } else {
+	return 0;
+    }
+}
+
+static void close_file(void *f)
+{
+    if (fs->interface->close_file) {
+	fs->interface->close_file(fs->state, f);
+    }
+}
+
+static int do_ls(char *path)
+{
+    struct nk_fs_dirent ents[16];
+    void *d;
+    ssize_t n, i;
+
+    if (!fs->interface->opendir || !(d = fs->interface->opendir(fs->state, path))) {
+	fprintf(stderr, "Cannot open directory %s\n", path);
+	return -1;
+    }
+
+    while ((n = fs->interface->readdir_batch(fs->state, d, ents, 16)) > 0) {
+	for (i=0;i<n;i++) {
+	    printf("%c %12lu %s\n", ents[i].attr & NK_FS_ATTR_DIR ? 'd' : '-', ents[i].size, ents[i].name);
+	}
+    }
+
+    fs->interface->closedir(fs->state, d);
+
+    return n < 0 ? -1 : 0;
+}
+
+// engines with vectored I/O get the transfer in three uneven pieces,
+// so that segments start and end inside blocks
+static ssize_t file_rw(void *f, uint8_t *buf, uint64_t off, size_t n, int write)
+{
+    struct nk_fs_iovec iov[3];
+    size_t a = n < 1 ? n : 1;
+    size_t b = n - a < 4095 ? n - a : 4095;
+
+    if (!(write ? fs->interface->writev_file : fs->interface->readv_file)) {
+	return write ? fs->interface->write_file(fs->state, f, buf, off, n)
+	    : fs->interface->read_file(fs->state, f, buf, off, n);
+    }
+
+    iov[0] = (struct nk_fs_iovec){ buf, a };
+    iov[1] = (struct nk_fs_iovec){ buf + a, b };
+    iov[2] = (struct nk_fs_iovec){ buf + a + b, n - a - b };
+
+    return write ? fs->interface->writev_file(fs->state, f, iov, 3, off)
+	: fs->interface->readv_file(fs->state, f, iov, 3, off);
+}
+
+static int do_cat(char *path, int out)
+{
+    struct nk_fs_stat st;
+    uint8_t *buf;
+    uint64_t off;
+    ssize_t n;
+    void *f;
+    int rc = 0;
+
+    if (!(f = open_file(path, 0)) || fs->interface->stat(fs->state, f, &st)) {
+	fprintf(stderr, "Cannot open %s\n", path);
+	return -1;
+    }
+
+    buf = malloc(XFER);
+
+    for (off=0;off<st.st_size;off+=n) {
+	n = file_rw(f, buf, off, XFER, 0);
+	if (n <= 0 || write(out, buf, n) != n) {
+	    fprintf(stderr, "Read of %s failed at %lu\n", path, off);
+	    rc = -1;
+	    break;
+	}
+    }
+
+    free(buf);
+    close_file(f);
+
+    return rc;
+}
+
+static int do_get(char *path, char *hostfile)
+{
+    int out = open(hostfile, HOST_O_WRONLY | HOST_O_CREAT | HOST_O_TRUNC, 0644);
+    int rc;
+
+    if (out < 0) {
+	fprintf(stderr, "Cannot create %s\n", hostfile);
+	return -1;
+    }
+    rc = do_cat(path, out);
+    close(out);
+    return rc;
+}
+
+static int do_put(char *hostfile, char *path)
+{
+    int in = open(hostfile, HOST_O_RDONLY);
+    uint8_t *buf;
+    uint64_t off = 0;
+    ssize_t n;
+    void *f;
+    int rc = 0;
+
+    if (in < 0) {
+	fprintf(stderr, "Cannot open %s\n", hostfile);
+	return -1;
+    }
+
+    if (!(f = open_file(path, 1)) ||
+	(fs->interface->trunc_file && fs->interface->trunc_file(fs->state, f, 0))) {
+	fprintf(stderr, "Cannot create %s\n", path);
+	close(in);
+	return -1;
+    }
+
+    buf = malloc(XFER);
+
+    while ((n = read(in, buf, XFER)) > 0) {
+	if (file_rw(f, buf, off, n, 1) != n) {
+	    fprintf(stderr, "Write of %s failed at %lu\n", path, off);
+	    rc = -1;
+	    break;
+	}
+	off += n;
+    }
+
+    free(buf);
+    close_file(f);
+    close(in);
+
+    return rc;
+}
+
+// compares hostdir and path recursively; returns the number of files
+// checked, or -1 on the first difference
+static long do_check(char *hostdir, char *path)
+{
+    char hp[1024], fp[1024];
+    uint8_t *hbuf, *fbuf;
+    struct nk_fs_stat st;
+    struct stat hst;
+    struct dirent *de;
+    long count = 0, sub;
+    uint64_t off;
+    ssize_t n;
+    DIR *d;
+    void *f;
+    int in;
+
+    if (!(d = opendir(hostdir))) {
+	fprintf(stderr, "Cannot open %s\n", hostdir);
+	return -1;
+    }
+
+    hbuf = malloc(XFER);
+    fbuf = malloc(XFER);
+
+    while ((de = readdir(d))) {
+	if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, "..") || !strcmp(de->d_name, "lost+found")) {
+	    continue;
+	}
+	snprintf(hp, sizeof(hp), "%s/%s", hostdir, de->d_name);
+	snprintf(fp, sizeof(fp), "%s/%s", strcmp(path, "/") ? path : "", de->d_name);
+	if (stat(hp, &hst)) {
+	    continue;
+	}
+	if (S_ISDIR(hst.st_mode)) {
+	    if ((sub = do_check(hp, fp)) < 0) {
+		count = -1;
+		break;
+	    }
+	    count += sub;
+	    continue;
+	}
+	if (!S_ISREG(hst.st_mode)) {
+	    continue;
+	}
+	if (!(f = open_file(fp, 0)) || fs->interface->stat(fs->state, f, &st)) {
+	    fprintf(stderr, "%s is missing\n", fp);
+	    count = -1;
+	    break;
+	}
+	if (st.st_size != hst.st_size) {
+	    fprintf(stderr, "%s is %lu bytes, not %lu\n", fp, st.st_size, (uint64_t)hst.st_size);
+	    close_file(f);
+	    count = -1;
+	    break;
+	}
+	in = open(hp, HOST_O_RDONLY);
+	for (off=0;off<st.st_size;off+=n) {
+	    n = read(in, hbuf, XFER);
+	    if (n <= 0 || file_rw(f, fbuf, off, n, 0) != n ||
+		memcmp(hbuf, fbuf, n)) {
+		fprintf(stderr, "%s differs at or after %lu\n", fp, off);
+		count = -1;
+		break;
+	    }
+	}
+	close(in);
+	close_file(f);
+	if (count < 0) {
+	    break;
+	}
+	count++;
+    }
+
+    free(hbuf);
+    free(fbuf);
+    closedir(d);
+
+    return count;
+}
+
+// runs the defragmenter in the background, as the shell's fatdefrag
+// start does, and waits for it
+static int do_defrag(uint64_t rate)
+{
+    struct nk_fs_fatfs_defrag_stats s;
+
+    if (nk_fs_fatfs_defrag(FS_NAME, rate, 1)) {
+	return -1;
+    }
+
+    do {
+	usleep(10000);
+	if (nk_fs_fatfs_defrag_stats(FS_NAME, &s)) {
+	    return -1;
+	}
+    } while (s.running);
+
+    printf("defrag: %lu passes, %lu files moved (%lu clusters), %lu skipped, %lu retries\n",
+	   s.passes, s.files_moved, s.clusters_moved, s.files_skipped, s.retries);
+
+    return 0;
+}
+
+static void usage(void)
+{
+    fprintf(stderr,
+	    "fshost [-e ext2|fatfs|ff|ff-fastseek] [-b blocksize] [-p] [-r] image command [args]\n"
+	    "  mkfs fat32|exfat [cluster]\n"
+	    "  ls [path]\n"
+	    "  cat path\n"
+	    "  put hostfile path\n"
+	    "  get path hostfile\n"
+	    "  mkdir path\n"
+	    "  rm path\n"
+	    "  check hostdir [path]\n"
+	    "  bench [tests=all] [bs=4096] [qd=1] [threads=1] [size=16M] [ops=N] [files=256]\n"
+	    "        [seed=1] [direct=0] [keep=0]\n"
+	    "  frag [frag|all]                 fatfs only\n"
+	    "  defrag [KB/s]                   fatfs only\n");
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t block_size = 512;
+    int use_mmap = 1, readonly = 0;
+    char *cmd;
+    long n;
+    int opt, rc = -1;
+
+    while ((opt = getopt(argc, argv, "e:b:pr")) != -1) {
+	switch (opt) {
+	case 'e': engine = optarg; break;
+	case 'b': block_size = strtoul(optarg, 0, 0); break;
+	case 'p': use_mmap = 0; break;
+	case 'r': readonly = 1; break;
+	default: usage(); return 1;
+	}
+    }
+
+    if (argc - optind < 2) {
+	usage();
+	return 1;
+    }
+
+    nk_fs_init();
+
+    if (!(dev = fshost_disk_open(DEV_NAME, argv[optind], block_size, readonly, use_mmap))) {
+	return 1;
+    }
+
+    cmd = argv[optind+1];
+    argv += optind + 2;
+    argc -= optind + 2;
+
+    if (!strcmp(cmd, "mkfs")) {
+	rc = argc < 1 ? -1 : fshost_mkfs(dev, argv[0], argc > 1 ? strtoul(argv[1], 0, 0) : 0);
+	fshost_disk_close(dev);
+	return rc ? 1 : 0;
+    }
+
+    if (attach(readonly)) {
+	fshost_disk_close(dev);
+	return 1;
+    }
+
+    if (!strcmp(cmd, "ls")) {
+	rc = do_ls(argc > 0 ? argv[0] : "/");
+    } else if (!strcmp(cmd, "cat") && argc == 1) {
+	rc = do_cat(argv[0], 1);
+    } else if (!strcmp(cmd, "get") && argc == 2) {
+	rc = do_get(argv[0], argv[1]);
+    } else if (!strcmp(cmd, "put") && argc == 2) {
+	rc = do_put(argv[0], argv[1]);
+    } else if (!strcmp(cmd, "mkdir") && argc == 1) {
+	rc = fs->interface->create_dir(fs->state, argv[0]);
+    } else if (!strcmp(cmd, "rm") && argc == 1) {
+	rc = fs->interface->remove(fs->state, argv[0]);
+    } else if (!strcmp(cmd, "check") && argc >= 1) {
+	n = do_check(argv[0], argc > 1 ? argv[1] : "/");
+	if (n >= 0) {
+	    printf("%ld files match\n", n);
+	}
+	rc = n < 0 ? -1 : 0;
+    } else if (!strcmp(cmd, "bench")) {
+	rc = fshost_bench(FS_NAME, dev, engine, argc, argv);
+    } else if (!strcmp(cmd, "frag")) {
+	rc = nk_fs_fatfs_frag_report(FS_NAME, argc < 1 ? 0 : !strcmp(argv[0], "all") ? 2 : 1);
+    } else if (!strcmp(cmd, "defrag")) {
+	rc = do_defrag(argc > 0 ? strtoul(argv[0], 0, 0) * 1024 : 0);
+    } else {
+	usage();
+    }
+
+    if (detach()) {
+	rc = -1;
+    }
+
+    fshost_disk_close(dev);
+
+    return rc ? 1 : 0;
+}
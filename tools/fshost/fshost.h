@@ -0,0 +1,33 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2017, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+
+#ifndef __FSHOST_H__
+#define __FSHOST_H__
+
+struct nk_block_dev;
+
+// formats dev as "fat32" or "exfat"; cluster is in bytes, 0 for the default
+int fshost_mkfs(struct nk_block_dev *dev, char *type, uint32_t cluster);
+
+// runs fsbench with the key=value arguments on the filesystem fs_name,
+// which is on dev
+int fshost_bench(char *fs_name, struct nk_block_dev *dev, char *engine, int argc, char **argv);
+
+#endif
@@ -0,0 +1,49 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2017, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+
+#ifndef __FSHOST_HOST_H__
+#define __FSHOST_HOST_H__
+
+// The host's file API, included before <nautilus/fs.h>, which has its
+// own O_* flags.  The host's are kept as HOST_O_*
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+enum {
+    HOST_O_RDONLY = O_RDONLY,
+    HOST_O_WRONLY = O_WRONLY,
+    HOST_O_RDWR   = O_RDWR,
+    HOST_O_CREAT  = O_CREAT,
+    HOST_O_TRUNC  = O_TRUNC,
+};
+
+#undef O_RDONLY
+#undef O_WRONLY
+#undef O_RDWR
+#undef O_APPEND
+#undef O_CREAT
+#undef O_TRUNC
+#undef O_DIRECT
+
+#endif
@@ -0,0 +1,33 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2017, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+
+// fshost: malloc and free are the host's, but malloc, like the
+// kernel's, returns page-aligned memory for a page or more, which
+// nk_fs_mmap and O_DIRECT buffers rely on
+
+#ifndef __MM_H__
+#define __MM_H__
+
+#include <stdlib.h>
+
+void *fshost_malloc(size_t size);
+#define malloc(n) fshost_malloc(n)
+
+#endif
@@ -0,0 +1,42 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2017, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+
+// fshost: the kernel's types, from the host's headers
+
+#ifndef __NAUT_TYPES_H__
+#define __NAUT_TYPES_H__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+typedef unsigned char uchar_t;
+typedef unsigned long ulong_t;
+typedef int64_t       sint64_t;
+typedef int32_t       sint32_t;
+typedef int16_t       sint16_t;
+typedef char          sint8_t;
+typedef ulong_t       addr_t;
+typedef uchar_t       bool_t;
+
+#define FALSE 0
+#define TRUE 1
+
+#endif
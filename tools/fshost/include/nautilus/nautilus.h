@@ -0,0 +1,80 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2017, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+
+// fshost: the part of <nautilus/nautilus.h> the filesystem engines use,
+// on top of the host C library
+
+#ifndef __NAUTILUS_H__
+#define __NAUTILUS_H__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <nautilus/naut_types.h>
+#include <nautilus/naut_string.h>
+#include <nautilus/printk.h>
+#include <nautilus/mm.h>
+
+#define DEBUG_PRINT(fmt, args...) fprintf(stderr, "DEBUG: " fmt, ##args)
+#define ERROR_PRINT(fmt, args...) fprintf(stderr, "ERROR at %s(%d): " fmt, __FILE__, __LINE__, ##args)
+#define WARN_PRINT(fmt, args...)  fprintf(stderr, "WARNING: " fmt, ##args)
+#define INFO_PRINT(fmt, args...)  fprintf(stderr, fmt, ##args)
+
+#define nk_vc_printf(fmt, args...) printf(fmt, ##args)
+
+#define panic(fmt, args...) do { fprintf(stderr, "PANIC: " fmt, ##args); abort(); } while (0)
+
+#define PAGE_SIZE_4KB 4096UL
+
+// each host thread started by nk_thread_start is a CPU of its own, so
+// that per-CPU state is never shared
+int my_cpu_id(void);
+uint32_t nk_get_num_cpus(void);
+
+// there are no interrupts to disable
+static inline uint8_t irq_disable_save(void)
+{
+    return 0;
+}
+
+static inline void irq_enable_restore(uint8_t iflag)
+{
+}
+
+static inline uint64_t rdtsc(void)
+{
+    return __builtin_ia32_rdtsc();
+}
+
+struct cpu {
+    ulong_t cpu_khz;    // of the TSC, measured at startup
+};
+
+struct sys_info {
+    struct cpu *cpus[NAUT_CONFIG_MAX_CPUS];
+};
+
+struct naut_info {
+    struct sys_info sys;
+};
+
+struct naut_info *nk_get_nautilus_info(void);
+
+#endif
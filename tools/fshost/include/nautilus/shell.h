@@ -0,0 +1,39 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2017, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+
+// fshost: there is no shell; a command fshost runs itself is found
+// by its symbol, fshost_cmd_<impl>
+
+#ifndef __SHELL_H__
+#define __SHELL_H__
+
+#define SHELL_MAX_CMD 80
+
+struct shell_cmd_impl {
+    char * cmd;
+    char * help_str;
+    int (*handler)(char * buf, void * priv);
+};
+
+#define nk_register_shell_cmd(cmd) \
+    struct shell_cmd_impl * fshost_cmd_##cmd \
+    __attribute__((used)) = &cmd;
+
+#endif
@@ -0,0 +1,67 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2017, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+
+// fshost: spinlocks are test-and-set loops, as in the kernel, so
+// engines built here can be run from several host threads
+
+#ifndef __SPINLOCK_H__
+#define __SPINLOCK_H__
+
+#include <nautilus/naut_types.h>
+
+typedef volatile int spinlock_t;
+
+static inline void spinlock_init(volatile spinlock_t *lock)
+{
+    *lock = 0;
+}
+
+static inline void spinlock_deinit(volatile spinlock_t *lock)
+{
+    *lock = 0;
+}
+
+static inline void spin_lock(volatile spinlock_t *lock)
+{
+    while (__sync_lock_test_and_set(lock, 1)) {
+	while (*lock) {
+	    __builtin_ia32_pause();
+	}
+    }
+}
+
+static inline void spin_unlock(volatile spinlock_t *lock)
+{
+    __sync_lock_release(lock);
+}
+
+// there are no interrupts to disable
+static inline uint8_t spin_lock_irq_save(volatile spinlock_t *lock)
+{
+    spin_lock(lock);
+    return 0;
+}
+
+static inline void spin_unlock_irq_restore(volatile spinlock_t *lock, uint8_t flags)
+{
+    spin_unlock(lock);
+}
+
+#endif
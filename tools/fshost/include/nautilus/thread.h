@@ -0,0 +1,52 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2017, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+
+// fshost: threads are detached or joinable pthreads
+
+#ifndef __THREAD_H__
+#define __THREAD_H__
+
+#include <nautilus/naut_types.h>
+
+#define CPU_ANY       -1
+#define TSTACK_1MB    0x100000
+
+typedef void* nk_thread_id_t;
+typedef void (*nk_thread_fun_t)(void * input, void ** output);
+
+struct nk_aspace;
+
+// host threads all run in the one address space
+typedef struct nk_thread {
+    struct nk_aspace *aspace;
+} nk_thread_t;
+
+static inline nk_thread_t *get_cur_thread(void)
+{
+    return 0;
+}
+
+int nk_thread_start(nk_thread_fun_t fun, void *input, void **output, uint8_t is_detached,
+                    uint64_t stack_size, nk_thread_id_t *tid, int bound_cpu);
+int nk_thread_name(nk_thread_id_t tid, char *name);
+int nk_join_all_children(int (*output_consumer)(void *output));
+void nk_yield(void);
+
+#endif
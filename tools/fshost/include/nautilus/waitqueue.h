@@ -0,0 +1,41 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2017, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+
+// fshost: a wait queue is a pthread condition variable; its mutex
+// stands in for the queue's lock, under which the condition is checked
+
+#ifndef __WAITQUEUE_H__
+#define __WAITQUEUE_H__
+
+#include <nautilus/naut_types.h>
+
+#define NK_WAIT_QUEUE_NAME_LEN 32
+
+typedef struct nk_wait_queue nk_wait_queue_t;
+
+nk_wait_queue_t *nk_wait_queue_create(char *name);
+void             nk_wait_queue_destroy(nk_wait_queue_t *q);
+
+void nk_wait_queue_sleep_extended(nk_wait_queue_t *q, int (*cond_check)(void *state), void *state);
+void nk_wait_queue_wake_all_extended(nk_wait_queue_t *q, int havelock);
+
+#define nk_wait_queue_wake_all(q) nk_wait_queue_wake_all_extended(q,0)
+
+#endif
@@ -0,0 +1,72 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2017, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+
+/*
+ * FAT32 and exFAT images made with FatFs' f_mkfs, so that no mkfs.vfat
+ * or mkfs.exfat is needed on the host.  This is apart from fshost.c
+ * since ff.h's DIR is not the host's
+ */
+
+#include <nautilus/nautilus.h>
+#include <nautilus/blkdev.h>
+
+#include "ff.h"
+#include "diskio.h"
+
+#include "fshost.h"
+
+int fshost_mkfs(struct nk_block_dev *dev, char *type, uint32_t cluster)
+{
+    MKFS_PARM opt = { .n_fat = 2, .au_size = cluster };
+    char drive[8];
+    void *work;
+    FRESULT res;
+    int pdrv;
+
+    if (!strcasecmp(type, "fat32")) {
+	opt.fmt = FM_FAT32 | FM_SFD;
+    } else if (!strcasecmp(type, "exfat")) {
+	opt.fmt = FM_EXFAT | FM_SFD;
+	opt.n_fat = 1;
+    } else {
+	ERROR("Unknown filesystem type %s\n", type);
+	return -1;
+    }
+
+    if ((pdrv = disk_bind(dev)) < 0) {
+	return -1;
+    }
+
+    if (!(work = malloc(FF_MAX_SS * 64))) {
+	disk_unbind(pdrv);
+	return -1;
+    }
+
+    snprintf(drive, sizeof(drive), "%u:", (BYTE)pdrv);
+
+    if ((res = f_mkfs(drive, &opt, work, FF_MAX_SS * 64)) != FR_OK) {
+	ERROR("f_mkfs failed (%d)\n", res);
+    }
+
+    free(work);
+    disk_unbind(pdrv);
+
+    return res == FR_OK ? 0 : -1;
+}
@@ -0,0 +1,602 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2017, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+
+/*
+ * The kernel services the filesystem engines call, on a Linux host.
+ *
+ * Block devices are image files, either mmap'd (and so memory-backed,
+ * with direct access, like a ramdisk) or read and written with
+ * pread/pwrite (like a disk).  The nk_fs registry and the VFS above it
+ * are the kernel's own, src/nautilus/fs.c.
+ *
+ * Each thread nk_thread_start makes gets a CPU id of its own for its
+ * lifetime, main being CPU 0, so the VFS's per-CPU caches are never
+ * shared between running threads.
+ */
+
+#include "host.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+#include <nautilus/nautilus.h>
+#include <nautilus/blkdev.h>
+#include <nautilus/fs.h>
+#include <nautilus/thread.h>
+#include <nautilus/waitqueue.h>
+#include <nautilus/semaphore.h>
+#include <nautilus/scheduler.h>
+#include <nautilus/timer.h>
+#include <nautilus/aspace.h>
+
+#include "shim.h"
+
+#define ERROR(fmt, args...) ERROR_PRINT("shim: " fmt, ##args)
+
+static LIST_HEAD(dev_list);
+
+static spinlock_t stats_lock;
+
+static spinlock_t   cpu_lock;
+static uint8_t      cpu_used[NAUT_CONFIG_MAX_CPUS] = { 1 };   // main is CPU 0
+static __thread int cpu_id;
+
+static struct cpu       the_cpu;
+static struct naut_info info;
+
+// the joinable threads, for nk_join_all_children
+struct child {
+    pthread_t         t;
+    pthread_t         parent;
+    struct list_head  node;
+};
+
+static LIST_HEAD(child_list);
+static spinlock_t child_lock;
+
+struct fshost_disk {
+    struct nk_block_dev     dev;
+    struct nk_block_dev_int inter;
+    int                     fd;
+    uint8_t                *data;   // if mmap'd
+    uint64_t                block_size;
+    uint64_t                num_blocks;
+    struct fshost_disk_stats stats;
+};
+
+static struct fshost_disk *disk_of(struct nk_block_dev *d)
+{
+    return (struct fshost_disk *)d;
+}
+
+
+struct nk_block_dev *fshost_disk_open(char *name, char *path, uint64_t block_size, int readonly, int use_mmap)
+{
+    struct fshost_disk *d;
+    struct stat st;
+
+    if (!(d = calloc(1, sizeof(*d)))) {
+	return 0;
+    }
+
+    if ((d->fd = open(path, readonly ? HOST_O_RDONLY : HOST_O_RDWR)) < 0) {
+	ERROR("Cannot open %s\n", path);
+	free(d);
+	return 0;
+    }
+
+    if (fstat(d->fd, &st) || !block_size || st.st_size < block_size) {
+	ERROR("%s is too small\n", path);
+	close(d->fd);
+	free(d);
+	return 0;
+    }
+
+    d->block_size = block_size;
+    d->num_blocks = st.st_size / block_size;
+
+    if (use_mmap) {
+	d->data = mmap(0, d->num_blocks * block_size, PROT_READ | (readonly ? 0 : PROT_WRITE),
+		       MAP_SHARED, d->fd, 0);
+	if (d->data == MAP_FAILED) {
+	    ERROR("Cannot map %s\n", path);
+	    close(d->fd);
+	    free(d);
+	    return 0;
+	}
+    }
+
+    strncpy(d->dev.dev.name, name, DEV_NAME_LEN-1);
+    d->dev.dev.type = NK_DEV_BLK;
+    d->dev.dev.state = d;
+    d->dev.dev.interface = &d->inter.dev_int;
+
+    list_add_tail(&d->dev.dev.dev_list_node, &dev_list);
+
+    return &d->dev;
+}
+
+void fshost_disk_close(struct nk_block_dev *dev)
+{
+    struct fshost_disk *d = disk_of(dev);
+
+    // as a ramdisk refuses to be destroyed
+    if (nk_block_dev_attached(dev)) {
+	ERROR("Closing %s with a filesystem still attached\n", dev->dev.name);
+    }
+
+    list_del(&d->dev.dev.dev_list_node);
+
+    if (d->data) {
+	msync(d->data, d->num_blocks * d->block_size, MS_SYNC);
+	munmap(d->data, d->num_blocks * d->block_size);
+    }
+    fsync(d->fd);
+    close(d->fd);
+    free(d);
+}
+
+void fshost_disk_stats(struct nk_block_dev *dev, struct fshost_disk_stats *s, int reset)
+{
+    struct fshost_disk *d = disk_of(dev);
+
+    spin_lock(&stats_lock);
+    *s = d->stats;
+    if (reset) {
+	memset(&d->stats, 0, sizeof(d->stats));
+    }
+    spin_unlock(&stats_lock);
+}
+
+
+struct nk_block_dev *nk_block_dev_find(char *name)
+{
+    struct list_head *cur;
+
+    list_for_each(cur, &dev_list) {
+	struct nk_dev *d = list_entry(cur, struct nk_dev, dev_list_node);
+	if (!strcmp(d->name, name)) {
+	    return (struct nk_block_dev *)d;
+	}
+    }
+    return 0;
+}
+
+void nk_block_dev_attach(struct nk_block_dev *dev)
+{
+    __sync_fetch_and_add(&dev->dev.attached, 1);
+}
+
+void nk_block_dev_detach(struct nk_block_dev *dev)
+{
+    __sync_fetch_and_sub(&dev->dev.attached, 1);
+}
+
+int nk_block_dev_attached(struct nk_block_dev *dev)
+{
+    return *(volatile int *)&dev->dev.attached;
+}
+
+int nk_block_dev_get_characteristics(struct nk_block_dev *dev, struct nk_block_dev_characteristics *c)
+{
+    struct fshost_disk *d = disk_of(dev);
+
+    c->block_size = d->block_size;
+    c->num_blocks = d->num_blocks;
+    return 0;
+}
+
+static int disk_rw(struct fshost_disk *d, uint64_t blocknum, uint64_t count, void *buf, int write)
+{
+    uint64_t off = blocknum * d->block_size, len = count * d->block_size;
+    ssize_t rc;
+
+    if (blocknum + count > d->num_blocks || blocknum + count < blocknum) {
+	ERROR("Access to blocks %lu+%lu is beyond the end of %s\n", blocknum, count, d->dev.dev.name);
+	return -1;
+    }
+
+    if (d->data) {
+	if (write) {
+	    memcpy(d->data + off, buf, len);
+	} else {
+	    memcpy(buf, d->data + off, len);
+	}
+    } else {
+	rc = write ? pwrite(d->fd, buf, len, off) : pread(d->fd, buf, len, off);
+	if (rc != len) {
+	    ERROR("%s of %lu bytes at %lu on %s failed\n", write ? "Write" : "Read", len, off, d->dev.dev.name);
+	    return -1;
+	}
+    }
+
+    spin_lock(&stats_lock);
+    if (write) {
+	d->stats.writes++;
+	d->stats.blocks_written += count;
+    } else {
+	d->stats.reads++;
+	d->stats.blocks_read += count;
+    }
+    spin_unlock(&stats_lock);
+
+    return 0;
+}
+
+int nk_block_dev_read(struct nk_block_dev *dev, uint64_t blocknum, uint64_t count, void *dest,
+		      nk_dev_request_type_t type, void (*callback)(nk_block_dev_status_t, void *), void *state)
+{
+    int rc = disk_rw(disk_of(dev), blocknum, count, dest, 0);
+
+    if (type == NK_DEV_REQ_CALLBACK && callback) {
+	callback(rc ? NK_BLOCK_DEV_STATUS_ERROR : NK_BLOCK_DEV_STATUS_SUCCESS, state);
+    }
+    return rc;
+}
+
+int nk_block_dev_write(struct nk_block_dev *dev, uint64_t blocknum, uint64_t count, void *src,
+		       nk_dev_request_type_t type, void (*callback)(nk_block_dev_status_t, void *), void *state)
+{
+    int rc = disk_rw(disk_of(dev), blocknum, count, src, 1);
+
+    if (type == NK_DEV_REQ_CALLBACK && callback) {
+	callback(rc ? NK_BLOCK_DEV_STATUS_ERROR : NK_BLOCK_DEV_STATUS_SUCCESS, state);
+    }
+    return rc;
+}
+
+int nk_block_dev_direct_access(struct nk_block_dev *dev, uint64_t blocknum, uint64_t count, void **ptr)
+{
+    struct fshost_disk *d = disk_of(dev);
+
+    if (!d->data || blocknum + count > d->num_blocks) {
+	return -1;
+    }
+
+    *ptr = d->data + blocknum * d->block_size;
+    return 0;
+}
+
+int nk_block_dev_flush(struct nk_block_dev *dev, nk_dev_request_type_t type,
+		       void (*callback)(nk_block_dev_status_t, void *), void *state)
+{
+    struct fshost_disk *d = disk_of(dev);
+    int rc;
+
+    if (d->data) {
+	rc = msync(d->data, d->num_blocks * d->block_size, MS_SYNC);
+    } else {
+	rc = fdatasync(d->fd);
+    }
+
+    spin_lock(&stats_lock);
+    d->stats.flushes++;
+    spin_unlock(&stats_lock);
+
+    if (type == NK_DEV_REQ_CALLBACK && callback) {
+	callback(rc ? NK_BLOCK_DEV_STATUS_ERROR : NK_BLOCK_DEV_STATUS_SUCCESS, state);
+    }
+    return rc ? -1 : 0;
+}
+
+
+void *fshost_malloc(size_t size)
+{
+    if (size >= PAGE_SIZE_4KB) {
+	return aligned_alloc(PAGE_SIZE_4KB, (size + PAGE_SIZE_4KB - 1) & ~(PAGE_SIZE_4KB - 1));
+    }
+    return (malloc)(size);
+}
+
+int my_cpu_id(void)
+{
+    return cpu_id;
+}
+
+uint32_t nk_get_num_cpus(void)
+{
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+    return n < 1 ? 1 : n > NAUT_CONFIG_MAX_CPUS ? NAUT_CONFIG_MAX_CPUS : n;
+}
+
+static int cpu_alloc(void)
+{
+    int i;
+
+    spin_lock(&cpu_lock);
+    for (i=1;i<NAUT_CONFIG_MAX_CPUS && cpu_used[i];i++) {
+    }
+    if (i < NAUT_CONFIG_MAX_CPUS) {
+	cpu_used[i] = 1;
+    }
+    spin_unlock(&cpu_lock);
+
+    return i < NAUT_CONFIG_MAX_CPUS ? i : -1;
+}
+
+static void cpu_free(int i)
+{
+    spin_lock(&cpu_lock);
+    cpu_used[i] = 0;
+    spin_unlock(&cpu_lock);
+}
+
+// the TSC rate is measured against the monotonic clock on first use
+struct naut_info *nk_get_nautilus_info(void)
+{
+    uint64_t t0, c0, t1, c1;
+    int i;
+
+    spin_lock(&cpu_lock);
+    if (!the_cpu.cpu_khz) {
+	t0 = nk_sched_get_realtime();
+	c0 = rdtsc();
+	nk_sleep(10000000);
+	t1 = nk_sched_get_realtime();
+	c1 = rdtsc();
+	the_cpu.cpu_khz = (c1 - c0) * 1000000 / (t1 - t0);
+	for (i=0;i<NAUT_CONFIG_MAX_CPUS;i++) {
+	    info.sys.cpus[i] = &the_cpu;
+	}
+    }
+    spin_unlock(&cpu_lock);
+
+    return &info;
+}
+
+
+struct thread_start {
+    nk_thread_fun_t fun;
+    void           *input;
+    void          **output;
+    int             cpu;
+};
+
+static void *thread_trampoline(void *arg)
+{
+    struct thread_start s = *(struct thread_start *)arg;
+
+    free(arg);
+    cpu_id = s.cpu;
+    s.fun(s.input, s.output);
+    cpu_free(s.cpu);
+
+    return 0;
+}
+
+int nk_thread_start(nk_thread_fun_t fun, void *input, void **output, uint8_t is_detached,
+                    uint64_t stack_size, nk_thread_id_t *tid, int bound_cpu)
+{
+    struct thread_start *s = malloc(sizeof(*s));
+    struct child *c = 0;
+    pthread_attr_t attr;
+    pthread_t t;
+    int rc;
+
+    if (!s || (!is_detached && !(c = malloc(sizeof(*c))))) {
+	free(s);
+	return -1;
+    }
+
+    if ((s->cpu = cpu_alloc()) < 0) {
+	ERROR("More than %d threads\n", NAUT_CONFIG_MAX_CPUS - 1);
+	free(s);
+	free(c);
+	return -1;
+    }
+
+    s->fun = fun;
+    s->input = input;
+    s->output = output;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, stack_size);
+    if (is_detached) {
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    }
+
+    if ((rc = pthread_create(&t, &attr, thread_trampoline, s))) {
+	ERROR("Cannot create thread (%d)\n", rc);
+	cpu_free(s->cpu);
+	free(s);
+	free(c);
+    } else {
+	if (tid) {
+	    *tid = (nk_thread_id_t)t;
+	}
+	if (c) {
+	    c->t = t;
+	    c->parent = pthread_self();
+	    spin_lock(&child_lock);
+	    list_add_tail(&c->node, &child_list);
+	    spin_unlock(&child_lock);
+	}
+    }
+
+    pthread_attr_destroy(&attr);
+
+    return rc ? -1 : 0;
+}
+
+int nk_thread_name(nk_thread_id_t tid, char *name)
+{
+    char n[16];
+
+    snprintf(n, sizeof(n), "%s", name);
+    return pthread_setname_np((pthread_t)tid, n) ? -1 : 0;
+}
+
+// outputs are not collected
+int nk_join_all_children(int (*output_consumer)(void *output))
+{
+    struct list_head *cur;
+    struct child *c;
+
+    while (1) {
+	c = 0;
+	spin_lock(&child_lock);
+	list_for_each(cur, &child_list) {
+	    c = list_entry(cur, struct child, node);
+	    if (pthread_equal(c->parent, pthread_self())) {
+		list_del(&c->node);
+		break;
+	    }
+	    c = 0;
+	}
+	spin_unlock(&child_lock);
+	if (!c) {
+	    return 0;
+	}
+	pthread_join(c->t, 0);
+	free(c);
+    }
+}
+
+// joined threads are gone already
+void nk_sched_reap(int unconditional)
+{
+}
+
+void nk_yield(void)
+{
+    sched_yield();
+}
+
+uint64_t nk_sched_get_realtime(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int nk_sleep(uint64_t ns)
+{
+    struct timespec ts = { .tv_sec = ns / 1000000000ULL, .tv_nsec = ns % 1000000000ULL };
+
+    while (nanosleep(&ts, &ts)) {
+    }
+
+    return 0;
+}
+
+// threads never have address spaces of their own
+int nk_aspace_add_region(nk_aspace_t *aspace, nk_aspace_region_t *region)
+{
+    return -1;
+}
+
+int nk_aspace_remove_region(nk_aspace_t *aspace, nk_aspace_region_t *region)
+{
+    return -1;
+}
+
+struct nk_wait_queue {
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+};
+
+nk_wait_queue_t *nk_wait_queue_create(char *name)
+{
+    nk_wait_queue_t *q = malloc(sizeof(*q));
+
+    if (!q) {
+	return 0;
+    }
+    pthread_mutex_init(&q->lock, 0);
+    pthread_cond_init(&q->cond, 0);
+    return q;
+}
+
+void nk_wait_queue_destroy(nk_wait_queue_t *q)
+{
+    pthread_cond_destroy(&q->cond);
+    pthread_mutex_destroy(&q->lock);
+    free(q);
+}
+
+// as in the kernel, returns after one wakeup, or at once if the
+// condition holds, and the caller looks again
+void nk_wait_queue_sleep_extended(nk_wait_queue_t *q, int (*cond_check)(void *state), void *state)
+{
+    pthread_mutex_lock(&q->lock);
+    if (!cond_check || !cond_check(state)) {
+	pthread_cond_wait(&q->cond, &q->lock);
+    }
+    pthread_mutex_unlock(&q->lock);
+}
+
+void nk_wait_queue_wake_all_extended(nk_wait_queue_t *q, int havelock)
+{
+    if (!havelock) {
+	pthread_mutex_lock(&q->lock);
+    }
+    pthread_cond_broadcast(&q->cond);
+    if (!havelock) {
+	pthread_mutex_unlock(&q->lock);
+    }
+}
+
+struct nk_semaphore {
+    pthread_mutex_t lock;
+    pthread_cond_t  cond;
+    int             count;
+};
+
+struct nk_semaphore *nk_semaphore_create(char *name, int init_count, nk_semaphore_type_t type,
+					 void *type_characteristics)
+{
+    struct nk_semaphore *s = malloc(sizeof(*s));
+
+    if (!s) {
+	return 0;
+    }
+    pthread_mutex_init(&s->lock, 0);
+    pthread_cond_init(&s->cond, 0);
+    s->count = init_count;
+    return s;
+}
+
+void nk_semaphore_release(struct nk_semaphore *s)
+{
+    pthread_cond_destroy(&s->cond);
+    pthread_mutex_destroy(&s->lock);
+    free(s);
+}
+
+void nk_semaphore_up(struct nk_semaphore *s)
+{
+    pthread_mutex_lock(&s->lock);
+    s->count++;
+    pthread_cond_signal(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+}
+
+void nk_semaphore_down(struct nk_semaphore *s)
+{
+    pthread_mutex_lock(&s->lock);
+    while (s->count <= 0) {
+	pthread_cond_wait(&s->cond, &s->lock);
+    }
+    s->count--;
+    pthread_mutex_unlock(&s->lock);
+}
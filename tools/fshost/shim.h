@@ -0,0 +1,38 @@
+/*
+ * This file is part of the Nautilus AeroKernel developed
+ * by the Hobbes and V3VEE Projects with funding from the
+ * United States National  Science Foundation and the Department of Energy.
+ *
+ * The V3VEE Project is a joint project between Northwestern University
+ * and the University of New Mexico.  The Hobbes Project is a collaboration
+ * led by Sandia National Laboratories that includes several national
+ * laboratories and universities. You can find out more at:
+ * http://www.v3vee.org  and
+ * http://xstack.sandia.gov/hobbes
+ *
+ * Copyright (c) 2017, The V3VEE Project  <http://www.v3vee.org>
+ *                     The Hobbes Project <http://xstack.sandia.gov/hobbes>
+ * All rights reserved.
+ *
+ * This is free software.  You are permitted to use,
+ * redistribute, and modify it as specified in the file "LICENSE.txt".
+ */
+
+#ifndef __FSHOST_SHIM_H__
+#define __FSHOST_SHIM_H__
+
+struct fshost_disk_stats {
+    uint64_t reads;
+    uint64_t writes;
+    uint64_t blocks_read;
+    uint64_t blocks_written;
+    uint64_t flushes;
+};
+
+// makes the image file at path the block device name, mmap'd if
+// use_mmap, and read and written through the file descriptor if not
+struct nk_block_dev *fshost_disk_open(char *name, char *path, uint64_t block_size, int readonly, int use_mmap);
+void                 fshost_disk_close(struct nk_block_dev *dev);
+void                 fshost_disk_stats(struct nk_block_dev *dev, struct fshost_disk_stats *s, int reset);
+
+#endif